@@ -5,6 +5,7 @@
  * See the EWMC Firmware documentation for details.
  *
  * State machines are used to keep track of all motors independently, using non-blocking code.
+ * See the Motor State Machine module for details.
  * The electromagnet is grouped in operation with the clamshell motor.
  *
  * Written by Alex Tavares <tavaresa13@gmail.com>
@@ -13,110 +14,106 @@
 #ifndef main_h
 #define main_h
 #include <arduino.h>
-#include <EEPROM.h>
+#include <avr/pgmspace.h>
+#include "src/hal.h"
+#include "src/input.h"
 #include "src/power.h"
 #include "src/error.h"
 #include "src/audio.h"
+#include "src/ambience.h"
+#include "src/motor.h"
+#include "src/choreography.h"
+#include "src/scheduler.h"
+#include "src/profile.h"
+#include "src/storage.h"
+#include "src/adapt.h"
+#include "src/health.h"
+#include "src/trace.h"
+#include "src/link.h"
 
 /////////////////////////
 // CONFIGURATION VARIABLES
 /////////////////////////
 
-// Debounce and anti-noise configuration
-// SENSOR_REQUIRED_COUNT is the number of consecutive cycles a sensor (or button) must be engaged
-// for it to register
-// This is the prevent electrical noise from falsely triggering endstops and the arcade button
+// Delay after the arcade button is released during startup and calibration
+// Input debouncing is configured in the Input Handling module
 const unsigned int BUTTON_DEBOUNCE_DELAY = 100;
-const unsigned int SENSOR_REQUIRED_COUNT = 5;
 
-// Motor state delays
-const unsigned int RELAY_PRE_CHANGE_DELAY = 250;
-const unsigned int RELAY_POST_CHANGE_DELAY = 250;
-const unsigned int MOTOR_IDLE_DELAY[3] = {3000, 1000, 1000};
+// Calibration stage delay
+// Motor state delays are configured in the Motor State Machine module
 const unsigned int CAL_STAGE_DELAY = 3000;
 
-// Audio playback delays
-const unsigned int AUDIO_MIN_DELAY = 3000;
-const unsigned int AUDIO_MAX_DELAY = 10000;
-const unsigned int AUDIO_MIN_BUTTON_DELAY = 5000;
+// Arcade button pattern which starts calibration during normal operation
+// Each press must be held for CAL_ENTRY_HOLD_MIN to CAL_ENTRY_HOLD_MAX milliseconds, and released
+// for no longer than CAL_ENTRY_GAP_MAX milliseconds before the next
+const byte CAL_ENTRY_PRESSES = 3;
+const unsigned int CAL_ENTRY_HOLD_MIN = 3000;
+const unsigned int CAL_ENTRY_HOLD_MAX = 6000;
+const unsigned int CAL_ENTRY_GAP_MAX = 1000;
 
 // Calibration default values
-const unsigned int CAL_TIMEOUT[3] = {25000, 20000, 20000};
-const unsigned int CAL_NEAR[3] = {2500, 2000, 2000};
+const unsigned int CAL_TIMEOUT[3] PROGMEM = {25000, 20000, 20000};
+const unsigned int CAL_NEAR[3] PROGMEM = {2500, 2000, 2000};
+
+// Longest each motor starting on its back endstop is nudged during the startup self-test
+// Must exceed CAL_NEAR[], so the motor is seen to leave that endstop
+const unsigned int SELF_TEST_TIMEOUT[3] PROGMEM = {4000, 3000, 3000};
 
 const byte NEAR_FACTOR = 10;      // Percentage of expected travel time before no longer near endstop
 const byte SLOWDOWN_FACTOR = 97;  // Percentage of expected travel time before slowing
 const byte TIMEOUT_FACTOR = 125;  // Percentage of expected travel time before timeout
 const unsigned int TIMEOUT_BUFFER = 1000;  // Number of extra milliseconds on top of TIMEOUT_FACTOR
 
+// Diagnostic link replies (see handleLinkCommands())
+const byte LINK_REPLY = 0x80;   // Set in the type of every reply to a valid request
+const byte LINK_NAK = 0x7F;     // Type of the reply to a rejected request
 
-/////////////////////////
-// PIN DEFINITIONS
-/////////////////////////
-
-// Pin list
-const byte ENDSTOP_1_PIN = A5;
-const byte ENDSTOP_2_PIN = A4;
-const byte ENDSTOP_3_PIN = A3;
-const byte ENDSTOP_4_PIN = A2;
-const byte ENDSTOP_5_PIN = A1;
-const byte ENDSTOP_6_PIN = A0;
-const byte BUTTON_PIN = 12;
+// Flags in the reply to LINK_REQUEST_STATE
+const byte LINK_FLAG_CALIBRATED = 0x01;     // Calibration data was read or measured
+const byte LINK_FLAG_TRACE_FROZEN = 0x02;   // The motion trace was frozen by a critical error
+const byte LINK_FLAG_STORAGE_BUSY = 0x04;   // A background EEPROM save is in progress
+const byte LINK_FLAG_AUDIO_PLAYING = 0x08;
+const byte LINK_FLAG_AUDIO_READBACK = 0x10;  // The ISD1700's status is read back (see src/audio.h)
 
 
 /////////////////////////
 // ENUMERATIONS
 /////////////////////////
 
-// Available sensors
+// Calibration states, in the order the routine steps through them
 typedef enum {
-	BUTTON = 0,
-	ENDSTOP_1 = 1,
-	ENDSTOP_2 = 2,
-	ENDSTOP_3 = 3,
-	ENDSTOP_4 = 4,
-	ENDSTOP_5 = 5,
-	ENDSTOP_6 = 6,
-	ENDSTOP_NONE = 7,
-	ENDSTOP_MOTOR_1 = 8,
-	ENDSTOP_MOTOR_2 = 9,
-	ENDSTOP_MOTOR_3 = 10,
-	ENDSTOP_ANY = 11
-} sensor_group;
-
-// Motor operation states
+	CAL_OFF,             // Normal operation; only the entry pattern is watched for
+	CAL_RELEASE,         // Waiting for the arcade button to be released
+	CAL_DISENGAGE,       // Stage 1, step 1
+	CAL_ENGAGE,          // Stage 1, steps 2-4
+	CAL_CONFIRM,         // Stage 1, step 5, until the arcade button is pressed
+	CAL_CONFIRM_RELEASE, // Stage 1, step 5, until the arcade button is released
+	CAL_CLEAR,           // Stage 1, step 6
+	CAL_SEEK,            // Stage 2, step 1
+	CAL_MEASURE,         // Stage 2, step 2
+	CAL_SELF_TEST        // Startup self-test, in place of the routine when calibration data is valid
+} cal_state;
+
+// Diagnostic link request types
 typedef enum {
-	INIT,
-	IDLE,
-	MOVE_START,
-	MOVE,
-	MOVE_END,
-	DELAY_PRE_CHANGE,
-	DELAY_POST_CHANGE,
-	SAFETY_REVERSE_ENDSTOP_FAIL,
-	SAFETY_REVERSE_ENDSTOP_EARLY,
-	FAULTED
-} motor_state;
-
-// Audio operation states
+	LINK_REQUEST_STATE = 0x01,
+	LINK_REQUEST_CALIBRATION = 0x02,
+	LINK_REQUEST_LIMITS = 0x03,
+	LINK_REQUEST_TIMING = 0x04,
+	LINK_REQUEST_ERRORS = 0x05,
+	LINK_REQUEST_LINK_STATS = 0x06,
+	LINK_REQUEST_HEALTH = 0x07,
+	LINK_REQUEST_CLEAR_ERRORS = 0x10,
+	LINK_REQUEST_RECALIBRATE = 0x11
+} link_request;
+
+// Reasons given in the reply to a rejected request
 typedef enum {
-	WAIT,
-	DELAY,
-	PLAY
-} audio_state;
-
-
-/////////////////////////
-// EEPROM POINTERS
-/////////////////////////
-
-uint16_t EEPROM_REF_FORWARD_PTR = 0x000;
-uint16_t EEPROM_REF_BACKWARD_PTR = 0x006;
-uint16_t EEPROM_ENDSTOP_FORWARD_PTR = 0x00C;
-uint16_t EEPROM_NEAR_FACTOR_PTR = 0x00F;
-uint16_t EEPROM_SLOWDOWN_FACTOR_PTR = 0x010;
-uint16_t EEPROM_TIMEOUT_FACTOR_PTR = 0x011;
-uint16_t EEPROM_TIMEOUT_BUFFER_PTR = 0x012;
+	LINK_NAK_NONE = 0,
+	LINK_NAK_UNKNOWN = 1,    // Unknown request type
+	LINK_NAK_ARGUMENT = 2,   // Missing or out of range argument
+	LINK_NAK_REFUSED = 3     // Not allowed in the current state
+} link_nak;
 
 
 /////////////////////////
@@ -125,10 +122,10 @@ uint16_t EEPROM_TIMEOUT_BUFFER_PTR = 0x012;
 
 void setup();
 /*
- * Initializes all modules and runs calibration routine
+ * Initializes all modules and starts the calibration routine
  * Runs automatically on program startup
  *
- * Once calibration is complete, all initial motor states are set, and the main program loop begins.
+ * Calibration itself runs from loop(). Normal operation begins once it completes or is skipped.
  */
 
 void loop();
@@ -136,102 +133,213 @@ void loop();
  * Handles the main state machines
  * Automatically loops endlessly after setup()
  *
- * Global state arrays are used to determine operation of each motor independently of the others.
- * The clamshell loader's electromagnet is controlled within this state machine, according to
- * the clamshell loader motor's state.
+ * Each motor is operated independently of the others by the Motor State Machine module, using
+ * the normal operation profile. The clamshell loader's electromagnet is controlled within this
+ * state machine, according to the clamshell loader motor's state.
+ *
+ * After every pass of the motor state machines, each completed trip is fed to the Adaptive
+ * Calibration module, which tunes that motor's slowdown and timeout limits to its travel time,
+ * and to the Motor Health module, which keeps statistics of every motor and warns when one needs
+ * servicing.
  *
- * Audio state is handled in a similar way, using global state variables. Its operation remains
- * entirely independent of motor states.
+ * Ambient audio is handled by the Ambient Audio module, which picks sound effects at random while
+ * the arcade button is held, and plays those tied to motor states after each pass of the motor
+ * state machines. Any queued feedback audio (such as the beeps that end calibration) is also
+ * played from here.
+ *
+ * Each of these, along with calibration, is a task of the Task Scheduler module. The error code
+ * display runs from the watchdog interrupt instead (see src/error.h), so it is not a task. A task
+ * only runs when the inputs have changed or its next deadline has passed, and the MCU sleeps
+ * whenever no task is due. Requests received over the diagnostic link are answered once the other
+ * tasks have run. While calibrating, the ambient audio is held off, and the motor state machines
+ * run the calibration profiles instead.
  */
 
-void initInputs();
+void systemTick();
 /*
- * Initializes input pins
- * Must be called once at startup
+ * Runs periodic interrupt-driven work for all modules
+ * Called from the system tick interrupt every SYSTEM_TICK_US microseconds
+ *
+ * Motor speed ramps are also stepped from here.
  *
- * Initialization involves endstop and button pin configuration.
+ * Once every input has settled, no audio commands are left to send, and no motor is ramping, the
+ * system tick stops itself. It is restarted by the endstop and arcade button pin change
+ * interrupts, by queueFrame(), and by startRamp().
  */
 
-void runCalibration();
+void handleLinkCommands();
 /*
- * Runs the calibration routine and saves updated calibration variables to EEPROM
- * Should be called only once at startup; it contains its own looping state machine
+ * Answers every complete request received over the diagnostic link
+ * Used by loop(); does nothing unless the link is enabled (see LINK_ENABLED in src/link.h)
  *
- * Calibration takes place in two stages; stage 1 is a manual checking of endstop functionality
- * and stage 2 uses automated motor movement to determine endstop location and motor speeds.
- * The process is fully explained in the Firmware documentation.
+ * Each reply is queued without waiting, and is dropped (and counted in the link statistics) if
+ * the transmit buffer is full. Multi-byte values are little-endian. Each request is a type byte,
+ * followed by its argument if it has one:
  *
- * The calibration routine can be exited at any time by pressing the arcade button.
- * Calibration variables are not altered if the routine is aborted.
+ * LINK_REQUEST_STATE         Reply: millis() (4), each motor_state (3), cal_state, engaged inputs
+ *                            (see SENSOR_MASK[]), error mask (2, bit 0 = error 1), and flags
+ * LINK_REQUEST_CALIBRATION   Reply: calibration valid, then for each motor the forward and backward
+ *                            reference times (2 each), forward endstop, and forward and backward
+ *                            slowdown trims, then the near, slowdown, and timeout factors, and
+ *                            timeout buffer (2)
+ * LINK_REQUEST_LIMITS        Argument: motor (0-indexed). Reply: motor, then forward near, slowdown,
+ *                            and timeout, then backward (2 each)
+ * LINK_REQUEST_TIMING        Argument: task_id. Reply: task_id, passes (4), total time (4), longest
+ *                            pass (2), overruns (4), and total time asleep (4), in microseconds
+ * LINK_REQUEST_ERRORS        Reply: error mask (2)
+ * LINK_REQUEST_LINK_STATS    Reply: frames received, rejected, sent, and dropped (2 each)
+ * LINK_REQUEST_HEALTH        Argument: motor (0-indexed). Reply: motor, faults (2), relay switches
+ *                            (4), then forward trips, mean (2 each), variance (4), shortest, and
+ *                            longest (2 each), then backward, in milliseconds (see src/health.h)
+ * LINK_REQUEST_CLEAR_ERRORS  Clears every error code. Refused while a critical error is set
+ * LINK_REQUEST_RECALIBRATE   Starts the calibration routine, as the entry pattern does. Refused
+ *                            while calibrating
  *
- * Affects Near_Forward[], Near_Backward[], Slowdown_Forward[], Slowdown_Backward[],
- *         Timeout_Forward[], Timeout_Backward[], Endstop_Forward[], Motor_State[],
- *         Motor_State_Start[], Endstop_Front[], and Endstop_Back[]
+ * A rejected request is answered with LINK_NAK, followed by the request type and a link_nak reason.
+ *
+ * Affects Error_Mask and Cal_State, by request
  */
 
-void readSavedCalibrationData();
+byte putLinkValue(byte reply[LINK_FRAME_MAX], byte index, unsigned long value, byte length);
 /*
- * Reads calibration data from EEPROM to global variables
+ * Writes a value into a reply, least significant byte first
+ * Used by handleLinkCommands()
  *
- * Global constants are not utilized when recalling stored data. If desired near, slowdown, and
- * timeout factors were changed since last calibration, calibration must be repeated to update
- * these values.
+ * INPUT:  Reply buffer
+ *         Index of the first byte to write
+ *         Value
+ *         Number of bytes to write
+ * OUTPUT: Index following the value
+ */
+
+void startCalibration();
+/*
+ * Starts the calibration routine, halting all motors
+ * Called by setup() and by handleCalibration() if the startup self-test fails, and by
+ * handleCalibrationEntry() during normal operation
+ *
+ * The routine begins once the arcade button is released. It then runs a step at a time from
+ * handleCalibration(), so the motors, audio, and error code display keep running throughout.
  *
- * Affects Near_Forward[], Near_Backward[], Slowdown_Forward[], Slowdown_Backward[],
- *         Timeout_Forward[], Timeout_Backward[], and Endstop_Forward[]
+ * Affects Cal_State, Cal_State_Start, Cal_Changed, Ambient_State, and all motor states
  */
 
-void saveCalibrationData(unsigned int ref_time_forward[3], unsigned int ref_time_backward[3]);
+void startSelfTest();
 /*
- * Saves calibration data to EEPROM
+ * Starts the startup self-test, which takes the place of the calibration routine when valid
+ * calibration data was read
+ * Called by setup()
  *
- * Both global variables and reference times are used to calculate stored data.
- * Reference travel times for each motor are stared, in addition to calibration constants.
- * Endstop_Forward[] is also saved.
+ * Each motor is nudged toward the front endstop recorded in Endstop_Forward[] at slow speed. A motor
+ * leaving its back endstop passes once that endstop releases, and is stopped after SELF_TEST_TIMEOUT[].
+ * A motor on neither endstop must reach its front endstop within a whole calibrated trip at slow
+ * speed. A motor already on its front endstop is not moved. If any motor has both endstops engaged,
+ * their error codes are flagged and calibration starts without moving anything.
  *
- * Affects locations 0x000 to 0x011 (inclusive) of EEPROM
- * INPUT:  Array of forward reference times
- *         Array of backward reference times
+ * Affects Cal_State, Cal_State_Start, Cal_Changed, Cal_Limits_Forward[], Cal_Limits_Backward[], and
+ *         all motor states
  */
 
-bool sensorEngaged(sensor_group sensor);
+void handleCalibration();
 /*
- * Gets the state of a given sensor
+ * Runs a single pass of the calibration routine
+ * Used by loop(); watches for the entry pattern instead during normal operation
+ *
+ * Calibration takes place in two stages; stage 1 is a manual checking of endstop functionality
+ * and stage 2 uses automated motor movement to determine endstop location and motor speeds.
+ * The process is fully explained in the Firmware documentation. Each wait, such as the stage 1
+ * delay or a motor's timeout, is a deadline rather than a loop, and all three motors calibrate
+ * at once during stage 2.
  *
- * INPUT:  Sensor group to check
- * OUTPUT: State of being engaged
+ * The calibration routine can be skipped by pressing the arcade button during stage 1, before
+ * every endstop has been engaged. Calibration variables are not altered if the routine is skipped.
+ * Pressing the arcade button during stage 2 asserts a critical error.
+ *
+ * If a motor faults during stage 2, the routine ends with every motor halted and the motor's error
+ * code displayed, until calibration is run again.
+ *
+ * During the startup self-test, the arcade button is ignored. Once every motor has stopped, normal
+ * operation begins, or the calibration routine starts if any motor faulted.
+ *
+ * Affects Cal_State, Cal_State_Start, Cal_Changed, Cal_Engaged[], Cal_Limits_Forward[], Cal_Limits_Backward[],
+ *         Cal_Endstop_Forward[], Limits_Forward[], Limits_Backward[], Endstop_Forward[],
+ *         Calibration_Record, Calibration_Valid, and all motor states
+ */
+
+bool getCalibrationDeadline(unsigned long* deadline);
+/*
+ * Determines when the calibration routine next needs to run, other than when the inputs change
+ * or the motor state machines have run
+ *
+ * If the state changed in the last pass, the deadline is now.
+ *
+ * Affects Cal_Changed
+ * INPUT:  Pointer to the deadline, in milliseconds
+ * OUTPUT: Is there a deadline?
  */
 
-void changeMotorState(output_group motor, motor_state state);
+void handleCalibrationEntry();
 /*
- * Changes the state of a motor, handling all the tricky bits
+ * Watches the arcade button for the pattern which starts calibration during normal operation
+ * Used by handleCalibration()
  *
- * This includes enabling/disabling outputs, updating Motor_State_Start[],
- * and changes to direction and speed.
+ * Affects Cal_Entry_Presses and Cal_Entry_Time
+ */
+
+void startNormalOperation();
+/*
+ * Sets every motor's initial state under the normal operation profile
+ * Called once calibration completes or is skipped
  *
- * The loader electromagnet is disabled upon any fault conditions of the loader motor. However,
- * The loader electromagnet must be enabled outside this function.
+ * Without valid calibration data, no motor knows which endstop it is traveling toward, so a
+ * critical error is asserted instead, and no motor moves until the module is calibrated.
  *
- * Error codes are not flagged by this function.
+ * Affects Cal_State, Cal_State_Start, Cal_Changed, all motor states, and all task deadlines and
+ *         statistics
+ */
+
+void changeCalibrationState(cal_state state);
+/*
+ * Moves the calibration routine on to another state
  *
- * Affects Motor_State[motor], Motor_State_Start[motor], Endstop_Front[motor], and Endstop_Back[motor]
- * INPUT:  Motor to change state (0-indexed)
- *         State to change to
+ * Affects Cal_State, Cal_State_Start, and Cal_Changed
+ * INPUT:  State to change to
  */
 
-void reverseMotor(output_group motor);
+bool allMotorsStopped(bool* faulted);
 /*
- * Reverses the direction of a given motor
+ * Determines if every motor has come to rest during calibration stage 2
  *
- * Affects Endstop_Front[motor] and Endstop_Back[motor]
- * INPUT:  Motor to reverse (0-indexed)
+ * INPUT:  Pointer to a flag, set if any motor has faulted
+ * OUTPUT: Is every motor either IDLE or FAULTED?
  */
 
-void assertCriticalError();
+bool readSavedCalibrationData();
 /*
- * Flags a critical error and halts all motors
+ * Reads calibration data from EEPROM to global variables
  *
- * Affects Motor_State[] and Motor_State_Start[]
+ * Global constants are not utilized when recalling stored data. If desired near, slowdown, and
+ * timeout factors were changed since last calibration, calibration must be repeated to update
+ * these values. Slowdown trims saved by the Adaptive Calibration module are applied on top.
+ *
+ * Affects Calibration_Record, Limits_Forward[], Limits_Backward[], and Endstop_Forward[]
+ * OUTPUT: Was valid calibration data found?
+ */
+
+void saveCalibrationData(unsigned int ref_time_forward[3], unsigned int ref_time_backward[3]);
+/*
+ * Saves calibration data to EEPROM
+ *
+ * Both global variables and reference times are used to calculate stored data.
+ * Reference travel times for each motor are stared, in addition to calibration constants.
+ * Endstop_Forward[] is also saved.
+ *
+ * The limits are recalculated from the new data, and any adapted slowdown trims are discarded.
+ * The data is written in the background, into the next slot of the Calibration Storage module.
+ *
+ * Affects Calibration_Record, Limits_Forward[], and Limits_Backward[]
+ * INPUT:  Array of forward reference times
+ *         Array of backward reference times
  */
 
 
@@ -1,698 +1,705 @@
 #include "EWMC-Firmware.h"
 
 // Motor + endstop calibration variables
-unsigned int Near_Forward[3];       // Time constant for each motor by which endstop should disengage
-unsigned int Near_Backward[3];
-unsigned int Slowdown_Forward[3];   // Time delay for each motor before slowing
-unsigned int Slowdown_Backward[3];
-unsigned int Timeout_Forward[3];    // Emergency timeout for each motor
-unsigned int Timeout_Backward[3];
+motor_limits Limits_Forward[3];     // Near, slowdown, and timeout limits for each motor
+motor_limits Limits_Backward[3];
 sensor_group Endstop_Forward[3];    // The expected endstop for each motor while traveling forward
-
-// Button + endstop engagement cycle counts
-unsigned int Sensor_Count[7] = {0, 0, 0, 0, 0, 0, 0};
-
-// Motor state variables
-motor_state Motor_State[3] = {INIT, INIT, INIT};
-unsigned long Motor_State_Start[3] = {0, 0, 0};
-sensor_group Endstop_Front[3];                    // Relative to current motor direction
-sensor_group Endstop_Back[3];                     // Relative to current motor direction
-
-// Audio state variables
-audio_state Audio_State = WAIT;
-audio_clip Audio_Last_Clip = AUDIO_BEEP;
-unsigned long Audio_Delay_Start = 0;
-unsigned int Audio_Delay_Length = AUDIO_MIN_BUTTON_DELAY;
+calibration_record Calibration_Record;  // Calibration data the limits are calculated from, adapted during operation
+bool Calibration_Valid = false;     // Has calibration data been read or measured?
+
+// Calibration state variables
+cal_state Cal_State = CAL_OFF;
+unsigned long Cal_State_Start = 0;
+bool Cal_Changed = false;                  // Has the state changed since the last deadline?
+byte Cal_Engaged[3];                       // Endstops of each pair engaged during stage 1 (bit 0 = first, bit 1 = second)
+motor_limits Cal_Limits_Forward[3];        // Limits of the calibration profiles
+motor_limits Cal_Limits_Backward[3];
+sensor_group Cal_Endstop_Forward[3];       // Front endstop of each motor at the end of stage 2, step 1
+byte Cal_Entry_Presses = 0;                // Presses of the entry pattern so far
+unsigned long Cal_Entry_Time = 0;          // Time of the last arcade button press or release
 
 void setup() {
 
 	// Do some basic MCU initialization
-	readSavedCalibrationData();
+	Calibration_Valid = readSavedCalibrationData();
 	initInputs();
 	initAudio();
+	initLink();
 	initErrors();
 	initPowerOutputs();
+	initHealth();
+	halInitSystemTick();
+	initScheduler();
 
-	// Wait for arcade button to be released
-	while(sensorEngaged(BUTTON)) {
-		// Do nothing
+	// Valid calibration data only needs the self-test, unless the arcade button is held at power-up
+	if(Calibration_Valid && !sensorEngaged(BUTTON)) {
+		startSelfTest();
 	}
-	delay(BUTTON_DEBOUNCE_DELAY);
-
-	// Try to get most up-to-date calibration data
-	runCalibration();
-
-	// Make sure all motors are in correct initial states
-	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+	else {
+		startCalibration();
+	}
+}
 
-		// Assign Endstop_Front[] and Endstop_Back[]
-		sensor_group Endstop_X = (sensor_group)((Motor * 2) + ENDSTOP_1);
-		sensor_group Endstop_Y = (sensor_group)(Endstop_X + 1);
+void loop() {
+	waitForTasks();
+	PROFILE_BEGIN(Loop_Start);
+
+	PROFILE_BEGIN(Sample_Start);
+	sampleInputs();
+	PROFILE_END(PROFILE_SAMPLE_INPUTS, Sample_Start);
+
+	// Every task reacts to the inputs
+	bool Inputs_Changed = inputsChanged();
+	unsigned long Deadline;
+
+	bool Motors_Ran = false;
+	if(Inputs_Changed || taskDue(TASK_MOTORS)) {
+		beginTask(TASK_MOTORS);
+		handleMotors();
+		handleChoreography(Cal_State == CAL_OFF);
+		handleAdaptation();
+		handleHealth(Cal_State == CAL_OFF);
+		handleAmbientEvents(Cal_State == CAL_OFF);
+		endTask(TASK_MOTORS);
+		if(getMotorDeadline(&Deadline)) {
+			scheduleTask(TASK_MOTORS, Deadline);
+		}
+		if(getChoreographyDeadline(&Deadline)) {
+			scheduleTask(TASK_MOTORS, Deadline);
+		}
+		if(getAudioDeadline(&Deadline)) {
+			scheduleTask(TASK_AUDIO, Deadline);
+		}
+		Motors_Ran = true;
+	}
 
-		if((Endstop_X == Endstop_Forward[Motor]) != (getMotorDir((output_group)Motor) == BACKWARD)) {
-			Endstop_Front[Motor] = Endstop_X;
-			Endstop_Back[Motor] = Endstop_Y;
+	// Calibration stage 2 follows the motor state machines, so it runs after every pass of them
+	if(Inputs_Changed || taskDue(TASK_CALIBRATION) || (Motors_Ran && (Cal_State != CAL_OFF))) {
+		beginTask(TASK_CALIBRATION);
+		PROFILE_BEGIN(Cal_Start);
+		handleCalibration();
+		PROFILE_END(PROFILE_CALIBRATION, Cal_Start);
+		endTask(TASK_CALIBRATION);
+		if(getCalibrationDeadline(&Deadline)) {
+			scheduleTask(TASK_CALIBRATION, Deadline);
 		}
-		else {
-			Endstop_Front[Motor] = Endstop_Y;
-			Endstop_Back[Motor] = Endstop_X;
+
+		// Motors started or halted by calibration are checked on the next pass
+		if(getMotorDeadline(&Deadline)) {
+			scheduleTask(TASK_MOTORS, Deadline);
 		}
+	}
 
-		// Set motor states
-		if(sensorEngaged(Endstop_Front[Motor])) {
-			changeMotorState((output_group)Motor, DELAY_POST_CHANGE);
+	if(Inputs_Changed || taskDue(TASK_AUDIO)) {
+		beginTask(TASK_AUDIO);
+		PROFILE_BEGIN(Audio_Start);
+		if(Cal_State == CAL_OFF) {
+			handleAmbientAudio();
 		}
-		else if(sensorEngaged(Endstop_Back[Motor])) {
-			changeMotorState((output_group)Motor, IDLE);
+		handleAudioQueue();
+		PROFILE_END(PROFILE_AUDIO, Audio_Start);
+		endTask(TASK_AUDIO);
+		if(getAmbientDeadline(&Deadline)) {
+			scheduleTask(TASK_AUDIO, Deadline);
 		}
-		else {
-			changeMotorState((output_group)Motor, MOVE_END);
-			setMotorSpeed((output_group) Motor, FAST);
-			setPowerOutput((output_group)Motor, true);
-			Motor_State_Start[Motor] = millis();
+		if(getAudioDeadline(&Deadline)) {
+			scheduleTask(TASK_AUDIO, Deadline);
 		}
 	}
+
+	if(linkPending() || taskDue(TASK_LINK)) {
+		beginTask(TASK_LINK);
+		PROFILE_BEGIN(Link_Start);
+		handleLinkCommands();
+		PROFILE_END(PROFILE_LINK, Link_Start);
+		endTask(TASK_LINK);
+	}
+
+	PROFILE_END(PROFILE_LOOP, Loop_Start);
 }
 
-void loop() {
-	for(byte Sensor = 0; Sensor <= ENDSTOP_6; Sensor++) {
-		if(sensorEngaged(Sensor)) {
-			if(Sensor_Count[Sensor] < SENSOR_REQUIRED_COUNT) {
-				Sensor_Count[Sensor] += 1;
-			}
-		}
-		else {
-			Sensor_Count[Sensor] = 0;
-		}
+void systemTick() {
+	PROFILE_BEGIN(Tick_Start);
+	bool Busy = debounceInputs();
+	if(transmitAudio()) {
+		Busy = true;
+	}
+	if(rampMotors()) {
+		Busy = true;
 	}
 
-	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-		switch(Motor_State[Motor]) {
-			case IDLE: {
-				if(Sensor_Count[BUTTON] == SENSOR_REQUIRED_COUNT) {
-					changeMotorState((output_group)Motor, MOVE_START);
-					if(Motor == LOADER_MOTOR) {
-						setPowerOutput(LOADER_MAGNET, true);
-					}
+	// Nothing left to do until an input changes (see halInitSystemTick()), audio is queued, or a ramp starts
+	if(!Busy) {
+		halStopSystemTick();
+	}
+	PROFILE_END(PROFILE_SYSTEM_TICK, Tick_Start);
+	return;
+}
+
+void handleLinkCommands() {
+	byte Request[LINK_FRAME_MAX];
+	byte Reply[LINK_FRAME_MAX];
+	byte Length;
+
+	// Leaves nothing of the request handling in a Firmware built without the link
+	if(!LINK_ENABLED) {
+		return;
+	}
+
+	while(linkReceiveFrame(Request, &Length)) {
+		byte Index = 1;
+		byte Reason = LINK_NAK_NONE;
+		Reply[0] = (Request[0] | LINK_REPLY);
+
+		switch(Request[0]) {
+			case LINK_REQUEST_STATE: {
+				Index = putLinkValue(Reply, Index, millis(), 4);
+				for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+					Reply[Index++] = getMotorState((output_group)Motor);
 				}
+				Reply[Index++] = Cal_State;
+				Reply[Index++] = getInputSnapshot();
+				Index = putLinkValue(Reply, Index, getErrorMask(), 2);
+
+				byte Flags = 0;
+				if(Calibration_Valid) {
+					Flags |= LINK_FLAG_CALIBRATED;
+				}
+				if(traceFrozen()) {
+					Flags |= LINK_FLAG_TRACE_FROZEN;
+				}
+				if(storageBusy()) {
+					Flags |= LINK_FLAG_STORAGE_BUSY;
+				}
+				if(audioPlaying()) {
+					Flags |= LINK_FLAG_AUDIO_PLAYING;
+				}
+				if(audioReadback()) {
+					Flags |= LINK_FLAG_AUDIO_READBACK;
+				}
+				Reply[Index++] = Flags;
 				break;
 			}
-			case MOVE_START: {
-				if((millis() - Motor_State_Start[Motor]) >= ((getMotorDir((output_group)Motor) == FORWARD) ? Near_Forward[Motor] : Near_Backward[Motor])) {
-					changeMotorState((output_group)Motor, MOVE);
+
+			case LINK_REQUEST_CALIBRATION: {
+				Reply[Index++] = Calibration_Valid;
+				for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+					Index = putLinkValue(Reply, Index, Calibration_Record.Ref_Time_Forward[Motor], 2);
+					Index = putLinkValue(Reply, Index, Calibration_Record.Ref_Time_Backward[Motor], 2);
+					Reply[Index++] = Calibration_Record.Endstop_Forward[Motor];
+					Reply[Index++] = Calibration_Record.Slowdown_Trim[Motor][FORWARD];
+					Reply[Index++] = Calibration_Record.Slowdown_Trim[Motor][BACKWARD];
 				}
+				Reply[Index++] = Calibration_Record.Near_Factor;
+				Reply[Index++] = Calibration_Record.Slowdown_Factor;
+				Reply[Index++] = Calibration_Record.Timeout_Factor;
+				Index = putLinkValue(Reply, Index, Calibration_Record.Timeout_Buffer, 2);
 				break;
 			}
-			case MOVE: {
-				unsigned int Elapsed_Time = (millis() - Motor_State_Start[Motor]);
 
-				if(Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) {
-					changeMotorState((output_group)Motor, SAFETY_REVERSE_ENDSTOP_EARLY);
-					flagError(Motor + 7);
-				}
-				else if(Elapsed_Time >= ((getMotorDir((output_group)Motor) == FORWARD) ? Slowdown_Forward[Motor] : Slowdown_Backward[Motor])) {
-					changeMotorState((output_group)Motor, MOVE_END);
+			case LINK_REQUEST_LIMITS: {
+				if((Length < 2) || (Request[1] > LOADER_MOTOR)) {
+					Reason = LINK_NAK_ARGUMENT;
+					break;
 				}
+				byte Motor = Request[1];
+				Reply[Index++] = Motor;
+				Index = putLinkValue(Reply, Index, Limits_Forward[Motor].Near, 2);
+				Index = putLinkValue(Reply, Index, Limits_Forward[Motor].Slowdown, 2);
+				Index = putLinkValue(Reply, Index, Limits_Forward[Motor].Timeout, 2);
+				Index = putLinkValue(Reply, Index, Limits_Backward[Motor].Near, 2);
+				Index = putLinkValue(Reply, Index, Limits_Backward[Motor].Slowdown, 2);
+				Index = putLinkValue(Reply, Index, Limits_Backward[Motor].Timeout, 2);
 				break;
 			}
-			case MOVE_END: {
-				if(Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) {
-					assertCriticalError();
-				}
-				else if((millis() - Motor_State_Start[Motor]) >= ((getMotorDir((output_group)Motor) == FORWARD) ? Timeout_Forward[Motor] : Timeout_Backward[Motor])) {
-					changeMotorState((output_group)Motor, SAFETY_REVERSE_ENDSTOP_FAIL);
-					flagError(Endstop_Back[Motor]);
-				}
-				else if(Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) {
-					changeMotorState((output_group)Motor, DELAY_PRE_CHANGE);
-					if(Motor == LOADER_MOTOR) {
-						setPowerOutput(LOADER_MAGNET, false);
-					}
+
+			case LINK_REQUEST_TIMING: {
+				if((Length < 2) || (Request[1] >= TASKS)) {
+					Reason = LINK_NAK_ARGUMENT;
+					break;
 				}
+				task_id Task = (task_id)Request[1];
+				Reply[Index++] = Task;
+				Index = putLinkValue(Reply, Index, getTaskRuns(Task), 4);
+				Index = putLinkValue(Reply, Index, getTaskTime(Task), 4);
+				Index = putLinkValue(Reply, Index, getTaskMaxTime(Task), 2);
+				Index = putLinkValue(Reply, Index, getTaskOverruns(Task), 4);
+				Index = putLinkValue(Reply, Index, getSleepTime(), 4);
 				break;
 			}
-			case DELAY_PRE_CHANGE: {
-				if((millis() - Motor_State_Start[Motor]) >= RELAY_PRE_CHANGE_DELAY) {
-					changeMotorState((output_group)Motor, DELAY_POST_CHANGE);
-				}
+
+			case LINK_REQUEST_ERRORS: {
+				Index = putLinkValue(Reply, Index, getErrorMask(), 2);
 				break;
 			}
-			case DELAY_POST_CHANGE: {
-				if((millis() - Motor_State_Start[Motor]) >= (RELAY_POST_CHANGE_DELAY + MOTOR_IDLE_DELAY[Motor])) {
-					changeMotorState((output_group)Motor, IDLE);
-				}
+
+			case LINK_REQUEST_LINK_STATS: {
+				link_stats Stats;
+				getLinkStats(&Stats);
+				Index = putLinkValue(Reply, Index, Stats.Received, 2);
+				Index = putLinkValue(Reply, Index, Stats.Rejected, 2);
+				Index = putLinkValue(Reply, Index, Stats.Sent, 2);
+				Index = putLinkValue(Reply, Index, Stats.Dropped, 2);
 				break;
 			}
-			case SAFETY_REVERSE_ENDSTOP_FAIL: {
-				if((millis() - Motor_State_Start[Motor]) >= ((getMotorDir((output_group)Motor) == FORWARD) ? Near_Forward[Motor] : Near_Backward[Motor])) {
-					changeMotorState((output_group)Motor, FAULTED);
+
+			case LINK_REQUEST_HEALTH: {
+				if((Length < 2) || (Request[1] > LOADER_MOTOR)) {
+					Reason = LINK_NAK_ARGUMENT;
+					break;
+				}
+				byte Motor = Request[1];
+				const motor_health* Health = getMotorHealth((output_group)Motor);
+				Reply[Index++] = Motor;
+				Index = putLinkValue(Reply, Index, Health->Faults, 2);
+				Index = putLinkValue(Reply, Index, Health->Relay_Switches, 4);
+				for(byte Dir = FORWARD; Dir <= BACKWARD; Dir++) {
+					const travel_stats* Stats = &Health->Travel[Dir];
+					Index = putLinkValue(Reply, Index, Stats->Count, 2);
+					Index = putLinkValue(Reply, Index, getTravelMean(Stats), 2);
+					Index = putLinkValue(Reply, Index, getTravelVariance(Stats), 4);
+					Index = putLinkValue(Reply, Index, ((Stats->Count > 0) ? Stats->Min : 0), 2);
+					Index = putLinkValue(Reply, Index, ((Stats->Count > 0) ? Stats->Max : 0), 2);
 				}
 				break;
 			}
-			case SAFETY_REVERSE_ENDSTOP_EARLY: {
-				if((millis() - Motor_State_Start[Motor]) >= ((getMotorDir((output_group)Motor) == FORWARD) ? Near_Forward[Motor] : Near_Backward[Motor])) {
-					if(Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) {
-						assertCriticalError();
-					}
-					else {
-						changeMotorState((output_group)Motor, FAULTED);
-					}
+
+			case LINK_REQUEST_CLEAR_ERRORS: {
+				// A critical error halts every motor until recalibration, so it stays on display
+				if(errorFlagged(CRITICAL_ERROR)) {
+					Reason = LINK_NAK_REFUSED;
+					break;
 				}
+				clearErrors();
 				break;
 			}
-			default:
-			case FAULTED: {
-				setPowerOutput((output_group)Motor, false);
-				setMotorDir((output_group)Motor, FORWARD);
-				if(Motor == LOADER_MOTOR) {
-					setPowerOutput(LOADER_MAGNET, false);
+
+			case LINK_REQUEST_RECALIBRATE: {
+				if(Cal_State != CAL_OFF) {
+					Reason = LINK_NAK_REFUSED;
+					break;
 				}
+				startCalibration();
+				scheduleTask(TASK_CALIBRATION, millis());
 				break;
 			}
-		}
-		if((Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) && (Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) && anyMotorEnabled()) {
-			assertCriticalError();
-		}
-	}
 
-	switch(Audio_State) {
-		case WAIT: {
-			if(Sensor_Count[BUTTON] == SENSOR_REQUIRED_COUNT) {
-				Audio_Delay_Length = random(AUDIO_MIN_BUTTON_DELAY, AUDIO_MAX_DELAY);
-				Audio_Delay_Start = millis();
-				Audio_State = DELAY;
+			default: {
+				Reason = LINK_NAK_UNKNOWN;
+				break;
 			}
-			break;
 		}
-		case DELAY: {
-			if((millis() - Audio_Delay_Start) > Audio_Delay_Length) {
-				if(Sensor_Count[BUTTON] == SENSOR_REQUIRED_COUNT) {
-					audio_clip Next_Clip = Audio_Last_Clip;
-					while(Next_Clip == Audio_Last_Clip) {
-						Next_Clip = (audio_clip)random(AUDIO_EXPLOSION, AUDIO_COUGH_2);
-					}
-					playAudio(Next_Clip);
-					Audio_Last_Clip = Next_Clip;
 
-					Audio_Delay_Length = random(AUDIO_MIN_DELAY, AUDIO_MAX_DELAY);
-					Audio_State = PLAY;
-				}
-				else {
-					Audio_State = WAIT;
-				}
-			}
-			break;
-		}
-		case PLAY: {
-			if(!audioPlaying()) {
-				Audio_Delay_Start = millis();
-				Audio_State = DELAY;
-			}
-			break;
+		if(Reason != LINK_NAK_NONE) {
+			Reply[0] = LINK_NAK;
+			Reply[1] = Request[0];
+			Reply[2] = Reason;
+			Index = 3;
 		}
+		linkSendFrame(Reply, Index);
 	}
+	return;
+}
 
-	handleErrorCodeDisplay();
+byte putLinkValue(byte reply[LINK_FRAME_MAX], byte index, unsigned long value, byte length) {
+	for(byte Count = 0; Count < length; Count++) {
+		reply[index++] = (value & 0xFF);
+		value >>= 8;
+	}
+	return index;
 }
 
-void initInputs() {
-	pinMode(ENDSTOP_1_PIN, INPUT_PULLUP);
-	pinMode(ENDSTOP_2_PIN, INPUT_PULLUP);
-	pinMode(ENDSTOP_3_PIN, INPUT_PULLUP);
-	pinMode(ENDSTOP_4_PIN, INPUT_PULLUP);
-	pinMode(ENDSTOP_5_PIN, INPUT_PULLUP);
-	pinMode(ENDSTOP_6_PIN, INPUT_PULLUP);
-	pinMode(BUTTON_PIN, INPUT_PULLUP);
+void startCalibration() {
+	// FAULTED is the only state which holds every output off under every profile
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		changeMotorState((output_group)Motor, FAULTED);
+	}
+	stopAmbientAudio();
+	changeCalibrationState(CAL_RELEASE);
 	return;
 }
 
-void runCalibration() {
+void startSelfTest() {
+	// Both endstops of a motor engaged at once is flagged, and fails the self-test before anything
+	// moves, since it would otherwise be a critical error as soon as any motor started
+	bool Paired = false;
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		sensor_group Sensor_A = (sensor_group)((Motor * 2) + ENDSTOP_1);
+		sensor_group Sensor_B = (sensor_group)(Sensor_A + 1);
+		if(sensorEngaged(Sensor_A) && sensorEngaged(Sensor_B)) {
+			flagError(Sensor_A);
+			flagError(Sensor_B);
+			Paired = true;
+		}
+	}
+	if(Paired) {
+		startCalibration();
+		return;
+	}
 
-	{  // Stage 1, Step 1: Disengage all endstops
-		bool Wait = true;
-		while(Wait) {
-			Wait = false;
-			clearErrors();
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		sensor_group Sensor_A = (sensor_group)((Motor * 2) + ENDSTOP_1);
+		sensor_group Sensor_B = (sensor_group)(Sensor_A + 1);
+		assignEndstops((output_group)Motor, Endstop_Forward[Motor]);
+		sensor_group Front = getEndstopFront((output_group)Motor);
+		sensor_group Back = (sensor_group)(Sensor_A + Sensor_B - Front);
+		Cal_Limits_Forward[Motor].Near = pgm_read_word(&CAL_NEAR[Motor]);
+		Cal_Limits_Forward[Motor].Timeout = pgm_read_word(&SELF_TEST_TIMEOUT[Motor]);
+
+		// A motor on neither endstop can only show it moves by reaching its front endstop, so it is
+		// given a whole calibrated trip, stretched to the slow speed
+		if(!sensorEngaged(Front) && !sensorEngaged(Back)) {
+			Cal_Limits_Forward[Motor].Timeout = clampTime(((unsigned long)Limits_Forward[Motor].Timeout * pgm_read_byte(&PWM_SPEED_FAST[Motor])) / pgm_read_byte(&PWM_SPEED_SLOW[Motor]));
+		}
+		Cal_Limits_Forward[Motor].Slowdown = Cal_Limits_Forward[Motor].Timeout;
+		Cal_Limits_Backward[Motor] = Cal_Limits_Forward[Motor];
+	}
+	setMotorProfile(MOTOR_PROFILE_SELF_TEST, Cal_Limits_Forward, Cal_Limits_Backward);
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		sensor_group Sensor_A = (sensor_group)((Motor * 2) + ENDSTOP_1);
+		sensor_group Sensor_B = (sensor_group)(Sensor_A + 1);
+		sensor_group Front = getEndstopFront((output_group)Motor);
+
+		// Only a motor leaving its back endstop is seen to move before it reaches its front endstop
+		if(sensorEngaged(Front)) {
+			changeMotorState((output_group)Motor, IDLE);
+		}
+		else {
+			setMotorSpeed((output_group)Motor, SLOW);
+			startMotor((output_group)Motor, (sensorEngaged((sensor_group)(Sensor_A + Sensor_B - Front)) ? MOVE_START : MOVE_END));
+		}
+	}
+	changeCalibrationState(CAL_SELF_TEST);
+	return;
+}
 
-			if(sensorEngaged(ENDSTOP_MOTOR_1)) {
-				flagError(7);
-				Wait = true;
+void handleCalibration() {
+	switch(Cal_State) {
+		case CAL_OFF: {
+			handleCalibrationEntry();
+			break;
+		}
+		case CAL_RELEASE: {
+			if(sensorEngaged(BUTTON)) {
+				Cal_State_Start = millis();
 			}
-			if(sensorEngaged(ENDSTOP_MOTOR_2)) {
-				flagError(8);
-				Wait = true;
+			else if((millis() - Cal_State_Start) >= BUTTON_DEBOUNCE_DELAY) {
+				changeCalibrationState(CAL_DISENGAGE);
 			}
-			if(sensorEngaged(ENDSTOP_MOTOR_3)) {
-				flagError(9);
-				Wait = true;
+			break;
+		}
+		case CAL_DISENGAGE:  // Stage 1, Step 1: Disengage all endstops
+		case CAL_CONFIRM: {  // Stage 1, Step 5: Disengage all endstops and press arcade button
+			bool Wait = false;
+
+			// Errors 7-9 show which motors still have an endstop engaged. Any other code, such as the
+			// endstops a failed self-test flagged, stays on display until calibration completes
+			clearError(CRITICAL_ERROR);
+			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+				if(!sensorEngaged((sensor_group)(Motor + ENDSTOP_MOTOR_1))) {
+					clearError(Motor + 7);
+				}
+				else {
+					if(!errorFlagged(Motor + 7)) {
+						flagError(Motor + 7);
+					}
+					Wait = true;
+				}
 			}
 
-			handleErrorCodeDisplay();
-			if(sensorEngaged(BUTTON)) {
-				clearErrors();
-				return;
+			if(Cal_State == CAL_DISENGAGE) {
+				if(sensorEngaged(BUTTON)) {
+					clearErrors();
+					startNormalOperation();
+				}
+				else if(!Wait) {
+					for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+						Cal_Engaged[Motor] = 0;
+					}
+					changeCalibrationState(CAL_ENGAGE);
+				}
 			}
+			else if(!Wait && sensorEngaged(BUTTON)) {
+				changeCalibrationState(CAL_CONFIRM_RELEASE);
+			}
+			break;
 		}
-	}
+		case CAL_ENGAGE: {  // Stage 1, Steps 2-4: Manually engage both endstops of every motor
+			if(sensorEngaged(BUTTON)) {
+				startNormalOperation();
+				break;
+			}
 
-	{  // Stage 1, Steps 2-4: Manually engage all endstops group by group
-		for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-			sensor_group Sensor_Group_Init = (sensor_group)(Motor + ENDSTOP_MOTOR_1);
-			sensor_group Sensor_Group_Next = (sensor_group)(Sensor_Group_Init + 1);
-			sensor_group Sensor_A = (sensor_group)((Motor * 2) + ENDSTOP_1);
-			sensor_group Sensor_B = (sensor_group)(Sensor_A + 1);
-
-			sensor_group Last_Activated_Sensor = Sensor_Group_Init;
-			while(Last_Activated_Sensor != Sensor_Group_Next) {
-				if(Last_Activated_Sensor == Sensor_Group_Init) {
+			// Each motor's pair is tracked separately, so the pairs may be engaged in any order
+			bool Complete = true;
+			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+				sensor_group Sensor_A = (sensor_group)((Motor * 2) + ENDSTOP_1);
+				sensor_group Sensor_B = (sensor_group)(Sensor_A + 1);
+				byte Engaged = Cal_Engaged[Motor];
+
+				if(Engaged == 0) {
 					if(sensorEngaged(Sensor_A)) {
-						Last_Activated_Sensor = Sensor_A;
+						Engaged = 0x01;
 						beep();
 					}
 					else if(sensorEngaged(Sensor_B)) {
-						Last_Activated_Sensor = Sensor_B;
-						beep();
-					}
-				}
-				else if(Last_Activated_Sensor == Sensor_A) {
-					if(sensorEngaged(Sensor_B)) {
-						Last_Activated_Sensor = Sensor_Group_Next;
-						beep();
+						Engaged = 0x02;
 						beep();
 					}
 				}
-				else {
-					if(sensorEngaged(Sensor_A)) {
-						Last_Activated_Sensor = Sensor_Group_Next;
+				else if(Engaged != 0x03) {
+					if(sensorEngaged((Engaged == 0x01) ? Sensor_B : Sensor_A)) {
+						Engaged = 0x03;
 						beep();
 						beep();
 					}
 				}
-
-				handleErrorCodeDisplay();
-				if(sensorEngaged(BUTTON)) {
-					return;
+				Cal_Engaged[Motor] = Engaged;
+				if(Engaged != 0x03) {
+					Complete = false;
 				}
 			}
-		}
-	}
-
-	{  // Stage 1, Step 5: Disengage all endstops and press arcade button
-		bool Wait = true;
-		while(Wait) {
-			Wait = false;
-			clearErrors();
-
-			if(sensorEngaged(ENDSTOP_MOTOR_1)) {
-				flagError(7);
-				Wait = true;
+			if(Complete) {
+				changeCalibrationState(CAL_CONFIRM);
 			}
-			if(sensorEngaged(ENDSTOP_MOTOR_2)) {
-				flagError(8);
-				Wait = true;
+			break;
+		}
+		case CAL_CONFIRM_RELEASE: {
+			if(((millis() - Cal_State_Start) >= BUTTON_DEBOUNCE_DELAY) && !sensorEngaged(BUTTON)) {
+				beep();
+				changeCalibrationState(CAL_CLEAR);
 			}
-			if(sensorEngaged(ENDSTOP_MOTOR_3)) {
-				flagError(9);
-				Wait = true;
+			break;
+		}
+		case CAL_CLEAR: {  // Stage 1, Step 6: Delay to avoid hand crushage
+			if((millis() - Cal_State_Start) < CAL_STAGE_DELAY) {
+				break;
 			}
 
-			if(!sensorEngaged(BUTTON)) {
-				Wait = true;
+			// Stage 2, Step 1: Slowly cycle each motor to endstops
+			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+				Cal_Limits_Forward[Motor].Near = pgm_read_word(&CAL_NEAR[Motor]);
+				Cal_Limits_Forward[Motor].Slowdown = pgm_read_word(&CAL_TIMEOUT[Motor]);
+				Cal_Limits_Forward[Motor].Timeout = pgm_read_word(&CAL_TIMEOUT[Motor]);
+				Cal_Limits_Backward[Motor] = Cal_Limits_Forward[Motor];
 			}
+			setMotorProfile(MOTOR_PROFILE_CAL_SEEK, Cal_Limits_Forward, Cal_Limits_Backward);
 
-			handleErrorCodeDisplay();
-		}
-
-		delay(BUTTON_DEBOUNCE_DELAY);
-		while(sensorEngaged(BUTTON)){
-			handleErrorCodeDisplay();
+			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+				assignEndstops((output_group)Motor, (sensor_group)((Motor * 2) + ENDSTOP_1));
+				startMotor((output_group)Motor, INIT);
+			}
+			changeCalibrationState(CAL_SEEK);
+			break;
 		}
+		case CAL_SEEK:
+		case CAL_MEASURE: {
+			if(sensorEngaged(BUTTON)) {
+				assertCriticalError();
+			}
 
-		beep();
-	}
-
-	{  // Stage 1, Step 6: Delay to avoid hand crushage
-		unsigned long Cal_Delay_Start = millis();
-		while((millis() - Cal_Delay_Start) < CAL_STAGE_DELAY) {
-			// Do nothing
-		}
-	}
+			bool Faulted = false;
+			if(!allMotorsStopped(&Faulted)) {
+				break;
+			}
+			else if(Faulted) {
+				changeCalibrationState(CAL_OFF);
+				break;
+			}
 
-	unsigned int Timeout_Forward_Buffer[3];
-	unsigned int Timeout_Backward_Buffer[3];
-	sensor_group Endstop_Forward_Buffer[3] = {ENDSTOP_1, ENDSTOP_3, ENDSTOP_5};
-
-	{  // Stage 2, Step 1: Slowly cycle each motor to endstops
-		Motor_State[ELEVATOR_MOTOR] = INIT;
-		setPowerOutput(ELEVATOR_MOTOR, true);
-		Motor_State_Start[ELEVATOR_MOTOR] = millis();
-		Motor_State[CART_MOTOR] = INIT;
-		setPowerOutput(CART_MOTOR, true);
-		Motor_State_Start[CART_MOTOR] = millis();
-		Motor_State[LOADER_MOTOR] = INIT;
-		setPowerOutput(LOADER_MOTOR, true);
-		Motor_State_Start[LOADER_MOTOR] = millis();
-		while((Motor_State[ELEVATOR_MOTOR] != IDLE) || (Motor_State[CART_MOTOR] != IDLE) || (Motor_State[LOADER_MOTOR] != IDLE)) {
-			for(byte Sensor = 0; Sensor <= ENDSTOP_6; Sensor++) {
-				if(sensorEngaged(Sensor)) {
-					if(Sensor_Count[Sensor] < SENSOR_REQUIRED_COUNT) {
-						Sensor_Count[Sensor] += 1;
-					}
+			if(Cal_State == CAL_SEEK) {
+				// Stage 2, Step 2: Quickly cycle each motor to endstops
+				// Each motor ends stage 2, step 1 traveling forward
+				for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+					Cal_Endstop_Forward[Motor] = getEndstopFront((output_group)Motor);
+					Cal_Limits_Forward[Motor].Near = pgm_read_word(&CAL_NEAR[Motor]);
+					Cal_Limits_Forward[Motor].Slowdown = pgm_read_word(&CAL_TIMEOUT[Motor]);
+					Cal_Limits_Forward[Motor].Timeout = clampTime(scaleTime(getMotorTravelTime((output_group)Motor, BACKWARD), getPercentScale(TIMEOUT_FACTOR)) + TIMEOUT_BUFFER);
+					Cal_Limits_Backward[Motor] = Cal_Limits_Forward[Motor];
 				}
-				else {
-					Sensor_Count[Sensor] = 0;
+				setMotorProfile(MOTOR_PROFILE_CAL_MEASURE, Cal_Limits_Forward, Cal_Limits_Backward);
+
+				for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+					startMotor((output_group)Motor, MOVE_START);
 				}
+				changeCalibrationState(CAL_MEASURE);
+				break;
 			}
 
+			// Calibration complete, update calibration variables
+			unsigned int Reference_Time_Forward[3];
+			unsigned int Reference_Time_Backward[3];
+
 			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-				switch(Motor_State[Motor]) {
-					default:
-					case FAULTED: {
-						setPowerOutput((output_group)Motor, false);
-						setMotorDir((output_group)Motor, FORWARD);
-						break;
-					}
-					case INIT: {
-						sensor_group Endstop_X = (sensor_group)((Motor * 2) + ENDSTOP_1);
-						sensor_group Endstop_Y = (sensor_group)(Endstop_X + 1);
-
-						if((millis() - Motor_State_Start[Motor]) >= CAL_TIMEOUT[Motor]) {
-							changeMotorState((output_group)Motor, SAFETY_REVERSE_ENDSTOP_FAIL);
-							flagError(Endstop_X);
-							flagError(Endstop_Y);
-						}
-						else if(Sensor_Count[Endstop_X] == SENSOR_REQUIRED_COUNT) {
-							changeMotorState((output_group)Motor, DELAY_PRE_CHANGE);
-							Endstop_Forward_Buffer[Motor] = Endstop_X;
-							Endstop_Front[Motor] = Endstop_X;
-							Endstop_Back[Motor] = Endstop_Y;
-						}
-						else if(Sensor_Count[Endstop_Y] == SENSOR_REQUIRED_COUNT) {
-							changeMotorState((output_group)Motor, DELAY_PRE_CHANGE);
-							Endstop_Forward_Buffer[Motor] = Endstop_Y;
-							Endstop_Front[Motor] = Endstop_Y;
-							Endstop_Back[Motor] = Endstop_X;
-						}
-						break;
-					}
-					case DELAY_PRE_CHANGE: {
-						if((millis() - Motor_State_Start[Motor]) >= RELAY_PRE_CHANGE_DELAY) {
-							changeMotorState((output_group)Motor, DELAY_POST_CHANGE);
-						}
-						break;
-					}
-					case DELAY_POST_CHANGE: {
-						if((millis() - Motor_State_Start[Motor]) >= RELAY_POST_CHANGE_DELAY) {
-							changeMotorState((output_group)Motor, ((getMotorDir((output_group)Motor) == BACKWARD) ? MOVE_START : IDLE));
-						}
-						break;
-					}
-					case MOVE_START: {
-						if((millis() - Motor_State_Start[Motor]) >= CAL_NEAR[Motor]) {
-							changeMotorState((output_group)Motor, MOVE);
-						}
-						break;
-					}
-					case MOVE: {
-						unsigned int Elapsed_Time = (millis() - Motor_State_Start[Motor]);
-
-						if(Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) {
-							assertCriticalError();
-						}
-						else if(Elapsed_Time >= CAL_TIMEOUT[Motor]) {
-							changeMotorState((output_group)Motor, SAFETY_REVERSE_ENDSTOP_FAIL);
-							flagError(Endstop_Front[Motor]);
-						}
-						else if(Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) {
-							changeMotorState((output_group)Motor, DELAY_PRE_CHANGE);
-							Timeout_Forward_Buffer[Motor] = (((((unsigned long) Elapsed_Time) * TIMEOUT_FACTOR) / 100) + TIMEOUT_BUFFER);
-							Timeout_Backward_Buffer[Motor] = (((((unsigned long) Elapsed_Time) * TIMEOUT_FACTOR) / 100) + TIMEOUT_BUFFER);
-						}
-						break;
-					}
-					case IDLE: {
-						break;
-					}
-					case SAFETY_REVERSE_ENDSTOP_FAIL: {
-						if((millis() - Motor_State_Start[Motor]) >= CAL_NEAR[Motor]) {
-							changeMotorState((output_group)Motor, FAULTED);
-						}
-						break;
-					}
-				}
-				if((Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) && (Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) && anyMotorEnabled()) {
-					assertCriticalError();
-				}
+				Reference_Time_Forward[Motor] = getMotorTravelTime((output_group)Motor, FORWARD);
+				Reference_Time_Backward[Motor] = getMotorTravelTime((output_group)Motor, BACKWARD);
+				Endstop_Forward[Motor] = Cal_Endstop_Forward[Motor];
 			}
-
-			handleErrorCodeDisplay();
-			if(sensorEngaged(BUTTON)) {
-				assertCriticalError();
+			saveCalibrationData(Reference_Time_Forward, Reference_Time_Backward);
+			resetHealthTravel();
+			clearErrors();
+			Calibration_Valid = true;
+			beep();
+			beep();
+			startNormalOperation();
+			break;
+		}
+		case CAL_SELF_TEST: {  // Startup: every motor nudged toward its front endstop
+			bool Faulted = false;
+			if(!allMotorsStopped(&Faulted)) {
+				break;
 			}
+			else if(Faulted) {
+				startCalibration();
+			}
+			else {
+				startNormalOperation();
+			}
+			break;
 		}
 	}
+	return;
+}
 
-	unsigned int Reference_Time_Forward[3];
-	unsigned int Reference_Time_Backward[3];
-
-	{  // Stage 2, Step 2: Quickly cycle each motor to endstops
-		Motor_State[ELEVATOR_MOTOR] = MOVE_START;
-		setPowerOutput(ELEVATOR_MOTOR, true);
-		Motor_State_Start[ELEVATOR_MOTOR] = millis();
-		Motor_State[CART_MOTOR] = MOVE_START;
-		setPowerOutput(CART_MOTOR, true);
-		Motor_State_Start[CART_MOTOR] = millis();
-		Motor_State[LOADER_MOTOR] = MOVE_START;
-		setPowerOutput(LOADER_MOTOR, true);
-		Motor_State_Start[LOADER_MOTOR] = millis();
-		while((Motor_State[ELEVATOR_MOTOR] != IDLE) || (Motor_State[CART_MOTOR] != IDLE) || (Motor_State[LOADER_MOTOR] != IDLE)) {
-			for(byte Sensor = 0; Sensor <= ENDSTOP_6; Sensor++) {
-				if(sensorEngaged(Sensor)) {
-					if(Sensor_Count[Sensor] < SENSOR_REQUIRED_COUNT) {
-						Sensor_Count[Sensor] += 1;
-					}
-				}
-				else {
-					Sensor_Count[Sensor] = 0;
-				}
-			}
+bool getCalibrationDeadline(unsigned long* deadline) {
+	// A new state may already be able to move on, so it is checked on the next pass
+	if(Cal_Changed) {
+		Cal_Changed = false;
+		*deadline = millis();
+		return true;
+	}
 
-			for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-				switch(Motor_State[Motor]) {
-					default:
-					case FAULTED: {
-						setPowerOutput((output_group)Motor, false);
-						setMotorDir((output_group)Motor, FORWARD);
-						break;
-					}
-					case MOVE_START: {
-						if((millis() - Motor_State_Start[Motor]) >= CAL_NEAR[Motor]) {
-							changeMotorState((output_group)Motor, MOVE);
-						}
-						break;
-					}
-					case MOVE: {
-						unsigned int Elapsed_Time = (millis() - Motor_State_Start[Motor]);
-
-						if(Elapsed_Time >= ((getMotorDir((output_group)Motor) == FORWARD) ? Timeout_Forward_Buffer[Motor] : Timeout_Backward_Buffer[Motor])) {
-							changeMotorState((output_group)Motor, SAFETY_REVERSE_ENDSTOP_FAIL);
-							flagError(Endstop_Front[Motor]);
-						}
-						else if(Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) {
-							changeMotorState((output_group)Motor, DELAY_PRE_CHANGE);
-							if(getMotorDir((output_group)Motor) == FORWARD) {
-								Reference_Time_Forward[Motor] = Elapsed_Time;
-							}
-							else {
-								Reference_Time_Backward[Motor] = Elapsed_Time;
-							}
-						}
-						break;
-					}
-					case DELAY_PRE_CHANGE: {
-						if((millis() - Motor_State_Start[Motor]) >= RELAY_PRE_CHANGE_DELAY) {
-							changeMotorState((output_group)Motor, DELAY_POST_CHANGE);
-						}
-						break;
-					}
-					case DELAY_POST_CHANGE: {
-						if((millis() - Motor_State_Start[Motor]) >= RELAY_POST_CHANGE_DELAY) {
-							changeMotorState((output_group)Motor, ((getMotorDir((output_group)Motor) == BACKWARD) ? MOVE_START : IDLE));
-						}
-						break;
-					}
-					case IDLE: {
-						break;
-					}
-					case SAFETY_REVERSE_ENDSTOP_FAIL: {
-						if((millis() - Motor_State_Start[Motor]) >= CAL_NEAR[Motor]) {
-							changeMotorState((output_group)Motor, FAULTED);
-						}
-						break;
-					}
-				}
-				if((Sensor_Count[Endstop_Front[Motor]] == SENSOR_REQUIRED_COUNT) && (Sensor_Count[Endstop_Back[Motor]] == SENSOR_REQUIRED_COUNT) && anyMotorEnabled()) {
-					assertCriticalError();
-				}
-			}
+	// A held arcade button is waited out by its release, which changes the inputs
+	// Every other state only reacts to the inputs, or to the motor state machines
+	if((Cal_State == CAL_RELEASE) && !sensorEngaged(BUTTON)) {
+		*deadline = (Cal_State_Start + BUTTON_DEBOUNCE_DELAY);
+		return true;
+	}
+	else if((Cal_State == CAL_CONFIRM_RELEASE) && ((millis() - Cal_State_Start) < BUTTON_DEBOUNCE_DELAY)) {
+		*deadline = (Cal_State_Start + BUTTON_DEBOUNCE_DELAY);
+		return true;
+	}
+	else if(Cal_State == CAL_CLEAR) {
+		*deadline = (Cal_State_Start + CAL_STAGE_DELAY);
+		return true;
+	}
+	return false;
+}
+
+void handleCalibrationEntry() {
+	unsigned long Now = millis();
 
-			handleErrorCodeDisplay();
+	// A press which follows the last one too late starts the pattern over
+	if(sensorRising(BUTTON)) {
+		if((Now - Cal_Entry_Time) > CAL_ENTRY_GAP_MAX) {
+			Cal_Entry_Presses = 0;
 		}
+		Cal_Entry_Time = Now;
 	}
 
-	{  // Calibration complete, update calibration variables
-		for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-			Near_Forward[Motor] = ((((unsigned long) Reference_Time_Forward[Motor]) * NEAR_FACTOR) / 100);
-			Near_Backward[Motor] = ((((unsigned long) Reference_Time_Backward[Motor]) * NEAR_FACTOR) / 100);
-			Slowdown_Forward[Motor] = ((((unsigned long) Reference_Time_Forward[Motor]) * SLOWDOWN_FACTOR) / 100);
-			Slowdown_Backward[Motor] = ((((unsigned long) Reference_Time_Backward[Motor]) * SLOWDOWN_FACTOR) / 100);
-			Timeout_Forward[Motor] = (((((unsigned long) Reference_Time_Forward[Motor]) * TIMEOUT_FACTOR) / 100) + TIMEOUT_BUFFER);
-			Timeout_Backward[Motor] = (((((unsigned long) Reference_Time_Backward[Motor]) * TIMEOUT_FACTOR) / 100) + TIMEOUT_BUFFER);
-			Endstop_Forward[Motor] = Endstop_Forward_Buffer[Motor];
+	if(sensorFalling(BUTTON)) {
+		unsigned long Hold_Time = (Now - Cal_Entry_Time);
+		if((Hold_Time >= CAL_ENTRY_HOLD_MIN) && (Hold_Time <= CAL_ENTRY_HOLD_MAX)) {
+			Cal_Entry_Presses += 1;
+		}
+		else {
+			Cal_Entry_Presses = 0;
+		}
+		Cal_Entry_Time = Now;
+
+		if(Cal_Entry_Presses >= CAL_ENTRY_PRESSES) {
+			Cal_Entry_Presses = 0;
+			startCalibration();
 		}
-		saveCalibrationData(Reference_Time_Forward, Reference_Time_Backward);
-		beep();
-		beep();
-		return;
 	}
+	return;
 }
 
-void readSavedCalibrationData() {
-	unsigned int Ref_Time_Forward[3];
-	unsigned int Ref_Time_Backward[3];
-
-	// Read data from EEPROM
-	byte Near_Factor = EEPROM.read(EEPROM_NEAR_FACTOR_PTR);
-	byte Slowdown_Factor = EEPROM.read(EEPROM_SLOWDOWN_FACTOR_PTR);
-	byte Timeout_Factor = EEPROM.read(EEPROM_TIMEOUT_FACTOR_PTR);
-	unsigned int Timeout_Buffer = EEPROM.read(EEPROM_TIMEOUT_BUFFER_PTR);
-	Timeout_Buffer += (((unsigned int) EEPROM.read(EEPROM_TIMEOUT_BUFFER_PTR + 1)) << 8);
-	for(byte Offset = 0; Offset <= LOADER_MOTOR; Offset++) {
-		Ref_Time_Forward[Offset] = EEPROM.read(EEPROM_REF_FORWARD_PTR + (Offset * 2));
-		Ref_Time_Forward[Offset] += (((unsigned int) (EEPROM.read(EEPROM_REF_FORWARD_PTR + (Offset * 2) + 1))) << 8);
-		Ref_Time_Backward[Offset] = EEPROM.read(EEPROM_REF_BACKWARD_PTR + (Offset * 2));
-		Ref_Time_Backward[Offset] += (((unsigned int) (EEPROM.read(EEPROM_REF_BACKWARD_PTR + (Offset * 2) + 1))) << 8);
-		Endstop_Forward[Offset] = (sensor_group)EEPROM.read(EEPROM_ENDSTOP_FORWARD_PTR + Offset);
+void startNormalOperation() {
+	// Make sure all motors are in correct initial states
+	setMotorProfile(MOTOR_PROFILE_NORMAL, Limits_Forward, Limits_Backward);
+	if(!Calibration_Valid) {
+		assertCriticalError();
 	}
+	else {
+		for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+			assignEndstops((output_group)Motor, Endstop_Forward[Motor]);
 
-	// Update calibration variables
-	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-		Near_Forward[Motor] = ((((unsigned long) Ref_Time_Forward[Motor]) * Near_Factor) / 100);
-		Near_Backward[Motor] = ((((unsigned long) Ref_Time_Backward[Motor]) * Near_Factor) / 100);
-		Slowdown_Forward[Motor] = ((((unsigned long) Ref_Time_Forward[Motor]) * Slowdown_Factor) / 100);
-		Slowdown_Backward[Motor] = ((((unsigned long) Ref_Time_Backward[Motor]) * Slowdown_Factor) / 100);
-		Timeout_Forward[Motor] = (((((unsigned long) Ref_Time_Forward[Motor]) * Timeout_Factor) / 100) + Timeout_Buffer);
-		Timeout_Backward[Motor] = (((((unsigned long) Ref_Time_Backward[Motor]) * Timeout_Factor) / 100) + Timeout_Buffer);
+			// Set motor states
+			if(sensorEngaged(getEndstopFront((output_group)Motor))) {
+				changeMotorState((output_group)Motor, DELAY_POST_CHANGE);
+			}
+			else if(sensorEngaged((sensor_group)(Motor + ENDSTOP_MOTOR_1))) {
+				changeMotorState((output_group)Motor, IDLE);
+			}
+			else {
+				setMotorSpeed((output_group)Motor, FAST);
+				startMotor((output_group)Motor, MOVE_END);
+			}
+		}
 	}
 
+	changeCalibrationState(CAL_OFF);
+	initScheduler();
 	return;
 }
 
-void saveCalibrationData(unsigned int ref_time_forward[3], unsigned int ref_time_backward[3]) {
-	for(byte Offset = 0; Offset <= LOADER_MOTOR; Offset++) {
-		EEPROM.write((EEPROM_REF_FORWARD_PTR + (Offset * 2)), (ref_time_forward[Offset] & 0xFF));
-		EEPROM.update((EEPROM_REF_FORWARD_PTR + (Offset * 2) + 1), ((ref_time_forward[Offset] >> 8) & 0xFF));
-		EEPROM.write((EEPROM_REF_BACKWARD_PTR + (Offset * 2)), (ref_time_backward[Offset] & 0xFF));
-		EEPROM.update((EEPROM_REF_BACKWARD_PTR + (Offset * 2) + 1), ((ref_time_backward[Offset] >> 8) & 0xFF));
-		EEPROM.update((EEPROM_ENDSTOP_FORWARD_PTR + Offset), Endstop_Forward[Offset]);
-	}
-	EEPROM.update(EEPROM_NEAR_FACTOR_PTR, NEAR_FACTOR);
-	EEPROM.update(EEPROM_SLOWDOWN_FACTOR_PTR, SLOWDOWN_FACTOR);
-	EEPROM.update(EEPROM_TIMEOUT_FACTOR_PTR, TIMEOUT_FACTOR);
-	EEPROM.update(EEPROM_TIMEOUT_BUFFER_PTR, (TIMEOUT_BUFFER & 0xFF));
-	EEPROM.update((EEPROM_TIMEOUT_BUFFER_PTR + 1), ((TIMEOUT_BUFFER >> 8) & 0xFF));
+void changeCalibrationState(cal_state state) {
+	Cal_State = state;
+	Cal_State_Start = millis();
+	Cal_Changed = true;
 	return;
 }
 
-bool sensorEngaged(sensor_group sensor) {
-	switch(sensor){
-		case BUTTON:
-			return(!digitalRead(BUTTON_PIN));
-		case ENDSTOP_1:
-			return(!digitalRead(ENDSTOP_1_PIN));
-		case ENDSTOP_2:
-			return(!digitalRead(ENDSTOP_2_PIN));
-		case ENDSTOP_3:
-			return(!digitalRead(ENDSTOP_3_PIN));
-		case ENDSTOP_4:
-			return(!digitalRead(ENDSTOP_4_PIN));
-		case ENDSTOP_5:
-			return(!digitalRead(ENDSTOP_5_PIN));
-		case ENDSTOP_6:
-			return(!digitalRead(ENDSTOP_6_PIN));
-		case ENDSTOP_MOTOR_1:
-			return(sensorEngaged(ENDSTOP_1) || sensorEngaged(ENDSTOP_2));
-		case ENDSTOP_MOTOR_2:
-			return(sensorEngaged(ENDSTOP_3) || sensorEngaged(ENDSTOP_4));
-		case ENDSTOP_MOTOR_3:
-			return(sensorEngaged(ENDSTOP_5) || sensorEngaged(ENDSTOP_6));
-		case ENDSTOP_ANY:
-			return(sensorEngaged(ENDSTOP_MOTOR_1) || sensorEngaged(ENDSTOP_MOTOR_2) || sensorEngaged(ENDSTOP_MOTOR_3));
-		case ENDSTOP_NONE:
-			return(!sensorEngaged(ENDSTOP_ANY));
-		default:
+bool allMotorsStopped(bool* faulted) {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		motor_state State = getMotorState((output_group)Motor);
+		if(State == FAULTED) {
+			*faulted = true;
+		}
+		else if(State != IDLE) {
 			return false;
+		}
 	}
+	return true;
 }
 
-void changeMotorState(output_group motor, motor_state state) {
-	switch(state) {
-		default:
-		case FAULTED:
-		case DELAY_PRE_CHANGE:
-			setPowerOutput(motor, false);
-			if(motor == LOADER_MOTOR) {
-				setPowerOutput(LOADER_MAGNET, false);
-			}
-			break;
-		case SAFETY_REVERSE_ENDSTOP_EARLY:
-		case SAFETY_REVERSE_ENDSTOP_FAIL:
-			setMotorSpeed(motor, SLOW);
-		case DELAY_POST_CHANGE:
-			reverseMotor(motor);
-			break;
-		case MOVE_START:
-			setPowerOutput(motor, true);
-			break;
-		case MOVE_END:
-			setMotorSpeed(motor, SLOW);
-			break;
-		case IDLE:
-			setMotorSpeed(motor, FAST);
-		case MOVE:
-			break;
+bool readSavedCalibrationData() {
+	// Leave every limit at zero, so nothing sensible can be mistaken for calibration data
+	if(!readCalibrationRecord(&Calibration_Record)) {
+		for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+			Limits_Forward[Motor].Near = 0;
+			Limits_Forward[Motor].Slowdown = 0;
+			Limits_Forward[Motor].Timeout = 0;
+			Limits_Backward[Motor] = Limits_Forward[Motor];
+			Endstop_Forward[Motor] = (sensor_group)((Motor * 2) + ENDSTOP_1);
+		}
+		return false;
 	}
 
-	if((state != MOVE_END) && (state != MOVE)) {
-		Motor_State_Start[motor] = millis();
+	// Update calibration variables, including any slowdown trims adapted since calibration
+	initAdaptation(&Calibration_Record, Limits_Forward, Limits_Backward);
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		Endstop_Forward[Motor] = (sensor_group)Calibration_Record.Endstop_Forward[Motor];
 	}
-	Motor_State[motor] = state;
-	return;
-}
 
-void reverseMotor(output_group motor) {
-	if(getMotorDir(motor) == FORWARD) {
-		setMotorDir(motor, BACKWARD);
-	}
-	else {
-		setMotorDir(motor, FORWARD);
-	}
-	sensor_group Temp_Endstop = Endstop_Front[motor];
-	Endstop_Front[motor] = Endstop_Back[motor];
-	Endstop_Back[motor] = Temp_Endstop;
-	return;
+	return true;
 }
 
-void assertCriticalError() {
-	Motor_State[ELEVATOR_MOTOR] = FAULTED;
-	setPowerOutput(ELEVATOR_MOTOR, false);
-	Motor_State_Start[ELEVATOR_MOTOR] = millis();
-	Motor_State[CART_MOTOR] = FAULTED;
-	setPowerOutput(CART_MOTOR, false);
-	Motor_State_Start[CART_MOTOR] = millis();
-	Motor_State[LOADER_MOTOR] = FAULTED;
-	setPowerOutput(LOADER_MOTOR, false);
-	Motor_State_Start[LOADER_MOTOR] = millis();
-	flagError(CRITICAL_ERROR);
+void saveCalibrationData(unsigned int ref_time_forward[3], unsigned int ref_time_backward[3]) {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		Calibration_Record.Ref_Time_Forward[Motor] = ref_time_forward[Motor];
+		Calibration_Record.Ref_Time_Backward[Motor] = ref_time_backward[Motor];
+		Calibration_Record.Endstop_Forward[Motor] = Endstop_Forward[Motor];
+		Calibration_Record.Slowdown_Trim[Motor][FORWARD] = 0;
+		Calibration_Record.Slowdown_Trim[Motor][BACKWARD] = 0;
+	}
+	Calibration_Record.Near_Factor = NEAR_FACTOR;
+	Calibration_Record.Slowdown_Factor = SLOWDOWN_FACTOR;
+	Calibration_Record.Timeout_Factor = TIMEOUT_FACTOR;
+	Calibration_Record.Timeout_Buffer = TIMEOUT_BUFFER;
+	initAdaptation(&Calibration_Record, Limits_Forward, Limits_Backward);
+	saveCalibrationRecord(&Calibration_Record);
 	return;
 }
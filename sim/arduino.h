@@ -0,0 +1,124 @@
+/* Arduino Core Shim
+ *
+ * Minimal stand-in for the Arduino core, used only by the Linux simulation build
+ *
+ * Provides the types, constants, and timekeeping functions the firmware modules expect from
+ * <arduino.h>. Timekeeping is backed by the simulator's virtual clock (see sim.h), so millis()
+ * only advances as modelled CPU time is consumed.
+ *
+ * Note that int is 32 bits wide on the host, unlike the 16 bits of the ATmega 328P.
+ */
+
+#ifndef arduino_h
+#define arduino_h
+#include <stdint.h>
+#include <stdlib.h>
+
+/////////////////////////
+// CORE TYPES AND CONSTANTS
+/////////////////////////
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+// Binary constants used by the firmware headers (see the Arduino core's binary.h)
+#define B00000100 4
+#define B10100000 160
+
+
+/////////////////////////
+// STATUS REGISTER
+/////////////////////////
+
+// Models the global interrupt flag (bit 7) of SREG, so the save and restore idiom
+// (Old_SREG = SREG; noInterrupts(); ... SREG = Old_SREG;) defers the system tick as on the board
+typedef struct sim_sreg {
+	operator byte() const;
+	sim_sreg& operator=(byte value);
+} sim_sreg;
+
+extern sim_sreg SREG;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+unsigned long millis();
+/*
+ * Gets the number of simulated milliseconds since power-up
+ *
+ * OUTPUT: Simulated milliseconds
+ */
+
+unsigned long micros();
+/*
+ * Gets the number of simulated microseconds since power-up
+ *
+ * OUTPUT: Simulated microseconds
+ */
+
+void delay(unsigned long ms);
+/*
+ * Advances the virtual clock by a number of milliseconds
+ *
+ * INPUT:  Milliseconds to wait
+ */
+
+void delayMicroseconds(unsigned int us);
+/*
+ * Advances the virtual clock by a number of microseconds
+ *
+ * INPUT:  Microseconds to wait
+ */
+
+void noInterrupts();
+/*
+ * Defers the system tick until interrupts() is called
+ */
+
+void interrupts();
+/*
+ * Re-enables the system tick, running any tick that became due while deferred
+ */
+
+long random(long howbig);
+/*
+ * Gets a deterministic pseudo-random number
+ *
+ * INPUT:  Upper bound (exclusive)
+ * OUTPUT: Random number
+ */
+
+long random(long howsmall, long howbig);
+/*
+ * Gets a deterministic pseudo-random number within a range
+ *
+ * INPUT:  Lower bound (inclusive)
+ *         Upper bound (exclusive)
+ * OUTPUT: Random number
+ */
+
+void randomSeed(unsigned long seed);
+/*
+ * Seeds the pseudo-random number generator
+ *
+ * INPUT:  Seed value
+ */
+
+
+#endif
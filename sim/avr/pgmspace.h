@@ -0,0 +1,19 @@
+/* Program Memory Shim
+ *
+ * Stand-in for <avr/pgmspace.h>, used only by the Linux simulation build
+ *
+ * The host has a single address space, so PROGMEM data is read like any other constant. Each
+ * read converts the element rather than reinterpreting it, since int is 32 bits wide on the host.
+ */
+
+#ifndef pgmspace_h
+#define pgmspace_h
+#include <stdint.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(address) ((uint8_t) *(address))
+#define pgm_read_word(address) ((uint16_t) *(address))
+
+
+#endif
@@ -0,0 +1,167 @@
+// Firmware translation unit for the simulation build
+// The unmodified sketch is compiled here, alongside read-only probes used by the scenario runner
+
+#include "../EWMC-Firmware.ino"
+#include "sim.h"
+
+static_assert((MOTOR_STATES == SIM_MOTOR_STATES) && (FAULTED == SIM_MOTOR_FAULTED), "sim.h must match motor_state");
+static_assert(CRITICAL_ERROR == SIM_CRITICAL_ERROR, "sim.h must match CRITICAL_ERROR");
+static_assert(ADAPT_SCALE_SHIFT == SIM_SCALE_SHIFT, "sim.h must match ADAPT_SCALE_SHIFT");
+
+void simFirmwareSetup() {
+	setup();
+	return;
+}
+
+void simFirmwareLoop() {
+	simCountOp(SIM_OP_LOOP_CALL, SIM_COST_LOOP_CALL);
+	loop();
+	return;
+}
+
+bool simCalibrating() {
+	return(Cal_State != CAL_OFF);
+}
+
+bool simLinkEnabled() {
+	return LINK_ENABLED;
+}
+
+byte simMotorState(byte motor) {
+	return getMotorState((output_group)motor);
+}
+
+void simMotorLimits(byte motor, bool backward, unsigned int* slowdown, unsigned int* timeout) {
+	const motor_limits* Limits = (backward ? &Limits_Backward[motor] : &Limits_Forward[motor]);
+	*slowdown = Limits->Slowdown;
+	*timeout = Limits->Timeout;
+	return;
+}
+
+void simMotorHealth(byte motor, bool backward, unsigned int* trips, unsigned int* mean, unsigned long* variance, unsigned int* shortest, unsigned int* longest) {
+	const travel_stats* Stats = &getMotorHealth((output_group)motor)->Travel[backward ? BACKWARD : FORWARD];
+	*trips = Stats->Count;
+	*mean = getTravelMean(Stats);
+	*variance = getTravelVariance(Stats);
+	*shortest = ((Stats->Count > 0) ? Stats->Min : 0);
+	*longest = ((Stats->Count > 0) ? Stats->Max : 0);
+	return;
+}
+
+void simMotorHealthCounts(byte motor, unsigned int* faults, unsigned long* relay_switches) {
+	const motor_health* Health = getMotorHealth((output_group)motor);
+	*faults = Health->Faults;
+	*relay_switches = Health->Relay_Switches;
+	return;
+}
+
+byte simAudioClips() {
+	return AUDIO_CLIPS;
+}
+
+byte simAmbientWeight(byte clip) {
+	return pgm_read_byte(&AMBIENT_WEIGHT[clip]);
+}
+
+byte simDrawAmbientClip(byte eligible) {
+	return drawAmbientClip(eligible);
+}
+
+unsigned long simScaleTime(unsigned int time, unsigned int per_mille) {
+	return scaleTime(time, getPerMilleScale(per_mille));
+}
+
+void simAdaptSlowdown(unsigned int ref_time, byte slowdown_factor, unsigned int travel_time, unsigned int* slowdown, int* trim, unsigned long* restored, unsigned long* next) {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		Calibration_Record.Ref_Time_Forward[Motor] = ref_time;
+		Calibration_Record.Ref_Time_Backward[Motor] = ref_time;
+		Calibration_Record.Slowdown_Trim[Motor][FORWARD] = 0;
+		Calibration_Record.Slowdown_Trim[Motor][BACKWARD] = 0;
+	}
+	Calibration_Record.Near_Factor = NEAR_FACTOR;
+	Calibration_Record.Slowdown_Factor = slowdown_factor;
+	Calibration_Record.Timeout_Factor = TIMEOUT_FACTOR;
+	Calibration_Record.Timeout_Buffer = TIMEOUT_BUFFER;
+	initAdaptation(&Calibration_Record, Limits_Forward, Limits_Backward);
+
+	adaptMotorLimits(ELEVATOR_MOTOR, FORWARD, travel_time);
+	*slowdown = Limits_Forward[ELEVATOR_MOTOR].Slowdown;
+	*trim = Calibration_Record.Slowdown_Trim[ELEVATOR_MOTOR][FORWARD];
+	*restored = getTrimmedSlowdown(ref_time, *trim);
+	*next = ((*trim < ADAPT_TRIM_MAX) ? getTrimmedSlowdown(ref_time, (*trim + 1)) : 0xFFFFFFFF);
+	return;
+}
+
+bool simErrorFlagged(byte error) {
+	return errorFlagged(error);
+}
+
+byte simErrorCodes() {
+	return ERROR_CODES;
+}
+
+byte simTasks() {
+	return TASKS;
+}
+
+void simTaskStats(byte task, unsigned long* runs, unsigned long* time_us, unsigned int* max_time_us, unsigned long* overruns) {
+	*runs = getTaskRuns((task_id)task);
+	*time_us = getTaskTime((task_id)task);
+	*max_time_us = getTaskMaxTime((task_id)task);
+	*overruns = getTaskOverruns((task_id)task);
+	return;
+}
+
+byte simProfileSections() {
+#if PROFILE_ENABLED
+	return PROFILE_SECTIONS;
+#else
+	return 0;
+#endif
+}
+
+void simProfileStats(byte section, unsigned long* count, unsigned int* min, unsigned long* total, unsigned int* max, unsigned int histogram[]) {
+#if PROFILE_ENABLED
+	profile_stats Stats;
+	getProfileStats((profile_section)section, &Stats);
+	*count = Stats.Count;
+	*min = Stats.Min;
+	*total = Stats.Total;
+	*max = Stats.Max;
+	for(byte Bin = 0; Bin < PROFILE_BINS; Bin++) {
+		histogram[Bin] = Stats.Histogram[Bin];
+	}
+#endif
+	return;
+}
+
+void simDumpProfile(void (*write)(char character)) {
+#if PROFILE_ENABLED
+	dumpProfile(write);
+#endif
+	return;
+}
+
+void simDumpTrace(void (*write)(byte data)) {
+	dumpTrace(write);
+	return;
+}
+
+bool simTraceFrozen() {
+	return traceFrozen();
+}
+
+uint16_t simTraceAddress() {
+	return EEPROM_TRACE_PTR;
+}
+
+
+void simLinkStats(unsigned int* received, unsigned int* rejected, unsigned int* sent, unsigned int* dropped) {
+	link_stats Stats;
+	getLinkStats(&Stats);
+	*received = Stats.Received;
+	*rejected = Stats.Rejected;
+	*sent = Stats.Sent;
+	*dropped = Stats.Dropped;
+	return;
+}
\ No newline at end of file
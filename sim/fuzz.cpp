@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "sim.h"
+
+/////////////////////////
+// CONFIGURATION
+/////////////////////////
+
+const char* const SIM_INVARIANT_NAME[SIM_SAFETY_INVARIANTS] = {
+	"motor powered with both endstops engaged",
+	"motor powered while FAULTED",
+	"magnet on while the loader is FAULTED",
+	"motor powered after a critical error"
+};
+const char* const SIM_ACTION_NAME[] = {"button", "hand", "fault", "drag", "push"};
+const byte SIM_FUZZ_ACTIONS = (sizeof(SIM_ACTION_NAME) / sizeof(SIM_ACTION_NAME[0]));
+
+// Coverage bitmap: every motor state transition of every motor, then every error code
+const unsigned int SIM_COVERAGE_ERRORS = (3 * SIM_MOTOR_STATES * SIM_MOTOR_STATES);
+const unsigned int SIM_COVERAGE_BITS = (SIM_COVERAGE_ERRORS + 16);
+const unsigned int SIM_COVERAGE_BYTES = ((SIM_COVERAGE_BITS + 7) / 8);
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+typedef struct {
+	sim_event events[SIM_CASE_EVENTS + 1];  // In time order, followed by ACTION_END
+	byte count;
+} sim_fuzz_case;
+
+// Result of a case, passed back from the process which ran it
+typedef struct {
+	byte coverage[SIM_COVERAGE_BYTES];
+	unsigned long violations;
+	unsigned long first_time;           // Milliseconds since the case started
+	byte first_invariant;
+	byte first_motor;
+	unsigned long long iterations;
+	unsigned long sim_time;
+} sim_fuzz_result;
+
+
+/////////////////////////
+// SAFETY STATE
+/////////////////////////
+
+unsigned int Safety_Held[SIM_SAFETY_INVARIANTS][3];  // Milliseconds each invariant has been broken for
+unsigned long Safety_Violations = 0;
+unsigned long Safety_First_Time = 0;
+byte Safety_First_Invariant = 0;
+byte Safety_First_Motor = 0;
+
+byte Coverage[SIM_COVERAGE_BYTES];
+byte Coverage_Last_State[3] = {SIM_MOTOR_STATES, SIM_MOTOR_STATES, SIM_MOTOR_STATES};  // SIM_MOTOR_STATES = not yet seen
+
+unsigned long Fuzz_Random = 1;
+
+
+/////////////////////////
+// SAFETY INVARIANTS
+/////////////////////////
+
+void checkInvariant(sim_invariant invariant, byte motor, bool broken) {
+	if(!broken) {
+		Safety_Held[invariant][motor] = 0;
+		return;
+	}
+
+	// Counted once, as soon as the grace time runs out
+	Safety_Held[invariant][motor] += 1;
+	if(Safety_Held[invariant][motor] == (SIM_SAFETY_GRACE_MS + 1)) {
+		if(Safety_Violations == 0) {
+			Safety_First_Time = simMillis();
+			Safety_First_Invariant = invariant;
+			Safety_First_Motor = motor;
+		}
+		Safety_Violations += 1;
+	}
+	return;
+}
+
+void setCoverage(unsigned int bit) {
+	Coverage[bit / 8] |= (1 << (bit % 8));
+	return;
+}
+
+void simMonitorSafety() {
+	bool Critical = simErrorFlagged(SIM_CRITICAL_ERROR);
+
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		byte State = simMotorState(Motor);
+		bool Powered = (simOutputPWM(Motor) > 0);
+		bool Both = (simInputEngaged((sim_input)(SIM_ENDSTOP_1 + (Motor * 2))) && simInputEngaged((sim_input)(SIM_ENDSTOP_1 + (Motor * 2) + 1)));
+		checkInvariant(SIM_SAFETY_BOTH_ENGAGED, Motor, (Powered && Both));
+		checkInvariant(SIM_SAFETY_FAULTED, Motor, (Powered && (State == SIM_MOTOR_FAULTED)));
+		checkInvariant(SIM_SAFETY_CRITICAL, Motor, (Powered && Critical));
+
+		if((Coverage_Last_State[Motor] < SIM_MOTOR_STATES) && (State < SIM_MOTOR_STATES) && (State != Coverage_Last_State[Motor])) {
+			setCoverage((Motor * SIM_MOTOR_STATES * SIM_MOTOR_STATES) + (Coverage_Last_State[Motor] * SIM_MOTOR_STATES) + State);
+		}
+		Coverage_Last_State[Motor] = State;
+	}
+	checkInvariant(SIM_SAFETY_MAGNET_FAULTED, 2, ((simOutputPWM(3) > 0) && (simMotorState(2) == SIM_MOTOR_FAULTED)));
+
+	for(byte Error = 1; Error <= simErrorCodes(); Error++) {
+		if(simErrorFlagged(Error)) {
+			setCoverage(SIM_COVERAGE_ERRORS + (Error - 1));
+		}
+	}
+	return;
+}
+
+unsigned long simSafetyViolations() {
+	return Safety_Violations;
+}
+
+void printViolation(unsigned long violations, unsigned long time, byte invariant, byte motor) {
+	if(violations == 0) {
+		printf("  safety: no invariant violations\n");
+		return;
+	}
+	printf("  safety: %lu invariant violations, first at %.3f s: %s %s\n", violations, (time / 1000.0),
+		SIM_MOTOR_NAME[motor], SIM_INVARIANT_NAME[invariant]);
+	return;
+}
+
+void simPrintSafety() {
+	printViolation(Safety_Violations, Safety_First_Time, Safety_First_Invariant, Safety_First_Motor);
+	return;
+}
+
+
+/////////////////////////
+// CASE FILES
+/////////////////////////
+
+void writeCase(FILE* file, const sim_fuzz_case* fuzz_case) {
+	for(byte Event = 0; Event < fuzz_case->count; Event++) {
+		const sim_event* Row = &fuzz_case->events[Event];
+		fprintf(file, "%lu %s %u %u\n", Row->time, SIM_ACTION_NAME[Row->action], Row->target, Row->value);
+	}
+	return;
+}
+
+bool readCaseFile(const char* path, sim_fuzz_case* fuzz_case) {
+	FILE* File = fopen(path, "r");
+	if(File == NULL) {
+		return false;
+	}
+
+	// One event per line: time in milliseconds, action, target, and value; # starts a comment
+	char Line[128];
+	bool Valid = true;
+	fuzz_case->count = 0;
+	while(Valid && (fgets(Line, sizeof(Line), File) != NULL)) {
+		unsigned long Time;
+		char Action[16];
+		unsigned int Target;
+		unsigned int Value;
+		if((Line[0] == '#') || (Line[0] == '\n')) {
+			continue;
+		}
+		if((sscanf(Line, "%lu %15s %u %u", &Time, Action, &Target, &Value) != 4) || (fuzz_case->count == SIM_CASE_EVENTS)) {
+			Valid = false;
+			break;
+		}
+		byte Index = 0;
+		while((Index < SIM_FUZZ_ACTIONS) && (strcmp(Action, SIM_ACTION_NAME[Index]) != 0)) {
+			Index++;
+		}
+		if((Index == SIM_FUZZ_ACTIONS) || (Target > 0xFF) || (Value > 0xFF) ||
+			((fuzz_case->count > 0) && (Time < fuzz_case->events[fuzz_case->count - 1].time))) {
+			Valid = false;
+			break;
+		}
+		sim_event* Row = &fuzz_case->events[fuzz_case->count++];
+		Row->time = Time;
+		Row->action = (sim_action)Index;
+		Row->target = Target;
+		Row->value = Value;
+	}
+	fclose(File);
+	return Valid;
+}
+
+bool readTraceCase(const char* path, sim_fuzz_case* fuzz_case) {
+	byte Trace[SIM_TRACE_LENGTH];
+	sim_trace_record Records[SIM_TRACE_RECORDS];
+	if(!simReadTraceFile(path, Trace)) {
+		return false;
+	}
+
+	// Each endstop is held at its recorded level with a fault, and the button follows its own
+	// Bits 0-5 of an input record are endstops 6 to 1, and bit 6 is the arcade button
+	byte Count = simTraceRecords(Trace, Records);
+	unsigned long Start = 0;
+	byte Previous = 0;
+	bool Started = false;
+	fuzz_case->count = 0;
+	for(byte Record = 0; Record < Count; Record++) {
+		if(Records[Record].type != 3) {
+			continue;
+		}
+		byte Changed = (Records[Record].value ^ Previous);
+		if(!Started) {
+			Start = Records[Record].time;
+			Changed = 0x7F;
+			Started = true;
+		}
+		Previous = Records[Record].value;
+		for(byte Input = 0; Input < SIM_INPUTS; Input++) {
+			byte Bit = ((Input == SIM_BUTTON) ? 6 : (SIM_ENDSTOP_6 - Input));
+			if(!(Changed & (1 << Bit)) || (fuzz_case->count == SIM_CASE_EVENTS)) {
+				continue;
+			}
+			bool Engaged = (Records[Record].value & (1 << Bit));
+			sim_event* Row = &fuzz_case->events[fuzz_case->count++];
+			Row->time = (Records[Record].time - Start);
+			if(Input == SIM_BUTTON) {
+				Row->action = ACTION_BUTTON;
+				Row->target = 0;
+				Row->value = Engaged;
+			}
+			else {
+				Row->action = ACTION_FAULT;
+				Row->target = Input;
+				Row->value = (Engaged ? SIM_ENDSTOP_STUCK : SIM_ENDSTOP_BROKEN);
+			}
+		}
+	}
+	return Started;
+}
+
+
+/////////////////////////
+// FUZZER
+/////////////////////////
+
+unsigned long fuzzRandom(unsigned long limit) {
+	// xorshift32, kept apart from the firmware's random() so mutations never disturb it
+	Fuzz_Random ^= (Fuzz_Random << 13);
+	Fuzz_Random ^= (Fuzz_Random >> 17);
+	Fuzz_Random ^= (Fuzz_Random << 5);
+	return((Fuzz_Random & 0xFFFFFFFF) % limit);
+}
+
+void randomizeEvent(sim_event* event) {
+	event->action = (sim_action)fuzzRandom(SIM_FUZZ_ACTIONS);
+	switch(event->action) {
+		case ACTION_BUTTON:
+			event->target = 0;
+			event->value = fuzzRandom(2);
+			break;
+		case ACTION_HAND:
+			event->target = (SIM_ENDSTOP_1 + fuzzRandom(6));
+			event->value = fuzzRandom(2);
+			break;
+		case ACTION_FAULT:
+			event->target = (SIM_ENDSTOP_1 + fuzzRandom(6));
+			event->value = fuzzRandom(3);
+			break;
+		case ACTION_DRAG:
+			event->target = fuzzRandom(3);
+			event->value = (50 + fuzzRandom(51));
+			break;
+		default:
+			event->action = ACTION_PUSH;
+			event->target = fuzzRandom(3);
+			event->value = fuzzRandom(101);
+			break;
+	}
+	return;
+}
+
+void sortCase(sim_fuzz_case* fuzz_case) {
+	for(byte Event = 1; Event < fuzz_case->count; Event++) {
+		sim_event Row = fuzz_case->events[Event];
+		byte Index = Event;
+		while((Index > 0) && (fuzz_case->events[Index - 1].time > Row.time)) {
+			fuzz_case->events[Index] = fuzz_case->events[Index - 1];
+			Index--;
+		}
+		fuzz_case->events[Index] = Row;
+	}
+	return;
+}
+
+void mutateCase(sim_fuzz_case* fuzz_case) {
+	byte Mutations = (1 + fuzzRandom(4));
+	for(byte Mutation = 0; Mutation < Mutations; Mutation++) {
+		byte Kind = fuzzRandom(4);
+		if((fuzz_case->count == 0) || ((Kind == 0) && (fuzz_case->count < SIM_FUZZ_EVENTS))) {
+			// Insert a new event
+			sim_event* Row = &fuzz_case->events[fuzz_case->count++];
+			Row->time = fuzzRandom(SIM_FUZZ_CASE_TIME);
+			randomizeEvent(Row);
+		}
+		else if(Kind == 1) {
+			// Remove an event
+			byte Index = fuzzRandom(fuzz_case->count);
+			fuzz_case->events[Index] = fuzz_case->events[--fuzz_case->count];
+		}
+		else if(Kind == 2) {
+			// Move an event by up to a second either way, where timing races live
+			sim_event* Row = &fuzz_case->events[fuzzRandom(fuzz_case->count)];
+			long Time = ((long)Row->time + (long)fuzzRandom(2001) - 1000);
+			if(Time < 0) {
+				Time = 0;
+			}
+			else if(Time >= (long)SIM_FUZZ_CASE_TIME) {
+				Time = (SIM_FUZZ_CASE_TIME - 1);
+			}
+			Row->time = Time;
+		}
+		else {
+			randomizeEvent(&fuzz_case->events[fuzzRandom(fuzz_case->count)]);
+		}
+	}
+	sortCase(fuzz_case);
+	return;
+}
+
+bool runCase(sim_fuzz_case* fuzz_case, unsigned long duration, sim_fuzz_result* result) {
+	fuzz_case->events[fuzz_case->count].time = duration;
+	fuzz_case->events[fuzz_case->count].action = ACTION_END;
+
+	// Each case starts from the calibrated firmware held by this process, which it never changes
+	int Pipe[2];
+	if(pipe(Pipe) != 0) {
+		return false;
+	}
+	fflush(stdout);
+	pid_t Child = fork();
+	if(Child == 0) {
+		close(Pipe[0]);
+		memset(Coverage, 0, sizeof(Coverage));
+		unsigned long Start = simMillis();
+		sim_fuzz_result Result;
+		Result.iterations = simRunEvents(fuzz_case->events);
+		memcpy(Result.coverage, Coverage, sizeof(Coverage));
+		Result.violations = Safety_Violations;
+		Result.first_time = (Safety_First_Time - Start);
+		Result.first_invariant = Safety_First_Invariant;
+		Result.first_motor = Safety_First_Motor;
+		Result.sim_time = (simMillis() - Start);
+		_exit((write(Pipe[1], &Result, sizeof(Result)) == sizeof(Result)) ? 0 : 1);
+	}
+	close(Pipe[1]);
+
+	size_t Length = 0;
+	while(Length < sizeof(*result)) {
+		ssize_t Count = read(Pipe[0], ((byte*)result) + Length, (sizeof(*result) - Length));
+		if(Count <= 0) {
+			break;
+		}
+		Length += Count;
+	}
+	close(Pipe[0]);
+	int Status = 1;
+	if((Child < 0) || (waitpid(Child, &Status, 0) < 0) || !WIFEXITED(Status) || (WEXITSTATUS(Status) != 0)) {
+		return false;
+	}
+	return(Length == sizeof(*result));
+}
+
+unsigned int countCoverage(const byte coverage[SIM_COVERAGE_BYTES], unsigned int first, unsigned int last) {
+	unsigned int Count = 0;
+	for(unsigned int Bit = first; Bit < last; Bit++) {
+		if(coverage[Bit / 8] & (1 << (Bit % 8))) {
+			Count++;
+		}
+	}
+	return Count;
+}
+
+double fuzzHostSeconds() {
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return(Time.tv_sec + (Time.tv_nsec / 1e9));
+}
+
+int simFuzz(unsigned long seed, unsigned long cases, const char* case_out) {
+	static sim_fuzz_case Corpus[SIM_FUZZ_CORPUS];
+	unsigned int Corpus_Size = 0;
+	byte Total_Coverage[SIM_COVERAGE_BYTES] = {0};
+	unsigned long long Iterations = 0;
+	unsigned long long Sim_Time = 0;
+
+	Fuzz_Random = ((seed != 0) ? seed : 1);
+	if(!simCalibrate(seed) || (Safety_Violations > 0)) {
+		printf("fuzz: calibration did not end safely\n");
+		simPrintSafety();
+		return 1;
+	}
+	printf("fuzz: %lu cases of %.1f s from calibration, seed %lu\n", cases, (SIM_FUZZ_CASE_TIME / 1000.0), seed);
+
+	double Host_Start = fuzzHostSeconds();
+	for(unsigned long Case = 0; Case < cases; Case++) {
+		// Mostly mutations of cases which found new coverage, with the odd fresh case
+		sim_fuzz_case Next;
+		Next.count = 0;
+		if((Corpus_Size > 0) && (fuzzRandom(8) != 0)) {
+			Next = Corpus[fuzzRandom(Corpus_Size)];
+		}
+		mutateCase(&Next);
+
+		sim_fuzz_result Result;
+		if(!runCase(&Next, SIM_FUZZ_CASE_TIME, &Result)) {
+			printf("fuzz: case %lu did not complete\n", Case);
+			writeCase(stdout, &Next);
+			return 1;
+		}
+		Iterations += Result.iterations;
+		Sim_Time += Result.sim_time;
+
+		bool New_Coverage = false;
+		for(unsigned int Index = 0; Index < SIM_COVERAGE_BYTES; Index++) {
+			if(Result.coverage[Index] & ~Total_Coverage[Index]) {
+				New_Coverage = true;
+			}
+			Total_Coverage[Index] |= Result.coverage[Index];
+		}
+		if(New_Coverage) {
+			if(Corpus_Size < SIM_FUZZ_CORPUS) {
+				Corpus[Corpus_Size++] = Next;
+			}
+			else {
+				Corpus[fuzzRandom(SIM_FUZZ_CORPUS)] = Next;
+			}
+		}
+
+		if(Result.violations > 0) {
+			printf("fuzz: case %lu failed\n", Case);
+			printViolation(Result.violations, Result.first_time, Result.first_invariant, Result.first_motor);
+			writeCase(stdout, &Next);
+			FILE* File = ((case_out != NULL) ? fopen(case_out, "w") : NULL);
+			if(File != NULL) {
+				fprintf(File, "# ewmc-sim --fuzz case %lu, seed %lu\n", Case, seed);
+				writeCase(File, &Next);
+				fclose(File);
+			}
+			return 1;
+		}
+	}
+	double Host_Elapsed = (fuzzHostSeconds() - Host_Start);
+
+	printf("  corpus: %u cases\n", Corpus_Size);
+	printf("  coverage: %u motor state transitions, %u error codes\n",
+		countCoverage(Total_Coverage, 0, SIM_COVERAGE_ERRORS), countCoverage(Total_Coverage, SIM_COVERAGE_ERRORS, SIM_COVERAGE_BITS));
+	printf("  speed: %.0f simulated seconds and %.0f loop() passes per host second\n",
+		((Host_Elapsed > 0) ? ((Sim_Time / 1000.0) / Host_Elapsed) : 0), ((Host_Elapsed > 0) ? (Iterations / Host_Elapsed) : 0));
+	printf("  safety: no invariant violations\n");
+	return 0;
+}
+
+
+/////////////////////////
+// REPLAY
+/////////////////////////
+
+int simReplay(unsigned long seed, const char* path) {
+	static sim_fuzz_case Replay;
+	FILE* File = fopen(path, "rb");
+	if(File == NULL) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		return 1;
+	}
+	fseek(File, 0, SEEK_END);
+	long Size = ftell(File);
+	fclose(File);
+
+	// Motion traces are recognized by their size, as --trace-in does
+	bool Trace = ((Size == SIM_EEPROM_SIZE) || (Size == SIM_TRACE_LENGTH));
+	if(Trace ? !readTraceCase(path, &Replay) : !readCaseFile(path, &Replay)) {
+		fprintf(stderr, "%s is not a valid %s\n", path, (Trace ? "motion trace" : "case file"));
+		return 1;
+	}
+	if(!simCalibrate(seed) || (Safety_Violations > 0)) {
+		printf("replay: calibration did not end safely\n");
+		simPrintSafety();
+		return 1;
+	}
+
+	unsigned long Duration = (((Replay.count > 0) ? Replay.events[Replay.count - 1].time : 0) + SIM_REPLAY_TAIL);
+	Replay.events[Replay.count].time = Duration;
+	Replay.events[Replay.count].action = ACTION_END;
+	printf("replay: %s (%s, %u events over %.3f s)\n", path, (Trace ? "motion trace inputs" : "case file"), Replay.count, (Duration / 1000.0));
+
+	unsigned long Start = simMillis();
+	simRunEvents(Replay.events);
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		printf("  %-8s final state %s\n", SIM_MOTOR_NAME[Motor], SIM_MOTOR_STATE_NAME[simMotorState(Motor)]);
+	}
+	printf("  errors:");
+	bool Any_Error = false;
+	for(byte Error = 1; Error <= simErrorCodes(); Error++) {
+		if(simErrorFlagged(Error)) {
+			printf(" %u", Error);
+			Any_Error = true;
+		}
+	}
+	printf("%s\n", (Any_Error ? "" : " none"));
+	printViolation(Safety_Violations, (Safety_First_Time - Start), Safety_First_Invariant, Safety_First_Motor);
+	return((Safety_Violations > 0) ? 1 : 0);
+}
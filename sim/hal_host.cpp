@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include "sim.h"
+#include "../src/hal.h"
+
+// Board wiring, mirroring the EWMC schematic
+const byte SIM_PIN_SPI_SCLK = 0;
+const byte SIM_PIN_SPI_MOSI = 1;
+const byte SIM_PIN_SPI_SS = 8;
+const byte SIM_PIN_BUTTON = 12;
+const byte SIM_PIN_LED = 13;
+const byte SIM_PIN_ENDSTOP[6] = {A5, A4, A3, A2, A1, A0};
+const byte SIM_PIN_MOTOR_DIR[3] = {6, 5, 4};
+
+// Power output driven by each PWM channel (indexed by pwm_channel)
+const byte SIM_PWM_OUTPUT[4] = {0, 1, 2, 3};
+
+const unsigned long SIM_CYCLES_PER_TICK = (SYSTEM_TICK_US * (SIM_CPU_HZ / 1000000));
+const unsigned long SIM_CYCLES_PER_WATCHDOG = (WATCHDOG_TICK_MS * SIM_CYCLES_PER_MS);
+
+// Interrupt sources dispatched by simConsume()
+typedef enum {
+	SIM_INTERRUPT_NONE,
+	SIM_INTERRUPT_TICK,
+	SIM_INTERRUPT_EEPROM,
+	SIM_INTERRUPT_WATCHDOG,
+	SIM_INTERRUPT_LINK_RX,
+	SIM_INTERRUPT_LINK_TX
+} sim_interrupt;
+
+unsigned long long Sim_Cycles = 0;
+unsigned long long Sim_Next_Step = SIM_CYCLES_PER_MS;
+unsigned long long Sim_Next_Tick = 0;
+unsigned long Sim_Op_Count[SIM_OP_COUNT];
+
+bool Sim_Tick_Enabled = false;
+bool Sim_In_Interrupt = false;
+bool Sim_Interrupts_Deferred = false;
+bool Sim_Pin_Change_Wake = false;
+bool Sim_Eeprom_Interrupt = false;
+bool Sim_Watchdog_Enabled = false;
+unsigned long long Sim_Next_Watchdog = 0;
+unsigned long long Sim_Eeprom_Ready = 0;  // Cycle at which the EEPROM write in progress finishes
+byte Sim_Input_Levels = 0x7F;
+unsigned long long Sim_Sleep_Cycles = 0;
+
+// Diagnostic link USART
+// UDR0 and the transmit shift register each hold one byte, so a byte can be written while another is sent
+unsigned long Sim_Link_Byte_Cycles = 0;        // Start, 8 data, and stop bits at the configured baud rate
+bool Sim_Link_Enabled = false;
+bool Sim_Link_Tx_Interrupt = false;
+unsigned long long Sim_Link_Udr_Free = 0;      // Cycle at which UDR0 can accept another byte
+unsigned long long Sim_Link_Shift_End = 0;     // Cycle at which the last byte written is fully sent
+byte Sim_Link_Rx_Queue[SIM_LINK_RX_QUEUE];     // Bytes sent by the host, not yet received
+unsigned int Sim_Link_Rx_Head = 0;
+unsigned int Sim_Link_Rx_Count = 0;
+unsigned long long Sim_Link_Rx_Next = 0;       // Cycle at which the next byte finishes arriving
+unsigned long Sim_Link_Lost = 0;
+unsigned long Sim_Link_Conflicts = 0;
+
+bool Sim_Pin_Level[20];
+byte Sim_EEPROM[SIM_EEPROM_SIZE];
+
+unsigned long Sim_Random_State = 1;
+
+void simConsume(unsigned long cycles) {
+	Sim_Cycles += cycles;
+
+	// Interrupts do not nest, and the plant only moves between them
+	if(Sim_In_Interrupt) {
+		return;
+	}
+
+	while(true) {
+		bool Tick_Due = (Sim_Tick_Enabled && !Sim_Interrupts_Deferred && (Sim_Cycles >= Sim_Next_Tick) && (Sim_Next_Tick <= Sim_Next_Step));
+		bool Eeprom_Due = (Sim_Eeprom_Interrupt && !Sim_Interrupts_Deferred && (Sim_Cycles >= Sim_Eeprom_Ready) && (Sim_Eeprom_Ready <= Sim_Next_Step));
+		bool Watchdog_Due = (Sim_Watchdog_Enabled && !Sim_Interrupts_Deferred && (Sim_Cycles >= Sim_Next_Watchdog) && (Sim_Next_Watchdog <= Sim_Next_Step));
+		bool Rx_Due = ((Sim_Link_Rx_Count > 0) && !Sim_Interrupts_Deferred && (Sim_Cycles >= Sim_Link_Rx_Next) && (Sim_Link_Rx_Next <= Sim_Next_Step));
+		bool Tx_Due = (Sim_Link_Enabled && Sim_Link_Tx_Interrupt && !Sim_Interrupts_Deferred && (Sim_Cycles >= Sim_Link_Udr_Free) && (Sim_Link_Udr_Free <= Sim_Next_Step));
+
+		// The earliest interrupt is serviced first; ties go to the system tick, then the EEPROM, then the
+		// watchdog, then the USART
+		sim_interrupt Source = SIM_INTERRUPT_NONE;
+		unsigned long long Source_Time = 0;
+		if(Tick_Due) {
+			Source = SIM_INTERRUPT_TICK;
+			Source_Time = Sim_Next_Tick;
+		}
+		if(Eeprom_Due && ((Source == SIM_INTERRUPT_NONE) || (Sim_Eeprom_Ready < Source_Time))) {
+			Source = SIM_INTERRUPT_EEPROM;
+			Source_Time = Sim_Eeprom_Ready;
+		}
+		if(Watchdog_Due && ((Source == SIM_INTERRUPT_NONE) || (Sim_Next_Watchdog < Source_Time))) {
+			Source = SIM_INTERRUPT_WATCHDOG;
+			Source_Time = Sim_Next_Watchdog;
+		}
+		if(Rx_Due && ((Source == SIM_INTERRUPT_NONE) || (Sim_Link_Rx_Next < Source_Time))) {
+			Source = SIM_INTERRUPT_LINK_RX;
+			Source_Time = Sim_Link_Rx_Next;
+		}
+		if(Tx_Due && ((Source == SIM_INTERRUPT_NONE) || (Sim_Link_Udr_Free < Source_Time))) {
+			Source = SIM_INTERRUPT_LINK_TX;
+			Source_Time = Sim_Link_Udr_Free;
+		}
+
+		if(Source == SIM_INTERRUPT_TICK) {
+			Sim_Next_Tick += SIM_CYCLES_PER_TICK;
+			Sim_In_Interrupt = true;
+			simCountOp(SIM_OP_INTERRUPT, SIM_COST_INTERRUPT);
+			systemTick();
+			Sim_In_Interrupt = false;
+		}
+		else if(Source == SIM_INTERRUPT_EEPROM) {
+			Sim_In_Interrupt = true;
+			simCountOp(SIM_OP_INTERRUPT, SIM_COST_INTERRUPT);
+			eepromReady();
+			Sim_In_Interrupt = false;
+		}
+		else if(Source == SIM_INTERRUPT_WATCHDOG) {
+			Sim_Next_Watchdog += SIM_CYCLES_PER_WATCHDOG;
+			Sim_In_Interrupt = true;
+			simCountOp(SIM_OP_INTERRUPT, SIM_COST_INTERRUPT);
+			errorTick();
+			Sim_In_Interrupt = false;
+		}
+		else if(Source == SIM_INTERRUPT_LINK_RX) {
+			byte Data = Sim_Link_Rx_Queue[Sim_Link_Rx_Head];
+			Sim_Link_Rx_Head = ((Sim_Link_Rx_Head + 1) % SIM_LINK_RX_QUEUE);
+			Sim_Link_Rx_Count -= 1;
+			Sim_Link_Rx_Next += Sim_Link_Byte_Cycles;
+
+			// With the receiver disabled for an SPI frame, the byte is never seen
+			if(Sim_Link_Enabled) {
+				Sim_In_Interrupt = true;
+				simCountOp(SIM_OP_INTERRUPT, SIM_COST_INTERRUPT);
+				simCountOp(SIM_OP_LINK_BYTE, SIM_COST_LINK_BYTE);
+				linkReceived(Data, false);
+				Sim_In_Interrupt = false;
+			}
+			else {
+				Sim_Link_Lost += 1;
+			}
+		}
+		else if(Source == SIM_INTERRUPT_LINK_TX) {
+			Sim_In_Interrupt = true;
+			simCountOp(SIM_OP_INTERRUPT, SIM_COST_INTERRUPT);
+			linkTransmitReady();
+			Sim_In_Interrupt = false;
+		}
+		else if(Sim_Cycles >= Sim_Next_Step) {
+			Sim_Next_Step += SIM_CYCLES_PER_MS;
+			simStepPlant();
+			simCheckPinChange();
+		}
+		else {
+			break;
+		}
+	}
+	return;
+}
+
+void simCountOp(sim_op op, unsigned long cycles) {
+	Sim_Op_Count[op] += 1;
+	simConsume(cycles);
+	return;
+}
+
+unsigned long long simCycles() {
+	return Sim_Cycles;
+}
+
+unsigned long simMillis() {
+	return(Sim_Cycles / SIM_CYCLES_PER_MS);
+}
+
+unsigned long simOpCount(sim_op op) {
+	return Sim_Op_Count[op];
+}
+
+unsigned long long simSleepCycles() {
+	return Sim_Sleep_Cycles;
+}
+
+byte simInputLevels() {
+	byte Levels = 0x7F;
+	for(byte Endstop = 0; Endstop < 6; Endstop++) {
+		if(simInputEngaged((sim_input)(SIM_ENDSTOP_1 + Endstop))) {
+			Levels &= ~(1 << (SIM_PIN_ENDSTOP[Endstop] - A0));
+		}
+	}
+	if(simInputEngaged(SIM_BUTTON)) {
+		Levels &= ~0x40;
+	}
+	return Levels;
+}
+
+void simCheckPinChange() {
+	byte Levels = simInputLevels();
+	if(Sim_Pin_Change_Wake && (Levels != Sim_Input_Levels)) {
+		Sim_Op_Count[SIM_OP_INTERRUPT] += 1;
+		Sim_Cycles += SIM_COST_INTERRUPT;
+		halStartSystemTick();
+	}
+	Sim_Input_Levels = Levels;
+	return;
+}
+
+void simInitHardware(unsigned long seed) {
+	for(byte Pin = 0; Pin < 20; Pin++) {
+		Sim_Pin_Level[Pin] = false;
+	}
+	for(unsigned int Address = 0; Address < SIM_EEPROM_SIZE; Address++) {
+		Sim_EEPROM[Address] = 0xFF;
+	}
+	Sim_Random_State = seed;
+	return;
+}
+
+bool simLoadEEPROM(const char* path) {
+	FILE* File = fopen(path, "rb");
+	if(File == NULL) {
+		return false;
+	}
+	bool Success = (fread(Sim_EEPROM, 1, SIM_EEPROM_SIZE, File) == SIM_EEPROM_SIZE);
+	fclose(File);
+	return Success;
+}
+
+void simLinkHostSend(const byte* data, unsigned int length) {
+	// A byte sent while the line is idle starts arriving now; otherwise it follows the one before it
+	if(Sim_Link_Rx_Count == 0) {
+		Sim_Link_Rx_Next = (Sim_Cycles + Sim_Link_Byte_Cycles);
+	}
+	for(unsigned int Index = 0; Index < length; Index++) {
+		if(Sim_Link_Rx_Count == SIM_LINK_RX_QUEUE) {
+			Sim_Link_Lost += (length - Index);
+			break;
+		}
+		Sim_Link_Rx_Queue[(Sim_Link_Rx_Head + Sim_Link_Rx_Count) % SIM_LINK_RX_QUEUE] = data[Index];
+		Sim_Link_Rx_Count += 1;
+	}
+	return;
+}
+
+unsigned long simLinkLost() {
+	return Sim_Link_Lost;
+}
+
+unsigned long simLinkConflicts() {
+	return Sim_Link_Conflicts;
+}
+
+bool simSaveEEPROM(const char* path) {
+	FILE* File = fopen(path, "wb");
+	if(File == NULL) {
+		return false;
+	}
+	bool Success = (fwrite(Sim_EEPROM, 1, SIM_EEPROM_SIZE, File) == SIM_EEPROM_SIZE);
+	fclose(File);
+	return Success;
+}
+
+
+/////////////////////////
+// ARDUINO CORE
+/////////////////////////
+
+unsigned long millis() {
+	simCountOp(SIM_OP_MILLIS, SIM_COST_MILLIS);
+	return simMillis();
+}
+
+unsigned long micros() {
+	simCountOp(SIM_OP_MILLIS, SIM_COST_MICROS);
+	return(Sim_Cycles / (SIM_CPU_HZ / 1000000));
+}
+
+void delay(unsigned long ms) {
+	simConsume(ms * SIM_CYCLES_PER_MS);
+	return;
+}
+
+void delayMicroseconds(unsigned int us) {
+	simConsume(us * (SIM_CPU_HZ / 1000000));
+	return;
+}
+
+void noInterrupts() {
+	Sim_Interrupts_Deferred = true;
+	return;
+}
+
+void interrupts() {
+	Sim_Interrupts_Deferred = false;
+	simConsume(0);
+	return;
+}
+
+sim_sreg SREG;
+
+sim_sreg::operator byte() const {
+	return(Sim_Interrupts_Deferred ? 0x00 : 0x80);
+}
+
+sim_sreg& sim_sreg::operator=(byte value) {
+	if(value & 0x80) {
+		interrupts();
+	}
+	else {
+		noInterrupts();
+	}
+	return *this;
+}
+
+long random(long howbig) {
+	if(howbig <= 0) {
+		return 0;
+	}
+	Sim_Random_State = (Sim_Random_State * 1103515245UL) + 12345UL;
+	return((long)((Sim_Random_State >> 8) & 0x7FFFFF) % howbig);
+}
+
+long random(long howsmall, long howbig) {
+	if(howsmall >= howbig) {
+		return howsmall;
+	}
+	return(random(howbig - howsmall) + howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+	Sim_Random_State = seed;
+	return;
+}
+
+
+/////////////////////////
+// HAL BACKEND
+/////////////////////////
+
+void halHostPinMode(byte pin, byte mode) {
+	simCountOp(SIM_OP_PIN_MODE, SIM_COST_PIN_MODE);
+	if((mode == INPUT_PULLUP) && (pin < 20)) {
+		Sim_Pin_Level[pin] = true;
+	}
+	return;
+}
+
+bool halHostDigitalRead(byte pin) {
+	simCountOp(SIM_OP_PIN_READ, SIM_COST_PIN_READ);
+	if(pin == SIM_PIN_BUTTON) {
+		return !simInputEngaged(SIM_BUTTON);
+	}
+	for(byte Endstop = 0; Endstop < 6; Endstop++) {
+		if(pin == SIM_PIN_ENDSTOP[Endstop]) {
+			return !simInputEngaged((sim_input)(SIM_ENDSTOP_1 + Endstop));
+		}
+	}
+	return((pin < 20) ? Sim_Pin_Level[pin] : false);
+}
+
+void halHostDigitalWrite(byte pin, bool level) {
+	simCountOp(SIM_OP_PIN_WRITE, SIM_COST_PIN_WRITE);
+	if(pin >= 20) {
+		return;
+	}
+	Sim_Pin_Level[pin] = level;
+
+	if((pin == SIM_PIN_SPI_SCLK) || (pin == SIM_PIN_SPI_MOSI) || (pin == SIM_PIN_SPI_SS)) {
+		simIsdPins(Sim_Pin_Level[SIM_PIN_SPI_SCLK], Sim_Pin_Level[SIM_PIN_SPI_MOSI], Sim_Pin_Level[SIM_PIN_SPI_SS]);
+	}
+	else if(pin == SIM_PIN_LED) {
+		simSetLed(level);
+	}
+	else {
+		for(byte Motor = 0; Motor < 3; Motor++) {
+			if(pin == SIM_PIN_MOTOR_DIR[Motor]) {
+				simSetMotorDirLevel(Motor, level);
+			}
+		}
+	}
+	return;
+}
+
+byte halReadInputPorts() {
+	simCountOp(SIM_OP_PORT_READ, SIM_COST_PORT_READ);
+	return simInputLevels();
+}
+
+void halInitSystemTick() {
+	Sim_Tick_Enabled = true;
+	Sim_Next_Tick = (Sim_Cycles + SIM_CYCLES_PER_TICK);
+	Sim_Pin_Change_Wake = true;
+	Sim_Input_Levels = simInputLevels();
+	return;
+}
+
+void halStartSystemTick() {
+	if(!Sim_Tick_Enabled) {
+		// Timer0 kept counting, so the next compare match keeps its original phase
+		if(Sim_Next_Tick <= Sim_Cycles) {
+			Sim_Next_Tick += ((((Sim_Cycles - Sim_Next_Tick) / SIM_CYCLES_PER_TICK) + 1) * SIM_CYCLES_PER_TICK);
+		}
+		Sim_Tick_Enabled = true;
+	}
+	return;
+}
+
+void halStopSystemTick() {
+	Sim_Tick_Enabled = false;
+	return;
+}
+
+void halStartWatchdogTick() {
+	// The watchdog counter restarts with each change of mode, so the first period is a full one
+	if(!Sim_Watchdog_Enabled) {
+		Sim_Watchdog_Enabled = true;
+		Sim_Next_Watchdog = (Sim_Cycles + SIM_CYCLES_PER_WATCHDOG);
+	}
+	return;
+}
+
+void halStopWatchdogTick() {
+	Sim_Watchdog_Enabled = false;
+	return;
+}
+
+void halSleep() {
+	simCountOp(SIM_OP_SLEEP, SIM_COST_SLEEP);
+	Sim_Interrupts_Deferred = false;
+
+	// Wake on the next system tick, EEPROM, watchdog, or USART interrupt, or on the next millis() interrupt
+	// (modelled once per plant step)
+	unsigned long long Wake = Sim_Next_Step;
+	if(Sim_Tick_Enabled && (Sim_Next_Tick < Wake)) {
+		Wake = Sim_Next_Tick;
+	}
+	if(Sim_Eeprom_Interrupt && (Sim_Eeprom_Ready < Wake)) {
+		Wake = Sim_Eeprom_Ready;
+	}
+	if(Sim_Watchdog_Enabled && (Sim_Next_Watchdog < Wake)) {
+		Wake = Sim_Next_Watchdog;
+	}
+	if(Sim_Link_Enabled && (Sim_Link_Rx_Count > 0) && (Sim_Link_Rx_Next < Wake)) {
+		Wake = Sim_Link_Rx_Next;
+	}
+	if(Sim_Link_Enabled && Sim_Link_Tx_Interrupt && (Sim_Link_Udr_Free < Wake)) {
+		Wake = Sim_Link_Udr_Free;
+	}
+	if(Wake > Sim_Cycles) {
+		Sim_Sleep_Cycles += (Wake - Sim_Cycles);
+		simConsume(Wake - Sim_Cycles);
+	}
+	else {
+		simConsume(0);
+	}
+	return;
+}
+
+uint16_t halReadTimestamp() {
+	simCountOp(SIM_OP_TIMESTAMP, SIM_COST_TIMESTAMP);
+	return((Sim_Cycles / 64) & 0xFFFF);
+}
+
+void halHostSpiSelect(bool selected) {
+	simConsume(SIM_COST_SPI_SELECT);
+
+	// The USART overrides SCLK and MOSI while enabled, so the ISD1700 would see link traffic instead
+	if(selected && Sim_Link_Enabled) {
+		Sim_Link_Conflicts += 1;
+	}
+	Sim_Pin_Level[SIM_PIN_SPI_SS] = !selected;
+	simIsdPins(Sim_Pin_Level[SIM_PIN_SPI_SCLK], Sim_Pin_Level[SIM_PIN_SPI_MOSI], Sim_Pin_Level[SIM_PIN_SPI_SS]);
+	return;
+}
+
+byte halHostSpiShiftByte(byte transmission) {
+	byte Reception = 0;
+	simCountOp(SIM_OP_SPI_BYTE, SIM_COST_SPI_BYTE);
+	for(byte Bit = 0; Bit < 8; Bit++) {
+		Sim_Pin_Level[SIM_PIN_SPI_SCLK] = false;
+		Sim_Pin_Level[SIM_PIN_SPI_MOSI] = ((transmission >> Bit) & 0x01);
+		simIsdPins(false, Sim_Pin_Level[SIM_PIN_SPI_MOSI], Sim_Pin_Level[SIM_PIN_SPI_SS]);
+		if(simIsdMiso()) {
+			Reception |= (1 << Bit);
+		}
+		Sim_Pin_Level[SIM_PIN_SPI_SCLK] = true;
+		simIsdPins(true, Sim_Pin_Level[SIM_PIN_SPI_MOSI], Sim_Pin_Level[SIM_PIN_SPI_SS]);
+	}
+	return Reception;
+}
+
+void halInitSpiInput() {
+	simConsume(SIM_COST_SPI_INPUT);
+	return;
+}
+
+void halInitPWM(pwm_carrier carrier) {
+	simCountOp(SIM_OP_PWM_WRITE, (4 * SIM_COST_PWM_WRITE));
+	return;
+}
+
+void halSetPWM(pwm_channel channel, uint8_t pwm) {
+	simCountOp(SIM_OP_PWM_WRITE, SIM_COST_PWM_WRITE);
+	simSetOutputPWM(SIM_PWM_OUTPUT[channel], pwm);
+	return;
+}
+
+void halSetDrive(pwm_channel channel, uint8_t pwm, byte dir_pin, bool dir_level) {
+	simCountOp(SIM_OP_PWM_WRITE, SIM_COST_DRIVE_WRITE);
+	if(dir_pin < 20) {
+		Sim_Pin_Level[dir_pin] = dir_level;
+	}
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		if(dir_pin == SIM_PIN_MOTOR_DIR[Motor]) {
+			simSetMotorDirLevel(Motor, dir_level);
+		}
+	}
+	simSetOutputPWM(SIM_PWM_OUTPUT[channel], pwm);
+	return;
+}
+
+byte halEepromRead(uint16_t address) {
+	simCountOp(SIM_OP_EEPROM_READ, SIM_COST_EEPROM_READ);
+	return Sim_EEPROM[address % SIM_EEPROM_SIZE];
+}
+
+void halEepromWrite(uint16_t address, byte value) {
+	simCountOp(SIM_OP_EEPROM_WRITE, SIM_COST_EEPROM_WRITE);
+	Sim_EEPROM[address % SIM_EEPROM_SIZE] = value;
+	return;
+}
+
+void halEepromUpdate(uint16_t address, byte value) {
+	if(halEepromRead(address) != value) {
+		halEepromWrite(address, value);
+	}
+	return;
+}
+
+void halEepromWriteAsync(uint16_t address, byte value) {
+	simCountOp(SIM_OP_EEPROM_WRITE, SIM_COST_EEPROM_START);
+	Sim_EEPROM[address % SIM_EEPROM_SIZE] = value;
+	Sim_Eeprom_Ready = (Sim_Cycles + SIM_COST_EEPROM_WRITE);
+	return;
+}
+
+void halEepromReadyInterrupt(bool enabled) {
+	Sim_Eeprom_Interrupt = enabled;
+	return;
+}
+
+void halInitLink(unsigned long baud) {
+	simConsume(4 * SIM_COST_LINK_CONTROL);
+	Sim_Link_Byte_Cycles = ((SIM_CPU_HZ * 10) / baud);
+	Sim_Link_Enabled = true;
+	Sim_Link_Tx_Interrupt = false;
+	return;
+}
+
+void halLinkEnable(bool enabled) {
+	simConsume(SIM_COST_LINK_CONTROL);
+
+	// Disabling the transmitter cuts short the byte being sent
+	if(!enabled && Sim_Link_Enabled && (Sim_Cycles < Sim_Link_Shift_End)) {
+		Sim_Link_Conflicts += 1;
+	}
+	Sim_Link_Enabled = enabled;
+	if(!enabled) {
+		Sim_Link_Tx_Interrupt = false;
+	}
+	return;
+}
+
+void halLinkTransmitInterrupt(bool enabled) {
+	simConsume(SIM_COST_LINK_CONTROL);
+	Sim_Link_Tx_Interrupt = enabled;
+	return;
+}
+
+void halLinkWrite(byte data) {
+	simCountOp(SIM_OP_LINK_BYTE, SIM_COST_LINK_BYTE);
+
+	// The byte waits in UDR0 until the shift register is free
+	unsigned long long Start = ((Sim_Link_Shift_End > Sim_Cycles) ? Sim_Link_Shift_End : Sim_Cycles);
+	Sim_Link_Udr_Free = Start;
+	Sim_Link_Shift_End = (Start + Sim_Link_Byte_Cycles);
+	simLinkHostReceive(data);
+	return;
+}
+
+bool halLinkIdle() {
+	simConsume(SIM_COST_LINK_CONTROL);
+	return(Sim_Cycles >= Sim_Link_Shift_End);
+}
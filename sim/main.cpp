@@ -0,0 +1,1121 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/wait.h>
+#include <util/crc16.h>
+#include "sim.h"
+
+/////////////////////////
+// SCENARIO DEFINITIONS
+/////////////////////////
+
+typedef enum {
+	PHASE_BOOT,  // Times are relative to power-up
+	PHASE_LOOP   // Times are relative to normal operation beginning, once calibration ends
+} sim_phase;
+
+typedef struct {
+	const char* name;
+	const char* description;
+	const sim_event* boot_events;
+	const sim_event* loop_events;
+} sim_scenario;
+
+const unsigned long SIM_MAX_BOOT_TIME = 300000;
+
+// Diagnostic link requests, matching EWMC-Firmware.h
+const byte SIM_LINK_FRAME_MAX = 32;
+const byte SIM_LINK_CORRUPT = 0x00;  // Not a request; sends a frame with a bad CRC instead
+const byte SIM_LINK_STATE = 0x01;
+const byte SIM_LINK_CALIBRATION = 0x02;
+const byte SIM_LINK_LIMITS = 0x03;
+const byte SIM_LINK_TIMING = 0x04;
+const byte SIM_LINK_ERRORS = 0x05;
+const byte SIM_LINK_STATS = 0x06;
+const byte SIM_LINK_HEALTH = 0x07;
+const byte SIM_LINK_CLEAR_ERRORS = 0x10;
+const byte SIM_LINK_RECALIBRATE = 0x11;
+const byte SIM_LINK_REPLY = 0x80;
+const byte SIM_LINK_NAK = 0x7F;
+
+// Staff walk through the full calibration routine described in the Firmware documentation
+const sim_event STAFF_CALIBRATION[] = {
+	{500, ACTION_HAND, 1, 1}, {900, ACTION_HAND, 1, 0},
+	{1500, ACTION_HAND, 2, 1}, {1900, ACTION_HAND, 2, 0},
+	{2800, ACTION_HAND, 3, 1}, {3200, ACTION_HAND, 3, 0},
+	{3800, ACTION_HAND, 4, 1}, {4200, ACTION_HAND, 4, 0},
+	{5100, ACTION_HAND, 5, 1}, {5500, ACTION_HAND, 5, 0},
+	{6100, ACTION_HAND, 6, 1}, {6500, ACTION_HAND, 6, 0},
+	{7400, ACTION_BUTTON, 0, 1}, {7700, ACTION_BUTTON, 0, 0},
+	{0, ACTION_END, 0, 0}
+};
+
+// Staff abort calibration with the arcade button while the elevator's double beep is playing
+const sim_event STAFF_ABORT[] = {
+	{500, ACTION_HAND, 1, 1}, {900, ACTION_HAND, 1, 0},
+	{1500, ACTION_HAND, 2, 1}, {1520, ACTION_HAND, 2, 0},
+	{1550, ACTION_BUTTON, 0, 1}, {1700, ACTION_BUTTON, 0, 0},
+	{0, ACTION_END, 0, 0}
+};
+
+// Staff skip calibration straight away, keeping the saved calibration data
+// With valid calibration data, the press falls during the startup self-test and is ignored
+const sim_event STAFF_SKIP[] = {
+	{500, ACTION_BUTTON, 0, 1}, {700, ACTION_BUTTON, 0, 0},
+	{0, ACTION_END, 0, 0}
+};
+
+const sim_event LOOP_SHORT[] = {
+	{5000, ACTION_END, 0, 0}
+};
+
+const sim_event LOOP_IDLE[] = {
+	{30000, ACTION_END, 0, 0}
+};
+
+const sim_event LOOP_CYCLING[] = {
+	{1000, ACTION_BUTTON, 0, 1},
+	{61000, ACTION_BUTTON, 0, 0},
+	{70000, ACTION_END, 0, 0}
+};
+
+const sim_event LOOP_ENDSTOP_FAULT[] = {
+	{0, ACTION_FAULT, 3, SIM_ENDSTOP_BROKEN},
+	{1000, ACTION_BUTTON, 0, 1},
+	{61000, ACTION_BUTTON, 0, 0},
+	{65000, ACTION_END, 0, 0}
+};
+
+const sim_event LOOP_CRITICAL[] = {
+	{1000, ACTION_BUTTON, 0, 1},
+	{10000, ACTION_FAULT, 1, SIM_ENDSTOP_STUCK},
+	{10000, ACTION_FAULT, 2, SIM_ENDSTOP_STUCK},
+	{20000, ACTION_END, 0, 0}
+};
+
+// The elevator wears partway through, slowing to 90% of its calibrated speed
+const sim_event LOOP_ENDURANCE[] = {
+	{1000, ACTION_BUTTON, 0, 1},
+	{300000, ACTION_DRAG, 0, 90},
+	{600000, ACTION_BUTTON, 0, 0},
+	{610000, ACTION_END, 0, 0}
+};
+
+// Staff enter calibration with the arcade button pattern partway through cycling, clear every
+// endstop by hand, then recalibrate
+const sim_event LOOP_RECALIBRATE[] = {
+	{1000, ACTION_BUTTON, 0, 1}, {4500, ACTION_BUTTON, 0, 0},
+	{5000, ACTION_BUTTON, 0, 1}, {8500, ACTION_BUTTON, 0, 0},
+	{9000, ACTION_BUTTON, 0, 1}, {12500, ACTION_BUTTON, 0, 0},
+	{13000, ACTION_PUSH, 0, 50}, {13000, ACTION_PUSH, 1, 50}, {13000, ACTION_PUSH, 2, 50},
+	{13500, ACTION_HAND, 1, 1}, {13900, ACTION_HAND, 1, 0},
+	{14500, ACTION_HAND, 2, 1}, {14900, ACTION_HAND, 2, 0},
+	{15800, ACTION_HAND, 3, 1}, {16200, ACTION_HAND, 3, 0},
+	{16800, ACTION_HAND, 4, 1}, {17200, ACTION_HAND, 4, 0},
+	{18100, ACTION_HAND, 5, 1}, {18500, ACTION_HAND, 5, 0},
+	{19100, ACTION_HAND, 6, 1}, {19500, ACTION_HAND, 6, 0},
+	{20400, ACTION_BUTTON, 0, 1}, {20700, ACTION_BUTTON, 0, 0},
+	{90000, ACTION_END, 0, 0}
+};
+
+// Cycling with the mine cart's rear endstop broken, while a host polls the state over the link and
+// sends every other request, including invalid ones and a burst too large for the transmit buffer
+const sim_event LOOP_TELEMETRY[] = {
+	{0, ACTION_FAULT, 3, SIM_ENDSTOP_BROKEN},
+	{0, ACTION_POLL, SIM_LINK_STATE, 1},
+	{1000, ACTION_BUTTON, 0, 1},
+	{2000, ACTION_LINK, SIM_LINK_CALIBRATION, 0},
+	{2100, ACTION_LINK, SIM_LINK_LIMITS, 0},
+	{2200, ACTION_LINK, SIM_LINK_LIMITS, 1},
+	{2300, ACTION_LINK, SIM_LINK_LIMITS, 2},
+	{2400, ACTION_LINK, SIM_LINK_LIMITS, 3},
+	{30000, ACTION_LINK, SIM_LINK_ERRORS, 0},
+	{30100, ACTION_LINK, SIM_LINK_CLEAR_ERRORS, 0},
+	{30200, ACTION_LINK, SIM_LINK_ERRORS, 0},
+	{40000, ACTION_LINK, SIM_LINK_CORRUPT, 0},
+	{40100, ACTION_LINK, 0x20, 0},
+	{50000, ACTION_LINK, SIM_LINK_TIMING, 0}, {50000, ACTION_LINK, SIM_LINK_TIMING, 1},
+	{50000, ACTION_LINK, SIM_LINK_TIMING, 2}, {50000, ACTION_LINK, SIM_LINK_TIMING, 3},
+	{60000, ACTION_LINK, SIM_LINK_HEALTH, 0},
+	{60100, ACTION_LINK, SIM_LINK_HEALTH, 1},
+	{60200, ACTION_LINK, SIM_LINK_HEALTH, 2},
+	{60300, ACTION_LINK, SIM_LINK_HEALTH, 3},
+	{61000, ACTION_BUTTON, 0, 0},
+	{64000, ACTION_LINK, SIM_LINK_STATS, 0},
+	{65000, ACTION_END, 0, 0}
+};
+
+const sim_scenario SIM_SCENARIOS[] = {
+	{"calibration", "Full staff calibration, then a short idle period", STAFF_CALIBRATION, LOOP_SHORT},
+	{"calibration-abort", "Calibration aborted during feedback beeps on a blank EEPROM", STAFF_ABORT, LOOP_SHORT},
+	{"idle", "Calibration, then 30 s with nobody at the arcade button", STAFF_CALIBRATION, LOOP_IDLE},
+	{"cycling", "Calibration, then the arcade button held for 60 s", STAFF_CALIBRATION, LOOP_CYCLING},
+	{"endstop-fault", "Cycling with the mine cart's rear endstop broken", STAFF_CALIBRATION, LOOP_ENDSTOP_FAULT},
+	{"critical", "Cycling until both elevator endstops stick engaged", STAFF_CALIBRATION, LOOP_CRITICAL},
+	{"resume", "Startup self-test and cycling with --eeprom-in data; otherwise calibration skipped and halts", STAFF_SKIP, LOOP_CYCLING},
+	{"endurance", "Calibration, then 10 min of cycling as the elevator wears", STAFF_CALIBRATION, LOOP_ENDURANCE},
+	{"recalibrate", "Cycling, then calibration entered with the button pattern and run again", STAFF_CALIBRATION, LOOP_RECALIBRATE},
+	{"telemetry", "Endstop fault cycling, queried and polled over the diagnostic link", STAFF_CALIBRATION, LOOP_TELEMETRY}
+};
+const byte SIM_SCENARIO_COUNT = (sizeof(SIM_SCENARIOS) / sizeof(SIM_SCENARIOS[0]));
+
+const char* const SIM_MOTOR_NAME[3] = {"elevator", "cart", "loader"};
+const char* const SIM_TASK_NAME[] = {"motors", "audio", "calibration", "link"};
+const char* const SIM_PROFILE_NAME[] = {"loop", "sample", "elevator", "cart", "loader", "audio", "calibration", "link", "tick", "errors"};
+const char* const SIM_MOTOR_STATE_NAME[SIM_MOTOR_STATES] = {
+	"INIT",
+	"IDLE",
+	"MOVE_START",
+	"MOVE",
+	"MOVE_END",
+	"DELAY_PRE_CHANGE",
+	"DELAY_POST_CHANGE",
+	"SAFETY_REVERSE_ENDSTOP_FAIL",
+	"SAFETY_REVERSE_ENDSTOP_EARLY",
+	"FAULTED"
+};
+const char* const SIM_CLIP_NAME[] = {"beep", "explosion", "canary", "cough 1", "cough 2"};
+
+// Chi-squared critical values at a significance of 0.001, for 1 to 7 degrees of freedom
+const double SIM_CHI_SQUARED_LIMIT[] = {10.83, 13.82, 16.27, 18.47, 20.52, 22.46, 24.32};
+const char* const SIM_SNAPSHOT_NAME[7] = {"E6", "E5", "E4", "E3", "E2", "E1", "button"};  // Indexed by snapshot bit
+
+
+/////////////////////////
+// SCENARIO STATE
+/////////////////////////
+
+const sim_scenario* Scenario;
+sim_phase Phase = PHASE_BOOT;
+unsigned long Phase_Start = 0;
+const sim_event* Next_Event;
+
+// Diagnostic link host
+int Link_Pty = -1;                 // Pseudo-terminal master, if --link was given
+double Link_Pty_Start = 0;         // Host time at power-up, for pacing to real time
+byte Link_Poll_Type = 0;
+unsigned long Link_Poll_Period = 0;
+unsigned long Link_Poll_Next = 0;
+byte Link_Host_Frame[SIM_LINK_FRAME_MAX + 8];
+unsigned int Link_Host_Length = 0;
+unsigned long Link_Host_Requests = 0;
+unsigned long Link_Host_Replies = 0;
+unsigned long Link_Host_Naks = 0;
+unsigned long Link_Host_Bad = 0;
+byte Link_Last_State[SIM_LINK_FRAME_MAX];
+unsigned int Link_Last_State_Length = 0;
+
+void sendLinkRequest(byte type, byte argument);
+void serviceLinkPty();
+
+void simStepScenario() {
+	unsigned long Now = (simMillis() - Phase_Start);
+
+	if(Link_Pty >= 0) {
+		serviceLinkPty();
+	}
+
+	if((Phase == PHASE_BOOT) && (Now >= SIM_MAX_BOOT_TIME)) {
+		throw sim_stop();
+	}
+	simMonitorSafety();
+
+	while((Next_Event->action != ACTION_END) && (Next_Event->time <= Now)) {
+		switch(Next_Event->action) {
+			case ACTION_BUTTON:
+				simSetButton(Next_Event->value);
+				break;
+			case ACTION_HAND:
+				simSetHand((sim_input)Next_Event->target, Next_Event->value);
+				break;
+			case ACTION_FAULT:
+				simSetEndstopFault((sim_input)Next_Event->target, (sim_endstop_fault)Next_Event->value);
+				break;
+			case ACTION_DRAG:
+				simSetMotorDrag(Next_Event->target, Next_Event->value);
+				break;
+			case ACTION_PUSH:
+				simPushMotor(Next_Event->target, Next_Event->value);
+				break;
+			case ACTION_LINK:
+				sendLinkRequest(Next_Event->target, Next_Event->value);
+				break;
+			case ACTION_POLL:
+				Link_Poll_Type = Next_Event->target;
+				Link_Poll_Period = (Next_Event->value * 100UL);
+				Link_Poll_Next = Now;
+				break;
+			default:
+				break;
+		}
+		Next_Event++;
+	}
+
+	if((Link_Poll_Period > 0) && (Now >= Link_Poll_Next)) {
+		sendLinkRequest(Link_Poll_Type, 0);
+		Link_Poll_Next += Link_Poll_Period;
+	}
+
+	if((Phase == PHASE_LOOP) && (Next_Event->action == ACTION_END) && (Next_Event->time <= Now)) {
+		throw sim_stop();
+	}
+	return;
+}
+
+void writeStdout(char character) {
+	putchar(character);
+	return;
+}
+
+
+/////////////////////////
+// TRACE DECODING
+/////////////////////////
+
+byte Trace_Dump[SIM_TRACE_LENGTH];
+unsigned int Trace_Dump_Length = 0;
+
+void writeTraceDump(byte data) {
+	if(Trace_Dump_Length < SIM_TRACE_LENGTH) {
+		Trace_Dump[Trace_Dump_Length++] = data;
+	}
+	return;
+}
+
+void printInputs(const char* prefix, byte inputs) {
+	for(byte Bit = 7; Bit > 0; Bit--) {
+		if(inputs & (1 << (Bit - 1))) {
+			printf(" %s%s", prefix, SIM_SNAPSHOT_NAME[Bit - 1]);
+		}
+	}
+	return;
+}
+
+bool traceValid(const byte trace[SIM_TRACE_LENGTH]) {
+	uint16_t CRC = 0xFFFF;
+	for(unsigned int Index = 0; Index < (SIM_TRACE_LENGTH - 2); Index++) {
+		CRC = _crc_ccitt_update(CRC, trace[Index]);
+	}
+	return((trace[0] == SIM_TRACE_VERSION) && (trace[1] <= SIM_TRACE_RECORDS) && (trace[2] < SIM_TRACE_RECORDS) &&
+		(CRC == (trace[SIM_TRACE_LENGTH - 2] | (trace[SIM_TRACE_LENGTH - 1] << 8))));
+}
+
+byte simTraceRecords(const byte trace[SIM_TRACE_LENGTH], sim_trace_record records[SIM_TRACE_RECORDS]) {
+	// Records are read oldest first, each epoch record supplying the upper bits of those after it
+	byte Count = trace[1];
+	byte Oldest = ((Count < SIM_TRACE_RECORDS) ? 0 : trace[2]);
+	unsigned long Epoch = (trace[3] | (trace[4] << 8));
+	byte Decoded = 0;
+	for(byte Record = 0; Record < Count; Record++) {
+		const byte* Data = &trace[SIM_TRACE_HEADER_LENGTH + (((Oldest + Record) % SIM_TRACE_RECORDS) * 4)];
+		uint16_t Time = (Data[2] | (Data[3] << 8));
+		if((Data[0] >> 4) == 1) {
+			Epoch = Time;
+			continue;
+		}
+		records[Decoded].time = ((Epoch << 16) | Time);
+		records[Decoded].type = (Data[0] >> 4);
+		records[Decoded].subject = (Data[0] & 0x0F);
+		records[Decoded].value = Data[1];
+		Decoded++;
+	}
+	return Decoded;
+}
+
+bool decodeTrace(const byte trace[SIM_TRACE_LENGTH]) {
+	if(!traceValid(trace)) {
+		printf("  no valid trace (version or CRC mismatch)\n");
+		return false;
+	}
+
+	sim_trace_record Records[SIM_TRACE_RECORDS];
+	byte Count = simTraceRecords(trace, Records);
+	byte Inputs = 0;
+	bool Inputs_Known = false;
+	for(byte Record = 0; Record < Count; Record++) {
+		byte Subject = Records[Record].subject;
+		byte Value = Records[Record].value;
+		printf("  %10.3f s  ", (Records[Record].time / 1000.0));
+		switch(Records[Record].type) {
+			case 2:
+				printf("%-8s %s\n", ((Subject < 3) ? SIM_MOTOR_NAME[Subject] : "?"),
+					((Value < SIM_MOTOR_STATES) ? SIM_MOTOR_STATE_NAME[Value] : "?"));
+				break;
+			case 3:
+				printf("inputs   engaged:");
+				printInputs("", Value);
+				if(Value == 0) {
+					printf(" none");
+				}
+				if(Inputs_Known) {
+					printf(" (");
+					printInputs("+", (Value & ~Inputs));
+					printInputs("-", (Inputs & ~Value));
+					printf(" )");
+				}
+				printf("\n");
+				Inputs = Value;
+				Inputs_Known = true;
+				break;
+			case 4:
+				printf("audio    %s, volume %u\n", ((Value < (sizeof(SIM_CLIP_NAME) / sizeof(SIM_CLIP_NAME[0]))) ? SIM_CLIP_NAME[Value] : "?"), Subject);
+				break;
+			case 5:
+				printf("error    %u\n", Value);
+				break;
+			default:
+				printf("unknown record %X %02X\n", Records[Record].type, Value);
+				break;
+		}
+	}
+	return true;
+}
+
+bool readTraceImage(const char* path, byte trace[SIM_TRACE_LENGTH]) {
+	byte Image[SIM_EEPROM_SIZE];
+	FILE* File = fopen(path, "rb");
+	if(File == NULL) {
+		fprintf(stderr, "Unable to read trace %s\n", path);
+		return false;
+	}
+	size_t Length = fread(Image, 1, sizeof(Image), File);
+	fclose(File);
+
+	// Either an EEPROM image holding a saved trace, or a trace written by dumpTrace()
+	if(Length == SIM_EEPROM_SIZE) {
+		memcpy(trace, &Image[simTraceAddress()], SIM_TRACE_LENGTH);
+	}
+	else if(Length == SIM_TRACE_LENGTH) {
+		memcpy(trace, Image, SIM_TRACE_LENGTH);
+	}
+	else {
+		fprintf(stderr, "%s is neither an EEPROM image nor a trace dump\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool simReadTraceFile(const char* path, byte trace[SIM_TRACE_LENGTH]) {
+	return(readTraceImage(path, trace) && traceValid(trace));
+}
+
+int decodeTraceFile(const char* path) {
+	byte Trace[SIM_TRACE_LENGTH];
+	if(!readTraceImage(path, Trace)) {
+		return 1;
+	}
+	printf("trace: %s\n", path);
+	return(decodeTrace(Trace) ? 0 : 1);
+}
+
+bool checkAmbientDraws(byte eligible, unsigned long draws) {
+	unsigned long Count[8] = {0};
+	unsigned int Total = 0;
+	byte Weighted = 0;
+	for(byte Clip = 0; Clip < simAudioClips(); Clip++) {
+		if((eligible & (1 << Clip)) && (simAmbientWeight(Clip) > 0)) {
+			Total += simAmbientWeight(Clip);
+			Weighted += 1;
+		}
+	}
+
+	bool Valid = true;
+	for(unsigned long Draw = 0; Draw < draws; Draw++) {
+		byte Clip = simDrawAmbientClip(eligible);
+		if((Clip >= simAudioClips()) || !(eligible & (1 << Clip)) || (simAmbientWeight(Clip) == 0)) {
+			Valid = false;
+			continue;
+		}
+		Count[Clip] += 1;
+	}
+
+	// Pearson's chi-squared test against the weights, failing only below a significance of 0.001
+	double Chi_Squared = 0;
+	printf("  eligible 0x%02X:", eligible);
+	for(byte Clip = 0; Clip < simAudioClips(); Clip++) {
+		if(!(eligible & (1 << Clip)) || (simAmbientWeight(Clip) == 0)) {
+			continue;
+		}
+		double Expected = ((double) draws * simAmbientWeight(Clip) / Total);
+		Chi_Squared += (((Count[Clip] - Expected) * (Count[Clip] - Expected)) / Expected);
+		printf(" %s %.1f%% (%.1f%%)", SIM_CLIP_NAME[Clip], (100.0 * Count[Clip] / draws), (100.0 * simAmbientWeight(Clip) / Total));
+		if(Count[Clip] == 0) {
+			Valid = false;
+		}
+	}
+	bool Fair = ((Weighted < 2) || (Chi_Squared < SIM_CHI_SQUARED_LIMIT[Weighted - 2]));
+	printf(", chi-squared %.2f, %s\n", Chi_Squared, ((Valid && Fair) ? "fair" : "UNFAIR"));
+	return(Valid && Fair);
+}
+
+int checkAmbientFairness(unsigned long seed, unsigned long draws) {
+	simInitHardware(seed);
+
+	// Every weighted clip, then with each one left out as the history would
+	byte All = 0;
+	for(byte Clip = 0; Clip < simAudioClips(); Clip++) {
+		if(simAmbientWeight(Clip) > 0) {
+			All |= (1 << Clip);
+		}
+	}
+	printf("ambient clip fairness over %lu draws:\n", draws);
+	bool Fair = checkAmbientDraws(All, draws);
+	for(byte Clip = 0; Clip < simAudioClips(); Clip++) {
+		if(All & (1 << Clip)) {
+			if(!checkAmbientDraws((All & ~(1 << Clip)), draws)) {
+				Fair = false;
+			}
+		}
+	}
+	if(simDrawAmbientClip(0) != simAudioClips()) {
+		printf("  a clip was picked with none eligible\n");
+		Fair = false;
+	}
+	return(Fair ? 0 : 1);
+}
+
+int checkThresholds() {
+	simInitHardware(1);
+	bool Valid = true;
+
+	// Every time, against every factor a calibration record can hold and every trimmed slowdown
+	printf("fixed-point thresholds against exact integer math:\n");
+	unsigned long Checked = 0;
+	unsigned long Exact = 0;
+	long Worst = 0;
+	for(unsigned int Per_Mille = 0; Per_Mille <= 2550; Per_Mille++) {
+		if((Per_Mille > 1000) && ((Per_Mille % 10) != 0)) {
+			continue;
+		}
+		for(unsigned long Time = 0; Time <= 0xFFFF; Time++) {
+			long Error = ((long) simScaleTime(Time, Per_Mille) - (long)((Time * Per_Mille) / 1000));
+			long Excess = (labs(Error) - (long)(1 + (Time >> SIM_SCALE_SHIFT)));
+			if(Excess > Worst) {
+				Worst = Excess;
+				printf("  %lu ms at %u.%u%%: %ld ms out\n", Time, (Per_Mille / 10), (Per_Mille % 10), Error);
+			}
+			Exact += (Error == 0);
+			Checked += 1;
+		}
+	}
+	printf("  %lu times checked, %.2f%% exact, %s\n", Checked, (100.0 * Exact / Checked), ((Worst == 0) ? "all within 1 + time / 2^14 ms" : "OUT OF BOUNDS"));
+	if(Worst > 0) {
+		Valid = false;
+	}
+
+	// Saved trims never restore a later slowdown, and one more would (unless both restore the same one)
+	const unsigned int REF_TIMES[] = {100, 101, 500, 999, 1000, 1001, 2047, 2048, 4000, 6000, 9999, 10000, 16383, 16384, 32767, 50000, 65535};
+	const byte FACTORS[] = {80, 90, 97, 100};
+	unsigned long Trips = 0;
+	unsigned long Failed = 0;
+	for(byte Ref = 0; Ref < (sizeof(REF_TIMES) / sizeof(REF_TIMES[0])); Ref++) {
+		for(byte Factor = 0; Factor < sizeof(FACTORS); Factor++) {
+			unsigned long Step = ((REF_TIMES[Ref] / 2000) + 1);
+			for(unsigned long Travel = (REF_TIMES[Ref] / 2); (Travel <= 0xFFFF) && (Travel <= (REF_TIMES[Ref] * 3UL / 2)); Travel += Step) {
+				unsigned int Slowdown;
+				int Trim;
+				unsigned long Restored;
+				unsigned long Next;
+				simAdaptSlowdown(REF_TIMES[Ref], FACTORS[Factor], Travel, &Slowdown, &Trim, &Restored, &Next);
+				if((Restored > Slowdown) || ((Next <= Slowdown) && (Next != Restored))) {
+					if(Failed == 0) {
+						printf("  reference %u ms at %u%%, trip %lu ms: slowdown %u ms saved as trim %d, restored as %lu ms (%lu ms)\n", REF_TIMES[Ref], FACTORS[Factor], Travel, Slowdown, Trim, Restored, Next);
+					}
+					Failed += 1;
+				}
+				Trips += 1;
+			}
+		}
+	}
+	printf("  %lu adapted slowdowns checked, %lu saved trims wrong\n", Trips, Failed);
+	if(Failed > 0) {
+		Valid = false;
+	}
+	return(Valid ? 0 : 1);
+}
+
+double hostSeconds() {
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return(Time.tv_sec + (Time.tv_nsec / 1e9));
+}
+
+
+/////////////////////////
+// DIAGNOSTIC LINK HOST
+/////////////////////////
+
+void sendLinkRequest(byte type, byte argument) {
+	byte Payload[5] = {type, argument};
+	byte Length = 2;
+	uint16_t CRC = 0xFFFF;
+	for(byte Index = 0; Index < Length; Index++) {
+		CRC = _crc_ccitt_update(CRC, Payload[Index]);
+	}
+	if(type == SIM_LINK_CORRUPT) {
+		CRC ^= 0x0001;
+	}
+	Payload[Length++] = (CRC & 0xFF);
+	Payload[Length++] = (CRC >> 8);
+
+	// COBS: each zero is replaced by the distance to the next, starting from a code byte before the frame
+	byte Encoded[8];
+	byte Encoded_Length = 1;
+	byte Code_Index = 0;
+	for(byte Index = 0; Index < Length; Index++) {
+		if(Payload[Index] == 0x00) {
+			Encoded[Code_Index] = (Encoded_Length - Code_Index);
+			Code_Index = Encoded_Length++;
+		}
+		else {
+			Encoded[Encoded_Length++] = Payload[Index];
+		}
+	}
+	Encoded[Code_Index] = (Encoded_Length - Code_Index);
+	Encoded[Encoded_Length++] = 0x00;
+
+	simLinkHostSend(Encoded, Encoded_Length);
+	Link_Host_Requests += 1;
+	return;
+}
+
+const char* linkRequestName(byte type) {
+	switch(type) {
+		case SIM_LINK_STATE: return "state";
+		case SIM_LINK_CALIBRATION: return "calibration";
+		case SIM_LINK_LIMITS: return "limits";
+		case SIM_LINK_TIMING: return "timing";
+		case SIM_LINK_ERRORS: return "errors";
+		case SIM_LINK_STATS: return "link stats";
+		case SIM_LINK_HEALTH: return "health";
+		case SIM_LINK_CLEAR_ERRORS: return "clear errors";
+		case SIM_LINK_RECALIBRATE: return "recalibrate";
+		default: return "unknown";
+	}
+}
+
+void handleLinkReply(const byte* frame, unsigned int length) {
+	// The state is polled, so only the latest reply is kept for the report
+	if(frame[0] == (SIM_LINK_STATE | SIM_LINK_REPLY)) {
+		memcpy(Link_Last_State, frame, length);
+		Link_Last_State_Length = length;
+		Link_Host_Replies += 1;
+		return;
+	}
+
+	printf("  link %10.3f s  ", (simMillis() / 1000.0));
+	if((frame[0] == SIM_LINK_NAK) && (length == 3)) {
+		Link_Host_Naks += 1;
+		printf("NAK of %s (0x%02X), reason %u\n", linkRequestName(frame[1]), frame[1], frame[2]);
+		return;
+	}
+	Link_Host_Replies += 1;
+	printf("%-12s", linkRequestName(frame[0] & ~SIM_LINK_REPLY));
+	for(unsigned int Index = 1; Index < length; Index++) {
+		printf(" %02X", frame[Index]);
+	}
+	printf("\n");
+	return;
+}
+
+void simLinkHostReceive(byte data) {
+	if(Link_Pty >= 0) {
+		// Bytes are dropped while nothing is reading the pseudo-terminal
+		if(write(Link_Pty, &data, 1) < 0) {
+			return;
+		}
+		return;
+	}
+
+	if(data != 0x00) {
+		if(Link_Host_Length < sizeof(Link_Host_Frame)) {
+			Link_Host_Frame[Link_Host_Length] = data;
+		}
+		Link_Host_Length += 1;
+		return;
+	}
+
+	// Decode the frame in place, then check its length and CRC
+	unsigned int Read = 0;
+	unsigned int Write = 0;
+	bool Valid = ((Link_Host_Length > 0) && (Link_Host_Length <= sizeof(Link_Host_Frame)));
+	while(Valid && (Read < Link_Host_Length)) {
+		byte Code = Link_Host_Frame[Read++];
+		for(byte Count = 1; Count < Code; Count++) {
+			if(Read >= Link_Host_Length) {
+				Valid = false;
+				break;
+			}
+			Link_Host_Frame[Write++] = Link_Host_Frame[Read++];
+		}
+		if((Code < 0xFF) && (Read < Link_Host_Length)) {
+			Link_Host_Frame[Write++] = 0x00;
+		}
+	}
+	Link_Host_Length = 0;
+	if(!Valid || (Write < 3)) {
+		Link_Host_Bad += 1;
+		return;
+	}
+	uint16_t CRC = 0xFFFF;
+	for(unsigned int Index = 0; Index < (Write - 2); Index++) {
+		CRC = _crc_ccitt_update(CRC, Link_Host_Frame[Index]);
+	}
+	if(CRC != (Link_Host_Frame[Write - 2] | (Link_Host_Frame[Write - 1] << 8))) {
+		Link_Host_Bad += 1;
+		return;
+	}
+	handleLinkReply(Link_Host_Frame, (Write - 2));
+	return;
+}
+
+bool openLinkPty() {
+	Link_Pty = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if((Link_Pty < 0) || (grantpt(Link_Pty) != 0) || (unlockpt(Link_Pty) != 0)) {
+		return false;
+	}
+
+	// The slave end is switched to raw mode, and held open so the master keeps working while no host is connected
+	const char* Name = ptsname(Link_Pty);
+	int Slave = ((Name != NULL) ? open(Name, O_RDWR | O_NOCTTY) : -1);
+	struct termios Settings;
+	if((Slave < 0) || (tcgetattr(Slave, &Settings) != 0)) {
+		return false;
+	}
+	cfmakeraw(&Settings);
+	tcsetattr(Slave, TCSANOW, &Settings);
+	printf("link: %s\n", Name);
+	return true;
+}
+
+void serviceLinkPty() {
+	// Simulated time is held back to real time, so a host sees the firmware's real timing
+	double Ahead = ((simMillis() / 1000.0) - (hostSeconds() - Link_Pty_Start));
+	if(Ahead > 0.001) {
+		usleep(Ahead * 1e6);
+	}
+
+	byte Buffer[64];
+	ssize_t Length = read(Link_Pty, Buffer, sizeof(Buffer));
+	if(Length > 0) {
+		simLinkHostSend(Buffer, Length);
+	}
+	return;
+}
+
+void printLinkState(const byte* state, unsigned int length) {
+	if(length != 13) {
+		printf("  link state: unexpected length %u\n", length);
+		return;
+	}
+	unsigned long Time = (state[1] | (state[2] << 8) | ((unsigned long)state[3] << 16) | ((unsigned long)state[4] << 24));
+	printf("  link state at %.3f s:", (Time / 1000.0));
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		printf(" %s %s,", SIM_MOTOR_NAME[Motor],
+			((state[5 + Motor] < (sizeof(SIM_MOTOR_STATE_NAME) / sizeof(SIM_MOTOR_STATE_NAME[0]))) ? SIM_MOTOR_STATE_NAME[state[5 + Motor]] : "?"));
+	}
+	printf(" calibration state %u, engaged:", state[8]);
+	printInputs("", state[9]);
+	printf("%s, error mask 0x%04X, flags 0x%02X\n", ((state[9] == 0) ? " none" : ""), (state[10] | (state[11] << 8)), state[12]);
+	return;
+}
+
+
+/////////////////////////
+// BASELINE COMPARISON
+/////////////////////////
+
+bool readBaseline(const char* path, const char* name, double* iterations_per_second, double* cycles_per_iteration, double* awake_percent) {
+	FILE* File = fopen(path, "r");
+	if(File == NULL) {
+		return false;
+	}
+
+	char Line[256];
+	bool Found = false;
+	while(fgets(Line, sizeof(Line), File) != NULL) {
+		char Name[64];
+		double IPS;
+		double CPI;
+		double Awake = 100;  // Baselines recorded before idle sleep have no awake percentage
+		if((sscanf(Line, "BENCH %63s %lf %lf %lf", Name, &IPS, &CPI, &Awake) >= 3) && (strcmp(Name, name) == 0)) {
+			*iterations_per_second = IPS;
+			*cycles_per_iteration = CPI;
+			*awake_percent = Awake;
+			Found = true;
+		}
+	}
+	fclose(File);
+	return Found;
+}
+
+
+/////////////////////////
+// SCENARIO EXECUTION
+/////////////////////////
+
+int runScenario(const sim_scenario* scenario, unsigned long seed, const char* eeprom_in, const char* eeprom_out, const char* baseline, bool trace) {
+	Scenario = scenario;
+	Phase = PHASE_BOOT;
+	Phase_Start = 0;
+	Next_Event = scenario->boot_events;
+	Link_Pty_Start = hostSeconds();
+
+	simInitHardware(seed);
+	simInitPlant();
+	if((eeprom_in != NULL) && !simLoadEEPROM(eeprom_in)) {
+		fprintf(stderr, "Unable to read EEPROM image %s\n", eeprom_in);
+		return 1;
+	}
+
+	printf("scenario: %s (%s)\n", scenario->name, scenario->description);
+
+	// Calibration runs from loop(), but is kept out of the benchmark
+	try {
+		simFirmwareSetup();
+		while(simCalibrating()) {
+			simFirmwareLoop();
+		}
+	}
+	catch(sim_stop&) {
+		printf("  calibration did not end within %.1f s\n", (SIM_MAX_BOOT_TIME / 1000.0));
+		return 1;
+	}
+
+	Phase = PHASE_LOOP;
+	Phase_Start = simMillis();
+	Next_Event = scenario->loop_events;
+	printf("  calibration ended after %.3f s\n", (Phase_Start / 1000.0));
+
+	unsigned long long Start_Cycles = simCycles();
+	unsigned long long Start_Sleep = simSleepCycles();
+	unsigned long Start_Ops[SIM_OP_COUNT];
+	unsigned long Start_Arrivals[3];
+	for(byte Op = 0; Op < SIM_OP_COUNT; Op++) {
+		Start_Ops[Op] = simOpCount((sim_op)Op);
+	}
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		Start_Arrivals[Motor] = simMotorArrivals(Motor);
+	}
+	unsigned long Start_Clips = simIsdClipsPlayed(0);
+	unsigned long Start_Relay[4];
+	simRelayStats(&Start_Relay[0], &Start_Relay[1], &Start_Relay[2], &Start_Relay[3]);
+
+	unsigned long long Iterations = 0;
+	double Host_Start = hostSeconds();
+	try {
+		while(true) {
+			simFirmwareLoop();
+			Iterations++;
+		}
+	}
+	catch(sim_stop&) {
+		// Scenario complete
+	}
+	double Host_Elapsed = (hostSeconds() - Host_Start);
+
+	// Time spent asleep is not counted against each iteration
+	double Sim_Elapsed = ((simMillis() - Phase_Start) / 1000.0);
+	unsigned long long Elapsed_Cycles = (simCycles() - Start_Cycles);
+	unsigned long long Awake_Cycles = (Elapsed_Cycles - (simSleepCycles() - Start_Sleep));
+	double Cycles_Per_Iteration = ((Iterations > 0) ? ((double)Awake_Cycles / Iterations) : 0);
+	double Iterations_Per_Second = ((Sim_Elapsed > 0) ? (Iterations / Sim_Elapsed) : 0);
+	double Awake_Percent = ((Elapsed_Cycles > 0) ? ((100.0 * Awake_Cycles) / Elapsed_Cycles) : 100);
+
+	printf("  loop(): %llu iterations in %.3f s simulated = %.0f iterations/s\n", Iterations, Sim_Elapsed, Iterations_Per_Second);
+	printf("  cost per iteration: %.1f modelled cycles (%.2f us @ 16 MHz), %.0f ns host\n",
+		Cycles_Per_Iteration, (Cycles_Per_Iteration / (SIM_CPU_HZ / 1e6)), ((Iterations > 0) ? ((Host_Elapsed * 1e9) / Iterations) : 0));
+	printf("  awake: %.2f%% of simulated time\n", Awake_Percent);
+
+	const char* const Op_Name[SIM_OP_COUNT] = {"loop", "interrupt", "millis", "timestamp", "pinMode", "pinRead", "pinWrite", "portRead", "pwm", "spiByte", "sleep", "eepromRead", "eepromWrite", "linkByte"};
+	printf("  hardware accesses per iteration:");
+	for(byte Op = 0; Op < SIM_OP_COUNT; Op++) {
+		unsigned long Count = (simOpCount((sim_op)Op) - Start_Ops[Op]);
+		if((Count > 0) && (Iterations > 0)) {
+			printf(" %s %.2f", Op_Name[Op], ((double)Count / Iterations));
+		}
+	}
+	printf("\n");
+
+	printf("  %-11s %8s %10s %8s %8s %9s\n", "task", "runs", "total us", "avg us", "max us", "overruns");
+	for(byte Task = 0; Task < simTasks(); Task++) {
+		unsigned long Runs;
+		unsigned long Time;
+		unsigned int Max_Time;
+		unsigned long Overruns;
+		simTaskStats(Task, &Runs, &Time, &Max_Time, &Overruns);
+		printf("  %-11s %8lu %10lu %8.1f %8u %9lu\n", SIM_TASK_NAME[Task], Runs, Time, ((Runs > 0) ? ((double)Time / Runs) : 0), Max_Time, Overruns);
+	}
+
+	if(simProfileSections() > 0) {
+		printf("  %-11s %8s %8s %8s %8s  %s\n", "section", "passes", "min us", "avg us", "max us", "log2 histogram (ticks)");
+		for(byte Section = 0; Section < simProfileSections(); Section++) {
+			unsigned long Count;
+			unsigned int Min;
+			unsigned long Total;
+			unsigned int Max;
+			unsigned int Histogram[SIM_PROFILE_BINS];
+			simProfileStats(Section, &Count, &Min, &Total, &Max, Histogram);
+			printf("  %-11s %8lu %8u %8.1f %8u ", SIM_PROFILE_NAME[Section], Count, (Min * SIM_PROFILE_TICK_US),
+				((Count > 0) ? (((double)Total * SIM_PROFILE_TICK_US) / Count) : 0), (Max * SIM_PROFILE_TICK_US));
+			for(byte Bin = 0; Bin < SIM_PROFILE_BINS; Bin++) {
+				printf(" %u", Histogram[Bin]);
+			}
+			printf("\n");
+		}
+		simDumpProfile(writeStdout);
+	}
+
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		unsigned int Slowdown[2];
+		unsigned int Timeout[2];
+		simMotorLimits(Motor, false, &Slowdown[0], &Timeout[0]);
+		simMotorLimits(Motor, true, &Slowdown[1], &Timeout[1]);
+		printf("  %-8s %4lu arrivals, final state %s, slowdown %u/%u ms, timeout %u/%u ms\n", SIM_MOTOR_NAME[Motor],
+			(simMotorArrivals(Motor) - Start_Arrivals[Motor]), SIM_MOTOR_STATE_NAME[simMotorState(Motor)],
+			Slowdown[0], Slowdown[1], Timeout[0], Timeout[1]);
+	}
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		unsigned int Trips[2];
+		unsigned int Mean[2];
+		unsigned long Variance[2];
+		unsigned int Shortest[2];
+		unsigned int Longest[2];
+		unsigned int Faults;
+		unsigned long Relay_Switches;
+		simMotorHealth(Motor, false, &Trips[0], &Mean[0], &Variance[0], &Shortest[0], &Longest[0]);
+		simMotorHealth(Motor, true, &Trips[1], &Mean[1], &Variance[1], &Shortest[1], &Longest[1]);
+		simMotorHealthCounts(Motor, &Faults, &Relay_Switches);
+		printf("  %-8s health: %u/%u trips, mean %u/%u ms, sd %.1f/%.1f ms, range %u-%u/%u-%u ms, %u faults, %lu relay switches\n", SIM_MOTOR_NAME[Motor],
+			Trips[0], Trips[1], Mean[0], Mean[1], sqrt((double)Variance[0]), sqrt((double)Variance[1]),
+			Shortest[0], Longest[0], Shortest[1], Longest[1], Faults, Relay_Switches);
+	}
+	unsigned long Relay[4];
+	simRelayStats(&Relay[0], &Relay[1], &Relay[2], &Relay[3]);
+	printf("  relays: %lu direction changes, %lu within %u ms of another motor's; %lu motor starts, %lu within %u ms of another motor's\n",
+		(Relay[0] - Start_Relay[0]), (Relay[1] - Start_Relay[1]), SIM_RELAY_WINDOW,
+		(Relay[2] - Start_Relay[2]), (Relay[3] - Start_Relay[3]), SIM_RELAY_WINDOW);
+	printf("  audio: %lu clips started (%lu total), %lu ISD commands, %lu malformed, %lu status reads\n",
+		(simIsdClipsPlayed(0) - Start_Clips), simIsdClipsPlayed(0), simIsdCommands(), simIsdMalformed(), simIsdStatusReads());
+
+	printf("  errors:");
+	bool Any_Error = false;
+	for(byte Error = 1; Error <= simErrorCodes(); Error++) {
+		if(simErrorFlagged(Error)) {
+			printf(" %u", Error);
+			Any_Error = true;
+		}
+	}
+	printf("%s (%lu LED blinks)\n", (Any_Error ? "" : " none"), simLedBlinks());
+	simPrintSafety();
+
+	unsigned int Received;
+	unsigned int Rejected;
+	unsigned int Sent;
+	unsigned int Dropped;
+	simLinkStats(&Received, &Rejected, &Sent, &Dropped);
+	printf("  link: %lu requests, %lu replies, %lu NAKs, %lu bad frames, %lu bytes lost, %lu pin conflicts; firmware received %u, rejected %u, sent %u, dropped %u\n",
+		Link_Host_Requests, Link_Host_Replies, Link_Host_Naks, Link_Host_Bad, simLinkLost(), simLinkConflicts(), Received, Rejected, Sent, Dropped);
+	if(Link_Last_State_Length > 0) {
+		printLinkState(Link_Last_State, Link_Last_State_Length);
+	}
+
+	Trace_Dump_Length = 0;
+	simDumpTrace(writeTraceDump);
+	printf("  trace: %u records held, %s\n", Trace_Dump[1], (simTraceFrozen() ? "frozen" : "recording"));
+	if(trace) {
+		decodeTrace(Trace_Dump);
+	}
+
+	if(baseline != NULL) {
+		double Base_IPS;
+		double Base_CPI;
+		double Base_Awake;
+		if(readBaseline(baseline, scenario->name, &Base_IPS, &Base_CPI, &Base_Awake)) {
+			printf("  vs baseline: iterations/s %+.1f%%, cycles/iteration %+.1f%%, awake %+.2f points\n",
+				(((Iterations_Per_Second / Base_IPS) - 1) * 100), (((Cycles_Per_Iteration / Base_CPI) - 1) * 100), (Awake_Percent - Base_Awake));
+		}
+	}
+	printf("BENCH %s %.1f %.1f %.2f\n", scenario->name, Iterations_Per_Second, Cycles_Per_Iteration, Awake_Percent);
+
+	if((eeprom_out != NULL) && !simSaveEEPROM(eeprom_out)) {
+		fprintf(stderr, "Unable to write EEPROM image %s\n", eeprom_out);
+		return 1;
+	}
+	return((simSafetyViolations() > 0) ? 1 : 0);
+}
+
+bool simCalibrate(unsigned long seed) {
+	Scenario = NULL;
+	Phase = PHASE_BOOT;
+	Phase_Start = 0;
+	Next_Event = STAFF_CALIBRATION;
+
+	simInitHardware(seed);
+	simInitPlant();
+	try {
+		simFirmwareSetup();
+		while(simCalibrating()) {
+			simFirmwareLoop();
+		}
+	}
+	catch(sim_stop&) {
+		return false;
+	}
+	return true;
+}
+
+unsigned long long simRunEvents(const sim_event events[]) {
+	Phase = PHASE_LOOP;
+	Phase_Start = simMillis();
+	Next_Event = events;
+
+	unsigned long long Iterations = 0;
+	try {
+		while(true) {
+			simFirmwareLoop();
+			Iterations++;
+		}
+	}
+	catch(sim_stop&) {
+		// Events complete
+	}
+	return Iterations;
+}
+
+void printUsage(const char* program) {
+	printf("Usage: %s [options] [scenario...]\n", program);
+	printf("  --list             List available scenarios\n");
+	printf("  --seed N           Seed for random() (default 1)\n");
+	printf("  --eeprom-in FILE   Load the EEPROM image before power-up\n");
+	printf("  --eeprom-out FILE  Save the EEPROM image once the scenario ends\n");
+	printf("  --baseline FILE    Compare against BENCH lines from a previous run\n");
+	printf("  --trace            Replay each scenario's motion trace once it ends\n");
+	printf("  --trace-in FILE    Replay the motion trace in an EEPROM image or trace dump, then exit\n");
+	printf("  --link             Connect the diagnostic link to a pseudo-terminal, running in real time\n");
+	printf("  --isd-miso         Wire the ISD1700's MISO line to A6, so its status can be read back\n");
+	printf("  --ambient N        Check N weighted random picks of ambient clips against their weights, then exit\n");
+	printf("  --thresholds       Check the fixed-point threshold math against exact integer math, then exit\n");
+	printf("  --fuzz N           Run N random event sequences, checking the safety invariants, then exit\n");
+	printf("  --case-out FILE    Save the first failing --fuzz case\n");
+	printf("  --replay FILE      Replay a case file, or the inputs of a motion trace, checking the safety invariants, then exit\n");
+	printf("With no scenario given, every scenario is run.\n");
+	return;
+}
+
+int main(int argc, char** argv) {
+	unsigned long Seed = 1;
+	const char* EEPROM_In = NULL;
+	const char* EEPROM_Out = NULL;
+	const char* Baseline = NULL;
+	bool Trace = false;
+	unsigned long Fuzz_Cases = 0;
+	const char* Case_Out = NULL;
+	const char* Replay = NULL;
+	const sim_scenario* Selected[SIM_SCENARIO_COUNT];
+	byte Selected_Count = 0;
+
+	for(int Arg = 1; Arg < argc; Arg++) {
+		if(strcmp(argv[Arg], "--list") == 0) {
+			for(byte Index = 0; Index < SIM_SCENARIO_COUNT; Index++) {
+				printf("%-16s %s\n", SIM_SCENARIOS[Index].name, SIM_SCENARIOS[Index].description);
+			}
+			return 0;
+		}
+		else if((strcmp(argv[Arg], "--seed") == 0) && ((Arg + 1) < argc)) {
+			Seed = strtoul(argv[++Arg], NULL, 0);
+		}
+		else if((strcmp(argv[Arg], "--eeprom-in") == 0) && ((Arg + 1) < argc)) {
+			EEPROM_In = argv[++Arg];
+		}
+		else if((strcmp(argv[Arg], "--eeprom-out") == 0) && ((Arg + 1) < argc)) {
+			EEPROM_Out = argv[++Arg];
+		}
+		else if((strcmp(argv[Arg], "--baseline") == 0) && ((Arg + 1) < argc)) {
+			Baseline = argv[++Arg];
+		}
+		else if(strcmp(argv[Arg], "--trace") == 0) {
+			Trace = true;
+		}
+		else if(strcmp(argv[Arg], "--link") == 0) {
+			if(!simLinkEnabled()) {
+				fprintf(stderr, "The Firmware was built without its diagnostic link (LINK=0)\n");
+				return 1;
+			}
+			if(!openLinkPty()) {
+				fprintf(stderr, "Unable to open a pseudo-terminal\n");
+				return 1;
+			}
+		}
+		else if(strcmp(argv[Arg], "--isd-miso") == 0) {
+			simSetIsdMisoWired(true);
+		}
+		else if((strcmp(argv[Arg], "--ambient") == 0) && ((Arg + 1) < argc)) {
+			return checkAmbientFairness(Seed, strtoul(argv[++Arg], NULL, 0));
+		}
+		else if(strcmp(argv[Arg], "--thresholds") == 0) {
+			return checkThresholds();
+		}
+		else if((strcmp(argv[Arg], "--trace-in") == 0) && ((Arg + 1) < argc)) {
+			return decodeTraceFile(argv[++Arg]);
+		}
+		else if((strcmp(argv[Arg], "--fuzz") == 0) && ((Arg + 1) < argc)) {
+			Fuzz_Cases = strtoul(argv[++Arg], NULL, 0);
+		}
+		else if((strcmp(argv[Arg], "--case-out") == 0) && ((Arg + 1) < argc)) {
+			Case_Out = argv[++Arg];
+		}
+		else if((strcmp(argv[Arg], "--replay") == 0) && ((Arg + 1) < argc)) {
+			Replay = argv[++Arg];
+		}
+		else if(argv[Arg][0] == '-') {
+			printUsage(argv[0]);
+			return 1;
+		}
+		else {
+			byte Index = 0;
+			while((Index < SIM_SCENARIO_COUNT) && (strcmp(argv[Arg], SIM_SCENARIOS[Index].name) != 0)) {
+				Index++;
+			}
+			if((Index == SIM_SCENARIO_COUNT) || (Selected_Count == SIM_SCENARIO_COUNT)) {
+				fprintf(stderr, "Unknown scenario %s\n", argv[Arg]);
+				return 1;
+			}
+			Selected[Selected_Count++] = &SIM_SCENARIOS[Index];
+		}
+	}
+	// Both run after every option is read, since they take the seed
+	if(Fuzz_Cases > 0) {
+		return simFuzz(Seed, Fuzz_Cases, Case_Out);
+	}
+	if(Replay != NULL) {
+		return simReplay(Seed, Replay);
+	}
+
+	if(Selected_Count == 0) {
+		for(byte Index = 0; Index < SIM_SCENARIO_COUNT; Index++) {
+			Selected[Selected_Count++] = &SIM_SCENARIOS[Index];
+		}
+	}
+
+	// Each scenario runs in its own process, so firmware globals always start from power-up values
+	int Result = 0;
+	for(byte Index = 0; Index < Selected_Count; Index++) {
+		fflush(stdout);
+		pid_t Child = fork();
+		if(Child == 0) {
+			int Status = runScenario(Selected[Index], Seed, EEPROM_In, EEPROM_Out, Baseline, Trace);
+			fflush(stdout);
+			_exit(Status);
+		}
+		int Status = 1;
+		if((Child < 0) || (waitpid(Child, &Status, 0) < 0) || !WIFEXITED(Status) || (WEXITSTATUS(Status) != 0)) {
+			Result = 1;
+		}
+	}
+	return Result;
+}
@@ -0,0 +1,445 @@
+#include "sim.h"
+
+/////////////////////////
+// PLANT CONFIGURATION
+/////////////////////////
+
+typedef struct {
+	unsigned long travel_time;  // Milliseconds from end to end at the reference duty cycle
+	uint8_t reference_pwm;
+	byte forward_endstop;       // Endstop at the forward end of travel
+	long start_position;
+} sim_motor_config;
+
+const sim_motor_config SIM_MOTOR_CONFIG[3] = {
+	{8000, 64, 1, 300000},
+	{6000, 255, 4, 500000},
+	{5000, 255, 5, 700000}
+};
+
+// ISD1700 commands understood by the mock, along with their expected length in bytes
+const byte SIM_ISD_PU = 0x01;
+const byte SIM_ISD_RD_STATUS = 0x05;
+const byte SIM_ISD_RD_PLAY_PTR = 0x06;
+const byte SIM_ISD_RD_REC_PTR = 0x08;
+const byte SIM_ISD_FWD = 0x48;
+const byte SIM_ISD_CHK_MEM = 0x49;
+const byte SIM_ISD_WR_APC2 = 0x65;
+const byte SIM_ISD_SET_PLAY = 0x80;
+const byte SIM_ISD_MAX_FRAME = 16;
+const byte SIM_ISD_MAX_CLIPS = 16;
+
+// Status register bits
+const byte SIM_ISD_SR0_PU = 0x04;
+const byte SIM_ISD_SR1_RDY = 0x01;
+const byte SIM_ISD_SR1_PLAY = 0x04;
+
+// Message memory, as recorded on the board
+const uint16_t SIM_ISD_MESSAGE_START[] = {0x010, 0x011, 0x028, 0x03F, 0x047};
+const byte SIM_ISD_MESSAGES = (sizeof(SIM_ISD_MESSAGE_START) / sizeof(SIM_ISD_MESSAGE_START[0]));
+const uint16_t SIM_ISD_RECORD_END = 0x050;      // First row after the last message
+const unsigned int SIM_ISD_SEEK_TIME = 5;       // Milliseconds spent busy by FWD and CHK_MEM
+
+
+/////////////////////////
+// PLANT STATE
+/////////////////////////
+
+long Sim_Motor_Position[3];
+bool Sim_Motor_Forward[3];
+unsigned long Sim_Motor_Arrivals[3];
+byte Sim_Motor_Drag[3];              // Percentage of the configured speed, as worn or loaded motors slow down
+uint8_t Sim_Output_PWM[4];
+
+// Direction changes and motor starts, and those within SIM_RELAY_WINDOW of another motor's
+unsigned long Sim_Relay_Change_Time[3];
+unsigned long Sim_Relay_Start_Time[3];
+unsigned long Sim_Relay_Changes;
+unsigned long Sim_Relay_Close_Changes;
+unsigned long Sim_Relay_Starts;
+unsigned long Sim_Relay_Close_Starts;
+
+bool Sim_Button;
+bool Sim_Hand[SIM_INPUTS];
+sim_endstop_fault Sim_Endstop_Fault[SIM_INPUTS];
+
+bool Sim_Led;
+unsigned long Sim_Led_Blinks;
+
+bool Sim_Isd_Sclk = true;
+bool Sim_Isd_Ss = true;
+byte Sim_Isd_Bit;
+byte Sim_Isd_Byte;
+byte Sim_Isd_Frame[SIM_ISD_MAX_FRAME];
+byte Sim_Isd_Frame_Length;
+unsigned long Sim_Isd_Commands;
+unsigned long Sim_Isd_Malformed;
+unsigned long Sim_Isd_Busy_Until;
+uint16_t Sim_Isd_Clip_Ptr[SIM_ISD_MAX_CLIPS];
+unsigned long Sim_Isd_Clip_Count[SIM_ISD_MAX_CLIPS];
+byte Sim_Isd_Clips;
+
+// Replies on MISO, which is only connected to A6 if wired
+bool Sim_Isd_Miso_Wired = false;
+bool Sim_Isd_Miso = true;
+byte Sim_Isd_Reply[SIM_ISD_MAX_FRAME];
+bool Sim_Isd_Powered;
+unsigned long Sim_Isd_Seek_Until;
+uint16_t Sim_Isd_Play_Ptr = 0x010;
+uint16_t Sim_Isd_Rec_Ptr;
+unsigned long Sim_Isd_Status_Reads;
+
+void simInitPlant() {
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		Sim_Motor_Position[Motor] = SIM_MOTOR_CONFIG[Motor].start_position;
+		Sim_Motor_Forward[Motor] = false;
+		Sim_Motor_Arrivals[Motor] = 0;
+		Sim_Motor_Drag[Motor] = 100;
+		Sim_Relay_Change_Time[Motor] = 0;
+		Sim_Relay_Start_Time[Motor] = 0;
+	}
+	Sim_Relay_Changes = 0;
+	Sim_Relay_Close_Changes = 0;
+	Sim_Relay_Starts = 0;
+	Sim_Relay_Close_Starts = 0;
+	for(byte Output = 0; Output < 4; Output++) {
+		Sim_Output_PWM[Output] = 0;
+	}
+	for(byte Input = 0; Input < SIM_INPUTS; Input++) {
+		Sim_Hand[Input] = false;
+		Sim_Endstop_Fault[Input] = SIM_ENDSTOP_OK;
+	}
+	Sim_Button = false;
+	Sim_Led = false;
+	Sim_Led_Blinks = 0;
+	return;
+}
+
+void simStepPlant() {
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		const sim_motor_config* Config = &SIM_MOTOR_CONFIG[Motor];
+		uint8_t PWM = Sim_Output_PWM[Motor];
+		if(PWM == 0) {
+			continue;
+		}
+
+		long Step = ((SIM_TRAVEL * PWM * Sim_Motor_Drag[Motor]) / ((long)Config->travel_time * Config->reference_pwm * 100));
+		long Position = Sim_Motor_Position[Motor] + (Sim_Motor_Forward[Motor] ? Step : -Step);
+		if(Position >= SIM_TRAVEL) {
+			Position = SIM_TRAVEL;
+		}
+		else if(Position <= 0) {
+			Position = 0;
+		}
+		bool Was_Inside = ((Sim_Motor_Position[Motor] > SIM_ENDSTOP_ZONE) && (Sim_Motor_Position[Motor] < (SIM_TRAVEL - SIM_ENDSTOP_ZONE)));
+		bool Is_Inside = ((Position > SIM_ENDSTOP_ZONE) && (Position < (SIM_TRAVEL - SIM_ENDSTOP_ZONE)));
+		if(Was_Inside && !Is_Inside) {
+			Sim_Motor_Arrivals[Motor] += 1;
+		}
+		Sim_Motor_Position[Motor] = Position;
+	}
+	simStepScenario();
+	return;
+}
+
+bool simInputEngaged(sim_input input) {
+	if(input == SIM_BUTTON) {
+		return Sim_Button;
+	}
+	if((input < SIM_ENDSTOP_1) || (input > SIM_ENDSTOP_6)) {
+		return false;
+	}
+	if(Sim_Endstop_Fault[input] == SIM_ENDSTOP_STUCK) {
+		return true;
+	}
+	if(Sim_Endstop_Fault[input] == SIM_ENDSTOP_BROKEN) {
+		return false;
+	}
+	if(Sim_Hand[input]) {
+		return true;
+	}
+
+	byte Motor = ((input - SIM_ENDSTOP_1) / 2);
+	long Position = Sim_Motor_Position[Motor];
+	if(input == SIM_MOTOR_CONFIG[Motor].forward_endstop) {
+		return(Position >= (SIM_TRAVEL - SIM_ENDSTOP_ZONE));
+	}
+	return(Position <= SIM_ENDSTOP_ZONE);
+}
+
+void simSetButton(bool pressed) {
+	Sim_Button = pressed;
+	return;
+}
+
+void simSetHand(sim_input endstop, bool engaged) {
+	Sim_Hand[endstop] = engaged;
+	return;
+}
+
+void simSetEndstopFault(sim_input endstop, sim_endstop_fault fault) {
+	Sim_Endstop_Fault[endstop] = fault;
+	return;
+}
+
+void simSetMotorDrag(byte motor, byte percent) {
+	Sim_Motor_Drag[motor] = percent;
+	return;
+}
+
+void simPushMotor(byte motor, byte percent) {
+	Sim_Motor_Position[motor] = ((SIM_TRAVEL / 100) * percent);
+	return;
+}
+
+void simSetMotorDirLevel(byte motor, bool level) {
+	if(level != Sim_Motor_Forward[motor]) {
+		countRelayEvent(motor, Sim_Relay_Change_Time, &Sim_Relay_Changes, &Sim_Relay_Close_Changes);
+	}
+	Sim_Motor_Forward[motor] = level;
+	return;
+}
+
+void simSetOutputPWM(byte output, uint8_t pwm) {
+	if((output < 3) && (pwm != 0) && (Sim_Output_PWM[output] == 0)) {
+		countRelayEvent(output, Sim_Relay_Start_Time, &Sim_Relay_Starts, &Sim_Relay_Close_Starts);
+	}
+	Sim_Output_PWM[output] = pwm;
+	return;
+}
+
+void simRelayStats(unsigned long* changes, unsigned long* close_changes, unsigned long* starts, unsigned long* close_starts) {
+	*changes = Sim_Relay_Changes;
+	*close_changes = Sim_Relay_Close_Changes;
+	*starts = Sim_Relay_Starts;
+	*close_starts = Sim_Relay_Close_Starts;
+	return;
+}
+
+void countRelayEvent(byte motor, unsigned long times[3], unsigned long* count, unsigned long* close) {
+	unsigned long Now = simMillis();
+	*count += 1;
+	for(byte Other = 0; Other < 3; Other++) {
+		if((Other != motor) && (times[Other] != 0) && ((Now - times[Other]) < SIM_RELAY_WINDOW)) {
+			*close += 1;
+			break;
+		}
+	}
+
+	// Zero marks a motor with no event yet
+	times[motor] = ((Now != 0) ? Now : 1);
+	return;
+}
+
+uint8_t simOutputPWM(byte output) {
+	return Sim_Output_PWM[output];
+}
+
+unsigned long simMotorArrivals(byte motor) {
+	return Sim_Motor_Arrivals[motor];
+}
+
+void simSetLed(bool on) {
+	if(on && !Sim_Led) {
+		Sim_Led_Blinks += 1;
+	}
+	Sim_Led = on;
+	return;
+}
+
+unsigned long simLedBlinks() {
+	return Sim_Led_Blinks;
+}
+
+
+/////////////////////////
+// MOCK ISD1700
+/////////////////////////
+
+void simIsdExecute() {
+	if(Sim_Isd_Frame_Length == 0) {
+		return;
+	}
+
+	byte Expected_Length;
+	switch(Sim_Isd_Frame[0]) {
+		case SIM_ISD_PU:
+		case SIM_ISD_FWD:
+		case SIM_ISD_CHK_MEM:
+			Expected_Length = 2;
+			break;
+		case SIM_ISD_RD_STATUS:
+			Expected_Length = 3;
+			break;
+		case SIM_ISD_RD_PLAY_PTR:
+		case SIM_ISD_RD_REC_PTR:
+			Expected_Length = 4;
+			break;
+		case SIM_ISD_WR_APC2:
+			Expected_Length = 3;
+			break;
+		case SIM_ISD_SET_PLAY:
+			Expected_Length = 7;
+			break;
+		default:
+			Expected_Length = 0;
+			break;
+	}
+	if((Expected_Length == 0) || (Sim_Isd_Frame_Length != Expected_Length) || (Sim_Isd_Bit != 0)) {
+		Sim_Isd_Malformed += 1;
+		return;
+	}
+	Sim_Isd_Commands += 1;
+
+	switch(Sim_Isd_Frame[0]) {
+		case SIM_ISD_PU:
+			Sim_Isd_Powered = true;
+			break;
+		case SIM_ISD_RD_STATUS:
+			Sim_Isd_Status_Reads += 1;
+			break;
+		case SIM_ISD_FWD:
+			// The play pointer moves to the next message, wrapping around after the last
+			{
+				byte Message = 0;
+				while((Message < SIM_ISD_MESSAGES) && (SIM_ISD_MESSAGE_START[Message] <= Sim_Isd_Play_Ptr)) {
+					Message++;
+				}
+				Sim_Isd_Play_Ptr = SIM_ISD_MESSAGE_START[(Message < SIM_ISD_MESSAGES) ? Message : 0];
+			}
+			Sim_Isd_Seek_Until = simMillis() + SIM_ISD_SEEK_TIME;
+			break;
+		case SIM_ISD_CHK_MEM:
+			Sim_Isd_Rec_Ptr = SIM_ISD_RECORD_END;
+			Sim_Isd_Seek_Until = simMillis() + SIM_ISD_SEEK_TIME;
+			break;
+		default:
+			break;
+	}
+
+	if(Sim_Isd_Frame[0] == SIM_ISD_SET_PLAY) {
+		uint16_t Start = (Sim_Isd_Frame[2] | (Sim_Isd_Frame[3] << 8));
+		uint16_t Stop = (Sim_Isd_Frame[4] | (Sim_Isd_Frame[5] << 8));
+		Sim_Isd_Busy_Until = simMillis() + (((Stop >= Start) ? (Stop - Start + 1) : 1) * SIM_ISD_ROW_TIME);
+
+		byte Clip = 0;
+		while((Clip < Sim_Isd_Clips) && (Sim_Isd_Clip_Ptr[Clip] != Start)) {
+			Clip++;
+		}
+		if(Clip < SIM_ISD_MAX_CLIPS) {
+			if(Clip == Sim_Isd_Clips) {
+				Sim_Isd_Clip_Ptr[Clip] = Start;
+				Sim_Isd_Clips += 1;
+			}
+			Sim_Isd_Clip_Count[Clip] += 1;
+		}
+	}
+	return;
+}
+
+void simIsdReply() {
+	// Every reply starts with SR0, and the rest depends on the command in the first byte
+	for(byte Index = 0; Index < SIM_ISD_MAX_FRAME; Index++) {
+		Sim_Isd_Reply[Index] = 0x00;
+	}
+	Sim_Isd_Reply[0] = (Sim_Isd_Powered ? SIM_ISD_SR0_PU : 0x00);
+	if(Sim_Isd_Frame_Length == 0) {
+		return;
+	}
+
+	switch(Sim_Isd_Frame[0]) {
+		case SIM_ISD_RD_STATUS:
+			if(simIsdPlaying()) {
+				Sim_Isd_Reply[2] = SIM_ISD_SR1_PLAY;
+			}
+			else if(simMillis() >= Sim_Isd_Seek_Until) {
+				Sim_Isd_Reply[2] = SIM_ISD_SR1_RDY;
+			}
+			break;
+		case SIM_ISD_RD_PLAY_PTR:
+			Sim_Isd_Reply[2] = (Sim_Isd_Play_Ptr & 0xFF);
+			Sim_Isd_Reply[3] = (Sim_Isd_Play_Ptr >> 8);
+			break;
+		case SIM_ISD_RD_REC_PTR:
+			Sim_Isd_Reply[2] = (Sim_Isd_Rec_Ptr & 0xFF);
+			Sim_Isd_Reply[3] = (Sim_Isd_Rec_Ptr >> 8);
+			break;
+		default:
+			break;
+	}
+	return;
+}
+
+void simIsdPins(bool sclk, bool mosi, bool ss) {
+	if(!ss && Sim_Isd_Ss) {
+		Sim_Isd_Bit = 0;
+		Sim_Isd_Byte = 0;
+		Sim_Isd_Frame_Length = 0;
+		simIsdReply();
+	}
+	else if(ss && !Sim_Isd_Ss) {
+		simIsdExecute();
+	}
+	else if(!ss && !sclk && Sim_Isd_Sclk) {
+		// MISO changes on each falling SCLK edge, for the Firmware to sample before the rising edge
+		byte Index = ((Sim_Isd_Frame_Length < SIM_ISD_MAX_FRAME) ? Sim_Isd_Frame_Length : (SIM_ISD_MAX_FRAME - 1));
+		Sim_Isd_Miso = ((Sim_Isd_Reply[Index] >> Sim_Isd_Bit) & 0x01);
+	}
+	else if(!ss && sclk && !Sim_Isd_Sclk) {
+		Sim_Isd_Byte |= ((mosi ? 1 : 0) << Sim_Isd_Bit);
+		Sim_Isd_Bit += 1;
+		if(Sim_Isd_Bit == 8) {
+			if(Sim_Isd_Frame_Length < SIM_ISD_MAX_FRAME) {
+				Sim_Isd_Frame[Sim_Isd_Frame_Length] = Sim_Isd_Byte;
+				Sim_Isd_Frame_Length += 1;
+				if(Sim_Isd_Frame_Length == 1) {
+					simIsdReply();
+				}
+			}
+			Sim_Isd_Bit = 0;
+			Sim_Isd_Byte = 0;
+		}
+	}
+	Sim_Isd_Sclk = sclk;
+	Sim_Isd_Ss = ss;
+	return;
+}
+
+unsigned long simIsdCommands() {
+	return Sim_Isd_Commands;
+}
+
+unsigned long simIsdClipsPlayed(uint16_t start_ptr) {
+	unsigned long Count = 0;
+	for(byte Clip = 0; Clip < Sim_Isd_Clips; Clip++) {
+		if((start_ptr == 0) || (Sim_Isd_Clip_Ptr[Clip] == start_ptr)) {
+			Count += Sim_Isd_Clip_Count[Clip];
+		}
+	}
+	return Count;
+}
+
+unsigned long simIsdMalformed() {
+	return Sim_Isd_Malformed;
+}
+
+bool simIsdPlaying() {
+	return(simMillis() < Sim_Isd_Busy_Until);
+}
+
+unsigned long simIsdStatusReads() {
+	return Sim_Isd_Status_Reads;
+}
+
+bool simIsdMiso() {
+	// MISO is tri-stated while deselected, and an unconnected A6 reads high
+	if(!Sim_Isd_Miso_Wired || Sim_Isd_Ss) {
+		return true;
+	}
+	return Sim_Isd_Miso;
+}
+
+void simSetIsdMisoWired(bool wired) {
+	Sim_Isd_Miso_Wired = wired;
+	return;
+}
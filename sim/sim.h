@@ -0,0 +1,790 @@
+/* EWMC Simulator
+ *
+ * Internal interface shared by the Linux simulation build
+ *
+ * The simulator is made of four parts:
+ *   - A virtual clock, advanced by the modelled AVR cycle cost of every hardware access
+ *   - A plant model of the coal mine module (motors, endstops, arcade button, LED, ISD1700)
+ *   - The host HAL backend, which maps firmware pin numbers onto the plant
+ *   - A scenario runner, which scripts staff and public interaction and reports loop timing
+ *
+ * The plant is stepped once per simulated millisecond. Because time only advances as the firmware
+ * consumes cycles, blocking firmware code (such as runCalibration()) is simulated faithfully.
+ */
+
+#ifndef sim_h
+#define sim_h
+#include <arduino.h>
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+const unsigned long SIM_CPU_HZ = 16000000;
+const unsigned long SIM_CYCLES_PER_MS = (SIM_CPU_HZ / 1000);
+
+// Modelled AVR cycle cost of each hardware access (Arduino core, 16 MHz)
+// These are approximations used only to compare firmware revisions against each other
+const unsigned int SIM_COST_LOOP_CALL = 12;
+const unsigned int SIM_COST_INTERRUPT = 40;  // Entry, register save/restore, and exit
+const unsigned int SIM_COST_MILLIS = 20;
+const unsigned int SIM_COST_MICROS = 36;
+const unsigned int SIM_COST_TIMESTAMP = 16;
+const unsigned int SIM_COST_PIN_MODE = 4;   // DDRx and PORTx bits, resolved at compile time
+const unsigned int SIM_COST_PIN_READ = 2;   // SBIC
+const unsigned int SIM_COST_PIN_WRITE = 2;  // SBI or CBI
+const unsigned int SIM_COST_PORT_READ = 8;
+const unsigned int SIM_COST_PWM_WRITE = 6;
+const unsigned int SIM_COST_DRIVE_WRITE = 18;  // A port bit and PWM write with interrupts held off
+const unsigned int SIM_COST_SPI_SELECT = 2;
+const unsigned int SIM_COST_SPI_BYTE = 256;  // Eight padded SCLK periods, sampling MISO in each
+const unsigned int SIM_COST_SPI_INPUT = 8;   // Analog comparator and ADC multiplexer setup
+const unsigned int SIM_COST_SLEEP = 12;      // Sleep mode setup, plus the 4 cycle wake-up from idle
+const unsigned int SIM_COST_EEPROM_READ = 12;
+const unsigned long SIM_COST_EEPROM_WRITE = 54400;  // 3.4 ms erase + write
+const unsigned int SIM_COST_EEPROM_START = 10;       // Starting a write without waiting for it
+const unsigned int SIM_COST_LINK_BYTE = 6;      // UDR0 access, plus its status flags
+const unsigned int SIM_COST_LINK_CONTROL = 4;   // UCSR0A or UCSR0B read or bit change
+
+// Plant dimensions
+const long SIM_TRAVEL = 1000000;         // Length of travel between endstops (arbitrary units)
+const long SIM_ENDSTOP_ZONE = 4000;      // Distance from either end within which an endstop engages
+const unsigned int SIM_EEPROM_SIZE = 1024;
+
+// Bytes the host can send ahead of the USART
+const unsigned int SIM_LINK_RX_QUEUE = 256;
+
+// Profiling histogram size, matching PROFILE_BINS, and Timer0 tick length
+const unsigned int SIM_PROFILE_BINS = 12;
+const unsigned int SIM_PROFILE_TICK_US = 4;
+
+// Motion trace layout, matching src/trace.h
+const unsigned int SIM_TRACE_VERSION = 1;
+const unsigned int SIM_TRACE_RECORDS = 60;
+const unsigned int SIM_TRACE_HEADER_LENGTH = 5;
+const unsigned int SIM_TRACE_LENGTH = (SIM_TRACE_HEADER_LENGTH + (SIM_TRACE_RECORDS * 4) + 2);
+
+// Window within which direction changes or motor starts of two motors are reported as together, matching RELAY_STAGGER_DELAY
+const unsigned int SIM_RELAY_WINDOW = 250;
+
+// ISD1700 message memory playback rate
+const unsigned int SIM_ISD_ROW_TIME = 110;  // Milliseconds per memory row
+
+// Firmware values, matching src/motor.h and src/error.h
+const byte SIM_MOTOR_STATES = 10;
+const byte SIM_MOTOR_FAULTED = 9;
+const byte SIM_CRITICAL_ERROR = 10;
+
+// Fixed-point threshold scale, matching ADAPT_SCALE_SHIFT in src/adapt.h
+const byte SIM_SCALE_SHIFT = 14;
+
+// Time a safety invariant may be broken for before it counts as violated, covering the
+// debounce time and the motor task's reaction
+const unsigned int SIM_SAFETY_GRACE_MS = 10;
+
+// Fuzzer case size and corpus
+// Replayed cases may hold up to SIM_CASE_EVENTS, while the fuzzer only grows its own to SIM_FUZZ_EVENTS
+const byte SIM_CASE_EVENTS = 128;
+const byte SIM_FUZZ_EVENTS = 24;
+const unsigned long SIM_FUZZ_CASE_TIME = 30000;  // Milliseconds of normal operation per case
+const unsigned int SIM_FUZZ_CORPUS = 256;
+
+// Normal operation left to run after the last replayed event
+const unsigned long SIM_REPLAY_TAIL = 10000;
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Counted hardware accesses
+typedef enum {
+	SIM_OP_LOOP_CALL,
+	SIM_OP_INTERRUPT,
+	SIM_OP_MILLIS,
+	SIM_OP_TIMESTAMP,
+	SIM_OP_PIN_MODE,
+	SIM_OP_PIN_READ,
+	SIM_OP_PIN_WRITE,
+	SIM_OP_PORT_READ,
+	SIM_OP_PWM_WRITE,
+	SIM_OP_SPI_BYTE,
+	SIM_OP_SLEEP,
+	SIM_OP_EEPROM_READ,
+	SIM_OP_EEPROM_WRITE,
+	SIM_OP_LINK_BYTE,
+	SIM_OP_COUNT
+} sim_op;
+
+// Injectable endstop faults
+typedef enum {
+	SIM_ENDSTOP_OK,
+	SIM_ENDSTOP_BROKEN,  // Never engages
+	SIM_ENDSTOP_STUCK    // Always engaged
+} sim_endstop_fault;
+
+// Simulated inputs, numbered identically to the firmware's sensor_group
+typedef enum {
+	SIM_BUTTON = 0,
+	SIM_ENDSTOP_1 = 1,
+	SIM_ENDSTOP_6 = 6,
+	SIM_INPUTS = 7
+} sim_input;
+
+// Scripted events
+typedef enum {
+	ACTION_BUTTON,  // Press (value = 1) or release (value = 0) the arcade button
+	ACTION_HAND,    // Manually engage (value = 1) or release (value = 0) an endstop
+	ACTION_FAULT,   // Inject an endstop fault (value = sim_endstop_fault)
+	ACTION_DRAG,    // Slow a motor down (target = motor, value = percentage of its configured speed)
+	ACTION_PUSH,    // Move a motor by hand (target = motor, value = percentage of its travel)
+	ACTION_LINK,    // Send a diagnostic link request (target = request type, value = argument)
+	ACTION_POLL,    // Repeat a link request (target = request type, value = period in tenths of a second, 0 = stop)
+	ACTION_END      // End of the event list; in PHASE_LOOP this also ends the scenario
+} sim_action;
+
+// Names used in reports, defined by the scenario runner
+extern const char* const SIM_MOTOR_NAME[3];
+extern const char* const SIM_MOTOR_STATE_NAME[SIM_MOTOR_STATES];
+
+// Safety invariants, checked once per plant step
+typedef enum {
+	SIM_SAFETY_BOTH_ENGAGED,     // No motor powered while both its endstops are engaged
+	SIM_SAFETY_FAULTED,          // No motor powered while FAULTED
+	SIM_SAFETY_MAGNET_FAULTED,   // Magnet never on while the loader is FAULTED
+	SIM_SAFETY_CRITICAL,         // No motor powered once a critical error is flagged
+	SIM_SAFETY_INVARIANTS
+} sim_invariant;
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+typedef struct {
+	unsigned long time;
+	sim_action action;
+	byte target;
+	byte value;
+} sim_event;
+
+// A motion trace record, with its full time since power-up
+typedef struct {
+	unsigned long time;
+	byte type;     // Matching trace_type
+	byte subject;
+	byte value;
+} sim_trace_record;
+
+
+/////////////////////////
+// VIRTUAL CLOCK
+/////////////////////////
+
+void simConsume(unsigned long cycles);
+/*
+ * Advances the virtual clock, stepping the plant once per elapsed millisecond
+ * The system tick interrupt is dispatched every SYSTEM_TICK_US once started, along with the EEPROM
+ * ready and USART interrupts, earliest first.
+ *
+ * INPUT:  Number of AVR cycles consumed
+ */
+
+void simCountOp(sim_op op, unsigned long cycles);
+/*
+ * Records a hardware access and advances the virtual clock by its cost
+ *
+ * INPUT:  Hardware access type
+ *         Number of AVR cycles consumed
+ */
+
+unsigned long long simCycles();
+/*
+ * Gets the number of AVR cycles simulated since power-up
+ *
+ * OUTPUT: Cycle count
+ */
+
+unsigned long simMillis();
+/*
+ * Gets the simulated time without consuming any cycles
+ *
+ * OUTPUT: Simulated milliseconds since power-up
+ */
+
+unsigned long simOpCount(sim_op op);
+/*
+ * Gets the number of hardware accesses of a given type since power-up
+ *
+ * INPUT:  Hardware access type
+ * OUTPUT: Access count
+ */
+
+unsigned long long simSleepCycles();
+/*
+ * Gets the number of AVR cycles spent asleep in halSleep() since power-up
+ *
+ * OUTPUT: Cycle count
+ */
+
+
+/////////////////////////
+// HOST HAL
+/////////////////////////
+
+void simInitHardware(unsigned long seed);
+/*
+ * Resets the MCU's simulated pins and erases the simulated EEPROM
+ *
+ * INPUT:  Seed for random()
+ */
+
+bool simLoadEEPROM(const char* path);
+/*
+ * Loads the simulated EEPROM contents from a file
+ *
+ * INPUT:  File path
+ * OUTPUT: Success
+ */
+
+bool simSaveEEPROM(const char* path);
+/*
+ * Saves the simulated EEPROM contents to a file
+ *
+ * INPUT:  File path
+ * OUTPUT: Success
+ */
+
+byte simInputLevels();
+/*
+ * Gets the pin levels of every input, laid out as returned by halReadInputPorts()
+ * No cycles are consumed
+ *
+ * OUTPUT: Input levels (active-low)
+ */
+
+void simCheckPinChange();
+/*
+ * Raises a pin change interrupt if any input changed since the last check
+ * Called after every plant step
+ */
+
+void simLinkHostSend(const byte* data, unsigned int length);
+/*
+ * Sends bytes from the host to the firmware's USART, one byte time apart
+ * Bytes which finish arriving while the USART is disabled (during an SPI frame) are lost.
+ *
+ * INPUT:  Bytes to send
+ *         Number of bytes
+ */
+
+void simLinkHostReceive(byte data);
+/*
+ * Receives a byte sent by the firmware's USART
+ * Defined by the scenario runner; called as soon as the byte is written to UDR0
+ *
+ * INPUT:  Byte sent
+ */
+
+unsigned long simLinkLost();
+/*
+ * Gets the number of bytes sent by the host which the firmware never received
+ *
+ * OUTPUT: Byte count
+ */
+
+unsigned long simLinkConflicts();
+/*
+ * Gets the number of times the USART and the ISD1700 were given the shared pins at once, either
+ * by selecting the ISD1700 with the USART enabled, or by disabling the USART mid-byte
+ *
+ * OUTPUT: Conflict count (always 0 for correct firmware)
+ */
+
+
+/////////////////////////
+// PLANT MODEL
+/////////////////////////
+
+void simInitPlant();
+/*
+ * Resets the plant to its power-up state
+ *
+ * All motors start part-way along their travel, with no endstops engaged.
+ */
+
+void simStepPlant();
+/*
+ * Advances the plant by one millisecond
+ */
+
+bool simInputEngaged(sim_input input);
+/*
+ * Gets the physical state of an endstop or the arcade button
+ *
+ * INPUT:  Input in question
+ * OUTPUT: State of being engaged
+ */
+
+void simSetButton(bool pressed);
+/*
+ * Presses or releases the arcade button
+ *
+ * INPUT:  State of being pressed
+ */
+
+void simSetHand(sim_input endstop, bool engaged);
+/*
+ * Manually engages or releases an endstop, as staff do during calibration
+ *
+ * INPUT:  Endstop in question
+ *         State of being held engaged
+ */
+
+void simSetEndstopFault(sim_input endstop, sim_endstop_fault fault);
+/*
+ * Injects an endstop fault
+ *
+ * INPUT:  Endstop in question
+ *         Fault to inject
+ */
+
+void simSetMotorDrag(byte motor, byte percent);
+/*
+ * Slows a motor down, as wear or extra load would
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Percentage of the configured speed to run at
+ */
+
+void simPushMotor(byte motor, byte percent);
+/*
+ * Moves a motor along its travel by hand, as staff would to clear its endstops
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Position, as a percentage of the length of travel
+ */
+
+void simSetMotorDirLevel(byte motor, bool level);
+/*
+ * Updates the direction relay of a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Logic level of the direction pin (HIGH = forward)
+ */
+
+void simSetOutputPWM(byte output, uint8_t pwm);
+/*
+ * Updates the duty cycle of a power output
+ *
+ * INPUT:  Power output (0-indexed, matching output_group)
+ *         Duty cycle
+ */
+
+uint8_t simOutputPWM(byte output);
+/*
+ * Gets the duty cycle of a power output
+ *
+ * INPUT:  Power output (0-indexed, matching output_group)
+ * OUTPUT: Duty cycle
+ */
+
+void simRelayStats(unsigned long* changes, unsigned long* close_changes, unsigned long* starts, unsigned long* close_starts);
+/*
+ * Gets the number of motor direction changes and starts (PWM rising from zero) since power-up
+ *
+ * INPUT:  Pointer to the direction change count
+ *         Pointer to the count of those within SIM_RELAY_WINDOW of another motor's
+ *         Pointer to the start count
+ *         Pointer to the count of those within SIM_RELAY_WINDOW of another motor's
+ */
+
+void countRelayEvent(byte motor, unsigned long times[3], unsigned long* count, unsigned long* close);
+/*
+ * Counts a direction change or start, and whether another motor's came within SIM_RELAY_WINDOW
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Time of each motor's last event of the same kind (0 = none)
+ *         Pointer to the event count
+ *         Pointer to the count of close events
+ */
+
+unsigned long simMotorArrivals(byte motor);
+/*
+ * Gets the number of times a motor has driven into either endstop
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: Arrival count
+ */
+
+void simSetLed(bool on);
+/*
+ * Updates the status LED
+ *
+ * INPUT:  State of being lit
+ */
+
+unsigned long simLedBlinks();
+/*
+ * Gets the number of times the status LED has turned on
+ *
+ * OUTPUT: Blink count
+ */
+
+
+/////////////////////////
+// MOCK ISD1700
+/////////////////////////
+
+void simIsdPins(bool sclk, bool mosi, bool ss);
+/*
+ * Updates the ISD1700 SPI lines, decoding commands on each rising SCLK edge, and presenting
+ * replies on each falling SCLK edge
+ *
+ * INPUT:  SCLK level
+ *         MOSI level
+ *         SS level
+ */
+
+unsigned long simIsdCommands();
+/*
+ * Gets the number of complete SPI commands received
+ *
+ * OUTPUT: Command count
+ */
+
+unsigned long simIsdClipsPlayed(uint16_t start_ptr);
+/*
+ * Gets the number of times playback was started at a given message address
+ *
+ * INPUT:  Start address of a message (0 = all messages)
+ * OUTPUT: Playback count
+ */
+
+unsigned long simIsdMalformed();
+/*
+ * Gets the number of SPI commands that did not match their expected length
+ *
+ * OUTPUT: Malformed command count
+ */
+
+bool simIsdPlaying();
+/*
+ * Gets the playback state of the mock ISD1700
+ *
+ * OUTPUT: State of audio playing
+ */
+
+unsigned long simIsdStatusReads();
+/*
+ * Gets the number of RD_STATUS commands received
+ *
+ * OUTPUT: Status read count
+ */
+
+bool simIsdMiso();
+/*
+ * Gets the level of A6, which reads the ISD1700's MISO line if it is wired
+ * Each reply bit is presented on the falling SCLK edge before it is sampled
+ *
+ * OUTPUT: MISO level (high if not wired, or while the ISD1700 is deselected)
+ */
+
+void simSetIsdMisoWired(bool wired);
+/*
+ * Connects or disconnects the ISD1700's MISO line and A6
+ * Must be called before power-up to be seen by the Firmware
+ *
+ * INPUT:  Is MISO wired to A6?
+ */
+
+
+/////////////////////////
+// SCENARIO RUNNER
+/////////////////////////
+
+void simStepScenario();
+/*
+ * Applies any scripted scenario events that are due, after checking the safety invariants
+ * Called by the plant once per simulated millisecond
+ *
+ * Ends the simulation (by throwing sim_stop) once the scenario is complete.
+ */
+
+struct sim_stop {};
+
+bool simCalibrate(unsigned long seed);
+/*
+ * Powers up the firmware and walks through staff calibration, stopping once normal operation begins
+ * Used by the fuzzer and replay, which then run their own events
+ *
+ * INPUT:  Seed for random()
+ * OUTPUT: Did calibration end?
+ */
+
+unsigned long long simRunEvents(const sim_event events[]);
+/*
+ * Runs normal operation through a list of events, relative to the call
+ * Must follow simCalibrate()
+ *
+ * INPUT:  Events, in time order, ending with ACTION_END at the time to stop
+ * OUTPUT: Number of loop() passes run
+ */
+
+bool simReadTraceFile(const char* path, byte trace[SIM_TRACE_LENGTH]);
+/*
+ * Reads the motion trace in an EEPROM image or trace dump, checking its version and CRC
+ *
+ * INPUT:  File path
+ *         Buffer to fill with the trace
+ * OUTPUT: Was a valid trace read?
+ */
+
+byte simTraceRecords(const byte trace[SIM_TRACE_LENGTH], sim_trace_record records[SIM_TRACE_RECORDS]);
+/*
+ * Decodes a valid motion trace, oldest record first, folding epoch records into the times of
+ * those after them
+ *
+ * INPUT:  Trace
+ *         Records to fill
+ * OUTPUT: Number of records, excluding epoch records
+ */
+
+
+/////////////////////////
+// SAFETY FUZZER
+/////////////////////////
+
+void simMonitorSafety();
+/*
+ * Checks every safety invariant against the plant, and records the motor state transitions and
+ * error codes seen, for coverage
+ * Called by simStepScenario() once per plant step
+ */
+
+unsigned long simSafetyViolations();
+/*
+ * Gets the number of times any safety invariant was violated since power-up
+ * An invariant broken for longer than SIM_SAFETY_GRACE_MS counts once, however long it lasts.
+ *
+ * OUTPUT: Violation count
+ */
+
+void simPrintSafety();
+/*
+ * Prints the violation count, along with the first violation
+ */
+
+int simFuzz(unsigned long seed, unsigned long cases, const char* case_out);
+/*
+ * Runs coverage-guided random event sequences against the firmware, checking the safety
+ * invariants, until one is violated or every case has run
+ *
+ * INPUT:  Seed for random() and the fuzzer
+ *         Number of cases to run
+ *         File to write the first failing case to (NULL = none)
+ * OUTPUT: Exit status (0 if no invariant was violated)
+ */
+
+int simReplay(unsigned long seed, const char* path);
+/*
+ * Replays a case file, or the input changes held in a motion trace, checking the safety invariants
+ *
+ * INPUT:  Seed for random()
+ *         Case file, EEPROM image, or trace dump
+ * OUTPUT: Exit status (0 if no invariant was violated)
+ */
+
+
+/////////////////////////
+// FIRMWARE PROBES
+/////////////////////////
+
+void simFirmwareSetup();
+/*
+ * Runs the firmware's setup()
+ */
+
+void simFirmwareLoop();
+/*
+ * Runs a single pass of the firmware's loop()
+ */
+
+bool simCalibrating();
+/*
+ * Determines if the firmware's calibration routine is running (or waiting to start)
+ */
+
+bool simLinkEnabled();
+/*
+ * Determines if the firmware was built with its diagnostic link enabled (see LINK_ENABLED)
+ */
+
+byte simMotorState(byte motor);
+/*
+ * Gets the firmware's state machine state for a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: motor_state value
+ */
+
+void simMotorLimits(byte motor, bool backward, unsigned int* slowdown, unsigned int* timeout);
+/*
+ * Gets the firmware's current slowdown and timeout limits for a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel (true = backward)
+ *         Pointer to the slowdown threshold, in milliseconds
+ *         Pointer to the timeout, in milliseconds
+ */
+
+void simMotorHealth(byte motor, bool backward, unsigned int* trips, unsigned int* mean, unsigned long* variance, unsigned int* shortest, unsigned int* longest);
+/*
+ * Gets the firmware's travel statistics for a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel (true = backward)
+ *         Pointer to the trips recorded
+ *         Pointer to the mean travel time, in milliseconds
+ *         Pointer to the variance, in square milliseconds
+ *         Pointers to the shortest and longest travel time, in milliseconds
+ */
+
+void simMotorHealthCounts(byte motor, unsigned int* faults, unsigned long* relay_switches);
+/*
+ * Gets the firmware's fault and relay switch counts for a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Pointer to the safety reversals and faults counted
+ *         Pointer to the direction relay switches counted
+ */
+
+byte simAudioClips();
+/*
+ * Gets the number of audio clips known to the firmware
+ *
+ * OUTPUT: Clip count
+ */
+
+byte simAmbientWeight(byte clip);
+/*
+ * Gets the weight of an audio clip when ambient clips are picked at random
+ *
+ * INPUT:  Clip (matching audio_clip)
+ * OUTPUT: Weight (0 = never picked)
+ */
+
+byte simDrawAmbientClip(byte eligible);
+/*
+ * Runs the firmware's weighted random pick of an ambient clip
+ *
+ * INPUT:  Eligible clips (bit n = audio_clip n)
+ * OUTPUT: Picked clip (the clip count if none could be picked)
+ */
+
+unsigned long simScaleTime(unsigned int time, unsigned int per_mille);
+/*
+ * Scales a time with the firmware's fixed-point threshold math
+ *
+ * INPUT:  Time in milliseconds
+ *         Factor in tenths of a percent
+ * OUTPUT: Scaled time in milliseconds
+ */
+
+void simAdaptSlowdown(unsigned int ref_time, byte slowdown_factor, unsigned int travel_time, unsigned int* slowdown, int* trim, unsigned long* restored, unsigned long* next);
+/*
+ * Adapts the elevator's forward slowdown to a single trip, from a fresh calibration record
+ * Replaces the firmware's calibration record, so only checks may call this
+ *
+ * INPUT:  Reference travel time in milliseconds
+ *         Slowdown factor as a percentage
+ *         Travel time of the trip in milliseconds
+ *         Pointer to the adapted slowdown threshold
+ *         Pointer to the trim saved for it, in tenths of a percent
+ *         Pointer to the slowdown restored from that trim
+ *         Pointer to the slowdown restored from one tenth of a percent more (0xFFFFFFFF at the largest trim)
+ */
+
+bool simErrorFlagged(byte error);
+/*
+ * Gets whether the firmware has flagged an error code
+ *
+ * INPUT:  Error code (1-indexed)
+ * OUTPUT: State of being flagged
+ */
+
+byte simErrorCodes();
+/*
+ * Gets the number of error codes supported by the firmware
+ *
+ * OUTPUT: Highest error code
+ */
+
+byte simTasks();
+/*
+ * Gets the number of tasks run by the firmware's scheduler
+ *
+ * OUTPUT: Task count
+ */
+
+void simTaskStats(byte task, unsigned long* runs, unsigned long* time_us, unsigned int* max_time_us, unsigned long* overruns);
+/*
+ * Gets the scheduler's statistics for a task since normal operation began
+ *
+ * INPUT:  Task (0-indexed, matching task_id)
+ *         Pointers to the pass count, total time, longest pass, and overrun count
+ */
+
+byte simProfileSections();
+/*
+ * Gets the number of sections measured by the firmware's Profiling module
+ *
+ * OUTPUT: Section count (0 unless built with PROFILE=1)
+ */
+
+void simProfileStats(byte section, unsigned long* count, unsigned int* min, unsigned long* total, unsigned int* max, unsigned int histogram[]);
+/*
+ * Gets the profiling statistics of a section since power-up, in Timer0 ticks
+ *
+ * INPUT:  Section (0-indexed, matching profile_section)
+ *         Pointers to the pass count, shortest pass, total time, and longest pass
+ *         Array of SIM_PROFILE_BINS histogram counts to fill
+ */
+
+void simDumpProfile(void (*write)(char character));
+/*
+ * Writes the firmware's profiling statistics using its own dumpProfile() text format
+ *
+ * INPUT:  Function which writes a single character
+ */
+
+void simDumpTrace(void (*write)(byte data));
+/*
+ * Writes the firmware's motion trace using its own dumpTrace() layout
+ *
+ * INPUT:  Function which writes a single byte
+ */
+
+bool simTraceFrozen();
+/*
+ * Gets whether the firmware has frozen its motion trace
+ *
+ * OUTPUT: State of being frozen
+ */
+
+uint16_t simTraceAddress();
+/*
+ * Gets the EEPROM address of the firmware's saved motion trace
+ *
+ * OUTPUT: EEPROM address
+ */
+
+void simLinkStats(unsigned int* received, unsigned int* rejected, unsigned int* sent, unsigned int* dropped);
+/*
+ * Gets the firmware's diagnostic link frame counts since power-up
+ *
+ * INPUT:  Pointers to the received, rejected, sent, and dropped frame counts
+ */
+
+
+#endif
@@ -0,0 +1,20 @@
+/* CRC Shim
+ *
+ * Stand-in for <util/crc16.h>, used only by the Linux simulation build
+ *
+ * Matches the C equivalent given in the avr-libc documentation, so records checksummed by the
+ * simulation build are valid on the ATmega 328P, and vice versa.
+ */
+
+#ifndef crc16_h
+#define crc16_h
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	data ^= (crc & 0xFF);
+	data ^= (data << 4);
+	return(((((uint16_t) data) << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ (((uint16_t) data) << 3));
+}
+
+
+#endif
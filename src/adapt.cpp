@@ -0,0 +1,159 @@
+#include "adapt.h"
+#include "health.h"
+
+// Calibration data being adapted, owned by the caller of initAdaptation()
+calibration_record* Adapt_Record = NULL;
+motor_limits* Adapt_Limits_Forward = NULL;
+motor_limits* Adapt_Limits_Backward = NULL;
+
+uint16_t Adapt_Timeout_Scale = 0;  // Record's timeout factor, as a fixed-point scale
+
+// Adaptation state, indexed by motor_dir
+unsigned int Adapt_Timeout_Limit[3][2];
+unsigned long Adapt_Ref_Inverse[3][2];  // 1000 * 2^16 / reference travel time (rounded up), or 0 without one
+unsigned long Adapt_Travel[3][2];  // Average travel time scaled by 2^ADAPT_EWMA_SHIFT, or 0 before the first trip
+unsigned int Adapt_Trips = 0;      // Trips taken since the last save
+bool Adapt_Unsaved = false;        // Has any trim changed since the last save?
+
+void initAdaptation(calibration_record* record, motor_limits limits_forward[3], motor_limits limits_backward[3]) {
+	Adapt_Record = record;
+	Adapt_Limits_Forward = limits_forward;
+	Adapt_Limits_Backward = limits_backward;
+	Adapt_Timeout_Scale = getPercentScale(record->Timeout_Factor);
+	uint16_t Near_Scale = getPercentScale(record->Near_Factor);
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		for(byte Dir = FORWARD; Dir <= BACKWARD; Dir++) {
+			motor_limits* Limits = ((Dir == FORWARD) ? &limits_forward[Motor] : &limits_backward[Motor]);
+			unsigned int Ref_Time = getReferenceTime((output_group)Motor, (motor_dir)Dir);
+
+			// Trims saved under different bounds are brought back within these ones
+			if(record->Slowdown_Trim[Motor][Dir] < ADAPT_TRIM_MIN) {
+				record->Slowdown_Trim[Motor][Dir] = ADAPT_TRIM_MIN;
+			}
+			else if(record->Slowdown_Trim[Motor][Dir] > ADAPT_TRIM_MAX) {
+				record->Slowdown_Trim[Motor][Dir] = ADAPT_TRIM_MAX;
+			}
+
+			Limits->Near = scaleTime(Ref_Time, Near_Scale);
+			Limits->Slowdown = getTrimmedSlowdown(Ref_Time, record->Slowdown_Trim[Motor][Dir]);
+			Limits->Timeout = clampTime(scaleTime(Ref_Time, Adapt_Timeout_Scale) + record->Timeout_Buffer);
+			Adapt_Timeout_Limit[Motor][Dir] = clampTime(scaleTime(Limits->Timeout, getPercentScale(ADAPT_TIMEOUT_LIMIT)));
+			Adapt_Ref_Inverse[Motor][Dir] = ((Ref_Time == 0) ? 0 : (((1000UL << 16) + Ref_Time - 1) / Ref_Time));
+			Adapt_Travel[Motor][Dir] = 0;
+		}
+	}
+	Adapt_Trips = 0;
+	Adapt_Unsaved = false;
+	return;
+}
+
+void handleAdaptation() {
+	if(Adapt_Record == NULL) {
+		return;
+	}
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		motor_dir Dir;
+		unsigned int Travel_Time;
+		if(takeMotorTrip((output_group)Motor, &Dir, &Travel_Time)) {
+			adaptMotorLimits((output_group)Motor, Dir, Travel_Time);
+			recordHealthTrip((output_group)Motor, Dir, Travel_Time);
+			if(Adapt_Trips < 0xFFFF) {
+				Adapt_Trips += 1;
+			}
+		}
+	}
+
+	if(Adapt_Unsaved && (Adapt_Trips >= ADAPT_SAVE_TRIPS) && !storageBusy()) {
+		saveCalibrationRecord(Adapt_Record);
+		Adapt_Trips = 0;
+		Adapt_Unsaved = false;
+	}
+	return;
+}
+
+void adaptMotorLimits(output_group motor, motor_dir dir, unsigned int travel_time) {
+	motor_limits* Limits = ((dir == FORWARD) ? &Adapt_Limits_Forward[motor] : &Adapt_Limits_Backward[motor]);
+	unsigned int Ref_Time = getReferenceTime(motor, dir);
+	if(Ref_Time == 0) {
+		return;
+	}
+
+	// Timeout follows the average travel time, seeded by the first trip
+	if(Adapt_Travel[motor][dir] == 0) {
+		Adapt_Travel[motor][dir] = (((unsigned long) travel_time) << ADAPT_EWMA_SHIFT);
+	}
+	else {
+		Adapt_Travel[motor][dir] = ((Adapt_Travel[motor][dir] - (Adapt_Travel[motor][dir] >> ADAPT_EWMA_SHIFT)) + travel_time);
+	}
+	unsigned long Timeout = (scaleTime((Adapt_Travel[motor][dir] >> ADAPT_EWMA_SHIFT), Adapt_Timeout_Scale) + Adapt_Record->Timeout_Buffer);
+	if(Timeout > Adapt_Timeout_Limit[motor][dir]) {
+		Timeout = Adapt_Timeout_Limit[motor][dir];
+
+		// The motor still runs, but has no margin left before it times out
+		if(!errorFlagged(ERROR_MOTOR_WORN + motor)) {
+			flagError(ERROR_MOTOR_WORN + motor);
+		}
+	}
+	Limits->Timeout = Timeout;
+
+	// The motor slowed on its first pass past the slowdown threshold, so the rest of the trip was spent crawling
+	long Crawl_Time = ((long) travel_time - Limits->Slowdown);
+	long Slowdown = (Limits->Slowdown + ((Crawl_Time - (long) ADAPT_CRAWL_TARGET) / (1 << ADAPT_GAIN_SHIFT)));
+	long Earliest = getTrimmedSlowdown(Ref_Time, ADAPT_TRIM_MIN);
+	long Latest = getTrimmedSlowdown(Ref_Time, ADAPT_TRIM_MAX);
+	if(Slowdown < Earliest) {
+		Slowdown = Earliest;
+	}
+	else if(Slowdown > Latest) {
+		Slowdown = Latest;
+	}
+	Limits->Slowdown = Slowdown;
+
+	// The saved trim rounds down, so a restored slowdown is never later than the adapted one
+	// The reciprocal can be a tenth of a percent out, which is corrected against the slowdown itself
+	int Trim = ((int)((((unsigned long) Slowdown) * Adapt_Ref_Inverse[motor][dir]) >> 16) - (Adapt_Record->Slowdown_Factor * 10));
+	if(Trim < ADAPT_TRIM_MIN) {
+		Trim = ADAPT_TRIM_MIN;
+	}
+	else if(Trim > ADAPT_TRIM_MAX) {
+		Trim = ADAPT_TRIM_MAX;
+	}
+	while((Trim < ADAPT_TRIM_MAX) && (getTrimmedSlowdown(Ref_Time, Trim + 1) <= (unsigned long) Slowdown)) {
+		Trim += 1;
+	}
+	while((Trim > ADAPT_TRIM_MIN) && (getTrimmedSlowdown(Ref_Time, Trim) > (unsigned long) Slowdown)) {
+		Trim -= 1;
+	}
+	if(Trim != Adapt_Record->Slowdown_Trim[motor][dir]) {
+		Adapt_Record->Slowdown_Trim[motor][dir] = Trim;
+		Adapt_Unsaved = true;
+	}
+	return;
+}
+
+unsigned int getReferenceTime(output_group motor, motor_dir dir) {
+	if(dir == FORWARD) {
+		return Adapt_Record->Ref_Time_Forward[motor];
+	}
+	return Adapt_Record->Ref_Time_Backward[motor];
+}
+
+unsigned long getTrimmedSlowdown(unsigned int ref_time, int trim) {
+	int Per_Mille = ((Adapt_Record->Slowdown_Factor * 10) + trim);
+	if(Per_Mille < 0) {
+		Per_Mille = 0;
+	}
+	else if(Per_Mille > 1000) {
+		Per_Mille = 1000;
+	}
+	return scaleTime(ref_time, getPerMilleScale(Per_Mille));
+}
+
+unsigned int clampTime(unsigned long time) {
+	if(time > 0xFFFF) {
+		return 0xFFFF;
+	}
+	return time;
+}
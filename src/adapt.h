@@ -0,0 +1,178 @@
+/* Adaptive Calibration Module
+ *
+ * Used to keep each motor's slowdown and timeout limits tuned to its actual travel time during
+ * normal operation, between calibrations
+ *
+ * Calibration measures each motor's travel time once, and the limits derived from it are fixed
+ * fractions of that time. As belts stretch, gears wear, and the module warms up, the actual travel
+ * time drifts, so a motor either spends longer than needed crawling at slow speed or arrives with
+ * less margin than intended. Every complete trip (MOVE_START through to the front endstop) is
+ * therefore fed back into that motor and direction's limits:
+ *
+ * + The slowdown threshold is nudged so that the time spent at slow speed approaches
+ *   ADAPT_CRAWL_TARGET. Each trip moves it by 1/2^ADAPT_GAIN_SHIFT of the difference, which
+ *   settles without overshoot as long as the motor's slow speed is at least 1/2^ADAPT_GAIN_SHIFT
+ *   of its fast speed. It is kept within ADAPT_TRIM_MIN to ADAPT_TRIM_MAX tenths of a percent of the
+ *   calibrated slowdown factor, so it can never approach the endstop at full speed.
+ * + The timeout follows an exponentially weighted average of the travel time (weight
+ *   1/2^ADAPT_EWMA_SHIFT per trip), with the calibrated timeout factor and buffer on top. It never
+ *   exceeds ADAPT_TIMEOUT_LIMIT percent of the calibrated timeout, so a failing motor is still
+ *   caught, while a motor that has sped up is caught sooner. A motor whose timeout reaches that
+ *   limit is flagged as worn (error ERROR_MOTOR_WORN plus the motor), but keeps running.
+ *
+ * The near threshold is left as calibrated, since it only guards the back endstop disengaging.
+ *
+ * Factors are applied as fixed-point scales, in units of 1/2^ADAPT_SCALE_SHIFT, so each limit
+ * costs a 16 x 16-bit multiply and a shift rather than a 32-bit division, which the ATmega 328P
+ * does in software. Percentages and tenths of a percent are converted to scales with a multiply
+ * and shift as well. Each limit is within 1 + (time / 2^ADAPT_SCALE_SHIFT) milliseconds of the
+ * exact percentage of the time, rounded down. The only division left is the reciprocal of each
+ * reference time, taken once by initAdaptation() and used to turn an adapted slowdown back into
+ * a trim.
+ *
+ * Slowdown thresholds are persisted as per-motor, per-direction trims in the calibration record.
+ * Once at least ADAPT_SAVE_TRIPS trips have been taken since the last save, and any trim has
+ * changed, the record is saved again in the background. A new calibration resets every trim.
+ */
+
+#ifndef adapt_h
+#define adapt_h
+#include <arduino.h>
+#include "hal.h"
+#include "power.h"
+#include "motor.h"
+#include "storage.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+const unsigned int ADAPT_CRAWL_TARGET = 200;  // Milliseconds at slow speed at the end of each trip
+const byte ADAPT_GAIN_SHIFT = 3;              // Slowdown moves by 1/8 of the crawl error per trip
+const byte ADAPT_EWMA_SHIFT = 3;              // Each trip weighs 1/8 in the travel time average
+
+// Bounds of the slowdown trim, in tenths of a percent of the reference travel time
+const int8_t ADAPT_TRIM_MIN = -120;
+const int8_t ADAPT_TRIM_MAX = 20;
+
+const byte ADAPT_TIMEOUT_LIMIT = 150;        // Percentage of the calibrated timeout
+
+// Fixed-point scales (1 = 2^ADAPT_SCALE_SHIFT) cover up to 400%, within 16 bits
+const byte ADAPT_SCALE_SHIFT = 14;
+const uint32_t ADAPT_PER_MILLE_SCALE = 16777;  // Scale of a tenth of a percent, times 2^10
+const uint16_t ADAPT_MAX_PER_MILLE = 3999;
+const unsigned int ADAPT_SAVE_TRIPS = 64;     // Minimum trips between saves
+
+
+/////////////////////////
+// FIXED-POINT SCALES
+/////////////////////////
+
+constexpr uint16_t getPerMilleScale(unsigned int per_mille) {
+	return((uint16_t)(((per_mille * ADAPT_PER_MILLE_SCALE) + (1 << 9)) >> 10));
+}
+/*
+ * Converts tenths of a percent into a fixed-point scale
+ *
+ * INPUT:  Tenths of a percent, up to ADAPT_MAX_PER_MILLE
+ * OUTPUT: Scale, where 2^ADAPT_SCALE_SHIFT is 100%
+ */
+
+constexpr uint16_t getPercentScale(unsigned int percent) {
+	return getPerMilleScale(percent * 10);
+}
+/*
+ * Converts a percentage into a fixed-point scale
+ *
+ * INPUT:  Percentage, up to ADAPT_MAX_PER_MILLE / 10
+ * OUTPUT: Scale, where 2^ADAPT_SCALE_SHIFT is 100%
+ */
+
+constexpr unsigned long scaleTime(unsigned int time, uint16_t scale) {
+	return((((uint32_t) time) * scale) >> ADAPT_SCALE_SHIFT);
+}
+/*
+ * Scales a time by a fixed-point scale, rounding down to the millisecond
+ *
+ * INPUT:  Time in milliseconds
+ *         Scale from getPercentScale() or getPerMilleScale()
+ * OUTPUT: Scaled time in milliseconds
+ */
+
+static_assert(((uint32_t) ADAPT_MAX_PER_MILLE * ADAPT_PER_MILLE_SCALE) < 0x4000000, "Scales must fit in 16 bits");
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void initAdaptation(calibration_record* record, motor_limits limits_forward[3], motor_limits limits_backward[3]);
+/*
+ * Calculates every motor's limits from a calibration record, including its slowdown trims
+ * Must be called whenever the record changes, other than by this module
+ *
+ * The record and limit arrays are updated in place by adaptMotorLimits(), so they must remain
+ * valid for as long as normal operation runs.
+ *
+ * Affects Adapt_Record, Adapt_Limits_Forward, Adapt_Limits_Backward, Adapt_Timeout_Scale,
+ *         Adapt_Timeout_Limit[][], Adapt_Ref_Inverse[][], Adapt_Travel[][], Adapt_Trips, and Adapt_Unsaved
+ * INPUT:  Calibration record
+ *         Limits to fill for each motor while traveling forward
+ *         Limits to fill for each motor while traveling backward
+ */
+
+void handleAdaptation();
+/*
+ * Adapts the limits to every trip completed since the last call, and saves the trims when due
+ * Should be called after handleMotors() during normal operation
+ *
+ * Each trip is also recorded by the Motor Health module (see recordHealthTrip()).
+ *
+ * Affects the limit arrays and record given to initAdaptation(), Adapt_Travel[][], Adapt_Trips,
+ * and Adapt_Unsaved
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void adaptMotorLimits(output_group motor, motor_dir dir, unsigned int travel_time);
+/*
+ * Adapts one motor's slowdown and timeout limits to a single trip
+ *
+ * Affects the limits and slowdown trim of the motor and direction, Adapt_Travel[motor][dir],
+ *         Adapt_Unsaved, and the motor's worn error code
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel
+ *         Travel time from MOVE_START to the front endstop, in milliseconds
+ */
+
+unsigned int getReferenceTime(output_group motor, motor_dir dir);
+/*
+ * Gets a motor's calibrated reference travel time
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel
+ * OUTPUT: Reference travel time in milliseconds
+ */
+
+unsigned long getTrimmedSlowdown(unsigned int ref_time, int trim);
+/*
+ * Calculates a slowdown threshold from the record's slowdown factor and a trim
+ *
+ * INPUT:  Reference travel time in milliseconds
+ *         Trim in tenths of a percent (not bounded)
+ * OUTPUT: Slowdown threshold in milliseconds, no later than the reference travel time
+ */
+
+unsigned int clampTime(unsigned long time);
+/*
+ * Limits a time to the 16 bits of motor_limits
+ *
+ * INPUT:  Time in milliseconds
+ * OUTPUT: Time in milliseconds, no more than 0xFFFF
+ */
+
+
+#endif
@@ -0,0 +1,160 @@
+#include "ambience.h"
+
+// State machine
+ambient_state Ambient_State = AMBIENT_WAIT;
+unsigned long Ambient_Delay_Start = 0;
+unsigned int Ambient_Delay_Length = AMBIENT_MIN_BUTTON_DELAY;
+
+// Clip history, oldest overwritten first (AUDIO_CLIPS = empty)
+audio_clip Ambient_History[AMBIENT_HISTORY] = {AUDIO_CLIPS, AUDIO_CLIPS};
+byte Ambient_History_Next = 0;
+
+// Cooldowns
+unsigned long Ambient_Started[AUDIO_CLIPS];  // Time each clip last started
+byte Ambient_Cooling = 0;                    // Clips started at least once, whose cooldown may still be running
+
+static_assert(AMBIENT_HISTORY == 2, "Ambient_History[] must be initialized with AMBIENT_HISTORY entries");
+
+void handleAmbientAudio() {
+	switch(Ambient_State) {
+		case AMBIENT_WAIT: {
+			if(sensorEngaged(BUTTON)) {
+				Ambient_Delay_Length = random(AMBIENT_MIN_BUTTON_DELAY, AMBIENT_MAX_DELAY);
+				Ambient_Delay_Start = millis();
+				Ambient_State = AMBIENT_DELAY;
+			}
+			break;
+		}
+		case AMBIENT_DELAY: {
+			if((millis() - Ambient_Delay_Start) > Ambient_Delay_Length) {
+				if(!sensorEngaged(BUTTON)) {
+					Ambient_State = AMBIENT_WAIT;
+					break;
+				}
+
+				// An event clip may still be playing, in which case the delay starts again after it
+				if(!audioQueued()) {
+					audio_clip Next_Clip = drawAmbientClip(getEligibleClips());
+					if(Next_Clip < AUDIO_CLIPS) {
+						playAmbientClip(Next_Clip);
+					}
+				}
+				Ambient_Delay_Length = random(AMBIENT_MIN_DELAY, AMBIENT_MAX_DELAY);
+				Ambient_State = AMBIENT_PLAY;
+			}
+			break;
+		}
+		case AMBIENT_PLAY: {
+			if(!audioQueued()) {
+				Ambient_Delay_Start = millis();
+				Ambient_State = AMBIENT_DELAY;
+			}
+			break;
+		}
+	}
+	return;
+}
+
+void handleAmbientEvents(bool enabled) {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		uint16_t Entered = takeMotorStatesEntered((output_group) Motor);
+		if(!enabled || (Entered == 0)) {
+			continue;
+		}
+
+		for(byte Event = 0; Event < AMBIENT_EVENT_COUNT; Event++) {
+			const ambient_event* Row = &AMBIENT_EVENTS[Event];
+			byte State = pgm_read_byte(&Row->State);
+			if((pgm_read_byte(&Row->Motor) != Motor) || !(Entered & (1 << State))) {
+				continue;
+			}
+			audio_clip Clip = (audio_clip)pgm_read_byte(&Row->Clip);
+			byte Chance = pgm_read_byte(&Row->Chance);
+			if(audioQueued() || clipCooling(Clip)) {
+				continue;
+			}
+			if((Chance < 100) && (random(100) >= Chance)) {
+				continue;
+			}
+			playAmbientClip(Clip);
+		}
+	}
+	return;
+}
+
+bool getAmbientDeadline(unsigned long* deadline) {
+	// WAIT only reacts to the arcade button, and PLAY to the end of playback (see getAudioDeadline())
+	if(Ambient_State == AMBIENT_DELAY) {
+		*deadline = (Ambient_Delay_Start + Ambient_Delay_Length + 1);
+		return true;
+	}
+	return false;
+}
+
+void stopAmbientAudio() {
+	Ambient_State = AMBIENT_WAIT;
+	return;
+}
+
+audio_clip drawAmbientClip(byte eligible) {
+	unsigned int Cumulative[AUDIO_CLIPS];
+	unsigned int Total = 0;
+
+	// A clip is picked when the draw falls below its cumulative weight, and above the previous clip's
+	for(byte Clip = 0; Clip < AUDIO_CLIPS; Clip++) {
+		if(eligible & (1 << Clip)) {
+			Total += pgm_read_byte(&AMBIENT_WEIGHT[Clip]);
+		}
+		Cumulative[Clip] = Total;
+	}
+	if(Total == 0) {
+		return AUDIO_CLIPS;
+	}
+
+	unsigned int Draw = random(Total);
+	byte Clip = 0;
+	while(Draw >= Cumulative[Clip]) {
+		Clip++;
+	}
+	return (audio_clip) Clip;
+}
+
+byte getEligibleClips() {
+	byte Eligible = 0;
+	for(byte Clip = 0; Clip < AUDIO_CLIPS; Clip++) {
+		if(!clipCooling((audio_clip) Clip)) {
+			Eligible |= (1 << Clip);
+		}
+	}
+	for(byte Entry = 0; Entry < AMBIENT_HISTORY; Entry++) {
+		if(Ambient_History[Entry] < AUDIO_CLIPS) {
+			Eligible &= ~(1 << Ambient_History[Entry]);
+		}
+	}
+	return Eligible;
+}
+
+bool clipCooling(audio_clip clip) {
+	if(!(Ambient_Cooling & (1 << clip))) {
+		return false;
+	}
+	if((millis() - Ambient_Started[clip]) >= pgm_read_word(&AMBIENT_COOLDOWN[clip])) {
+		Ambient_Cooling &= ~(1 << clip);
+		return false;
+	}
+	return true;
+}
+
+void playAmbientClip(audio_clip clip) {
+	// An ambient clip is not worth waiting for, so one that cannot start is dropped
+	if(!playAudio(clip)) {
+		return;
+	}
+	Ambient_History[Ambient_History_Next] = clip;
+	Ambient_History_Next = ((Ambient_History_Next + 1) % AMBIENT_HISTORY);
+	if(pgm_read_word(&AMBIENT_COOLDOWN[clip]) > 0) {
+		Ambient_Started[clip] = millis();
+		Ambient_Cooling |= (1 << clip);
+	}
+	return;
+}
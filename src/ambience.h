@@ -0,0 +1,174 @@
+/* Ambient Audio Module
+ *
+ * Used to pick and play the sound effects heard while the arcade button is held, and those tied
+ * to motor events
+ *
+ * While the arcade button is held, a clip is picked at random after a random delay, and another
+ * after each clip finishes. Each clip's chance of being picked is its AMBIENT_WEIGHT[] over the
+ * total weight of every clip still eligible. A clip is not eligible if it is one of the last
+ * AMBIENT_HISTORY clips played, or if fewer than AMBIENT_COOLDOWN[] milliseconds have passed since
+ * it last started. Picking takes a single call to random(), over cumulative weights built from the
+ * eligible clips, so it never loops on a rejected pick. If no clip is eligible, the delay simply
+ * starts again.
+ *
+ * Clips can also be tied to motor states in AMBIENT_EVENTS[]. Each time a motor enters the state,
+ * its clip plays immediately with the chance given, as long as nothing else is playing and the
+ * clip's cooldown has passed. Event clips count towards the history and cooldowns as well.
+ *
+ * Every clip, weight, cooldown, and event is configured in the tables below. The simulation build
+ * checks that the weights are honored (see the Simulation documentation).
+ */
+
+#ifndef ambience_h
+#define ambience_h
+#include <arduino.h>
+#include <avr/pgmspace.h>
+#include "input.h"
+#include "power.h"
+#include "motor.h"
+#include "audio.h"
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Ambient audio operation states
+typedef enum {
+	AMBIENT_WAIT,   // Waiting for the arcade button
+	AMBIENT_DELAY,  // Waiting to pick the next clip
+	AMBIENT_PLAY    // Waiting for playback to finish
+} ambient_state;
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// A clip tied to a motor state, stored in PROGMEM (enumerations are held in bytes)
+typedef struct {
+	byte Motor;   // output_group
+	byte State;   // motor_state whose entry plays the clip
+	byte Clip;    // audio_clip
+	byte Chance;  // Percentage of entries which play the clip (1-100)
+} ambient_event;
+
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// Delays before each clip, in milliseconds
+// The first clip after the arcade button is pressed waits at least AMBIENT_MIN_BUTTON_DELAY
+const unsigned int AMBIENT_MIN_DELAY = 3000;
+const unsigned int AMBIENT_MAX_DELAY = 10000;
+const unsigned int AMBIENT_MIN_BUTTON_DELAY = 5000;
+
+// Relative chance of each clip being picked at random (0 = never), indexed by audio_clip
+const byte AMBIENT_WEIGHT[AUDIO_CLIPS] PROGMEM = {
+	0,
+	1,
+	2,
+	2,
+	2
+};
+
+// Time after each clip starts before it can play again, indexed by audio_clip
+const unsigned int AMBIENT_COOLDOWN[AUDIO_CLIPS] PROGMEM = {
+	0,
+	30000,
+	15000,
+	0,
+	0
+};
+
+// Number of most recent clips which are never picked at random
+// Must leave at least one clip with a weight eligible
+const byte AMBIENT_HISTORY = 2;
+
+// Clips tied to motor states
+const ambient_event AMBIENT_EVENTS[] PROGMEM = {
+	{LOADER_MOTOR, MOVE_START, AUDIO_EXPLOSION, 25}  // Loader electromagnet engaging
+};
+const byte AMBIENT_EVENT_COUNT = (sizeof(AMBIENT_EVENTS) / sizeof(AMBIENT_EVENTS[0]));
+
+static_assert(AUDIO_CLIPS <= 8, "Eligible clips are held in a byte");
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void handleAmbientAudio();
+/*
+ * Runs a single pass of the ambient audio state machine
+ * Used by loop(), except while calibrating
+ *
+ * Affects Ambient_State, Ambient_Delay_Start, Ambient_Delay_Length, and the clip history
+ */
+
+void handleAmbientEvents(bool enabled);
+/*
+ * Plays the clips tied to any motor states entered since the last call
+ * Should be called after every pass of the motor state machines
+ *
+ * Affects the clip history
+ * INPUT:  Play event clips? (false discards the states entered, such as while calibrating)
+ */
+
+bool getAmbientDeadline(unsigned long* deadline);
+/*
+ * Determines when the ambient audio state machine next needs to run, other than when the
+ * inputs change
+ *
+ * INPUT:  Pointer to the deadline, in milliseconds
+ * OUTPUT: Is there a deadline?
+ */
+
+void stopAmbientAudio();
+/*
+ * Returns the ambient audio state machine to waiting for the arcade button
+ * Any clip already playing is left to finish.
+ *
+ * Affects Ambient_State
+ */
+
+audio_clip drawAmbientClip(byte eligible);
+/*
+ * Picks a clip at random among those given, weighted by AMBIENT_WEIGHT[]
+ * Used by handleAmbientAudio(), and by the simulation build's fairness check
+ *
+ * INPUT:  Eligible clips (bit n = audio_clip n)
+ * OUTPUT: Picked clip (AUDIO_CLIPS if no eligible clip has a weight)
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+byte getEligibleClips();
+/*
+ * Determines which clips may be picked at random, given the history and cooldowns
+ *
+ * OUTPUT: Eligible clips (bit n = audio_clip n)
+ */
+
+bool clipCooling(audio_clip clip);
+/*
+ * Determines if a clip is still within its cooldown
+ *
+ * INPUT:  Clip
+ * OUTPUT: Has too little time passed since it last started?
+ */
+
+void playAmbientClip(audio_clip clip);
+/*
+ * Plays a clip, recording it in the history and restarting its cooldown
+ * A clip that cannot be started is dropped, and leaves both untouched
+ *
+ * Affects Ambient_History[], Ambient_History_Next, Ambient_Started[], and Ambient_Cooling
+ * INPUT:  Clip to play
+ */
+
+
+#endif
@@ -1,90 +1,386 @@
 #include "audio.h"
+#include "trace.h"
+#include "link.h"
 
-unsigned long Audio_Start;
-unsigned int Audio_Duration;
+unsigned long Audio_Start = 0;
+unsigned int Audio_Duration = 0;   // Estimated, until status readback finds the actual end
 bool Audio_Playing = false;
 
+// Message memory layout, from the ISD1700 itself if discovered at startup
+uint16_t Audio_Start_Ptr[AUDIO_CLIPS];
+uint16_t Audio_Stop_Ptr[AUDIO_CLIPS];
+unsigned int Audio_Clip_Duration[AUDIO_CLIPS];
+
+// Status readback
+bool Audio_Readback = false;          // Was the ISD1700's MISO line found at startup?
+bool Audio_Status_Pending = false;    // Has a status read been queued, and not yet checked?
+unsigned long Audio_Status_Time = 0;  // Time the last status read was queued
+unsigned long Audio_Status_Next = 0;  // Time the next status read is due
+byte Audio_Status_Queued = 0;         // Status reads queued, and transmitted (wrapping)
+volatile byte Audio_Status_Received = 0;
+byte Audio_Rx_Buffer[AUDIO_RX_LENGTH];
+byte Audio_Rx_Index = 0;
+bool Audio_Tx_Capture = false;        // Is the frame being transmitted capturing its reply?
+
+// Playlist
+audio_clip Audio_Queue_Clip[AUDIO_QUEUE_SIZE];
+unsigned int Audio_Queue_Gap[AUDIO_QUEUE_SIZE];
+byte Audio_Queue_Head = 0;
+byte Audio_Queue_Tail = 0;
+unsigned int Audio_Gap = 0;     // Gap to leave after the clip currently playing
+
+// SPI transmit buffer
+// Only queueFrame() advances the head, and only transmitAudio() advances the tail
+byte Audio_Tx_Buffer[AUDIO_TX_BUFFER_SIZE];
+volatile byte Audio_Tx_Head = 0;
+volatile byte Audio_Tx_Tail = 0;
+byte Audio_Tx_Remaining = 0;    // Bytes left in the frame being transmitted
+
 void initAudio() {
 	// Prepare SPI outputs
-	digitalWrite(SPI_SCLK_PIN, HIGH);
-	digitalWrite(SPI_MOSI_PIN, LOW);
-	digitalWrite(SPI_SS_PIN, HIGH);
+	halDigitalWrite<SPI_SCLK_PIN>(HIGH);
+	halDigitalWrite<SPI_MOSI_PIN>(LOW);
+	halDigitalWrite<SPI_SS_PIN>(HIGH);
 
 	// Drive SPI pins
-	pinMode(SPI_SCLK_PIN, OUTPUT);
-	pinMode(SPI_MOSI_PIN, OUTPUT);
-	pinMode(SPI_SS_PIN, OUTPUT);
+	halPinMode<SPI_SCLK_PIN>(OUTPUT);
+	halPinMode<SPI_MOSI_PIN>(OUTPUT);
+	halPinMode<SPI_SS_PIN>(OUTPUT);
 
 	// Initialize ISD1700 device
-	digitalWrite(SPI_SS_PIN, LOW);
-	sendByte(ISD_PU);
-	sendByte(0x00);
-	digitalWrite(SPI_SS_PIN, HIGH);
+	// The system tick may not be running yet, so these commands are sent directly
+	halInitSpiInput();
+	byte Command[2] = {ISD_PU, 0x00};
+	transferFrame(Command, 2, NULL);
 	delay(ISD_POWER_UP_DELAY);
+
+	for(byte Clip = 0; Clip < AUDIO_CLIPS; Clip++) {
+		Audio_Start_Ptr[Clip] = pgm_read_word(&ISD_AUDIO_START_PTR[Clip]);
+		Audio_Stop_Ptr[Clip] = pgm_read_word(&ISD_AUDIO_STOP_PTR[Clip]);
+		Audio_Clip_Duration[Clip] = pgm_read_word(&AUDIO_DURATION[Clip]);
+	}
+	Audio_Readback = (ISD_READBACK && detectReadback());
+	if(Audio_Readback) {
+		discoverClips();
+	}
 	configAudio(ISD_APC_DEFAULT_CONFIG);
 
 	return;
 }
 
-void playAudio(audio_clip sound) {
-	return playAudio(sound, AUDIO_VOLUME[sound]);
+bool audioReadback() {
+	return Audio_Readback;
 }
 
-void playAudio(audio_clip sound, byte volume) {
+bool playAudio(audio_clip sound) {
+	return playAudio(sound, pgm_read_byte(&AUDIO_VOLUME[sound]));
+}
+
+bool playAudio(audio_clip sound, byte volume) {
+	// A clip with only its volume sent would leave the next one at the wrong volume
+	if(!audioTxRoom(AUDIO_PLAY_LENGTH)) {
+		return false;
+	}
 
 	// Send configuration data to adjust volume
 	configAudio(ISD_APC_DEFAULT_CONFIG + (volume & 0x7));
 
 	// Send play command
-	digitalWrite(SPI_SS_PIN, LOW);
-	sendByte(ISD_SET_PLAY);
-	sendByte(0x00);
-	sendByte(getByte(ISD_AUDIO_START_PTR[sound], 0));
-	sendByte(getByte(ISD_AUDIO_START_PTR[sound], 1));
-	sendByte(getByte(ISD_AUDIO_STOP_PTR[sound], 0));
-	sendByte(getByte(ISD_AUDIO_STOP_PTR[sound], 1));
-	sendByte(0x00);
-	digitalWrite(SPI_SS_PIN, HIGH);
+	byte Frame[7] = {
+		ISD_SET_PLAY,
+		0x00,
+		getByte(Audio_Start_Ptr[sound], 0),
+		getByte(Audio_Start_Ptr[sound], 1),
+		getByte(Audio_Stop_Ptr[sound], 0),
+		getByte(Audio_Stop_Ptr[sound], 1),
+		0x00
+	};
+	queueFrame(Frame, 7, false);
 
 	// Update status variables
 	Audio_Start = millis();
-	Audio_Duration = AUDIO_DURATION[sound];
+	Audio_Duration = Audio_Clip_Duration[sound];
 	Audio_Playing = true;
+	Audio_Gap = 0;
+	Audio_Status_Pending = false;
+	Audio_Status_Next = Audio_Start;
+	if(Audio_Duration > AUDIO_STATUS_LEAD) {
+		Audio_Status_Next += (Audio_Duration - AUDIO_STATUS_LEAD);
+	}
+	traceEvent(TRACE_AUDIO, (volume & 0x7), sound);
 
+	return true;
+}
+
+bool queueAudio(audio_clip sound, unsigned int gap) {
+	byte Next_Head = ((Audio_Queue_Head + 1) & (AUDIO_QUEUE_SIZE - 1));
+	if(Next_Head == Audio_Queue_Tail) {
+		return false;
+	}
+	Audio_Queue_Clip[Audio_Queue_Head] = sound;
+	Audio_Queue_Gap[Audio_Queue_Head] = gap;
+	Audio_Queue_Head = Next_Head;
+	return true;
+}
+
+void handleAudioQueue() {
+	if(Audio_Queue_Head == Audio_Queue_Tail) {
+		return;
+	}
+
+	// Wait for the previous clip and its gap to finish
+	if(audioPlaying() || ((millis() - Audio_Start) < ((unsigned long) Audio_Duration + Audio_Gap))) {
+		return;
+	}
+
+	if(!playAudio(Audio_Queue_Clip[Audio_Queue_Tail])) {
+		return;
+	}
+	Audio_Gap = Audio_Queue_Gap[Audio_Queue_Tail];
+	Audio_Queue_Tail = ((Audio_Queue_Tail + 1) & (AUDIO_QUEUE_SIZE - 1));
 	return;
 }
 
+bool audioQueued() {
+	if((Audio_Queue_Head != Audio_Queue_Tail) || audioPlaying()) {
+		return true;
+	}
+	return((millis() - Audio_Start) < ((unsigned long) Audio_Duration + Audio_Gap));
+}
+
 void beep() {
-	playAudio(AUDIO_BEEP);
-	while(audioPlaying()) {
-		// Do nothing
+	queueAudio(AUDIO_BEEP, BEEP_DELAY);
+	return;
+}
+
+bool getAudioDeadline(unsigned long* deadline) {
+	bool Scheduled = false;
+
+	// End of playback, or the next status read while it is being watched for
+	if(audioPlaying()) {
+		if(Audio_Readback) {
+			*deadline = Audio_Status_Next;
+		}
+		else {
+			*deadline = (Audio_Start + Audio_Duration);
+		}
+		Scheduled = true;
 	}
-	delay(BEEP_DELAY);
+
+	// Start of the next queued clip
+	if((Audio_Queue_Head != Audio_Queue_Tail) && !Scheduled) {
+		*deadline = (Audio_Start + Audio_Duration + Audio_Gap);
+		Scheduled = true;
+	}
+	return Scheduled;
 }
 
 bool audioPlaying() {
 	if(Audio_Playing) {
-		if((millis() - Audio_Start) >= Audio_Duration) {
+		unsigned long Elapsed = (millis() - Audio_Start);
+		if(Audio_Readback) {
+			checkPlaybackStatus(Elapsed);
+		}
+		else if(Elapsed >= Audio_Duration) {
 			Audio_Playing = false;
 		}
 	}
 	return Audio_Playing;
 }
 
-void configAudio(uint16_t configuration) {
-	digitalWrite(SPI_SS_PIN, LOW);
-	sendByte(ISD_WR_APC2);
-	sendByte(getByte(configuration, 0));
-	sendByte(getByte(configuration, 1));
-	digitalWrite(SPI_SS_PIN, HIGH);
+bool transmitAudio() {
+	byte Tail = Audio_Tx_Tail;
+
+	for(byte Count = 0; Count < AUDIO_TX_BYTES_PER_TICK; Count++) {
+		// Start the next frame, if there is one
+		if(Audio_Tx_Remaining == 0) {
+			if(Tail == Audio_Tx_Head) {
+				break;
+			}
+			// SCLK and MOSI are shared with the link, which must finish its current byte first
+			if(!linkReleasePins()) {
+				break;
+			}
+			Audio_Tx_Remaining = (Audio_Tx_Buffer[Tail] & ~AUDIO_FRAME_CAPTURE);
+			Audio_Tx_Capture = (Audio_Tx_Buffer[Tail] & AUDIO_FRAME_CAPTURE);
+			Audio_Rx_Index = 0;
+			Tail = ((Tail + 1) & (AUDIO_TX_BUFFER_SIZE - 1));
+			halSpiSelect<SPI_SS_PIN>(true);
+		}
+
+		byte Reception = halSpiShiftByte<SPI_SCLK_PIN, SPI_MOSI_PIN>(Audio_Tx_Buffer[Tail]);
+		Tail = ((Tail + 1) & (AUDIO_TX_BUFFER_SIZE - 1));
+		Audio_Tx_Remaining -= 1;
+		if(Audio_Tx_Capture && (Audio_Rx_Index < AUDIO_RX_LENGTH)) {
+			Audio_Rx_Buffer[Audio_Rx_Index++] = Reception;
+		}
+
+		if(Audio_Tx_Remaining == 0) {
+			halSpiSelect<SPI_SS_PIN>(false);
+			linkClaimPins();
+			if(Audio_Tx_Capture) {
+				Audio_Status_Received += 1;
+			}
+		}
+	}
+
+	Audio_Tx_Tail = Tail;
+	return((Audio_Tx_Remaining != 0) || (Tail != Audio_Tx_Head));
+}
+
+bool configAudio(uint16_t configuration) {
+	byte Frame[3] = {
+		ISD_WR_APC2,
+		getByte(configuration, 0),
+		getByte(configuration, 1)
+	};
+	return queueFrame(Frame, 3, false);
+}
+
+bool queueFrame(const byte* frame, byte length, bool capture) {
+	if(!audioTxRoom(length + 1)) {
+		return false;
+	}
+
+	byte Head = Audio_Tx_Head;
+	Audio_Tx_Buffer[Head] = (capture ? (length | AUDIO_FRAME_CAPTURE) : length);
+	Head = ((Head + 1) & (AUDIO_TX_BUFFER_SIZE - 1));
+	for(byte Index = 0; Index < length; Index++) {
+		Audio_Tx_Buffer[Head] = frame[Index];
+		Head = ((Head + 1) & (AUDIO_TX_BUFFER_SIZE - 1));
+	}
+
+	// Publish the frame only once it is complete, then make sure the system tick is running to send it
+	Audio_Tx_Head = Head;
+	byte Old_SREG = SREG;
+	noInterrupts();
+	halStartSystemTick();
+	SREG = Old_SREG;
+	return true;
+}
+
+bool audioTxRoom(byte length) {
+	return(((Audio_Tx_Tail - Audio_Tx_Head - 1) & (AUDIO_TX_BUFFER_SIZE - 1)) >= length);
+}
+
+void checkPlaybackStatus(unsigned long elapsed) {
+	// Once every status read queued has been transmitted, the last one shows whether playback is still going
+	if(Audio_Status_Pending && (Audio_Status_Received == Audio_Status_Queued)) {
+		Audio_Status_Pending = false;
+		if(!(Audio_Rx_Buffer[2] & ISD_SR1_PLAY)) {
+			Audio_Duration = (Audio_Status_Time - Audio_Start);
+			Audio_Playing = false;
+			return;
+		}
+	}
+
+	// Give up on a clip which outlasts its estimate by too much, in case the status reads stopped making sense
+	if(elapsed >= ((unsigned long) Audio_Duration + AUDIO_STATUS_TIMEOUT)) {
+		Audio_Playing = false;
+		return;
+	}
+
+	// A full transmit buffer puts the read off until a later pass
+	if(!Audio_Status_Pending && ((long)(millis() - Audio_Status_Next) >= 0) && audioTxRoom(4)) {
+		byte Frame[3] = {ISD_RD_STATUS, 0x00, 0x00};
+		Audio_Status_Queued += 1;
+		queueFrame(Frame, 3, true);
+		Audio_Status_Time = millis();
+		Audio_Status_Next = (Audio_Status_Time + AUDIO_STATUS_POLL);
+		Audio_Status_Pending = true;
+	}
 	return;
 }
 
-void sendByte(uint8_t transmission) {
-	for(byte Bit = 0; Bit < 8; Bit++) {
-		digitalWrite(SPI_SCLK_PIN, LOW);
-		digitalWrite(SPI_MOSI_PIN, ((transmission >> Bit) & 0x01));
-		digitalWrite(SPI_SCLK_PIN, HIGH);
+void transferFrame(const byte* frame, byte length, byte* reply) {
+	halSpiSelect<SPI_SS_PIN>(true);
+	for(byte Index = 0; Index < length; Index++) {
+		byte Reception = halSpiShiftByte<SPI_SCLK_PIN, SPI_MOSI_PIN>(frame[Index]);
+		if(reply != NULL) {
+			reply[Index] = Reception;
+		}
+	}
+	halSpiSelect<SPI_SS_PIN>(false);
+	return;
+}
+
+bool readStatus(byte status[3]) {
+	byte Frame[3] = {ISD_RD_STATUS, 0x00, 0x00};
+	transferFrame(Frame, 3, status);
+
+	// After power-up, the ISD1700 is powered, ready, and idle, and has no command error
+	return(((status[0] & (ISD_SR0_PU | ISD_SR0_CMD_ERR)) == ISD_SR0_PU) &&
+		((status[2] & (ISD_SR1_RDY | ISD_SR1_ERASE | ISD_SR1_PLAY | ISD_SR1_REC)) == ISD_SR1_RDY));
+}
+
+bool detectReadback() {
+	// An unconnected MISO line reads as noise or a constant level, which is unlikely to pass twice
+	byte Status[3];
+	return(readStatus(Status) && readStatus(Status));
+}
+
+bool waitReady() {
+	byte Status[3];
+	for(byte Attempt = 0; Attempt < ISD_READY_TIMEOUT; Attempt++) {
+		if(readStatus(Status)) {
+			return true;
+		}
+		delay(1);
+	}
+	return false;
+}
+
+uint16_t readPointer(byte command) {
+	byte Frame[4] = {command, 0x00, 0x00, 0x00};
+	byte Reply[4];
+	transferFrame(Frame, 4, Reply);
+	return((Reply[2] | (((uint16_t) Reply[3]) << 8)) & ISD_PTR_MASK);
+}
+
+void discoverClips() {
+	uint16_t Start[AUDIO_CLIPS + 1];
+	byte Count = 0;
+
+	// CHK_MEM leaves the record pointer just after the last message
+	byte Command[2] = {ISD_CHK_MEM, 0x00};
+	transferFrame(Command, 2, NULL);
+	if(!waitReady()) {
+		return;
+	}
+	uint16_t End = readPointer(ISD_RD_REC_PTR);
+
+	// FWD steps the play pointer through every message, wrapping around after the last
+	Command[0] = ISD_FWD;
+	for(byte Step = 0; Step <= AUDIO_CLIPS; Step++) {
+		transferFrame(Command, 2, NULL);
+		if(!waitReady()) {
+			return;
+		}
+		uint16_t Pointer = readPointer(ISD_RD_PLAY_PTR);
+
+		// Keep the start pointers sorted, stopping once they repeat
+		byte Index = 0;
+		while((Index < Count) && (Start[Index] < Pointer)) {
+			Index++;
+		}
+		if((Index < Count) && (Start[Index] == Pointer)) {
+			break;
+		}
+		for(byte Move = Count; Move > Index; Move--) {
+			Start[Move] = Start[Move - 1];
+		}
+		Start[Index] = Pointer;
+		Count += 1;
+	}
+
+	// The clips are recorded in audio_clip order, so anything else is left to the built-in table
+	if((Count != AUDIO_CLIPS) || (Start[Count - 1] >= End)) {
+		return;
+	}
+	for(byte Clip = 0; Clip < AUDIO_CLIPS; Clip++) {
+		Audio_Start_Ptr[Clip] = Start[Clip];
+		Audio_Stop_Ptr[Clip] = (((Clip + 1) < AUDIO_CLIPS) ? Start[Clip + 1] : End) - 1;
+		Audio_Clip_Duration[Clip] = ((Audio_Stop_Ptr[Clip] - Audio_Start_Ptr[Clip] + 1) * ISD_ROW_TIME);
 	}
 	return;
 }
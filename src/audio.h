@@ -5,8 +5,25 @@
  * This includes configuring pins on startup, sending SPI commands,
  * and keeping track of playback state.
  *
- * Note that only one audio clip is capable of playing at a time. Current [estimated] playback
- * status can be determined using audioPlaying().
+ * SPI commands are not sent immediately. Each command is queued as a frame in a transmit buffer,
+ * which transmitAudio() drains from the system tick interrupt a few bytes at a time. Requesting
+ * a clip therefore only costs a handful of buffer writes, and the motor state machines are never
+ * stalled while a command is clocked out. A command that does not fit in the buffer is refused
+ * rather than waited on, and is retried or dropped by whoever asked for it.
+ *
+ * Note that only one audio clip is capable of playing at a time. Current playback status can be
+ * determined using audioPlaying().
+ *
+ * If the ISD1700's MISO line is wired to A6 (see src/hal.h), its replies can be read back. This is
+ * detected at startup, in which case the start and end of each clip are read from the ISD1700's
+ * message memory instead of ISD_AUDIO_START_PTR[] and ISD_AUDIO_STOP_PTR[], and the end of playback
+ * is found by polling the ISD1700's status from shortly before each clip's estimated end. Otherwise,
+ * playback is assumed to end once AUDIO_DURATION[] has passed.
+ *
+ * A short playlist of clips is also available for feedback that would otherwise need to wait
+ * on playback, such as calibration beeps. queueAudio() appends a clip and the silent gap to
+ * leave after it, and handleAudioQueue() starts each clip in turn once the previous clip and its
+ * gap have finished. handleAudioQueue() must be called from every loop that waits on anything.
  *
  * Written by Alex Tavares <tavaresa13@gmail.com>
  */
@@ -14,15 +31,32 @@
 #ifndef audio_h
 #define audio_h
 #include <arduino.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
 
 /////////////////////////
 // CONFIGURATION VARIABLES
 /////////////////////////
 
-const unsigned int BEEP_DELAY = 150;
+const unsigned int BEEP_DELAY = 150;  // Silent gap after each beep
+
+// Playlist size, which must be a power of two (one entry is always left free)
+const byte AUDIO_QUEUE_SIZE = 8;
+
+// SPI transmit buffer configuration
+// The buffer size must be a power of two, and holds each frame's bytes plus a one byte length
+const byte AUDIO_TX_BUFFER_SIZE = 32;
+const byte AUDIO_PLAY_LENGTH = 12;  // Bytes queued by a single call to playAudio()
+const byte AUDIO_TX_BYTES_PER_TICK = 2;
 
-// Audio clip durations
-const unsigned int AUDIO_DURATION[] = {
+// Status readback configuration
+const bool ISD_READBACK = true;                  // Use MISO if it is found at startup?
+const unsigned int AUDIO_STATUS_LEAD = 200;      // Start polling this long before the estimated end
+const unsigned int AUDIO_STATUS_POLL = 10;       // Time between status reads
+const unsigned int AUDIO_STATUS_TIMEOUT = 1000;  // Give up this long after the estimated end
+
+// Audio clip durations, used unless they can be read from the ISD1700
+const unsigned int AUDIO_DURATION[] PROGMEM = {
 	100,
 	2553,
 	2506,
@@ -30,7 +64,7 @@ const unsigned int AUDIO_DURATION[] = {
 	1000
 };
 
-const byte AUDIO_VOLUME[] = {
+const byte AUDIO_VOLUME[] PROGMEM = {
 	0,
 	0,
 	4,
@@ -47,6 +81,8 @@ const byte SPI_SCLK_PIN = 0;
 const byte SPI_MOSI_PIN = 1;
 const byte SPI_SS_PIN = 8;
 
+// SCLK and MOSI are PD0 and PD1, which the diagnostic link's USART shares (see src/link.h)
+
 
 /////////////////////////
 // ENUMERATIONS
@@ -58,7 +94,8 @@ typedef enum {
 	AUDIO_EXPLOSION = 1,
 	AUDIO_CANARY = 2,
 	AUDIO_COUGH_1 = 3,
-	AUDIO_COUGH_2 = 4
+	AUDIO_COUGH_2 = 4,
+	AUDIO_CLIPS
 } audio_clip;
 
 /////////////////////////
@@ -66,24 +103,47 @@ typedef enum {
 /////////////////////////
 
 const byte ISD_POWER_UP_DELAY = 50;
+const byte ISD_READY_TIMEOUT = 50;     // Longest wait for a command to finish at startup
+const unsigned int ISD_ROW_TIME = 110; // Playback time of a single row of message memory (8 kHz sampling)
+const uint16_t ISD_PTR_MASK = 0x07FF;
 
 // Commands list
 const byte ISD_PU = 0x01;
+const byte ISD_RD_STATUS = 0x05;
+const byte ISD_RD_PLAY_PTR = 0x06;
+const byte ISD_RD_REC_PTR = 0x08;
+const byte ISD_FWD = 0x48;
+const byte ISD_CHK_MEM = 0x49;
 const byte ISD_WR_APC2 = 0x65;
 const byte ISD_SET_PLAY = 0x80;
 
+// Status register bits
+// Every reply starts with the two bytes of SR0; RD_STATUS then returns SR1
+const byte ISD_SR0_CMD_ERR = 0x01;
+const byte ISD_SR0_PU = 0x04;
+const byte ISD_SR1_RDY = 0x01;
+const byte ISD_SR1_ERASE = 0x02;
+const byte ISD_SR1_PLAY = 0x04;
+const byte ISD_SR1_REC = 0x08;
+
+// Replies kept from each frame read back by transmitAudio()
+const byte AUDIO_RX_LENGTH = 3;
+
+// Set in a queued frame's length byte when its reply is to be kept
+const byte AUDIO_FRAME_CAPTURE = 0x80;
+
 // Configuration data
 const uint16_t ISD_APC_DEFAULT_CONFIG = ((B00000100 << 8) + B10100000);
 
-// Audio pointer arrays
-const uint16_t ISD_AUDIO_START_PTR[5] = {
+// Audio pointer arrays, used unless they can be read from the ISD1700
+const uint16_t ISD_AUDIO_START_PTR[5] PROGMEM = {
 	0x010,
 	0x011,
 	0x028,
 	0x03F,
 	0x047
 };
-const uint16_t ISD_AUDIO_STOP_PTR[5] = {
+const uint16_t ISD_AUDIO_STOP_PTR[5] PROGMEM = {
 	0x010,
 	0x027,
 	0x03E,
@@ -103,69 +163,218 @@ void initAudio();
  *
  * Initialization involves setting status variables and pin configurations.
  * The ISD1700 configuration register is also set.
+ *
+ * If the ISD1700's status can be read back, the clips are found in its message memory, taking
+ * a few milliseconds per clip. They must be recorded in audio_clip order.
+ *
+ * Affects Audio_Readback, Audio_Start_Ptr[], Audio_Stop_Ptr[], and Audio_Clip_Duration[]
  */
 
-void playAudio(audio_clip sound);
+bool audioReadback();
+/*
+ * Determines if the ISD1700's status was found to be readable at startup
+ *
+ * OUTPUT: Is playback status read from the ISD1700?
+ */
+
+bool playAudio(audio_clip sound);
 /*
  * Plays an audio clip without blocking additional code from running
  * Defaults to playing at the volume specified in AUDIO_VOLUME[5]
  *
- * Affects Audio_Start, Audio_Duration, and Audio_Playing
+ * Playback begins once the queued commands have been transmitted, within a few system ticks.
+ *
+ * Affects Audio_Start, Audio_Duration, Audio_Playing, and Audio_Status_Next
  * INPUT:  Clip to play
+ * OUTPUT: Was the clip started? (false if the transmit buffer is too full)
  */
 
-void playAudio(audio_clip sound, byte volume);
+bool playAudio(audio_clip sound, byte volume);
 /*
  * Plays an audio clip without blocking additional code from running
  * Also offers a selection of volume reduction (where 0 = loudest and 8 = quietest)
+ * The clip is recorded in the motion trace.
  *
- * Affects Audio_Start, Audio_Duration, and Audio_Playing
+ * Nothing is queued unless both the configuration and play commands fit in the transmit buffer.
+ *
+ * Affects Audio_Start, Audio_Duration, Audio_Playing, and Audio_Status_Next
  * INPUT:  Clip to play
  *         Volume reduction amount (0-8)
+ * OUTPUT: Was the clip started? (false if the transmit buffer is too full)
+ */
+
+bool queueAudio(audio_clip sound, unsigned int gap);
+/*
+ * Adds an audio clip to the end of the playlist
+ * The clip plays at the volume specified in AUDIO_VOLUME[5]
+ *
+ * Affects Audio_Queue_Clip[], Audio_Queue_Gap[], and Audio_Queue_Head
+ * INPUT:  Clip to play
+ *         Silent gap to leave after the clip, in milliseconds
+ * OUTPUT: Was the clip queued? (false if the playlist is full)
+ */
+
+void handleAudioQueue();
+/*
+ * Starts the next clip in the playlist once the previous clip and its gap have finished
+ * A clip that cannot be started yet stays at the head of the playlist until a later pass
+ * Should be called once per pass of any loop
+ *
+ * Affects Audio_Queue_Tail, Audio_Gap, Audio_Start, Audio_Duration, and Audio_Playing
+ */
+
+bool audioQueued();
+/*
+ * Determines if the playlist still has clips to start, or if the clip currently playing
+ * (including its gap) has yet to finish
+ *
+ * OUTPUT: State of audio being busy
  */
 
 void beep();
 /*
- * Plays the BEEP audio clip
+ * Queues the BEEP audio clip, followed by a gap of BEEP_DELAY milliseconds
  *
- * This function waits for the beep to complete, then delays an additional BEEP_DELAY milliseconds.
+ * This function returns immediately. Consecutive calls play one beep after another.
  *
- * Affects Audio_Start and Audio_Duration
+ * Affects Audio_Queue_Clip[], Audio_Queue_Gap[], and Audio_Queue_Head
+ */
+
+bool getAudioDeadline(unsigned long* deadline);
+/*
+ * Determines when playback next changes without being asked to
+ * This is either the end of the clip currently playing (or its next status read, if the status
+ * is read back), or the start of the next queued clip.
+ *
+ * Affects Audio_Playing
+ * INPUT:  Pointer to the deadline, in milliseconds
+ * OUTPUT: Is there a deadline? (false if nothing is playing or queued)
  */
 
 bool audioPlaying();
 /*
  * Gets the status of audio playback
+ * If the status is read back, this also queues the next status read once it is due.
  *
- * Affects Audio_Playing
+ * Affects Audio_Playing, and the status readback variables
  * OUTPUT: State of audio playing
  */
 
 
+bool transmitAudio();
+/*
+ * Transmits up to AUDIO_TX_BYTES_PER_TICK queued bytes to the ISD1700
+ * Must be called from systemTick()
+ *
+ * SPI_SS is held low for the duration of each queued frame. SPI_SCLK and SPI_MOSI are borrowed
+ * from the diagnostic link for each frame (see src/link.h), so a frame may wait a tick or two for
+ * the link to finish sending its current byte. The reply to a frame queued for capture is kept in
+ * Audio_Rx_Buffer[].
+ *
+ * Affects Audio_Tx_Tail, Audio_Tx_Remaining, Audio_Rx_Buffer[], and Audio_Status_Received
+ * OUTPUT: Are any bytes left to transmit?
+ */
+
+
 /////////////////////////
 // INTERNAL FUNCTIONS
 /////////////////////////
 
-void configAudio(uint16_t configuration);
+bool configAudio(uint16_t configuration);
 /*
  * Configures the ISD1700 device
  * Can be used to change volume
  *
  * INPUT:  configuration bytes to use
+ * OUTPUT: Was the command queued? (false if the transmit buffer is too full)
+ */
+
+bool queueFrame(const byte* frame, byte length, bool capture);
+/*
+ * Queues a single SPI command frame for transmission to the ISD1700
+ *
+ * If the frame does not fit in the transmit buffer, nothing is queued and this returns
+ * immediately, rather than waiting for transmitAudio() to make room.
+ * The system tick is started, in case it was stopped while idle.
+ *
+ * Affects Audio_Tx_Buffer[] and Audio_Tx_Head
+ * INPUT:  Command bytes
+ *         Number of command bytes (up to 127)
+ *         Keep the reply? (the first AUDIO_RX_LENGTH bytes)
+ * OUTPUT: Was the frame queued?
+ */
+
+bool audioTxRoom(byte length);
+/*
+ * Determines if the transmit buffer has room for a number of bytes, including frame lengths
+ * Only transmitAudio() frees room, so the answer holds until queueFrame() is next called
+ *
+ * INPUT:  Number of bytes
+ * OUTPUT: Is there room? (one slot is always left free to tell a full buffer from an empty one)
+ */
+
+void checkPlaybackStatus(unsigned long elapsed);
+/*
+ * Ends playback once a status read shows the ISD1700 has stopped playing, or once the clip has
+ * outlasted its estimate by AUDIO_STATUS_TIMEOUT, and otherwise queues the next status read when due
+ * Used by audioPlaying() while the status is read back
+ *
+ * Affects Audio_Playing, Audio_Duration, and the status readback variables
+ * INPUT:  Time since playback started
+ */
+
+void transferFrame(const byte* frame, byte length, byte* reply);
+/*
+ * Exchanges a single SPI frame with the ISD1700 immediately, bypassing the transmit buffer
+ * Only used by initAudio(), before the diagnostic link claims the shared pins
+ *
+ * INPUT:  Command bytes
+ *         Number of command bytes
+ *         Buffer for the reply, as long as the frame (or NULL)
+ */
+
+bool readStatus(byte status[3]);
+/*
+ * Reads the ISD1700's status registers immediately
+ *
+ * INPUT:  Buffer for SR0 (bytes 0-1) and SR1 (byte 2)
+ * OUTPUT: Is the ISD1700 powered up, ready, and idle, without a command error?
+ */
+
+bool detectReadback();
+/*
+ * Determines if the ISD1700's replies can be read, by checking its status twice after power-up
+ *
+ * OUTPUT: Was a valid status read both times?
+ */
+
+bool waitReady();
+/*
+ * Waits for the ISD1700 to finish a command, for up to ISD_READY_TIMEOUT milliseconds
+ *
+ * OUTPUT: Did it finish?
+ */
+
+uint16_t readPointer(byte command);
+/*
+ * Reads one of the ISD1700's message pointers immediately
+ *
+ * INPUT:  Pointer read command (ISD_RD_PLAY_PTR or ISD_RD_REC_PTR)
+ * OUTPUT: Pointer value
  */
 
-void sendByte(uint8_t transmission);
+void discoverClips();
 /*
- * Sends a single byte via SPI to the ISD1700
- * SPI_SS pin must still be manually set before and after a command
+ * Finds the start and end of every clip in the ISD1700's message memory
+ * The built-in pointers and durations are kept unless exactly AUDIO_CLIPS messages are found.
  *
- * INPUT:  Byte to transmit
+ * Affects Audio_Start_Ptr[], Audio_Stop_Ptr[], and Audio_Clip_Duration[]
  */
 
 byte getByte(uint16_t input, byte byteSelect);
 /*
  * Gets a single byte out of a two-byte input
- * Used with sendByte() to send SPI commands to the ISD1700
+ * Used to build SPI commands for the ISD1700
  *
  * INPUT:  Two-byte input
  *         Selection of output byte (0-indexed)
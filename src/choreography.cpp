@@ -0,0 +1,126 @@
+#include "choreography.h"
+#include "scheduler.h"
+
+// Timeline state, with one bit per cue
+bool Choreo_Running = false;                      // Has a run started, and not yet ended?
+byte Choreo_Armed = 0;                            // Cues still to be given
+byte Choreo_Waiting = 0;                          // Armed cues still waiting for their motor state
+byte Choreo_Pressed = 0;                          // Cues to give once more, as the arcade button was pressed
+unsigned long Choreo_Due[CHOREO_CUE_COUNT];       // Time each armed cue's delay ends, once its wait is over
+unsigned long Choreo_Last_Cue = 0;                // Time a motor was last cued
+
+void handleChoreography(bool enabled) {
+	if(!enabled) {
+		Choreo_Running = false;
+		Choreo_Armed = 0;
+		Choreo_Pressed = 0;
+		return;
+	}
+
+	// A press during a run gives every cue once more, so a short press is never lost
+	bool Held = sensorEngaged(BUTTON);
+	if(sensorRising(BUTTON) && Choreo_Running) {
+		Choreo_Pressed = CHOREO_ALL_CUES;
+	}
+	else if(!Choreo_Running) {
+		if(!sensorRising(BUTTON) && !Held) {
+			return;
+		}
+		Choreo_Running = true;
+		Choreo_Armed = CHOREO_ALL_CUES;
+		Choreo_Waiting = CHOREO_ALL_CUES;
+	}
+
+	unsigned long Now = getLoopTime();
+	for(byte Step = 0; Step < CHOREO_CUE_COUNT; Step++) {
+		const choreo_cue* Cue = &CHOREO_TIMELINE[Step];
+		output_group Motor = (output_group)pgm_read_byte(&Cue->Motor);
+		byte Bit = (1 << Step);
+		motor_state State = getMotorState(Motor);
+
+		// Once given, a cue is given again as soon as its motor is back in IDLE, without waiting on
+		// another motor again, so the timeline's order only holds for the first trip of a run
+		if(!(Choreo_Armed & Bit)) {
+			if(!Held && !(Choreo_Pressed & Bit)) {
+				continue;
+			}
+			if(State == FAULTED) {
+				Choreo_Pressed &= ~Bit;
+			}
+			if(State != IDLE) {
+				continue;
+			}
+			Choreo_Pressed &= ~Bit;
+			Choreo_Armed |= Bit;
+			Choreo_Due[Step] = Now;
+		}
+
+		if(Choreo_Waiting & Bit) {
+			if(!cueTriggered(Cue)) {
+				continue;
+			}
+			Choreo_Waiting &= ~Bit;
+			Choreo_Due[Step] = (Now + pgm_read_word(&Cue->Delay));
+		}
+		if(!cueReady(Step)) {
+			continue;
+		}
+
+		// A motor still finishing its last trip is waited for, and a faulted motor is skipped
+		if(State == IDLE) {
+			cueMotor(Motor);
+			Choreo_Last_Cue = Now;
+		}
+		else if(State != FAULTED) {
+			continue;
+		}
+		Choreo_Armed &= ~Bit;
+	}
+
+	// The run ends once every cue has been given, and the button is neither held nor pressed again
+	if(!Choreo_Armed && !Choreo_Pressed && !Held) {
+		Choreo_Running = false;
+	}
+	return;
+}
+
+bool getChoreographyDeadline(unsigned long* deadline) {
+	// Waits for a motor state or the arcade button are ended by a pass of the motor state machines
+	bool Found = false;
+	for(byte Step = 0; Step < CHOREO_CUE_COUNT; Step++) {
+		byte Bit = (1 << Step);
+		if(!(Choreo_Armed & Bit) || (Choreo_Waiting & Bit)) {
+			continue;
+		}
+
+		// Once the cue is ready, only the cued motor coming to rest can move the timeline on
+		if(cueReady(Step)) {
+			continue;
+		}
+		unsigned long Stagger_End = (Choreo_Last_Cue + CHOREO_CUE_GAP);
+		unsigned long Ready = (((long)(Choreo_Due[Step] - Stagger_End) > 0) ? Choreo_Due[Step] : Stagger_End);
+		if(!Found || ((long)(Ready - *deadline) < 0)) {
+			*deadline = Ready;
+			Found = true;
+		}
+	}
+	return Found;
+}
+
+bool cueTriggered(const choreo_cue* cue) {
+	byte After = pgm_read_byte(&cue->After);
+	if(After == CHOREO_RUN_START) {
+		return true;
+	}
+
+	motor_state State = getMotorState((output_group)After);
+	return((State == pgm_read_byte(&cue->State)) || (State == FAULTED));
+}
+
+bool cueReady(byte step) {
+	unsigned long Now = getLoopTime();
+	if((long)(Now - Choreo_Due[step]) < 0) {
+		return false;
+	}
+	return((Now - Choreo_Last_Cue) >= CHOREO_CUE_GAP);
+}
@@ -0,0 +1,110 @@
+/* Choreography Module
+ *
+ * Used to sequence the motors along a common timeline, rather than starting all
+ * three on the arcade button at once
+ *
+ * A run starts when the arcade button is pressed or held, and gives every cue of CHOREO_TIMELINE[].
+ * Each cue waits for another motor to be seen in a given state (or for the run to start), then for
+ * a delay, then cues its own motor (see cueMotor()). The timeline only sets the order the motors
+ * first set off in. While the button stays held, each motor is cued again as soon as it is back in
+ * IDLE, without waiting on the others, so each cycles at the pace set by MOTOR_IDLE_DELAY[], as
+ * without the timeline. A press during a run cues every motor once more in the same way, so a
+ * short press is never lost. No two cues are less than CHOREO_CUE_GAP apart, so motors never start
+ * together.
+ *
+ * Cues only start motors waiting in IDLE; every other transition, including every safety state,
+ * is still taken by the motor state machines alone. A faulted motor sits out the rest of the
+ * show, and counts as having reached any state a later cue waits for, so one fault never stalls
+ * the others.
+ */
+
+#ifndef choreography_h
+#define choreography_h
+#include <arduino.h>
+#include <avr/pgmspace.h>
+#include "input.h"
+#include "power.h"
+#include "motor.h"
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// A single cue of the timeline, stored in PROGMEM (enumerations are held in bytes)
+typedef struct {
+	byte Motor;      // output_group to cue
+	byte After;      // output_group whose state the cue waits for, or CHOREO_RUN_START
+	byte State;      // motor_state the After motor must be seen in
+	uint16_t Delay;  // Time from the end of the wait until the cue, in milliseconds
+} choreo_cue;
+
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// Waits for the start of the run, rather than for a motor
+const byte CHOREO_RUN_START = 0xFF;
+
+// Minimum time between any two cues, leaving at least RELAY_STAGGER_DELAY between the motors
+// drawing current once the first step of each ramp is taken
+const unsigned int CHOREO_CUE_GAP = (RELAY_STAGGER_DELAY + 50);
+
+// Cues of a run, at most 8
+const choreo_cue CHOREO_TIMELINE[] PROGMEM = {
+	{CART_MOTOR, CHOREO_RUN_START, IDLE, 0},       // Cart sets off as the run starts
+	{LOADER_MOTOR, CART_MOTOR, MOVE, 0},           // Loader drops while the cart is under way
+	{ELEVATOR_MOTOR, LOADER_MOTOR, MOVE_START, 0}  // Elevator raises once the loader electromagnet has engaged
+};
+const byte CHOREO_CUE_COUNT = (sizeof(CHOREO_TIMELINE) / sizeof(CHOREO_TIMELINE[0]));
+const byte CHOREO_ALL_CUES = ((1 << CHOREO_CUE_COUNT) - 1);
+
+static_assert(CHOREO_CUE_COUNT <= 8, "Cues are tracked one bit each in a byte");
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void handleChoreography(bool enabled);
+/*
+ * Runs a single pass of the timeline, cueing every motor whose cue is due
+ * Should be called after every pass of the motor state machines
+ *
+ * Affects Choreo_Running, Choreo_Armed, Choreo_Waiting, Choreo_Pressed, Choreo_Due[],
+ *         Choreo_Last_Cue, and the cues of the motors
+ * INPUT:  Run the timeline? (false abandons any run, such as while calibrating)
+ */
+
+bool getChoreographyDeadline(unsigned long* deadline);
+/*
+ * Determines when the timeline next needs to run, other than when the inputs or any motor's
+ * state change
+ *
+ * INPUT:  Pointer to the deadline, in milliseconds
+ * OUTPUT: Is there a deadline?
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+bool cueTriggered(const choreo_cue* cue);
+/*
+ * Determines if the wait of a cue is over
+ *
+ * INPUT:  Cue, in PROGMEM
+ * OUTPUT: Has the run started, or the motor waited for reached its state (or faulted)?
+ */
+
+bool cueReady(byte step);
+/*
+ * Determines if a cue whose wait is over may be given
+ *
+ * INPUT:  Cue's position in CHOREO_TIMELINE[]
+ * OUTPUT: Have both the cue's delay and CHOREO_CUE_GAP since the last cue passed?
+ */
+
+
+#endif
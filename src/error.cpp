@@ -1,68 +1,126 @@
 #include "error.h"
+#include "trace.h"
+#include "profile.h"
 
-bool Error_Status[MACRO_ERROR_CODES];
-unsigned long Error_Tick_Start = 0;
-byte Error_Tick_Curr = 0;              // Current tick within the cycle (0-indexed)
-byte Error_Cycle_Blinks = 0;           // Number of blinks in the current cycle (1-indexed)
+volatile uint16_t Error_Mask = 0;  // Bit n - 1 = error code n, only written outside interrupt context
+
+// Display state, owned by errorTick() once the watchdog tick is running
+byte Error_Period = 0;      // Watchdog periods elapsed within the current tick
+byte Error_Tick_Curr = 0;   // Current tick within the cycle (0-indexed)
+byte Error_Cycle_Code = 0;  // Error code displayed in the current cycle (0 = none)
 
 void initErrors() {
+	halPinMode<ERROR_PIN>(OUTPUT);
 	clearErrors();
-	pinMode(ERROR_PIN, OUTPUT);
 	return;
 }
 
-void handleErrorCodeDisplay() {
-	unsigned int Tick_Elapsed_Time = millis() - Error_Tick_Start;
+void errorTick() {
+	PROFILE_BEGIN(Error_Start);
+	Error_Period += 1;
 
-	if(Tick_Elapsed_Time >= ERROR_TICK_TIME) {
+	if(Error_Period >= ERROR_TICK_PERIODS) {
+		Error_Period = 0;
 		Error_Tick_Curr += 1;
-		if(Error_Tick_Curr == ERROR_CODES) {
+		if(Error_Tick_Curr >= ERROR_CYCLE_TICKS) {
 			Error_Tick_Curr = 0;
-			Error_Cycle_Blinks = getBlinksNext(Error_Cycle_Blinks);
+			Error_Cycle_Code = getErrorNext(Error_Cycle_Code);
 		}
-		if(Error_Tick_Curr < Error_Cycle_Blinks) {
-			digitalWrite(ERROR_PIN, HIGH);
+		if(Error_Tick_Curr < getErrorBlinks(Error_Cycle_Code)) {
+			halDigitalWrite<ERROR_PIN>(HIGH);
 		}
-		Error_Tick_Start = millis();
 	}
-	else if(Tick_Elapsed_Time >= ERROR_BLINK_TIME) {
-		digitalWrite(ERROR_PIN, LOW);
+	else {
+		// An extended code's first blink is its long one
+		byte Blink_Periods = ERROR_BLINK_PERIODS;
+		if((Error_Tick_Curr == 0) && (Error_Cycle_Code >= ERROR_EXTENDED)) {
+			Blink_Periods = ERROR_LONG_BLINK_PERIODS;
+		}
+		if(Error_Period == Blink_Periods) {
+			halDigitalWrite<ERROR_PIN>(LOW);
+		}
 	}
+	PROFILE_END(PROFILE_ERROR_TICK, Error_Start);
 	return;
 }
 
 void flagError(byte error) {
-	if((error == 0) || (error > CRITICAL_ERROR)) {
+	if((error == 0) || (error > ERROR_CODES)) {
 		return;
 	}
-	else if(error == CRITICAL_ERROR) {
+	traceEvent(TRACE_ERROR, 0, error);
+	if(error == CRITICAL_ERROR) {
 		clearErrors();
+		freezeTrace();
 	}
-	Error_Status[error - 1] = true;
+
+	// The first error starts a new cycle on the next watchdog period
+	byte Old_SREG = SREG;
+	noInterrupts();
+	if(Error_Mask == 0) {
+		Error_Period = (ERROR_TICK_PERIODS - 1);
+		Error_Tick_Curr = (ERROR_CYCLE_TICKS - 1);
+		Error_Cycle_Code = 0;
+		halStartWatchdogTick();
+	}
+	Error_Mask |= (((uint16_t) 1) << (error - 1));
+	SREG = Old_SREG;
 	return;
 }
 
+bool errorFlagged(byte error) {
+	if((error == 0) || (error > ERROR_CODES)) {
+		return false;
+	}
+	return(Error_Mask & (((uint16_t) 1) << (error - 1)));
+}
+
+uint16_t getErrorMask() {
+	return Error_Mask;
+}
+
 void clearErrors() {
-	for(byte Error = 0; Error < ERROR_CODES; Error++) {
-		Error_Status[Error] = false;
+	byte Old_SREG = SREG;
+	noInterrupts();
+	Error_Mask = 0;
+	halStopWatchdogTick();
+	halDigitalWrite<ERROR_PIN>(LOW);
+	SREG = Old_SREG;
+	return;
+}
+
+void clearError(byte error) {
+	if((error == 0) || (error > ERROR_CODES)) {
+		return;
 	}
+	byte Old_SREG = SREG;
+	noInterrupts();
+	Error_Mask &= ~(((uint16_t) 1) << (error - 1));
+	if(Error_Mask == 0) {
+		halStopWatchdogTick();
+		halDigitalWrite<ERROR_PIN>(LOW);
+	}
+	SREG = Old_SREG;
 	return;
 }
 
-byte getBlinksNext(byte blinks_prev) {
-	if(blinks_prev < ERROR_CODES) {
-		for(byte Blinks_Test = (blinks_prev + 1); Blinks_Test <= ERROR_CODES; Blinks_Test++) {
-			if(Error_Status[Blinks_Test - 1]) {
-				return Blinks_Test;
-			}
-		}
+byte getErrorNext(byte error_prev) {
+	uint16_t Mask = Error_Mask;
+	if(Mask == 0) {
+		return 0;
 	}
-	if(blinks_prev > 0) {
-		for(byte Blinks_Test = 1; Blinks_Test <= blinks_prev; Blinks_Test++) {
-			if(Error_Status[Blinks_Test - 1]) {
-				return Blinks_Test;
-			}
-		}
+
+	// Bit 0 of the shifted mask is the code after the previous one
+	uint16_t Later = ((error_prev < 16) ? (Mask >> error_prev) : 0);
+	if(Later != 0) {
+		return(error_prev + 1 + __builtin_ctz(Later));
+	}
+	return(1 + __builtin_ctz(Mask));
+}
+
+byte getErrorBlinks(byte error) {
+	if(error >= ERROR_EXTENDED) {
+		return(error - CRITICAL_ERROR + 1);
 	}
-	return 0;
+	return error;
 }
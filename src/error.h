@@ -4,17 +4,17 @@
  *
  * Error codes are displayed by blinking the corresponding number of times to the error code.
  * If multiple errors are set, each error is displayed in increasing order.
- * The highest error code is a critical error. If it is set, all other errors are cleared,
+ * CRITICAL_ERROR is a critical error. If it is set, all other errors are cleared,
  * and the status LED blinks constantly. All Firmware operation should be halted if this happens.
  *
- * Each error code is displayed within a "cycle". Each cycle consists of ERROR_CODES "ticks".
+ * Each error code is displayed within a "cycle". Each cycle consists of ERROR_CYCLE_TICKS "ticks".
  * Each tick lasts for ERROR_TICK_TIME milliseconds. At the beginning of each tick,
  * the LED may or may not turn on to represent a "blink".
  * After ERROR_BLINK_TIME elapses within a tick, the LED will be disabled.
  * The next cycle starts immediately afterwards, with no additional gap. As a result,
- * the error ERROR_CODES will constantly blink.
+ * the error ERROR_CYCLE_TICKS will constantly blink.
  *
- * The following diagram assumes ERROR_CODES = 3 and the error code 2 is being displayed repeatedly:
+ * The following diagram assumes ERROR_CYCLE_TICKS = 3 and the error code 2 is being displayed repeatedly:
  *
  * |_________           |_________           |                    |_________           |
  * |         |__________|         |_______________________________|         |__________| and so on...
@@ -22,23 +22,48 @@
  *  --------tick-------- --------tick-------- --------tick--------
  * -----------------------------cycle-----------------------------
  *
+ * Codes from ERROR_EXTENDED upwards would take too many blinks to count, so each starts with a
+ * single long blink, lasting ERROR_LONG_BLINK_TIME, followed by one blink for every code past
+ * CRITICAL_ERROR. For example, error 12 is shown as one long blink and two short ones.
+ *
+ * Every code is held as a single bit of Error_Mask, so the next code to display is found by
+ * counting trailing zeros rather than scanning. The display is driven by the watchdog timer's
+ * interrupt (see halStartWatchdogTick()), which only runs while an error is flagged, so loop()
+ * pays nothing for it, and the LED keeps blinking through code that blocks loop().
+ * Times are counted in whole watchdog periods, so each is rounded down to a multiple of
+ * WATCHDOG_TICK_MS.
+ *
  * Written by Alex Tavares <tavaresa13@gmail.com>
  */
 
 #ifndef error_h
 #define error_h
 #include <arduino.h>
+#include "hal.h"
 
 /////////////////////////
 // CONFIGURATION VARIABLES
 /////////////////////////
 
-#define MACRO_ERROR_CODES 10
+// Error codes (1-indexed), see the Error Codes documentation
+const byte ERROR_CODES = 16;
+const byte CRITICAL_ERROR = 10;
+const byte ERROR_EXTENDED = 11;      // First code displayed with a long blink
+const byte ERROR_MOTOR_WORN = 11;    // Plus the motor (0-indexed)
+const byte ERROR_SERVICE_SOON = 14;  // Plus the motor (0-indexed)
 
-const byte ERROR_CODES = MACRO_ERROR_CODES;
-const byte CRITICAL_ERROR = MACRO_ERROR_CODES;
+const byte ERROR_CYCLE_TICKS = 10;
 const unsigned int ERROR_TICK_TIME = 250;
 const unsigned int ERROR_BLINK_TIME = 100;
+const unsigned int ERROR_LONG_BLINK_TIME = 200;
+
+// Display times, in watchdog periods
+const byte ERROR_TICK_PERIODS = (ERROR_TICK_TIME / WATCHDOG_TICK_MS);
+const byte ERROR_BLINK_PERIODS = (ERROR_BLINK_TIME / WATCHDOG_TICK_MS);
+const byte ERROR_LONG_BLINK_PERIODS = (ERROR_LONG_BLINK_TIME / WATCHDOG_TICK_MS);
+
+static_assert(ERROR_CODES <= 16, "Error codes are held in a 16-bit mask");
+static_assert((ERROR_CODES - CRITICAL_ERROR + 1) <= ERROR_CYCLE_TICKS, "Every extended code's blinks must fit within a cycle");
 
 
 /////////////////////////
@@ -59,30 +84,48 @@ void initErrors();
  *
  * Initialization involves setting status variables and pin configuration.
  *
- * Affects Error_Status[]
+ * Affects Error_Mask
  */
 
-void handleErrorCodeDisplay();
+void flagError(byte error);
 /*
- * Updates the EWMC status LED to display error codes
- * Must be placed within a loop that executes regularly
+ * Sets a single error code to true, recording it in the motion trace
+ * A critical error also freezes the motion trace (see src/trace.h).
+ *
+ * The display starts within one watchdog period if no other error was flagged.
  *
- * Affects Error_Tick_Start, Error_Tick_Curr, and Error_Cycle_Blinks
+ * Affects Error_Mask, the display state, and the motion trace
+ * INPUT:  Error code to set (1-indexed)
  */
 
-void flagError(byte error);
+bool errorFlagged(byte error);
 /*
- * Sets a single error code to true
+ * Determines if a single error code is set
  *
- * Affects Error_Status[]
- * INPUT:  Error code to set (1-indexed)
+ * INPUT:  Error code in question (1-indexed)
+ * OUTPUT: Is the error code set?
+ */
+
+uint16_t getErrorMask();
+/*
+ * Gets every set error code at once
+ *
+ * OUTPUT: Bitmask of error codes (bit 0 = error 1)
  */
 
 void clearErrors();
 /*
- * Clears all error codes
+ * Clears all error codes, turning the status LED off and stopping the display
+ *
+ * Affects Error_Mask
+ */
+
+void clearError(byte error);
+/*
+ * Clears a single error code, stopping the display if no other code is set
  *
- * Affects Error_Status[]
+ * Affects Error_Mask
+ * INPUT:  Error code to clear (1-indexed)
  */
 
 
@@ -90,16 +133,24 @@ void clearErrors();
 // INTERNAL FUNCTIONS
 /////////////////////////
 
-byte getBlinksNext(byte blinks_prev);
+byte getErrorNext(byte error_prev);
 /*
- * Scans through active errors and determines the next one to display
- * Used by handleErrorCodeDisplay()
+ * Determines the next flagged error to display, wrapping around to the lowest
+ * Used by errorTick()
  *
  * If no errors are flagged, returns 0.
  *
- * INPUT:  Previous displayed error (1-indexed)
+ * INPUT:  Previous displayed error (1-indexed, or 0 for none)
  * OUTPUT: Next error to display (1-indexed)
  */
 
+byte getErrorBlinks(byte error);
+/*
+ * Determines how many blinks display an error code, including the long blink of an extended code
+ *
+ * INPUT:  Error code (1-indexed, or 0 for none)
+ * OUTPUT: Number of blinks
+ */
+
 
 #endif
@@ -0,0 +1,235 @@
+#include "hal.h"
+#include <EEPROM.h>
+#include <avr/sleep.h>
+
+// Maintained by the Arduino core's Timer0 overflow interrupt (wiring.c)
+extern volatile unsigned long timer0_overflow_count;
+
+// Output compare register of each PWM channel (indexed by pwm_channel)
+// Timer1 runs in 8-bit mode, so only the low byte of its 16-bit registers is used
+volatile uint8_t* const PWM_OCR[4] = {&OCR2A, &OCR1BL, &OCR1AL, &OCR2B};
+
+// Clock select bits of each carrier (indexed by pwm_carrier); Timer2 has more prescaler steps than Timer1
+const byte PWM_TIMER1_CLOCK[PWM_CARRIERS] = {B00000100, B00000011, B00000010, B00000001};
+const byte PWM_TIMER2_CLOCK[PWM_CARRIERS] = {B00000110, B00000100, B00000010, B00000001};
+
+// TXC0 is only set once a byte has been sent, so it cannot tell an idle USART apart before the first
+volatile bool Hal_Link_Written = false;
+
+byte halReadInputPorts() {
+	return((PINC & 0x3F) | ((PINB & _BV(PINB4)) << 2));
+}
+
+void halInitSystemTick() {
+	// Timer0 is already running (fast PWM, /64 prescaler) for millis()
+	OCR0A = 0x00;
+	OCR0B = 0x80;
+	TIMSK0 |= (_BV(OCIE0A) | _BV(OCIE0B));
+
+	// Wake on any change of PC0-PC5 (endstops) or PB4 (arcade button)
+	PCMSK1 = 0x3F;
+	PCMSK0 = _BV(PCINT4);
+	PCIFR = (_BV(PCIF1) | _BV(PCIF0));
+	PCICR |= (_BV(PCIE1) | _BV(PCIE0));
+	return;
+}
+
+void halStartSystemTick() {
+	TIMSK0 |= (_BV(OCIE0A) | _BV(OCIE0B));
+	return;
+}
+
+void halStopSystemTick() {
+	TIMSK0 &= ~(_BV(OCIE0A) | _BV(OCIE0B));
+	return;
+}
+
+void halStartWatchdogTick() {
+	byte Old_SREG = SREG;
+	noInterrupts();
+	if(!(WDTCSR & _BV(WDIE))) {
+		// The prescaler can only be changed within 4 cycles of setting WDCE; WDE is cleared by the second write
+		WDTCSR = (_BV(WDCE) | _BV(WDE));
+		WDTCSR = _BV(WDIE);
+	}
+	SREG = Old_SREG;
+	return;
+}
+
+void halStopWatchdogTick() {
+	WDTCSR &= ~_BV(WDIE);
+	return;
+}
+
+void halSleep() {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+
+	// The instruction following sei always executes before any pending interrupt is serviced
+	interrupts();
+	sleep_cpu();
+	sleep_disable();
+	return;
+}
+
+uint16_t halReadTimestamp() {
+	byte Old_SREG = SREG;
+	noInterrupts();
+	byte Count = TCNT0;
+	byte Overflows = timer0_overflow_count;
+
+	// Account for an overflow which has not been serviced yet
+	if((TIFR0 & _BV(TOV0)) && (Count < 255)) {
+		Overflows += 1;
+	}
+	SREG = Old_SREG;
+	return((((uint16_t) Overflows) << 8) | Count);
+}
+
+void halInitSpiInput() {
+	// Bandgap on the positive input, and the ADC multiplexer (channel 6) on the negative input
+	ADCSRA &= ~_BV(ADEN);
+	ADMUX = 6;
+	ADCSRB |= _BV(ACME);
+	ACSR = _BV(ACBG);
+	return;
+}
+
+void halInitPWM(pwm_carrier carrier) {
+	// Phase-correct 8-bit PWM on both channels of each timer
+	TCCR1A = B10100001;
+	TCCR1B = PWM_TIMER1_CLOCK[carrier];
+	TCCR2A = B10100001;
+	TCCR2B = PWM_TIMER2_CLOCK[carrier];
+	return;
+}
+
+void halSetPWM(pwm_channel channel, uint8_t pwm) {
+	*PWM_OCR[channel] = pwm;
+	return;
+}
+
+void halSetDrive(pwm_channel channel, uint8_t pwm, byte dir_pin, bool dir_level) {
+	byte Old_SREG = SREG;
+	noInterrupts();
+
+	// The pin is only known at run time, so its port is looked up rather than assumed
+	if(dir_level) {
+		_SFR_IO8(halPinRegister(dir_pin, 2)) |= _BV(halPinBit(dir_pin));
+	}
+	else {
+		_SFR_IO8(halPinRegister(dir_pin, 2)) &= ~_BV(halPinBit(dir_pin));
+	}
+	*PWM_OCR[channel] = pwm;
+	SREG = Old_SREG;
+	return;
+}
+
+byte halEepromRead(uint16_t address) {
+	return(EEPROM.read(address));
+}
+
+void halEepromWrite(uint16_t address, byte value) {
+	EEPROM.write(address, value);
+	return;
+}
+
+void halEepromUpdate(uint16_t address, byte value) {
+	EEPROM.update(address, value);
+	return;
+}
+
+void halEepromWriteAsync(uint16_t address, byte value) {
+	EEAR = address;
+	EEDR = value;
+
+	// EEPE must be set within four cycles of EEMPE, so no interrupt may come between them
+	byte Old_SREG = SREG;
+	noInterrupts();
+	EECR |= _BV(EEMPE);
+	EECR |= _BV(EEPE);
+	SREG = Old_SREG;
+	return;
+}
+
+void halEepromReadyInterrupt(bool enabled) {
+	if(enabled) {
+		EECR |= _BV(EERIE);
+	}
+	else {
+		EECR &= ~_BV(EERIE);
+	}
+	return;
+}
+
+void halInitLink(unsigned long baud) {
+	// Double speed mode, rounding the divider to the nearest baud rate
+	UCSR0A = _BV(U2X0);
+	UBRR0 = (((F_CPU / 8) + (baud / 2)) / baud) - 1;
+	UCSR0C = (_BV(UCSZ01) | _BV(UCSZ00));
+	UCSR0B = (_BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0));
+	return;
+}
+
+void halLinkEnable(bool enabled) {
+	if(enabled) {
+		UCSR0B |= (_BV(RXEN0) | _BV(TXEN0));
+	}
+	else {
+		UCSR0B &= ~(_BV(UDRIE0) | _BV(RXEN0) | _BV(TXEN0));
+	}
+	return;
+}
+
+void halLinkTransmitInterrupt(bool enabled) {
+	if(enabled) {
+		UCSR0B |= _BV(UDRIE0);
+	}
+	else {
+		UCSR0B &= ~_BV(UDRIE0);
+	}
+	return;
+}
+
+void halLinkWrite(byte data) {
+	// Writing TXC0 clears it, so it is only set again once this byte has been sent
+	UCSR0A = (_BV(TXC0) | _BV(U2X0));
+	UDR0 = data;
+	Hal_Link_Written = true;
+	return;
+}
+
+bool halLinkIdle() {
+	return(!Hal_Link_Written || (UCSR0A & _BV(TXC0)));
+}
+
+ISR(TIMER0_COMPA_vect) {
+	systemTick();
+}
+
+ISR(TIMER0_COMPB_vect, ISR_ALIASOF(TIMER0_COMPA_vect));
+
+ISR(PCINT1_vect) {
+	halStartSystemTick();
+}
+
+ISR(PCINT0_vect, ISR_ALIASOF(PCINT1_vect));
+
+ISR(WDT_vect) {
+	errorTick();
+}
+
+ISR(EE_READY_vect) {
+	eepromReady();
+}
+
+
+ISR(USART_RX_vect) {
+	// The error flags belong to the byte in UDR0, so they must be read first
+	bool Error = (UCSR0A & (_BV(FE0) | _BV(DOR0)));
+	linkReceived(UDR0, Error);
+}
+
+ISR(USART_UDRE_vect) {
+	linkTransmitReady();
+}
\ No newline at end of file
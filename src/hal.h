@@ -0,0 +1,584 @@
+/* Hardware Abstraction Module
+ *
+ * Used to isolate all direct hardware access of the EWMC Firmware behind a small set of functions
+ *
+ * This includes GPIO pin access, the system tick interrupt, pin change wake-up, idle sleep,
+ * the profiling timestamp, the ISD1700 SPI lines, PWM timer configuration, EEPROM storage, and
+ * the USART carrying the diagnostic link.
+ * Timekeeping (millis(), delay(), and random()) continues to use the Arduino core API.
+ *
+ * Two backends implement this interface. The AVR backend (hal.cpp) drives the ATmega 328P directly
+ * and is the only one built by the Arduino IDE. The host backend (sim/hal_host.cpp) is used by the
+ * Linux simulation build; it provides simulated endstops, a virtual millis clock, an in-memory
+ * EEPROM, a mock ISD1700, and a simulated USART. See the EWMC Simulation documentation for details.
+ *
+ * GPIO pins are template arguments rather than function arguments, so each pin's port and bit are
+ * resolved at compile time instead of through the Arduino core's lookup tables on every call. Each
+ * module checks its own pin definitions against the wiring this module expects with static_assert,
+ * so a mis-wired board description fails to compile.
+ */
+
+#ifndef hal_h
+#define hal_h
+#include <arduino.h>
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// System tick period
+// The tick is generated by both compare channels of Timer0, offset by half a period, so it
+// coexists with millis() and with the Timer1/Timer2 PWM outputs (16 MHz / 64 / 128 = 1953 Hz)
+const unsigned int SYSTEM_TICK_US = 512;
+
+// Watchdog tick period
+// Every timer is already taken, so slow periodic work uses the watchdog timer's interrupt mode
+// (2048 cycles of its 128 kHz oscillator); it is never set to reset the MCU
+const byte WATCHDOG_TICK_MS = 16;
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// GPIO ports of the ATmega 328P
+// Numbered so that each port's PINx, DDRx, and PORTx registers start at I/O address 0x03 + (3 * port)
+typedef enum {
+	HAL_PORT_B = 0,
+	HAL_PORT_C = 1,
+	HAL_PORT_D = 2
+} hal_port;
+
+// Available PWM timer channels
+typedef enum {
+	PWM_CHANNEL_OC2A = 0,
+	PWM_CHANNEL_OC1B = 1,
+	PWM_CHANNEL_OC1A = 2,
+	PWM_CHANNEL_OC2B = 3
+} pwm_channel;
+
+// Available PWM carrier frequencies
+// Every carrier is 8-bit phase-correct PWM, so a duty cycle of 0-255 means the same at each one
+typedef enum {
+	PWM_CARRIER_122HZ = 0,   // 16 MHz / 256 / 510; audible through the speaker
+	PWM_CARRIER_490HZ = 1,   // 16 MHz / 64 / 510
+	PWM_CARRIER_3900HZ = 2,  // 16 MHz / 8 / 510
+	PWM_CARRIER_31KHZ = 3,   // 16 MHz / 1 / 510; ultrasonic
+	PWM_CARRIERS
+} pwm_carrier;
+
+
+/////////////////////////
+// PIN MAPPING
+/////////////////////////
+
+// Pins are numbered as on the Arduino Uno: 0-7 are PD0-PD7, 8-13 are PB0-PB5, and 14-19 (A0-A5)
+// are PC0-PC5. Every function here is evaluated at compile time, so board descriptions can be
+// checked with static_assert, and the pin templates below reduce to single-bit port accesses.
+
+const byte HAL_PINS = 20;
+
+constexpr bool halPinExists(byte pin) {
+	return(pin < HAL_PINS);
+}
+/*
+ * Determines if a pin number exists on the ATmega 328P
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: Does the pin exist?
+ */
+
+constexpr hal_port halPinPort(byte pin) {
+	return((pin < 8) ? HAL_PORT_D : ((pin < 14) ? HAL_PORT_B : HAL_PORT_C));
+}
+/*
+ * Gets the GPIO port of a pin
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: Port
+ */
+
+constexpr byte halPinBit(byte pin) {
+	return((pin < 8) ? pin : ((pin < 14) ? (pin - 8) : (pin - 14)));
+}
+/*
+ * Gets the bit of a pin within its port
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: Bit (0-7)
+ */
+
+constexpr bool halPinHasPWM(byte pin) {
+	return((pin == 3) || (pin == 9) || (pin == 10) || (pin == 11));
+}
+/*
+ * Determines if a pin is driven by a Timer1 or Timer2 PWM channel
+ * Pins 5 and 6 are excluded, since Timer0 generates the system tick and millis()
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: Is the pin one of the PWM channels configured by halInitPWM()?
+ */
+
+constexpr pwm_channel halPinPWMChannel(byte pin) {
+	return((pin == 11) ? PWM_CHANNEL_OC2A : ((pin == 10) ? PWM_CHANNEL_OC1B : ((pin == 9) ? PWM_CHANNEL_OC1A : PWM_CHANNEL_OC2B)));
+}
+/*
+ * Gets the PWM timer channel driving a pin
+ * Only meaningful if halPinHasPWM() is true for the pin
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: PWM channel
+ */
+
+constexpr byte halPinInputMask(byte pin) {
+	return((halPinPort(pin) == HAL_PORT_C) ? (1 << halPinBit(pin)) : ((pin == 12) ? 0x40 : 0x00));
+}
+/*
+ * Gets the bit of halReadInputPorts() holding a pin's logic level
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ * OUTPUT: Bitmask (0 if the pin is not read by halReadInputPorts())
+ */
+
+constexpr byte halPinRegister(byte pin, byte offset) {
+	return(0x03 + (3 * halPinPort(pin)) + offset);
+}
+/*
+ * Gets the I/O address of one of a pin's port registers
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ *         Register (0 = PINx, 1 = DDRx, 2 = PORTx)
+ * OUTPUT: I/O address
+ */
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+template <byte PIN> void halPinMode(byte mode);
+/*
+ * Configures a GPIO pin
+ * The pin is resolved at compile time; each mode compiles to one or two single-bit port writes
+ *
+ * INPUT:  Pin number (Arduino numbering, as the template argument)
+ *         Pin mode (INPUT, OUTPUT, or INPUT_PULLUP)
+ */
+
+template <byte PIN> bool halDigitalRead();
+/*
+ * Reads the logic level of a GPIO pin
+ * The pin is resolved at compile time, and compiles to a single-bit port read
+ *
+ * INPUT:  Pin number (Arduino numbering, as the template argument)
+ * OUTPUT: Logic level (true = HIGH)
+ */
+
+template <byte PIN> void halDigitalWrite(bool level);
+/*
+ * Sets the logic level of a GPIO output pin
+ * The pin is resolved at compile time, and compiles to a single SBI or CBI instruction
+ *
+ * Unlike digitalWrite(), this is atomic, so it is safe to call from interrupt context.
+ *
+ * INPUT:  Pin number (Arduino numbering, as the template argument)
+ *         Logic level (true = HIGH)
+ */
+
+
+byte halReadInputPorts();
+/*
+ * Reads every endstop and button pin in a single pass
+ *
+ * Port C and port B are each read once. PC0-PC5 (A0-A5) are returned in bits 0-5,
+ * and PB4 (pin 12) is returned in bit 6.
+ *
+ * OUTPUT: Raw logic levels (1 = HIGH)
+ */
+
+void halInitSystemTick();
+/*
+ * Starts the system tick interrupt, which calls systemTick() every SYSTEM_TICK_US microseconds
+ * Must be called once at startup, after all modules are initialized
+ *
+ * Pin change interrupts are also enabled on every endstop and the arcade button. Any pin change
+ * restarts the system tick if it was stopped by halStopSystemTick().
+ */
+
+void halStartSystemTick();
+/*
+ * Restarts the system tick interrupt if it is stopped
+ * Safe to call from interrupt context
+ */
+
+void halStopSystemTick();
+/*
+ * Stops the system tick interrupt until the next pin change or call to halStartSystemTick()
+ * Should only be called from systemTick(), once it has no more work to do
+ *
+ * millis() is unaffected.
+ */
+
+void halStartWatchdogTick();
+/*
+ * Starts the watchdog interrupt, which calls errorTick() every WATCHDOG_TICK_MS milliseconds
+ * Does nothing if it is already running
+ *
+ * The watchdog oscillator is only accurate to within about 10%, and keeps running while asleep.
+ */
+
+void halStopWatchdogTick();
+/*
+ * Stops the watchdog interrupt until the next call to halStartWatchdogTick()
+ * Safe to call from interrupt context
+ */
+
+void halSleep();
+/*
+ * Puts the MCU into idle sleep until the next interrupt
+ * Must be called with interrupts disabled, so that a wake-up condition checked beforehand
+ * cannot be missed; interrupts are enabled on return
+ *
+ * Timers keep running while asleep. The millis() interrupt alone wakes the MCU at least once
+ * per 1.024 milliseconds.
+ */
+
+uint16_t halReadTimestamp();
+/*
+ * Reads a free-running timestamp, counted in Timer0 ticks (4 microseconds)
+ * Safe to call from interrupt context
+ *
+ * The timestamp is built from TCNT0 and the millis() overflow count, so it costs far less than
+ * micros(). It wraps every 262 milliseconds; only differences between timestamps are meaningful.
+ *
+ * OUTPUT: Timestamp
+ */
+
+template <byte SS_PIN> void halSpiSelect(bool selected);
+/*
+ * Drives the ISD1700 slave select line
+ * The pin is resolved at compile time, and compiles to a single SBI or CBI instruction
+ *
+ * INPUT:  Slave select pin number (Arduino numbering, as the template argument)
+ *         State of being selected (true = SS low)
+ */
+
+template <byte SCLK_PIN, byte MOSI_PIN> byte halSpiShiftByte(byte transmission);
+/*
+ * Shifts a single byte out to the ISD1700 while shifting its reply in, least significant bit first
+ *
+ * SCLK idles high and MOSI changes while SCLK is low (SPI mode 3). MISO is sampled just before
+ * each rising edge of SCLK. The pins are resolved at compile time, so each edge is a single SBI or
+ * CBI instruction, and this is safe to call from interrupt context.
+ *
+ * The board has no free digital pin for MISO, so it is read on A6 through the analog comparator
+ * (see halInitSpiInput()). If A6 is not wired to MISO, the reply is meaningless.
+ *
+ * INPUT:  SCLK and MOSI pin numbers (Arduino numbering, as the template arguments)
+ *         Byte to transmit
+ * OUTPUT: Byte received
+ */
+
+void halInitSpiInput();
+/*
+ * Configures the analog comparator to read the ISD1700's MISO line on A6
+ * Must be called once at startup, before the first call to halSpiShiftByte()
+ *
+ * A6 is analog-only on the Pro Trinket, so it is compared against the internal 1.1 V bandgap
+ * reference through the ADC multiplexer. The ADC is disabled to free the multiplexer, which is
+ * fine since no analog inputs are read.
+ */
+
+void halInitPWM(pwm_carrier carrier);
+/*
+ * Configures Timer1 and Timer2 for phase-correct PWM on all four power output channels
+ * Must be called once at startup; may be called again later to change the carrier
+ *
+ * The carrier is selectable, but duty cycles are not compensated for it. The output stages take a
+ * fixed time to switch, which is a larger share of an ultrasonic carrier's period, so low duty
+ * cycles deliver less than their share of power there. Compensation waits on measured switching
+ * times at each carrier.
+ *
+ * INPUT:  Carrier frequency
+ */
+
+void halSetPWM(pwm_channel channel, uint8_t pwm);
+/*
+ * Sets the duty cycle of a PWM timer channel
+ * Safe to call from interrupt context
+ *
+ * INPUT:  PWM channel
+ *         New duty cycle (0-255)
+ */
+
+void halSetDrive(pwm_channel channel, uint8_t pwm, byte dir_pin, bool dir_level);
+/*
+ * Sets the duty cycle of a PWM timer channel along with the direction pin it drives, at once
+ * Safe to call from interrupt context
+ *
+ * Both are written with interrupts disabled, so no interrupt (such as a ramp step from the system
+ * tick) can observe or drive a motor with a new direction and an old duty cycle, or vice versa.
+ *
+ * INPUT:  PWM channel
+ *         New duty cycle (0-255)
+ *         Direction pin number (Arduino numbering)
+ *         Logic level of the direction pin (true = HIGH)
+ */
+
+byte halEepromRead(uint16_t address);
+/*
+ * Reads a single byte of EEPROM
+ *
+ * INPUT:  EEPROM address
+ * OUTPUT: Stored byte
+ */
+
+void halEepromWrite(uint16_t address, byte value);
+/*
+ * Writes a single byte of EEPROM, blocking until complete
+ *
+ * INPUT:  EEPROM address
+ *         Byte to store
+ */
+
+void halEepromUpdate(uint16_t address, byte value);
+/*
+ * Writes a single byte of EEPROM only if it differs from the stored value
+ *
+ * INPUT:  EEPROM address
+ *         Byte to store
+ */
+
+void halEepromWriteAsync(uint16_t address, byte value);
+/*
+ * Starts writing a single byte of EEPROM, without waiting for it to finish
+ * Must only be called from eepromReady(), so that no other write is in progress
+ *
+ * INPUT:  EEPROM address
+ *         Byte to store
+ */
+
+void halEepromReadyInterrupt(bool enabled);
+/*
+ * Enables or disables the EEPROM ready interrupt
+ *
+ * While enabled, eepromReady() is called whenever no EEPROM write is in progress. It is called
+ * immediately if the EEPROM is already idle, so it must either start a write or disable the interrupt.
+ *
+ * INPUT:  State of being enabled
+ */
+
+void halInitLink(unsigned long baud);
+/*
+ * Configures the USART for 8N1 at the given baud rate, and enables it with its receive interrupt
+ * Must be called once at startup, after the SPI pins are configured
+ *
+ * While enabled, the USART takes over PD0 (RX) and PD1 (TX) from their GPIO settings.
+ *
+ * INPUT:  Baud rate
+ */
+
+void halLinkEnable(bool enabled);
+/*
+ * Hands PD0 and PD1 to the USART, or back to GPIO, enabling or disabling its receiver and transmitter
+ * Safe to call from interrupt context; disabling also disables the transmit interrupt
+ *
+ * Disabling the transmitter while a byte is being sent cuts the byte short, so check halLinkIdle() first.
+ *
+ * INPUT:  State of being enabled
+ */
+
+void halLinkTransmitInterrupt(bool enabled);
+/*
+ * Enables or disables the USART data register empty interrupt
+ * Safe to call from interrupt context
+ *
+ * While enabled, linkTransmitReady() is called whenever the USART can accept another byte.
+ * It must either write a byte or disable the interrupt.
+ *
+ * INPUT:  State of being enabled
+ */
+
+void halLinkWrite(byte data);
+/*
+ * Writes a single byte to the USART, which must be able to accept it
+ * Must only be called from linkTransmitReady()
+ *
+ * INPUT:  Byte to transmit
+ */
+
+bool halLinkIdle();
+/*
+ * Determines if the USART has finished sending every byte written to it
+ * Safe to call from interrupt context
+ *
+ * OUTPUT: Is the USART transmitter idle?
+ */
+
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void halHostPinMode(byte pin, byte mode);
+bool halHostDigitalRead(byte pin);
+void halHostDigitalWrite(byte pin, bool level);
+/*
+ * Simulated GPIO behind the pin templates
+ * Defined by the host backend only
+ *
+ * INPUT:  Pin number (Arduino numbering)
+ *         Pin mode, or logic level (true = HIGH)
+ * OUTPUT: Logic level (true = HIGH)
+ */
+
+void halHostSpiSelect(bool selected);
+byte halHostSpiShiftByte(byte transmission);
+/*
+ * Simulated ISD1700 SPI lines behind halSpiSelect() and halSpiShiftByte()
+ * Defined by the host backend only
+ *
+ * INPUT:  State of being selected, or byte to transmit
+ * OUTPUT: Byte received
+ */
+
+
+/////////////////////////
+// INTERRUPT HOOKS
+/////////////////////////
+
+void systemTick();
+/*
+ * Runs periodic interrupt-driven work
+ * Must be defined by the application
+ *
+ * Called from interrupt context every SYSTEM_TICK_US microseconds once halInitSystemTick() is called.
+ * Keep it short; it delays every other interrupt, including millis().
+ */
+
+void errorTick();
+/*
+ * Steps the error code display
+ * Defined by the Error Code module
+ *
+ * Called from interrupt context every WATCHDOG_TICK_MS milliseconds, once halStartWatchdogTick() is called.
+ */
+
+void eepromReady();
+/*
+ * Continues a background EEPROM save
+ * Defined by the Calibration Storage module
+ *
+ * Called from interrupt context while the EEPROM is idle, once halEepromReadyInterrupt() enables it.
+ */
+
+void linkReceived(byte data, bool error);
+/*
+ * Stores a byte received by the USART
+ * Defined by the Diagnostic Link module
+ *
+ * Called from interrupt context for every byte received while the USART is enabled.
+ *
+ * INPUT:  Received byte
+ *         Was the byte hit by a framing or overrun error?
+ */
+
+void linkTransmitReady();
+/*
+ * Sends the next queued byte
+ * Defined by the Diagnostic Link module
+ *
+ * Called from interrupt context while the USART can accept a byte, once halLinkTransmitInterrupt() enables it.
+ */
+
+
+/////////////////////////
+// PIN TEMPLATES
+/////////////////////////
+
+// Every operand below is a compile-time constant, so the AVR backend's port accesses reduce to
+// SBI, CBI, and SBIC instructions. The host backend maps the same pins onto its simulated GPIO.
+
+template <byte PIN> void halPinMode(byte mode) {
+	static_assert(halPinExists(PIN), "Pin does not exist on the ATmega 328P");
+#ifdef __AVR__
+	if(mode == OUTPUT) {
+		_SFR_IO8(halPinRegister(PIN, 1)) |= _BV(halPinBit(PIN));
+	}
+	else {
+		_SFR_IO8(halPinRegister(PIN, 1)) &= ~_BV(halPinBit(PIN));
+		if(mode == INPUT_PULLUP) {
+			_SFR_IO8(halPinRegister(PIN, 2)) |= _BV(halPinBit(PIN));
+		}
+		else {
+			_SFR_IO8(halPinRegister(PIN, 2)) &= ~_BV(halPinBit(PIN));
+		}
+	}
+#else
+	halHostPinMode(PIN, mode);
+#endif
+	return;
+}
+
+template <byte PIN> bool halDigitalRead() {
+	static_assert(halPinExists(PIN), "Pin does not exist on the ATmega 328P");
+#ifdef __AVR__
+	return((_SFR_IO8(halPinRegister(PIN, 0)) & _BV(halPinBit(PIN))) != 0);
+#else
+	return halHostDigitalRead(PIN);
+#endif
+}
+
+template <byte PIN> void halDigitalWrite(bool level) {
+	static_assert(halPinExists(PIN), "Pin does not exist on the ATmega 328P");
+#ifdef __AVR__
+	if(level) {
+		_SFR_IO8(halPinRegister(PIN, 2)) |= _BV(halPinBit(PIN));
+	}
+	else {
+		_SFR_IO8(halPinRegister(PIN, 2)) &= ~_BV(halPinBit(PIN));
+	}
+#else
+	halHostDigitalWrite(PIN, level);
+#endif
+	return;
+}
+
+template <byte SS_PIN> void halSpiSelect(bool selected) {
+#ifdef __AVR__
+	halDigitalWrite<SS_PIN>(!selected);
+#else
+	halHostSpiSelect(selected);
+#endif
+	return;
+}
+
+template <byte SCLK_PIN, byte MOSI_PIN> byte halSpiShiftByte(byte transmission) {
+	static_assert(halPinExists(SCLK_PIN) && halPinExists(MOSI_PIN), "Pin does not exist on the ATmega 328P");
+#ifdef __AVR__
+	// Each half clock period is padded to stay within the ISD1700's 1 MHz SCLK limit
+	// The low half is padded further, for MISO to settle and the comparator to respond (about 0.7 us)
+	byte Reception = 0;
+	for(byte Bit = 0; Bit < 8; Bit++) {
+		halDigitalWrite<SCLK_PIN>(LOW);
+		halDigitalWrite<MOSI_PIN>(transmission & 0x01);
+		transmission >>= 1;
+		Reception >>= 1;
+		__builtin_avr_delay_cycles(18);
+
+		// The comparator output is high while A6 is below the bandgap reference
+		if(!(ACSR & _BV(ACO))) {
+			Reception |= 0x80;
+		}
+		halDigitalWrite<SCLK_PIN>(HIGH);
+		__builtin_avr_delay_cycles(6);
+	}
+	return Reception;
+#else
+	return halHostSpiShiftByte(transmission);
+#endif
+}
+
+
+#endif
@@ -0,0 +1,234 @@
+#include "health.h"
+
+// Statistics of each motor
+motor_health Health[3];
+
+// Fault and relay switch tracking
+motor_state Health_Last_State[3];  // State each motor was last seen in
+motor_dir Health_Last_Dir[3];      // Direction each motor was last seen in
+
+// Checkpoint state
+byte Health_Buffer[HEALTH_RECORD_LENGTH];  // Held until the background save ends
+storage_ring Health_Ring = {EEPROM_HEALTH_PTR, HEALTH_RECORD_LENGTH, HEALTH_SLOTS, (HEALTH_SLOTS - 1), 0};
+unsigned int Health_Trips = 0;             // Trips recorded since the last checkpoint
+
+void initHealth() {
+	bool Found = readRing(&Health_Ring, Health_Buffer, readHealthSlot);
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		motor_health* Motor_Health = &Health[Motor];
+		const byte* Data = &Health_Buffer[3 + (Motor * HEALTH_MOTOR_LENGTH)];
+		if(!Found) {
+			Motor_Health->Faults = 0;
+			Motor_Health->Relay_Switches = 0;
+		}
+		else {
+			Motor_Health->Faults = getWord(&Data[0]);
+			Motor_Health->Relay_Switches = (getWord(&Data[2]) | (((uint32_t) getWord(&Data[4])) << 16));
+		}
+
+		for(byte Dir = FORWARD; Dir <= BACKWARD; Dir++) {
+			travel_stats* Stats = &Motor_Health->Travel[Dir];
+			const byte* Travel = &Data[6 + (Dir * 12)];
+			if(!Found) {
+				Stats->Count = 0;
+				Stats->Min = 0;
+				Stats->Max = 0;
+				Stats->Mean = 0;
+				Stats->M2 = 0;
+				Stats->Recent = 0;
+				continue;
+			}
+
+			// The recent average restarts at the mean, so no trend is carried over a power cycle
+			uint16_t Mean = getWord(&Travel[2]);
+			Stats->Count = getWord(&Travel[0]);
+			Stats->Mean = (((uint32_t) Mean) << HEALTH_MEAN_SHIFT);
+			Stats->M2 = (getWord(&Travel[4]) | (((uint32_t) getWord(&Travel[6])) << 16));
+			Stats->Min = getWord(&Travel[8]);
+			Stats->Max = getWord(&Travel[10]);
+			Stats->Recent = (((uint32_t) Mean) << HEALTH_RECENT_SHIFT);
+		}
+
+		Health_Last_State[Motor] = getMotorState((output_group)Motor);
+		Health_Last_Dir[Motor] = getMotorDir((output_group)Motor);
+	}
+	Health_Trips = 0;
+	return;
+}
+
+void handleHealth(bool enabled) {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		motor_health* Motor_Health = &Health[Motor];
+		motor_state State = getMotorState((output_group)Motor);
+		motor_dir Dir = getMotorDir((output_group)Motor);
+
+		// A fault always follows its safety reversal, so only a fault straight from travel is counted again
+		if(State != Health_Last_State[Motor]) {
+			bool Reversal = ((State == SAFETY_REVERSE_ENDSTOP_FAIL) || (State == SAFETY_REVERSE_ENDSTOP_EARLY));
+			bool Reversed = ((Health_Last_State[Motor] == SAFETY_REVERSE_ENDSTOP_FAIL) || (Health_Last_State[Motor] == SAFETY_REVERSE_ENDSTOP_EARLY));
+			if(enabled && (Reversal || ((State == FAULTED) && !Reversed)) && (Motor_Health->Faults < 0xFFFF)) {
+				Motor_Health->Faults += 1;
+			}
+			Health_Last_State[Motor] = State;
+		}
+		if(Dir != Health_Last_Dir[Motor]) {
+			Motor_Health->Relay_Switches += 1;
+			Health_Last_Dir[Motor] = Dir;
+		}
+	}
+
+	if((Health_Trips >= HEALTH_SAVE_TRIPS) && !storageBusy()) {
+		saveHealth();
+	}
+	return;
+}
+
+void recordHealthTrip(output_group motor, motor_dir dir, unsigned int travel_time) {
+	travel_stats* Stats = &Health[motor].Travel[dir];
+	uint32_t Time = (((uint32_t) travel_time) << HEALTH_MEAN_SHIFT);
+
+	// The first trip seeds every statistic
+	if(Stats->Count == 0) {
+		Stats->Count = 1;
+		Stats->Min = travel_time;
+		Stats->Max = travel_time;
+		Stats->Mean = Time;
+		Stats->M2 = 0;
+		Stats->Recent = (((uint32_t) travel_time) << HEALTH_RECENT_SHIFT);
+	}
+	else {
+		if(Stats->Count < 0xFFFF) {
+			Stats->Count += 1;
+		}
+		if(travel_time < Stats->Min) {
+			Stats->Min = travel_time;
+		}
+		else if(travel_time > Stats->Max) {
+			Stats->Max = travel_time;
+		}
+
+		// Welford's method, with the weight of each trip held at 1/HEALTH_WINDOW once the window is full
+		byte Weight = HEALTH_WINDOW;
+		if(Stats->Count < HEALTH_WINDOW) {
+			Weight = Stats->Count;
+		}
+		else {
+			Stats->M2 -= (Stats->M2 / HEALTH_WINDOW);
+		}
+		long Delta = ((long) Time - (long) Stats->Mean);
+		Stats->Mean = (uint32_t)((long) Stats->Mean + (Delta / Weight));
+		long Delta_After = ((long) Time - (long) Stats->Mean);
+
+		// Both differences share a sign, and each fits in 16 bits once in milliseconds
+		uint32_t Square = ((uint32_t)(labs(Delta) >> HEALTH_MEAN_SHIFT) * (uint32_t)(labs(Delta_After) >> HEALTH_MEAN_SHIFT));
+		if(Square > (0xFFFFFFFFUL - Stats->M2)) {
+			Stats->M2 = 0xFFFFFFFFUL;
+		}
+		else {
+			Stats->M2 += Square;
+		}
+		Stats->Recent = ((Stats->Recent - (Stats->Recent >> HEALTH_RECENT_SHIFT)) + travel_time);
+	}
+	if(Health_Trips < 0xFFFF) {
+		Health_Trips += 1;
+	}
+
+	// The motor still runs, but should be serviced before it is worn
+	if(healthTrendRising(Stats) && !errorFlagged(ERROR_SERVICE_SOON + motor)) {
+		flagError(ERROR_SERVICE_SOON + motor);
+	}
+	return;
+}
+
+void resetHealthTravel() {
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		for(byte Dir = FORWARD; Dir <= BACKWARD; Dir++) {
+			Health[Motor].Travel[Dir].Count = 0;
+		}
+	}
+	Health_Trips = HEALTH_SAVE_TRIPS;
+	return;
+}
+
+const motor_health* getMotorHealth(output_group motor) {
+	return &Health[motor];
+}
+
+uint16_t getTravelMean(const travel_stats* stats) {
+	if(stats->Count == 0) {
+		return 0;
+	}
+	return(stats->Mean >> HEALTH_MEAN_SHIFT);
+}
+
+uint32_t getTravelVariance(const travel_stats* stats) {
+	// Once the window is full, M2 settles at HEALTH_WINDOW times the variance
+	if(stats->Count < 2) {
+		return 0;
+	}
+	else if(stats->Count < HEALTH_WINDOW) {
+		return(stats->M2 / (stats->Count - 1));
+	}
+	return(stats->M2 / HEALTH_WINDOW);
+}
+
+bool readHealthSlot(uint16_t address, byte* buffer) {
+	for(byte Index = 0; Index < HEALTH_RECORD_LENGTH; Index++) {
+		buffer[Index] = halEepromRead(address + Index);
+	}
+	if(buffer[0] != HEALTH_VERSION) {
+		return false;
+	}
+	return(getRecordCRC(buffer, HEALTH_RECORD_LENGTH) == getWord(&buffer[HEALTH_RECORD_LENGTH - 2]));
+}
+
+void saveHealth() {
+	Health_Buffer[0] = HEALTH_VERSION;
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		const motor_health* Motor_Health = &Health[Motor];
+		byte* Data = &Health_Buffer[3 + (Motor * HEALTH_MOTOR_LENGTH)];
+		putWord(&Data[0], Motor_Health->Faults);
+		putWord(&Data[2], (Motor_Health->Relay_Switches & 0xFFFF));
+		putWord(&Data[4], (Motor_Health->Relay_Switches >> 16));
+
+		for(byte Dir = FORWARD; Dir <= BACKWARD; Dir++) {
+			const travel_stats* Stats = &Motor_Health->Travel[Dir];
+			byte* Travel = &Data[6 + (Dir * 12)];
+			bool Recorded = (Stats->Count > 0);
+			putWord(&Travel[0], Stats->Count);
+			putWord(&Travel[2], getTravelMean(Stats));
+			putWord(&Travel[4], (Recorded ? (Stats->M2 & 0xFFFF) : 0));
+			putWord(&Travel[6], (Recorded ? (Stats->M2 >> 16) : 0));
+			putWord(&Travel[8], (Recorded ? Stats->Min : 0));
+			putWord(&Travel[10], (Recorded ? Stats->Max : 0));
+		}
+	}
+	saveRing(&Health_Ring, Health_Buffer, HEALTH_RECORD_LENGTH);
+	Health_Trips = 0;
+	return;
+}
+
+bool healthTrendRising(const travel_stats* stats) {
+	if(stats->Count < HEALTH_MIN_TRIPS) {
+		return false;
+	}
+
+	uint16_t Mean = getTravelMean(stats);
+	uint16_t Recent = (stats->Recent >> HEALTH_RECENT_SHIFT);
+	if(Recent <= Mean) {
+		return false;
+	}
+
+	uint32_t Rise = (Recent - Mean);
+	if(Rise < scaleTime(Mean, getPercentScale(HEALTH_TREND_PERCENT))) {
+		return false;
+	}
+
+	// Averaging divides the variance by 2^(HEALTH_RECENT_SHIFT + 1) - 1, so a steady motor's recent
+	// average stays well within it; squares are compared, so no square root is taken
+	const uint32_t SIGMAS_SQUARED = ((uint32_t) HEALTH_TREND_SIGMAS * HEALTH_TREND_SIGMAS);
+	const uint32_t RECENT_SPREAD = ((2UL << HEALTH_RECENT_SHIFT) - 1);
+	uint32_t Variance = (getTravelVariance(stats) / RECENT_SPREAD);
+	return((Variance <= (0xFFFFFFFFUL / SIGMAS_SQUARED)) && ((Rise * Rise) > (Variance * SIGMAS_SQUARED)));
+}
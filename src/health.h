@@ -0,0 +1,202 @@
+/* Motor Health Module
+ *
+ * Used to keep running statistics of each motor's travel times, faults, and relay switches, and to
+ * warn staff that a motor needs servicing before it fails outright
+ *
+ * Every complete trip (see takeMotorTrip()) is recorded against its motor and direction. The count,
+ * mean, variance, and shortest and longest travel time are kept in streaming form with Welford's
+ * method, so no trip is ever stored. Once HEALTH_WINDOW trips have been recorded, each new trip
+ * weighs 1/HEALTH_WINDOW in the mean and variance, so older trips fade out and the statistics
+ * describe the motor as it is now, rather than over its lifetime. A trip costs two 32-bit
+ * divisions and a few 32-bit multiplies, well under a millisecond.
+ *
+ * Alongside the mean, a recent average weighs each trip 1/2^HEALTH_RECENT_SHIFT, so it follows a
+ * change in travel time within a few trips while the mean lags behind. Once HEALTH_MIN_TRIPS trips
+ * have been recorded, a recent average at least HEALTH_TREND_PERCENT percent above the mean, and
+ * further above it than HEALTH_TREND_SIGMAS of its own standard deviations (averaging narrows the
+ * travel time's to about a quarter), means the motor has started slowing, and its service soon
+ * code (ERROR_SERVICE_SOON plus the motor) is flagged. The code is a warning only; the motor
+ * keeps running, and it is cleared along with every other non-critical code. A motor still slowing
+ * would later be flagged as worn by the Adaptive Calibration module, and then fault.
+ *
+ * Safety reversals and faults during normal operation are counted per motor. A safety reversal
+ * followed by its fault counts once. Direction relay switches are counted at all times.
+ *
+ * The statistics are checkpointed to EEPROM every HEALTH_SAVE_TRIPS trips, alternating between two
+ * slots at EEPROM_HEALTH_PTR, so a save cut short by a power loss leaves the other slot intact. The
+ * slot with the highest sequence number and a valid version and CRC is restored at startup. A
+ * completed calibration resets the travel statistics, since it follows servicing or replacing a
+ * motor, but keeps the fault and relay counts.
+ *
+ * Slot layout (multi-byte values are little-endian):
+ *
+ *  0      Record version (HEALTH_VERSION)
+ *  1-2    Sequence number
+ *  3-32   Elevator statistics
+ * 33-62   Mine cart statistics
+ * 63-92   Loader statistics
+ * 93-94   CRC-CCITT of bytes 0-92
+ *
+ * Statistics of each motor:
+ *
+ *  0-1    Safety reversals and faults
+ *  2-5    Direction relay switches
+ *  6-17   Forward travel: trips (2), mean (2), sum of squared differences from the mean (4),
+ *         shortest (2), and longest (2), in milliseconds
+ * 18-29   Backward travel, as above
+ */
+
+#ifndef health_h
+#define health_h
+#include <arduino.h>
+#include "hal.h"
+#include "power.h"
+#include "motor.h"
+#include "error.h"
+#include "storage.h"
+#include "adapt.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+const byte HEALTH_WINDOW = 64;           // Trips before older trips start to fade out
+const byte HEALTH_MEAN_SHIFT = 4;        // Mean is held in 1/16 ms
+const byte HEALTH_RECENT_SHIFT = 3;      // Each trip weighs 1/8 in the recent average
+const byte HEALTH_MIN_TRIPS = 8;         // Trips recorded before a trend is looked for
+const byte HEALTH_TREND_SIGMAS = 2;
+const byte HEALTH_TREND_PERCENT = 5;
+const unsigned int HEALTH_SAVE_TRIPS = 256;  // Minimum trips between checkpoints
+
+// Must be changed whenever the slot layout changes
+const byte HEALTH_VERSION = 1;
+
+const byte HEALTH_MOTOR_LENGTH = 30;
+const byte HEALTH_RECORD_LENGTH = (3 + (3 * HEALTH_MOTOR_LENGTH) + 2);
+const byte HEALTH_SLOTS = 2;
+
+static_assert((HEALTH_SLOTS * HEALTH_RECORD_LENGTH) <= EEPROM_HEALTH_SIZE, "Health checkpoints do not fit in their EEPROM area");
+static_assert(HEALTH_WINDOW >= HEALTH_MIN_TRIPS, "A trend needs at least HEALTH_MIN_TRIPS trips in the window");
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// Travel statistics of a single motor and direction
+typedef struct {
+	uint16_t Count;   // Trips recorded, saturating at 65535
+	uint16_t Min;     // Shortest travel time, in milliseconds
+	uint16_t Max;     // Longest travel time, in milliseconds
+	uint32_t Mean;    // Mean travel time, scaled by 2^HEALTH_MEAN_SHIFT
+	uint32_t M2;      // Sum of squared differences from the mean, in square milliseconds
+	uint32_t Recent;  // Recent average travel time, scaled by 2^HEALTH_RECENT_SHIFT
+} travel_stats;
+
+// Statistics of a single motor
+typedef struct {
+	travel_stats Travel[2];  // Indexed by motor_dir
+	uint16_t Faults;         // Safety reversals and faults during normal operation, saturating at 65535
+	uint32_t Relay_Switches; // Direction relay switches
+} motor_health;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void initHealth();
+/*
+ * Restores the newest checkpoint from EEPROM, or starts every statistic from zero without one
+ * Must be called once at startup, after initPowerOutputs()
+ *
+ * Affects Health[], Health_Ring, Health_Trips, Health_Last_State[], and
+ *         Health_Last_Dir[]
+ */
+
+void handleHealth(bool enabled);
+/*
+ * Counts faults and relay switches seen since the last call, and checkpoints the statistics when due
+ * Should be called after every pass of the motor state machines
+ *
+ * Affects Health[], Health_Last_State[], Health_Last_Dir[], Health_Trips, and the checkpoint state
+ * INPUT:  Count faults? (false while calibrating, when motors are faulted on purpose)
+ */
+
+void recordHealthTrip(output_group motor, motor_dir dir, unsigned int travel_time);
+/*
+ * Records a single complete trip, flagging the motor's service soon code if it has started slowing
+ * Used by handleAdaptation()
+ *
+ * Affects Health[motor].Travel[dir], Health_Trips, and the motor's service soon error code
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel
+ *         Travel time from MOVE_START to the front endstop, in milliseconds
+ */
+
+void resetHealthTravel();
+/*
+ * Clears the travel statistics of every motor, keeping the fault and relay counts
+ * Called once calibration completes; the cleared statistics are checkpointed when storage is free
+ *
+ * Affects Health[].Travel[] and Health_Trips
+ */
+
+const motor_health* getMotorHealth(output_group motor);
+/*
+ * Gets a motor's statistics
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: Statistics, which change as trips are recorded
+ */
+
+uint16_t getTravelMean(const travel_stats* stats);
+/*
+ * Gets the mean travel time of a motor and direction
+ *
+ * INPUT:  Travel statistics
+ * OUTPUT: Mean in milliseconds (0 before the first trip)
+ */
+
+uint32_t getTravelVariance(const travel_stats* stats);
+/*
+ * Gets the variance of the travel time of a motor and direction
+ *
+ * INPUT:  Travel statistics
+ * OUTPUT: Variance in square milliseconds (0 before the second trip)
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+bool readHealthSlot(uint16_t address, byte* buffer);
+/*
+ * Reads a checkpoint slot, checking its version and CRC
+ * Used by readRing()
+ *
+ * INPUT:  EEPROM address of the slot
+ *         Buffer to read the slot into
+ * OUTPUT: Does the slot hold a valid checkpoint?
+ */
+
+void saveHealth();
+/*
+ * Starts saving the statistics into the slot after the newest checkpoint
+ * Returns immediately; the checkpoint is written in the background (see saveBlock())
+ *
+ * Affects Health_Buffer[], Health_Ring, and Health_Trips
+ */
+
+bool healthTrendRising(const travel_stats* stats);
+/*
+ * Determines if a motor's recent average has risen far enough above its mean to need servicing
+ *
+ * INPUT:  Travel statistics
+ * OUTPUT: Is the recent average at least HEALTH_TREND_PERCENT percent, and more than
+ *         HEALTH_TREND_SIGMAS of its standard deviations, above the mean?
+ */
+
+
+#endif
@@ -0,0 +1,119 @@
+#include "input.h"
+#include "trace.h"
+
+// Interrupt state
+byte Input_Integrator[7];        // Debounce integrator for each snapshot bit
+volatile byte Input_Debounced;   // Engaged inputs, one bit per input (see SENSOR_MASK[])
+volatile byte Input_Rising;      // Inputs engaged since the last snapshot
+volatile byte Input_Falling;     // Inputs disengaged since the last snapshot
+
+// Snapshot state
+byte Input_Snapshot = 0;
+byte Input_Rising_Snapshot = 0;
+byte Input_Falling_Snapshot = 0;
+
+void initInputs() {
+	halPinMode<ENDSTOP_1_PIN>(INPUT_PULLUP);
+	halPinMode<ENDSTOP_2_PIN>(INPUT_PULLUP);
+	halPinMode<ENDSTOP_3_PIN>(INPUT_PULLUP);
+	halPinMode<ENDSTOP_4_PIN>(INPUT_PULLUP);
+	halPinMode<ENDSTOP_5_PIN>(INPUT_PULLUP);
+	halPinMode<ENDSTOP_6_PIN>(INPUT_PULLUP);
+	halPinMode<BUTTON_PIN>(INPUT_PULLUP);
+
+	// All inputs are active-low
+	byte Engaged = (~halReadInputPorts() & INPUT_MASK_ALL);
+	for(byte Bit = 0; Bit < 7; Bit++) {
+		Input_Integrator[Bit] = ((Engaged & (1 << Bit)) ? DEBOUNCE_SAMPLES : 0);
+	}
+	Input_Debounced = Engaged;
+	Input_Rising = 0;
+	Input_Falling = 0;
+	sampleInputs();
+	return;
+}
+
+void sampleInputs() {
+	byte Old_SREG = SREG;
+	noInterrupts();
+	Input_Snapshot = Input_Debounced;
+	Input_Rising_Snapshot = Input_Rising;
+	Input_Falling_Snapshot = Input_Falling;
+	Input_Rising = 0;
+	Input_Falling = 0;
+	SREG = Old_SREG;
+
+	if((Input_Rising_Snapshot | Input_Falling_Snapshot) != 0) {
+		traceEvent(TRACE_INPUTS, 0, Input_Snapshot);
+	}
+	return;
+}
+
+byte getInputSnapshot() {
+	return Input_Snapshot;
+}
+
+bool sensorEngaged(sensor_group sensor) {
+	if(sensor > ENDSTOP_ANY) {
+		return false;
+	}
+	else if(sensor == ENDSTOP_NONE) {
+		return((Input_Snapshot & pgm_read_byte(&SENSOR_MASK[ENDSTOP_NONE])) == 0);
+	}
+	return((Input_Snapshot & pgm_read_byte(&SENSOR_MASK[sensor])) != 0);
+}
+
+bool sensorRising(sensor_group sensor) {
+	if((sensor > ENDSTOP_ANY) || (sensor == ENDSTOP_NONE)) {
+		return false;
+	}
+	return((Input_Rising_Snapshot & pgm_read_byte(&SENSOR_MASK[sensor])) != 0);
+}
+
+bool sensorFalling(sensor_group sensor) {
+	if((sensor > ENDSTOP_ANY) || (sensor == ENDSTOP_NONE)) {
+		return false;
+	}
+	return((Input_Falling_Snapshot & pgm_read_byte(&SENSOR_MASK[sensor])) != 0);
+}
+
+bool inputsPending() {
+	return((Input_Rising | Input_Falling) != 0);
+}
+
+bool inputsChanged() {
+	return((Input_Rising_Snapshot | Input_Falling_Snapshot) != 0);
+}
+
+bool debounceInputs() {
+	byte Engaged = (~halReadInputPorts() & INPUT_MASK_ALL);
+	byte Debounced = Input_Debounced;
+	bool Settled = true;
+
+	for(byte Bit = 0; Bit < 7; Bit++) {
+		byte Mask = (1 << Bit);
+		if(Engaged & Mask) {
+			if(Input_Integrator[Bit] < DEBOUNCE_SAMPLES) {
+				Input_Integrator[Bit] += 1;
+				if((Input_Integrator[Bit] == DEBOUNCE_SAMPLES) && !(Debounced & Mask)) {
+					Debounced |= Mask;
+					Input_Rising |= Mask;
+				}
+			}
+		}
+		else if(Input_Integrator[Bit] > 0) {
+			Input_Integrator[Bit] -= 1;
+			if((Input_Integrator[Bit] == 0) && (Debounced & Mask)) {
+				Debounced &= ~Mask;
+				Input_Falling |= Mask;
+			}
+		}
+
+		if((Input_Integrator[Bit] != 0) && (Input_Integrator[Bit] != DEBOUNCE_SAMPLES)) {
+			Settled = false;
+		}
+	}
+
+	Input_Debounced = Debounced;
+	return !Settled;
+}
@@ -0,0 +1,194 @@
+/* Input Handling Module
+ *
+ * Used to initialize and sample the six endstops and the arcade button
+ *
+ * All seven inputs are read in a single pass (PINC and PINB) from the system tick interrupt and
+ * debounced there, at a fixed rate that does not depend on how long loop() takes. Each input has
+ * an integrator which counts up while the input is engaged and down while it is disengaged.
+ * The debounced state only changes once the integrator reaches either end of its range, so an
+ * input must read consistently for DEBOUNCE_SAMPLES ticks before it engages or disengages.
+ *
+ * The interrupt publishes a debounced bitmask along with latched rising and falling edges.
+ * sampleInputs() copies these into a snapshot; every sensor and sensor group query then resolves
+ * against that snapshot, so all decisions made between two calls to sampleInputs() see one
+ * consistent moment in time.
+ *
+ * Endstop and button reaction latency is therefore bounded by DEBOUNCE_TIME_US, plus the time
+ * until loop() next calls sampleInputs().
+ *
+ * Once every input has settled, the system tick may be stopped; a pin change interrupt restarts
+ * it on the next change of any input, so debouncing resumes within one SYSTEM_TICK_US.
+ */
+
+#ifndef input_h
+#define input_h
+#include <arduino.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// Debounce and anti-noise configuration
+// An input must read consistently for DEBOUNCE_TIME_US before its debounced state changes
+// This is to prevent electrical noise from falsely triggering endstops and the arcade button
+const unsigned int DEBOUNCE_TIME_US = 2560;
+const byte DEBOUNCE_SAMPLES = (DEBOUNCE_TIME_US / SYSTEM_TICK_US);
+
+
+/////////////////////////
+// PIN DEFINITIONS
+/////////////////////////
+
+// Pin list
+const byte ENDSTOP_1_PIN = A5;
+const byte ENDSTOP_2_PIN = A4;
+const byte ENDSTOP_3_PIN = A3;
+const byte ENDSTOP_4_PIN = A2;
+const byte ENDSTOP_5_PIN = A1;
+const byte ENDSTOP_6_PIN = A0;
+const byte BUTTON_PIN = 12;
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Available sensors
+typedef enum {
+	BUTTON = 0,
+	ENDSTOP_1 = 1,
+	ENDSTOP_2 = 2,
+	ENDSTOP_3 = 3,
+	ENDSTOP_4 = 4,
+	ENDSTOP_5 = 5,
+	ENDSTOP_6 = 6,
+	ENDSTOP_NONE = 7,
+	ENDSTOP_MOTOR_1 = 8,
+	ENDSTOP_MOTOR_2 = 9,
+	ENDSTOP_MOTOR_3 = 10,
+	ENDSTOP_ANY = 11
+} sensor_group;
+
+
+/////////////////////////
+// SNAPSHOT BITMASKS
+/////////////////////////
+
+// Snapshot bit layout, matching halReadInputPorts()
+// Bits 0-5 hold PC0-PC5 (A0-A5), and bit 6 holds PB4 (pin 12)
+const byte INPUT_MASK_ALL = 0x7F;
+
+// Snapshot bits belonging to each sensor group (indexed by sensor_group)
+// ENDSTOP_NONE is engaged when none of its bits are set
+constexpr byte SENSOR_MASK[12] PROGMEM = {
+	0x40,  // BUTTON
+	0x20,  // ENDSTOP_1
+	0x10,  // ENDSTOP_2
+	0x08,  // ENDSTOP_3
+	0x04,  // ENDSTOP_4
+	0x02,  // ENDSTOP_5
+	0x01,  // ENDSTOP_6
+	0x3F,  // ENDSTOP_NONE
+	0x30,  // ENDSTOP_MOTOR_1
+	0x0C,  // ENDSTOP_MOTOR_2
+	0x03,  // ENDSTOP_MOTOR_3
+	0x3F   // ENDSTOP_ANY
+};
+
+// Each input must be wired to the snapshot bit its sensor is read from
+static_assert(halPinInputMask(BUTTON_PIN) == SENSOR_MASK[BUTTON], "BUTTON_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_1_PIN) == SENSOR_MASK[ENDSTOP_1], "ENDSTOP_1_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_2_PIN) == SENSOR_MASK[ENDSTOP_2], "ENDSTOP_2_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_3_PIN) == SENSOR_MASK[ENDSTOP_3], "ENDSTOP_3_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_4_PIN) == SENSOR_MASK[ENDSTOP_4], "ENDSTOP_4_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_5_PIN) == SENSOR_MASK[ENDSTOP_5], "ENDSTOP_5_PIN is not read into its snapshot bit");
+static_assert(halPinInputMask(ENDSTOP_6_PIN) == SENSOR_MASK[ENDSTOP_6], "ENDSTOP_6_PIN is not read into its snapshot bit");
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void initInputs();
+/*
+ * Initializes input pins and debounce state
+ * Must be called once at startup
+ *
+ * The debounced state starts out matching the current state of every input.
+ *
+ * Affects Input_Debounced, Input_Integrator[], and Input_Snapshot
+ */
+
+void sampleInputs();
+/*
+ * Takes a snapshot of the debounced state of all endstops and the arcade button
+ * Should be called once per pass of any loop that checks sensors
+ *
+ * Edges latched since the previous snapshot are consumed. A snapshot containing any edge is
+ * recorded in the motion trace.
+ *
+ * Affects Input_Snapshot, Input_Rising_Snapshot, Input_Falling_Snapshot,
+ *         Input_Rising, and Input_Falling
+ */
+
+byte getInputSnapshot();
+/*
+ * Gets every engaged input as of the last snapshot, as recorded in the motion trace
+ *
+ * OUTPUT: Engaged inputs, one bit per input (see SENSOR_MASK[])
+ */
+
+bool sensorEngaged(sensor_group sensor);
+/*
+ * Gets the debounced state of a given sensor, as of the last snapshot
+ *
+ * INPUT:  Sensor group to check
+ * OUTPUT: State of being engaged
+ */
+
+bool sensorRising(sensor_group sensor);
+/*
+ * Determines if any input of a sensor group became engaged before the last snapshot
+ * Each edge is reported by exactly one snapshot
+ *
+ * INPUT:  Sensor group to check
+ * OUTPUT: Did an input become engaged?
+ */
+
+bool sensorFalling(sensor_group sensor);
+/*
+ * Determines if any input of a sensor group became disengaged before the last snapshot
+ * Each edge is reported by exactly one snapshot
+ *
+ * INPUT:  Sensor group to check
+ * OUTPUT: Did an input become disengaged?
+ */
+
+bool inputsPending();
+/*
+ * Determines if any input has changed since the last snapshot, without taking a new one
+ * Used to decide whether the MCU may sleep
+ *
+ * OUTPUT: Has any debounced input changed?
+ */
+
+bool inputsChanged();
+/*
+ * Determines if any input changed before the last snapshot
+ *
+ * OUTPUT: Did the last snapshot contain any rising or falling edges?
+ */
+
+bool debounceInputs();
+/*
+ * Samples and debounces all inputs
+ * Must be called from systemTick()
+ *
+ * Affects Input_Integrator[], Input_Debounced, Input_Rising, and Input_Falling
+ * OUTPUT: Is any input still being debounced? (false once every input reads consistently)
+ */
+
+
+#endif
@@ -0,0 +1,252 @@
+#include "link.h"
+#include <util/crc16.h>
+
+// Transmit buffer, filled by linkSendFrame() and drained by linkTransmitReady()
+byte Link_Tx_Buffer[LINK_TX_BUFFER_SIZE];
+volatile byte Link_Tx_Head = 0;
+volatile byte Link_Tx_Tail = 0;
+volatile bool Link_Paused = false;     // Are the pins handed over to the ISD1700?
+
+// Receive buffer, filled by linkReceived() and drained by linkReceiveFrame()
+byte Link_Rx_Buffer[LINK_RX_BUFFER_SIZE];
+volatile byte Link_Rx_Head = 0;
+volatile byte Link_Rx_Tail = 0;
+volatile bool Link_Rx_Error = false;   // Was a byte lost since the last one decoded?
+
+// Frame being received, still encoded
+byte Link_Frame[LINK_FRAME_MAX + 3];
+byte Link_Frame_Length = 0;
+bool Link_Frame_Bad = false;
+
+link_stats Link_Stats;
+
+void initLink() {
+	Link_Tx_Head = 0;
+	Link_Tx_Tail = 0;
+	Link_Paused = false;
+	Link_Rx_Head = 0;
+	Link_Rx_Tail = 0;
+	Link_Rx_Error = false;
+	Link_Frame_Length = 0;
+	Link_Frame_Bad = false;
+	Link_Stats.Received = 0;
+	Link_Stats.Rejected = 0;
+	Link_Stats.Sent = 0;
+	Link_Stats.Dropped = 0;
+	if(LINK_ENABLED) {
+		halInitLink(LINK_BAUD);
+	}
+	return;
+}
+
+bool linkPending() {
+	return(Link_Rx_Head != Link_Rx_Tail);
+}
+
+bool linkReceiveFrame(byte frame[LINK_FRAME_MAX], byte* length) {
+	byte Tail = Link_Rx_Tail;
+
+	while(Tail != Link_Rx_Head) {
+		byte Data = Link_Rx_Buffer[Tail];
+		Tail = ((Tail + 1) & (LINK_RX_BUFFER_SIZE - 1));
+		Link_Rx_Tail = Tail;
+		if(Link_Rx_Error) {
+			Link_Rx_Error = false;
+			Link_Frame_Bad = true;
+		}
+
+		if(Data != 0x00) {
+			if(Link_Frame_Length < sizeof(Link_Frame)) {
+				Link_Frame[Link_Frame_Length++] = Data;
+			}
+			else {
+				Link_Frame_Bad = true;
+			}
+			continue;
+		}
+
+		// End of frame; consecutive delimiters are ignored
+		byte Length = 0;
+		bool Empty = ((Link_Frame_Length == 0) && !Link_Frame_Bad);
+		if(!Link_Frame_Bad && !Empty) {
+			Length = decodeLinkFrame();
+		}
+		Link_Frame_Length = 0;
+		Link_Frame_Bad = false;
+
+		if(Length > 0) {
+			for(byte Index = 0; Index < Length; Index++) {
+				frame[Index] = Link_Frame[Index];
+			}
+			*length = Length;
+			if(Link_Stats.Received < 0xFFFF) {
+				Link_Stats.Received += 1;
+			}
+			return true;
+		}
+		else if(!Empty && (Link_Stats.Rejected < 0xFFFF)) {
+			Link_Stats.Rejected += 1;
+		}
+	}
+	return false;
+}
+
+bool linkSendFrame(const byte frame[], byte length) {
+	if(!LINK_ENABLED) {
+		return false;
+	}
+	byte Head = Link_Tx_Head;
+
+	// Every byte is sent once, plus one COBS code byte and the delimiter
+	if(((Link_Tx_Tail - Head - 1) & (LINK_TX_BUFFER_SIZE - 1)) < (length + 4)) {
+		if(Link_Stats.Dropped < 0xFFFF) {
+			Link_Stats.Dropped += 1;
+		}
+		return false;
+	}
+
+	uint16_t CRC = 0xFFFF;
+	for(byte Index = 0; Index < length; Index++) {
+		CRC = _crc_ccitt_update(CRC, frame[Index]);
+	}
+
+	// Each zero is replaced by the distance to the next, starting from a code byte before the frame
+	byte Code_Index = Head;
+	byte Code = 1;
+	putLinkByte(&Head, 0x00);
+	for(byte Index = 0; Index < (length + 2); Index++) {
+		byte Data;
+		if(Index < length) {
+			Data = frame[Index];
+		}
+		else if(Index == length) {
+			Data = (CRC & 0xFF);
+		}
+		else {
+			Data = (CRC >> 8);
+		}
+
+		if(Data == 0x00) {
+			Link_Tx_Buffer[Code_Index] = Code;
+			Code_Index = Head;
+			Code = 1;
+			putLinkByte(&Head, 0x00);
+		}
+		else {
+			putLinkByte(&Head, Data);
+			Code += 1;
+		}
+	}
+	Link_Tx_Buffer[Code_Index] = Code;
+	putLinkByte(&Head, 0x00);
+
+	// Publish the frame only once it is complete, then start sending unless the ISD1700 has the pins
+	Link_Tx_Head = Head;
+	byte Old_SREG = SREG;
+	noInterrupts();
+	if(!Link_Paused) {
+		halLinkTransmitInterrupt(true);
+	}
+	SREG = Old_SREG;
+
+	if(Link_Stats.Sent < 0xFFFF) {
+		Link_Stats.Sent += 1;
+	}
+	return true;
+}
+
+void getLinkStats(link_stats* stats) {
+	*stats = Link_Stats;
+	return;
+}
+
+bool linkReleasePins() {
+	if(!LINK_ENABLED) {
+		return true;
+	}
+	Link_Paused = true;
+	halLinkTransmitInterrupt(false);
+	if(!halLinkIdle()) {
+		return false;
+	}
+	halLinkEnable(false);
+	return true;
+}
+
+void linkClaimPins() {
+	// The USART must never drive the shared pins on a board without the host's series resistor
+	if(!LINK_ENABLED) {
+		return;
+	}
+	halLinkEnable(true);
+	Link_Paused = false;
+	if(Link_Tx_Head != Link_Tx_Tail) {
+		halLinkTransmitInterrupt(true);
+	}
+	return;
+}
+
+void linkReceived(byte data, bool error) {
+	byte Head = Link_Rx_Head;
+	byte Next_Head = ((Head + 1) & (LINK_RX_BUFFER_SIZE - 1));
+
+	if(error || (Next_Head == Link_Rx_Tail)) {
+		Link_Rx_Error = true;
+		if(Next_Head == Link_Rx_Tail) {
+			return;
+		}
+	}
+	Link_Rx_Buffer[Head] = data;
+	Link_Rx_Head = Next_Head;
+	return;
+}
+
+void linkTransmitReady() {
+	byte Tail = Link_Tx_Tail;
+
+	if(Tail == Link_Tx_Head) {
+		halLinkTransmitInterrupt(false);
+		return;
+	}
+	halLinkWrite(Link_Tx_Buffer[Tail]);
+	Link_Tx_Tail = ((Tail + 1) & (LINK_TX_BUFFER_SIZE - 1));
+	return;
+}
+
+void putLinkByte(byte* head, byte data) {
+	Link_Tx_Buffer[*head] = data;
+	*head = ((*head + 1) & (LINK_TX_BUFFER_SIZE - 1));
+	return;
+}
+
+byte decodeLinkFrame() {
+	byte Read = 0;
+	byte Write = 0;
+
+	// Decoding never writes ahead of reading, so it can be done in place
+	while(Read < Link_Frame_Length) {
+		byte Code = Link_Frame[Read++];
+		for(byte Count = 1; Count < Code; Count++) {
+			if(Read >= Link_Frame_Length) {
+				return 0;
+			}
+			Link_Frame[Write++] = Link_Frame[Read++];
+		}
+		if((Code < 0xFF) && (Read < Link_Frame_Length)) {
+			Link_Frame[Write++] = 0x00;
+		}
+	}
+
+	// The payload must hold at least its type, and fit in the caller's buffer
+	if((Write < 3) || (Write > (LINK_FRAME_MAX + 2))) {
+		return 0;
+	}
+	uint16_t CRC = 0xFFFF;
+	for(byte Index = 0; Index < (Write - 2); Index++) {
+		CRC = _crc_ccitt_update(CRC, Link_Frame[Index]);
+	}
+	if(CRC != (Link_Frame[Write - 2] | (((uint16_t) Link_Frame[Write - 1]) << 8))) {
+		return 0;
+	}
+	return(Write - 2);
+}
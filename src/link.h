@@ -0,0 +1,157 @@
+/* Diagnostic Link Module
+ *
+ * Used to carry framed commands and replies between the Firmware and a diagnostic host
+ *
+ * The link runs on the USART at LINK_BAUD (8N1), through the FTDI header's RX and TX pins. These
+ * are also the ISD1700's SCLK and MOSI, which the ISD1700 ignores while it is deselected, so the
+ * two take turns: transmitAudio() only selects the ISD1700 once the USART has finished sending its
+ * current byte, and hands both pins back to the USART when the SPI frame ends. Bytes sent by the
+ * host during an SPI frame (a few milliseconds each time a clip starts) are lost, which the host
+ * sees as a missing reply. The host's TX line is driven against SCLK during SPI frames, so it must
+ * have a series resistor of at least 1 kilohm.
+ *
+ * The stock board has no such resistor, so the link is disabled unless LINK_ENABLED is defined as
+ * 1, either below or by the build, and should only be enabled on a board which has one fitted.
+ * When disabled, the USART is never enabled, SCLK and MOSI are left to the ISD1700 at all times,
+ * nothing is ever received, and every frame sent is refused without being counted.
+ *
+ * Both directions are interrupt-driven through ring buffers, so neither sending nor receiving ever
+ * blocks. A reply which does not fit in the transmit buffer is dropped and counted.
+ *
+ * Each frame is a payload of up to LINK_FRAME_MAX bytes, followed by its CRC-CCITT (initial value
+ * 0xFFFF, low byte first), COBS-encoded and ended with a single 0x00 byte. The first byte of the
+ * payload is its type. The host sends requests, and the Firmware answers each valid request with a
+ * single reply, whose type is the request's type with bit 7 set (see EWMC-Firmware.h for the
+ * request types). Frames with a bad CRC, length, or encoding, or which were hit by a USART
+ * framing or overrun error, are counted and ignored.
+ */
+
+#ifndef link_h
+#define link_h
+#include <arduino.h>
+#include "hal.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+#ifndef LINK_ENABLED
+#define LINK_ENABLED 0
+#endif
+
+const unsigned long LINK_BAUD = 38400;
+
+// Largest payload, excluding its CRC and encoding
+const byte LINK_FRAME_MAX = 32;
+
+// Buffer sizes, which must be powers of two (one slot is always left free)
+// The transmit buffer holds at least one of the largest replies, of LINK_FRAME_MAX + 4 bytes once encoded
+const byte LINK_TX_BUFFER_SIZE = 64;
+const byte LINK_RX_BUFFER_SIZE = 16;
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// Frame counts since startup, each saturating at 65535
+typedef struct {
+	uint16_t Received;  // Valid frames received
+	uint16_t Rejected;  // Invalid frames received
+	uint16_t Sent;      // Frames queued for transmission
+	uint16_t Dropped;   // Frames dropped for lack of room in the transmit buffer
+} link_stats;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void initLink();
+/*
+ * Initializes the link and enables the USART (unless the link is disabled)
+ * Must be called once at startup, after initAudio()
+ *
+ * Affects every link variable
+ */
+
+bool linkPending();
+/*
+ * Determines if any received bytes are waiting for linkReceiveFrame()
+ * Used to decide whether the MCU may sleep
+ *
+ * OUTPUT: Are received bytes waiting?
+ */
+
+bool linkReceiveFrame(byte frame[LINK_FRAME_MAX], byte* length);
+/*
+ * Decodes received bytes until a complete, valid frame is found
+ * Should be called while linkPending() is true
+ *
+ * Affects Link_Rx_Tail, Link_Frame[], Link_Frame_Length, Link_Frame_Bad, and Link_Stats
+ * INPUT:  Buffer to fill with the frame's payload
+ *         Pointer to the payload length
+ * OUTPUT: Was a frame found? (false once every received byte is used up)
+ */
+
+bool linkSendFrame(const byte frame[], byte length);
+/*
+ * Queues a frame for transmission, without waiting
+ *
+ * Affects Link_Tx_Buffer[], Link_Tx_Head, and Link_Stats
+ * INPUT:  Payload, starting with its type
+ *         Payload length (1 to LINK_FRAME_MAX)
+ * OUTPUT: Was the frame queued? (false if it was dropped, or the link is disabled)
+ */
+
+void getLinkStats(link_stats* stats);
+/*
+ * Gets the frame counts since startup
+ *
+ * INPUT:  Pointer to the copy
+ */
+
+bool linkReleasePins();
+/*
+ * Hands the USART's pins over to the ISD1700 for an SPI frame, once the USART is idle
+ * Must be called from interrupt context (transmitAudio()), before selecting the ISD1700
+ *
+ * No further bytes are sent after the first call, so the USART is idle within two byte times.
+ * While the link is disabled, the pins are never the USART's, so this always succeeds.
+ *
+ * Affects Link_Paused
+ * OUTPUT: Were the pins released? (false while a byte is still being sent)
+ */
+
+void linkClaimPins();
+/*
+ * Hands the pins back to the USART once an SPI frame has ended, resuming transmission
+ * Must be called from interrupt context (transmitAudio()), after deselecting the ISD1700
+ *
+ * Affects Link_Paused
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void putLinkByte(byte* head, byte data);
+/*
+ * Writes a byte into the transmit buffer, without publishing it
+ * Used by linkSendFrame()
+ *
+ * INPUT:  Pointer to the write position, which is advanced
+ *         Byte to write
+ */
+
+byte decodeLinkFrame();
+/*
+ * Decodes the COBS-encoded frame in Link_Frame[] in place and checks its CRC
+ *
+ * Affects Link_Frame[]
+ * OUTPUT: Payload length (0 if the frame is invalid)
+ */
+
+
+#endif
@@ -0,0 +1,466 @@
+#include "motor.h"
+#include "trace.h"
+#include "scheduler.h"
+
+// Transition tables
+// Rows must be grouped by state, in ascending order, and each table ends with a MOTOR_STATES row
+// Within a state, rows are checked in order and the first row with all of its events present wins
+const motor_transition MOTOR_TABLE_CAL_SEEK[] PROGMEM = {
+	{INIT, MOTOR_EVENT_TIMEOUT, SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_ACTION_FLAG_PAIR},
+	{INIT, MOTOR_EVENT_ENDSTOP, DELAY_PRE_CHANGE, MOTOR_ACTION_FIND_ENDSTOPS},
+	{MOVE_START, MOTOR_EVENT_NEAR, MOVE, MOTOR_ACTION_NONE},
+	{MOVE, MOTOR_EVENT_BACK, FAULTED, MOTOR_ACTION_CRITICAL},
+	{MOVE, MOTOR_EVENT_TIMEOUT, SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_ACTION_FLAG_TARGET},
+	{MOVE, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_RECORD_TIME},
+	{DELAY_PRE_CHANGE, (MOTOR_EVENT_PRE_CHANGE | MOTOR_EVENT_RELAY_FREE), DELAY_POST_CHANGE, MOTOR_ACTION_NONE},
+	{DELAY_POST_CHANGE, (MOTOR_EVENT_POST_CHANGE | MOTOR_EVENT_BACKWARD), MOVE_START, MOTOR_ACTION_NONE},
+	{DELAY_POST_CHANGE, MOTOR_EVENT_POST_CHANGE, IDLE, MOTOR_ACTION_NONE},
+	{SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_EVENT_NEAR, FAULTED, MOTOR_ACTION_NONE},
+	{MOTOR_STATES, 0, MOTOR_STATES, MOTOR_ACTION_NONE}
+};
+
+const motor_transition MOTOR_TABLE_CAL_MEASURE[] PROGMEM = {
+	{MOVE_START, MOTOR_EVENT_NEAR, MOVE, MOTOR_ACTION_NONE},
+	{MOVE, MOTOR_EVENT_TIMEOUT, SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_ACTION_FLAG_TARGET},
+	{MOVE, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_RECORD_TIME},
+	{DELAY_PRE_CHANGE, (MOTOR_EVENT_PRE_CHANGE | MOTOR_EVENT_RELAY_FREE), DELAY_POST_CHANGE, MOTOR_ACTION_NONE},
+	{DELAY_POST_CHANGE, (MOTOR_EVENT_POST_CHANGE | MOTOR_EVENT_BACKWARD), MOVE_START, MOTOR_ACTION_NONE},
+	{DELAY_POST_CHANGE, MOTOR_EVENT_POST_CHANGE, IDLE, MOTOR_ACTION_NONE},
+	{SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_EVENT_NEAR, FAULTED, MOTOR_ACTION_NONE},
+	{MOTOR_STATES, 0, MOTOR_STATES, MOTOR_ACTION_NONE}
+};
+
+const motor_transition MOTOR_TABLE_NORMAL[] PROGMEM = {
+	{IDLE, MOTOR_EVENT_CUE, MOVE_START, MOTOR_ACTION_MAGNET_ON},
+	{MOVE_START, MOTOR_EVENT_NEAR, MOVE, MOTOR_ACTION_NONE},
+	{MOVE, MOTOR_EVENT_FRONT, SAFETY_REVERSE_ENDSTOP_EARLY, MOTOR_ACTION_FLAG_EARLY},
+	{MOVE, MOTOR_EVENT_SLOWDOWN, MOVE_END, MOTOR_ACTION_NONE},
+	{MOVE_END, MOTOR_EVENT_BACK, FAULTED, MOTOR_ACTION_CRITICAL},
+	{MOVE_END, MOTOR_EVENT_TIMEOUT, SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_ACTION_FLAG_TARGET},
+	{MOVE_END, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_RECORD_TRIP},
+	{DELAY_PRE_CHANGE, (MOTOR_EVENT_PRE_CHANGE | MOTOR_EVENT_RELAY_FREE), DELAY_POST_CHANGE, MOTOR_ACTION_NONE},
+	{DELAY_POST_CHANGE, MOTOR_EVENT_IDLE_DELAY, IDLE, MOTOR_ACTION_NONE},
+	{SAFETY_REVERSE_ENDSTOP_FAIL, MOTOR_EVENT_NEAR, FAULTED, MOTOR_ACTION_NONE},
+	{SAFETY_REVERSE_ENDSTOP_EARLY, (MOTOR_EVENT_NEAR | MOTOR_EVENT_BACK), FAULTED, MOTOR_ACTION_CRITICAL},
+	{SAFETY_REVERSE_ENDSTOP_EARLY, MOTOR_EVENT_NEAR, FAULTED, MOTOR_ACTION_NONE},
+	{MOTOR_STATES, 0, MOTOR_STATES, MOTOR_ACTION_NONE}
+};
+
+// Each motor creeps toward its front endstop, stopping in IDLE once it is shown to move. A motor
+// starting on its back endstop (MOVE_START) has moved once that endstop releases before
+// MOTOR_EVENT_NEAR (MOVE), after which the nudge may time out. A motor starting on neither endstop
+// (MOVE_END) can only show it moves by reaching its front endstop, so its timeout is a fault,
+// flagging that endstop. Reaching the back endstop instead, or never leaving it, is also a fault,
+// flagging both of the motor's endstops.
+const motor_transition MOTOR_TABLE_SELF_TEST[] PROGMEM = {
+	{MOVE_START, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_NONE},
+	{MOVE_START, (MOTOR_EVENT_NEAR | MOTOR_EVENT_BACK), FAULTED, MOTOR_ACTION_FLAG_PAIR},
+	{MOVE_START, MOTOR_EVENT_NEAR, MOVE, MOTOR_ACTION_NONE},
+	{MOVE, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_NONE},
+	{MOVE, MOTOR_EVENT_BACK, FAULTED, MOTOR_ACTION_FLAG_PAIR},
+	{MOVE, MOTOR_EVENT_TIMEOUT, DELAY_PRE_CHANGE, MOTOR_ACTION_NONE},
+	{MOVE_END, MOTOR_EVENT_FRONT, DELAY_PRE_CHANGE, MOTOR_ACTION_NONE},
+	{MOVE_END, MOTOR_EVENT_BACK, FAULTED, MOTOR_ACTION_FLAG_PAIR},
+	{MOVE_END, MOTOR_EVENT_TIMEOUT, FAULTED, MOTOR_ACTION_FLAG_TARGET},
+	{DELAY_PRE_CHANGE, MOTOR_EVENT_PRE_CHANGE, IDLE, MOTOR_ACTION_NONE},
+	{MOTOR_STATES, 0, MOTOR_STATES, MOTOR_ACTION_NONE}
+};
+
+// Indexed by motor_profile
+const motor_transition* const MOTOR_TABLES[4] = {
+	MOTOR_TABLE_CAL_SEEK,
+	MOTOR_TABLE_CAL_MEASURE,
+	MOTOR_TABLE_NORMAL,
+	MOTOR_TABLE_SELF_TEST
+};
+
+// Engine state
+const motor_transition* Motor_Transitions = MOTOR_TABLE_NORMAL;
+byte Motor_Row_Start[MOTOR_STATES + 1];  // First row of each state, plus the end of the table
+uint16_t Motor_State_Events[MOTOR_STATES];  // Events referenced by any row of each state
+const motor_limits* Motor_Limits_Forward = NULL;
+const motor_limits* Motor_Limits_Backward = NULL;
+
+// Motor state variables
+motor_status Motor_Status[3];                     // Zeroed at startup, with every motor in INIT
+bool Motor_Changed = false;                       // Has any motor changed state since the last deadline?
+unsigned long Relay_Change_Time = 0;              // Time any motor last reversed
+
+void setMotorProfile(motor_profile profile, const motor_limits limits_forward[3], const motor_limits limits_backward[3]) {
+	Motor_Transitions = MOTOR_TABLES[profile];
+	Motor_Limits_Forward = limits_forward;
+	Motor_Limits_Backward = limits_backward;
+
+	// Index the first row of each state, along with the events its rows depend on
+	byte Row = 0;
+	for(byte State = 0; State < MOTOR_STATES; State++) {
+		Motor_Row_Start[State] = Row;
+		Motor_State_Events[State] = 0;
+		while(pgm_read_byte(&Motor_Transitions[Row].State) == State) {
+			Motor_State_Events[State] |= pgm_read_word(&Motor_Transitions[Row].Events);
+			Row++;
+		}
+	}
+	Motor_Row_Start[MOTOR_STATES] = Row;
+
+	// Trips recorded under the previous profile were not timed against these limits
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		Motor_Status[Motor].Trip_Ready = false;
+		updateMotorLimits((output_group)Motor);
+	}
+	return;
+}
+
+void handleMotors() {
+	uint16_t Now = (uint16_t) getLoopTime();
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		PROFILE_BEGIN(Motor_Start);
+		byte State = Motor_Status[Motor].State;
+		uint16_t Needed = Motor_State_Events[State];
+		uint16_t Timed = (Needed & MOTOR_EVENTS_TIMED);
+		uint16_t Elapsed_Time = 0;
+
+		// Once every threshold has passed, the elapsed time holds at its maximum rather than wrapping
+		if(Motor_Status[Motor].Time_Expired) {
+			Elapsed_Time = MOTOR_ELAPSED_MAX;
+		}
+		else if(Timed) {
+			Elapsed_Time = (uint16_t)(Now - Motor_Status[Motor].State_Start);
+		}
+		uint16_t Events = getMotorEvents((output_group)Motor, Needed, Elapsed_Time);
+		if(Timed && ((Events & Timed) == Timed)) {
+			Motor_Status[Motor].Time_Expired = true;
+		}
+
+		for(byte Row = Motor_Row_Start[State]; Row < Motor_Row_Start[State + 1]; Row++) {
+			uint16_t Required = pgm_read_word(&Motor_Transitions[Row].Events);
+			if((Events & Required) == Required) {
+				motor_action Action = (motor_action)pgm_read_byte(&Motor_Transitions[Row].Action);
+				sensor_group Target = Motor_Status[Motor].Endstop_Front;
+				motor_dir Dir = getMotorDir((output_group)Motor);
+
+				if(Action == MOTOR_ACTION_CRITICAL) {
+					assertCriticalError();
+				}
+				else {
+					changeMotorState((output_group)Motor, (motor_state)pgm_read_byte(&Motor_Transitions[Row].Next_State));
+					runMotorAction((output_group)Motor, Action, Target, Dir, Elapsed_Time);
+				}
+				break;
+			}
+		}
+
+		if(sensorEngaged(Motor_Status[Motor].Endstop_Front) && sensorEngaged(Motor_Status[Motor].Endstop_Back) && anyMotorEnabled()) {
+			assertCriticalError();
+		}
+		PROFILE_END((profile_section)(PROFILE_MOTOR_ELEVATOR + Motor), Motor_Start);
+	}
+	return;
+}
+
+bool getMotorDeadline(unsigned long* deadline) {
+	unsigned long Now = getLoopTime();
+
+	// A new state may already have all of its events present, so it is checked on the next pass
+	if(Motor_Changed) {
+		Motor_Changed = false;
+		*deadline = Now;
+		return true;
+	}
+
+	bool Scheduled = false;
+	uint16_t Soonest = 0;
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		uint16_t Needed = (Motor_State_Events[Motor_Status[Motor].State] & MOTOR_EVENTS_TIMED);
+		if((Needed == 0) || Motor_Status[Motor].Time_Expired) {
+			continue;
+		}
+
+		// Only thresholds still to come can change the outcome of a pass
+		uint16_t Elapsed_Time = (uint16_t)(((uint16_t) Now) - Motor_Status[Motor].State_Start);
+		for(uint16_t Event = MOTOR_EVENT_NEAR; Event <= MOTOR_EVENT_RELAY_FREE; Event <<= 1) {
+			if(Needed & Event) {
+				uint16_t Threshold = getMotorThreshold((output_group)Motor, Event);
+				if((Threshold > Elapsed_Time) && (!Scheduled || ((Threshold - Elapsed_Time) < Soonest))) {
+					Soonest = (Threshold - Elapsed_Time);
+					Scheduled = true;
+				}
+			}
+		}
+	}
+
+	*deadline = (Now + Soonest);
+	return Scheduled;
+}
+
+void startMotor(output_group motor, motor_state state) {
+	Motor_Status[motor].State = state;
+	Motor_Status[motor].Trip_Started = (state == MOVE_START);
+	setPowerOutput(motor, true);
+	Motor_Status[motor].State_Start = (uint16_t) getLoopTime();
+	Motor_Status[motor].Time_Expired = false;
+	Motor_Status[motor].Cued = false;
+	Motor_Status[motor].Entered |= (1 << state);
+	Motor_Changed = true;
+	traceEvent(TRACE_MOTOR, motor, state);
+	return;
+}
+
+void cueMotor(output_group motor) {
+	Motor_Status[motor].Cued = true;
+	Motor_Changed = true;
+	return;
+}
+
+motor_state getMotorState(output_group motor) {
+	return Motor_Status[motor].State;
+}
+
+unsigned int getMotorTravelTime(output_group motor, motor_dir dir) {
+	return Motor_Status[motor].Travel_Time[dir];
+}
+
+bool takeMotorTrip(output_group motor, motor_dir* dir, unsigned int* travel_time) {
+	if(!Motor_Status[motor].Trip_Ready) {
+		return false;
+	}
+	Motor_Status[motor].Trip_Ready = false;
+	*dir = Motor_Status[motor].Trip_Dir;
+	*travel_time = Motor_Status[motor].Travel_Time[Motor_Status[motor].Trip_Dir];
+	return true;
+}
+
+uint16_t takeMotorStatesEntered(output_group motor) {
+	uint16_t Entered = Motor_Status[motor].Entered;
+	Motor_Status[motor].Entered = 0;
+	return Entered;
+}
+
+void assignEndstops(output_group motor, sensor_group endstop_forward) {
+	sensor_group Endstop_X = (sensor_group)((motor * 2) + ENDSTOP_1);
+	sensor_group Endstop_Y = (sensor_group)(Endstop_X + 1);
+
+	if((Endstop_X == endstop_forward) != (getMotorDir(motor) == BACKWARD)) {
+		Motor_Status[motor].Endstop_Front = Endstop_X;
+		Motor_Status[motor].Endstop_Back = Endstop_Y;
+	}
+	else {
+		Motor_Status[motor].Endstop_Front = Endstop_Y;
+		Motor_Status[motor].Endstop_Back = Endstop_X;
+	}
+	return;
+}
+
+sensor_group getEndstopFront(output_group motor) {
+	return Motor_Status[motor].Endstop_Front;
+}
+
+void changeMotorState(output_group motor, motor_state state) {
+	switch(state) {
+		default:
+		case FAULTED:
+			setPowerOutput(motor, false);
+			setMotorDir(motor, FORWARD);
+			if(motor == LOADER_MOTOR) {
+				setPowerOutput(LOADER_MAGNET, false);
+			}
+			break;
+		case DELAY_PRE_CHANGE:
+			setPowerOutput(motor, false);
+			if(motor == LOADER_MOTOR) {
+				setPowerOutput(LOADER_MAGNET, false);
+			}
+			break;
+		case SAFETY_REVERSE_ENDSTOP_EARLY:
+		case SAFETY_REVERSE_ENDSTOP_FAIL:
+			setMotorSpeed(motor, SLOW);
+		case DELAY_POST_CHANGE:
+			reverseMotor(motor);
+			break;
+		case MOVE_START:
+			setPowerOutput(motor, true);
+			break;
+		case MOVE_END:
+			setMotorSpeed(motor, SLOW);
+			break;
+		case IDLE:
+			setMotorSpeed(motor, FAST);
+		case MOVE:
+			break;
+	}
+
+	if((state != MOVE_END) && (state != MOVE)) {
+		Motor_Status[motor].State_Start = (uint16_t) getLoopTime();
+	}
+	Motor_Status[motor].Time_Expired = false;
+	Motor_Status[motor].Cued = false;
+
+	// A trip runs from MOVE_START until the DELAY_PRE_CHANGE that ends it, where it is recorded
+	if(state == MOVE_START) {
+		Motor_Status[motor].Trip_Started = true;
+	}
+	else if((state != MOVE) && (state != MOVE_END) && (state != DELAY_PRE_CHANGE)) {
+		Motor_Status[motor].Trip_Started = false;
+	}
+	Motor_Status[motor].State = state;
+	Motor_Status[motor].Entered |= (1 << state);
+	Motor_Changed = true;
+	traceEvent(TRACE_MOTOR, motor, state);
+	return;
+}
+
+void assertCriticalError() {
+	changeMotorState(ELEVATOR_MOTOR, FAULTED);
+	changeMotorState(CART_MOTOR, FAULTED);
+	changeMotorState(LOADER_MOTOR, FAULTED);
+	flagError(CRITICAL_ERROR);
+	return;
+}
+
+void reverseMotor(output_group motor) {
+	if(getMotorDir(motor) == FORWARD) {
+		setMotorDir(motor, BACKWARD);
+	}
+	else {
+		setMotorDir(motor, FORWARD);
+	}
+	sensor_group Temp_Endstop = Motor_Status[motor].Endstop_Front;
+	Motor_Status[motor].Endstop_Front = Motor_Status[motor].Endstop_Back;
+	Motor_Status[motor].Endstop_Back = Temp_Endstop;
+	updateMotorLimits(motor);
+	Relay_Change_Time = getLoopTime();
+	return;
+}
+
+void updateMotorLimits(output_group motor) {
+	if((Motor_Limits_Forward == NULL) || (Motor_Limits_Backward == NULL)) {
+		return;
+	}
+	if(getMotorDir(motor) == FORWARD) {
+		Motor_Status[motor].Limits = Motor_Limits_Forward[motor];
+	}
+	else {
+		Motor_Status[motor].Limits = Motor_Limits_Backward[motor];
+	}
+	return;
+}
+
+uint16_t getMotorEvents(output_group motor, uint16_t needed, uint16_t elapsed_time) {
+	uint16_t Events = 0;
+
+	// Sensor events
+	if((needed & MOTOR_EVENT_BUTTON) && sensorEngaged(BUTTON)) {
+		Events |= MOTOR_EVENT_BUTTON;
+	}
+	if((needed & MOTOR_EVENT_FRONT) && sensorEngaged(Motor_Status[motor].Endstop_Front)) {
+		Events |= MOTOR_EVENT_FRONT;
+	}
+	if((needed & MOTOR_EVENT_BACK) && sensorEngaged(Motor_Status[motor].Endstop_Back)) {
+		Events |= MOTOR_EVENT_BACK;
+	}
+	if((needed & MOTOR_EVENT_ENDSTOP) && sensorEngaged((sensor_group)(motor + ENDSTOP_MOTOR_1))) {
+		Events |= MOTOR_EVENT_ENDSTOP;
+	}
+	if((needed & MOTOR_EVENT_CUE) && Motor_Status[motor].Cued) {
+		Events |= MOTOR_EVENT_CUE;
+	}
+
+	// Timing events
+	if(!(needed & MOTOR_EVENTS_TIMED)) {
+		return Events;
+	}
+	if(elapsed_time >= Motor_Status[motor].Limits.Near) {
+		Events |= MOTOR_EVENT_NEAR;
+	}
+	if(elapsed_time >= Motor_Status[motor].Limits.Slowdown) {
+		Events |= MOTOR_EVENT_SLOWDOWN;
+	}
+	if(elapsed_time >= Motor_Status[motor].Limits.Timeout) {
+		Events |= MOTOR_EVENT_TIMEOUT;
+	}
+	if(elapsed_time >= RELAY_PRE_CHANGE_DELAY) {
+		Events |= MOTOR_EVENT_PRE_CHANGE;
+	}
+	if(elapsed_time >= RELAY_POST_CHANGE_DELAY) {
+		Events |= MOTOR_EVENT_POST_CHANGE;
+	}
+	if(elapsed_time >= getMotorThreshold(motor, MOTOR_EVENT_IDLE_DELAY)) {
+		Events |= MOTOR_EVENT_IDLE_DELAY;
+	}
+	if((needed & MOTOR_EVENT_RELAY_FREE) && (elapsed_time >= getMotorThreshold(motor, MOTOR_EVENT_RELAY_FREE))) {
+		Events |= MOTOR_EVENT_RELAY_FREE;
+	}
+
+	// Direction events
+	if(getMotorDir(motor) == BACKWARD) {
+		Events |= MOTOR_EVENT_BACKWARD;
+	}
+	return Events;
+}
+
+void runMotorAction(output_group motor, motor_action action, sensor_group target, motor_dir dir, uint16_t elapsed_time) {
+	sensor_group Endstop_X = (sensor_group)((motor * 2) + ENDSTOP_1);
+	sensor_group Endstop_Y = (sensor_group)(Endstop_X + 1);
+
+	switch(action) {
+		case MOTOR_ACTION_MAGNET_ON:
+			if(motor == LOADER_MOTOR) {
+				setPowerOutput(LOADER_MAGNET, true);
+			}
+			break;
+		case MOTOR_ACTION_FLAG_TARGET:
+			flagError(target);
+			break;
+		case MOTOR_ACTION_FLAG_PAIR:
+			flagError(Endstop_X);
+			flagError(Endstop_Y);
+			break;
+		case MOTOR_ACTION_FLAG_EARLY:
+			flagError(motor + 7);
+			break;
+		case MOTOR_ACTION_FIND_ENDSTOPS:
+			// The motor is still traveling in its initial direction, so this endstop is its forward one
+			assignEndstops(motor, (sensorEngaged(Endstop_X) ? Endstop_X : Endstop_Y));
+			break;
+		case MOTOR_ACTION_RECORD_TIME:
+			Motor_Status[motor].Travel_Time[dir] = elapsed_time;
+			break;
+		case MOTOR_ACTION_RECORD_TRIP:
+			Motor_Status[motor].Travel_Time[dir] = elapsed_time;
+			Motor_Status[motor].Trip_Ready = Motor_Status[motor].Trip_Started;
+			Motor_Status[motor].Trip_Dir = dir;
+			break;
+		default:
+		case MOTOR_ACTION_NONE:
+			break;
+	}
+	return;
+}
+
+uint16_t getMotorThreshold(output_group motor, uint16_t event) {
+	switch(event) {
+		case MOTOR_EVENT_NEAR:
+			return Motor_Status[motor].Limits.Near;
+		case MOTOR_EVENT_SLOWDOWN:
+			return Motor_Status[motor].Limits.Slowdown;
+		case MOTOR_EVENT_TIMEOUT:
+			return Motor_Status[motor].Limits.Timeout;
+		case MOTOR_EVENT_PRE_CHANGE:
+			return RELAY_PRE_CHANGE_DELAY;
+		case MOTOR_EVENT_POST_CHANGE:
+			return RELAY_POST_CHANGE_DELAY;
+		case MOTOR_EVENT_IDLE_DELAY:
+			return(RELAY_POST_CHANGE_DELAY + pgm_read_word(&MOTOR_IDLE_DELAY[motor]));
+		case MOTOR_EVENT_RELAY_FREE: {
+			// The stagger runs from another motor's reversal, so it is carried over into this motor's elapsed time
+			unsigned long Since_Change = (getLoopTime() - Relay_Change_Time);
+			if(Since_Change >= RELAY_STAGGER_DELAY) {
+				return 0;
+			}
+			return((uint16_t)(((uint16_t) getLoopTime()) - Motor_Status[motor].State_Start) + (RELAY_STAGGER_DELAY - Since_Change));
+		}
+		default:
+			return 0;
+	}
+}
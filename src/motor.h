@@ -0,0 +1,359 @@
+/* Motor State Machine Module
+ *
+ * Used to run the state machines of all three motors, both during calibration and normal operation
+ *
+ * Each motor is driven by a single table-driven engine. Once per pass, handleMotors() gathers the
+ * events seen by each motor (endstops, elapsed time thresholds, the arcade button, cues, and
+ * direction) into a bitmask. It then scans the transition table of the motor's current state, in
+ * order, and takes the first transition whose required events are all present. A transition names
+ * the next state and an optional action (flagging an error, recording a travel time, and so on).
+ *
+ * Transition tables are stored in PROGMEM, one per motor profile. Both steps of calibration
+ * stage 2, the startup self-test, and normal operation are each a profile of the same engine, so the
+ * worst-case work done in a pass is bounded by the longest run of rows for a single state. Only the
+ * events referenced by the current state's rows are gathered, and the time is taken once per pass
+ * of loop() (see getLoopTime()).
+ *
+ * Elapsed times are 16-bit, taken as the lower 16 bits of the time less those of the time the
+ * state started, so they are correct across millis() overflow but wrap after 65.5 seconds. Every
+ * threshold is below that, and each is reached by a pass scheduled for it, so a state's elapsed
+ * time is always seen before it wraps. Once a pass has seen every timed event of the current state,
+ * the motor's elapsed time is held at MOTOR_ELAPSED_MAX until it next changes state, so a motor
+ * left IDLE indefinitely never sees its idle delay again.
+ *
+ * Elapsed time thresholds depend on the direction of travel. The limits for the current direction
+ * are copied into Motor_Status[].Limits whenever a motor reverses, rather than chosen on every pass.
+ *
+ * Direction relays are staggered, so no two motors reverse within RELAY_STAGGER_DELAY of each
+ * other. A motor waiting to reverse holds in DELAY_PRE_CHANGE until MOTOR_EVENT_RELAY_FREE, which
+ * is timed like any other threshold. Safety reversals never wait, but do hold off other motors.
+ *
+ * In normal operation, motors leave IDLE when cued by the Choreography module (see cueMotor()),
+ * rather than on the arcade button, so that the three motors follow a common timeline.
+ */
+
+#ifndef motor_h
+#define motor_h
+#include <arduino.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
+#include "input.h"
+#include "power.h"
+#include "error.h"
+#include "profile.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// Motor state delays
+const unsigned int RELAY_PRE_CHANGE_DELAY = 250;
+const unsigned int RELAY_POST_CHANGE_DELAY = 250;
+const unsigned int MOTOR_IDLE_DELAY[3] PROGMEM = {3000, 1000, 1000};
+
+// Minimum time between any two motors' direction changes, so their relays never switch together
+const unsigned int RELAY_STAGGER_DELAY = RELAY_PRE_CHANGE_DELAY;
+
+// Elapsed time of a state once all of its thresholds have passed
+const uint16_t MOTOR_ELAPSED_MAX = 0xFFFF;
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Motor operation states
+typedef enum {
+	INIT,
+	IDLE,
+	MOVE_START,
+	MOVE,
+	MOVE_END,
+	DELAY_PRE_CHANGE,
+	DELAY_POST_CHANGE,
+	SAFETY_REVERSE_ENDSTOP_FAIL,
+	SAFETY_REVERSE_ENDSTOP_EARLY,
+	FAULTED,
+	MOTOR_STATES
+} motor_state;
+
+static_assert(MOTOR_STATES <= 16, "States entered are held in a uint16_t");
+static_assert(INIT == 0, "Motor_Status[] is zeroed at startup, placing every motor in INIT");
+
+// Available transition tables
+typedef enum {
+	MOTOR_PROFILE_CAL_SEEK = 0,     // Calibration stage 2, step 1
+	MOTOR_PROFILE_CAL_MEASURE = 1,  // Calibration stage 2, step 2
+	MOTOR_PROFILE_NORMAL = 2,
+	MOTOR_PROFILE_SELF_TEST = 3     // Startup self-test, when calibration data is valid
+} motor_profile;
+
+// Actions taken alongside a transition
+typedef enum {
+	MOTOR_ACTION_NONE,
+	MOTOR_ACTION_MAGNET_ON,      // Enables the loader electromagnet (loader motor only)
+	MOTOR_ACTION_FLAG_TARGET,    // Flags the endstop the motor was traveling toward (errors 1-6)
+	MOTOR_ACTION_FLAG_PAIR,      // Flags both of the motor's endstops (errors 1-6)
+	MOTOR_ACTION_FLAG_EARLY,     // Flags the motor's early endstop error (errors 7-9)
+	MOTOR_ACTION_FIND_ENDSTOPS,  // Assigns the engaged endstop as the front endstop
+	MOTOR_ACTION_RECORD_TIME,    // Records the elapsed travel time for the direction of travel
+	MOTOR_ACTION_RECORD_TRIP,    // As above, also marking a complete trip for takeMotorTrip()
+	MOTOR_ACTION_CRITICAL        // Asserts a critical error, halting all motors
+} motor_action;
+
+
+/////////////////////////
+// EVENT BITMASKS
+/////////////////////////
+
+const uint16_t MOTOR_EVENT_BUTTON = 0x0001;       // Arcade button engaged
+const uint16_t MOTOR_EVENT_FRONT = 0x0002;        // Front endstop engaged
+const uint16_t MOTOR_EVENT_BACK = 0x0004;         // Back endstop engaged
+const uint16_t MOTOR_EVENT_ENDSTOP = 0x0008;      // Either of the motor's endstops engaged
+const uint16_t MOTOR_EVENT_NEAR = 0x0010;         // Elapsed time >= Motor_Status[].Limits.Near
+const uint16_t MOTOR_EVENT_SLOWDOWN = 0x0020;     // Elapsed time >= Motor_Status[].Limits.Slowdown
+const uint16_t MOTOR_EVENT_TIMEOUT = 0x0040;      // Elapsed time >= Motor_Status[].Limits.Timeout
+const uint16_t MOTOR_EVENT_PRE_CHANGE = 0x0080;   // Elapsed time >= RELAY_PRE_CHANGE_DELAY
+const uint16_t MOTOR_EVENT_POST_CHANGE = 0x0100;  // Elapsed time >= RELAY_POST_CHANGE_DELAY
+const uint16_t MOTOR_EVENT_IDLE_DELAY = 0x0200;   // Elapsed time >= RELAY_POST_CHANGE_DELAY + MOTOR_IDLE_DELAY[]
+const uint16_t MOTOR_EVENT_RELAY_FREE = 0x0400;   // No direction relay has switched for RELAY_STAGGER_DELAY
+const uint16_t MOTOR_EVENT_BACKWARD = 0x0800;     // Motor is traveling backward
+const uint16_t MOTOR_EVENT_CUE = 0x1000;          // Motor has been cued by cueMotor()
+
+// Events which depend on elapsed time (and therefore need millis())
+const uint16_t MOTOR_EVENTS_TIMED = 0x07F0;
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// Elapsed time thresholds for a single direction of travel, in milliseconds
+typedef struct {
+	unsigned int Near;      // Time by which the back endstop should disengage
+	unsigned int Slowdown;  // Time before slowing
+	unsigned int Timeout;   // Emergency timeout
+} motor_limits;
+
+// A single row of a transition table
+typedef struct {
+	byte State;        // motor_state the row applies to
+	uint16_t Events;   // Events which must all be present
+	byte Next_State;   // motor_state to change to
+	byte Action;       // motor_action to take
+} motor_transition;
+
+// Run-time state of a single motor, packed so that each enumeration takes a byte and each flag a bit
+typedef struct {
+	motor_state State : 8;
+	sensor_group Endstop_Front : 8;  // Relative to current motor direction
+	sensor_group Endstop_Back : 8;   // Relative to current motor direction
+	motor_dir Trip_Dir : 1;          // Direction of the trip waiting for takeMotorTrip()
+	bool Trip_Started : 1;           // Has the motor traveled from MOVE_START?
+	bool Trip_Ready : 1;             // Is a recorded trip waiting for takeMotorTrip()?
+	bool Time_Expired : 1;           // Has every timed event of the current state occurred?
+	bool Cued : 1;                   // Has the motor been cued since it entered the current state?
+	uint16_t State_Start;            // Lower 16 bits of millis()
+	uint16_t Entered;                // States entered since takeMotorStatesEntered() (bit n = motor_state n)
+	motor_limits Limits;             // Relative to current motor direction
+	unsigned int Travel_Time[2];     // Indexed by motor_dir
+} motor_status;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void setMotorProfile(motor_profile profile, const motor_limits limits_forward[3], const motor_limits limits_backward[3]);
+/*
+ * Selects the transition table and elapsed time limits used by all motors
+ *
+ * The limit arrays must remain valid for as long as the profile is in use.
+ *
+ * Affects Motor_Transitions, Motor_Row_Start[], Motor_State_Events[], Motor_Limits_Forward,
+ *         Motor_Limits_Backward, and Motor_Status[].Limits
+ * INPUT:  Profile to use
+ *         Limits for each motor while traveling forward
+ *         Limits for each motor while traveling backward
+ */
+
+void handleMotors();
+/*
+ * Runs one pass of every motor's state machine
+ * Should be called once per pass of any loop that moves motors, after sampleInputs()
+ *
+ * A critical error is asserted if both of a motor's endstops are engaged while any motor is enabled.
+ *
+ * Affects Motor_Status[] and Motor_Changed
+ */
+
+bool getMotorDeadline(unsigned long* deadline);
+/*
+ * Determines when handleMotors() next needs to run, other than when the inputs change
+ * Should be called after handleMotors()
+ *
+ * If any motor changed state in the last pass, the deadline is now. Otherwise it is the soonest
+ * elapsed time threshold, among those referenced by each motor's current state, still to come.
+ * Motors whose elapsed time is held at MOTOR_ELAPSED_MAX have none to come.
+ *
+ * Affects Motor_Changed
+ * INPUT:  Pointer to the deadline, in milliseconds
+ * OUTPUT: Is there a deadline? (false if only the inputs can change any motor's state)
+ */
+
+void startMotor(output_group motor, motor_state state);
+/*
+ * Places a motor directly into a given state and enables it
+ *
+ * Unlike changeMotorState(), no other outputs, speeds, or directions are changed.
+ *
+ * Affects Motor_Status[motor] and Motor_Changed
+ * INPUT:  Motor to start (0-indexed)
+ *         State to start in
+ */
+
+void cueMotor(output_group motor);
+/*
+ * Cues a motor, giving it MOTOR_EVENT_CUE until it next changes state
+ * Used by the Choreography module to start motors waiting in IDLE
+ *
+ * Affects Motor_Status[motor].Cued and Motor_Changed
+ * INPUT:  Motor to cue (0-indexed)
+ */
+
+motor_state getMotorState(output_group motor);
+/*
+ * Gets the current state of a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: State of motor
+ */
+
+unsigned int getMotorTravelTime(output_group motor, motor_dir dir);
+/*
+ * Gets the last travel time recorded by MOTOR_ACTION_RECORD_TIME or MOTOR_ACTION_RECORD_TRIP
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Direction of travel
+ * OUTPUT: Travel time in milliseconds
+ */
+
+bool takeMotorTrip(output_group motor, motor_dir* dir, unsigned int* travel_time);
+/*
+ * Takes the trip last recorded by MOTOR_ACTION_RECORD_TRIP, if not already taken
+ *
+ * Only trips that ran from MOVE_START through to the front endstop are recorded, so the travel
+ * time of a motor started partway along (such as at startup) is never reported.
+ *
+ * Affects Motor_Status[motor].Trip_Ready
+ * INPUT:  Motor (0-indexed)
+ *         Pointer to the direction of travel
+ *         Pointer to the travel time, in milliseconds
+ * OUTPUT: Was a trip taken?
+ */
+
+uint16_t takeMotorStatesEntered(output_group motor);
+/*
+ * Takes the states a motor has entered since the last call, including re-entries of its current state
+ * Used to tie sound effects to motor events
+ *
+ * Affects Motor_Status[motor].Entered
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: States entered (bit n = motor_state n)
+ */
+
+void assignEndstops(output_group motor, sensor_group endstop_forward);
+/*
+ * Assigns a motor's front and back endstops from its current direction
+ *
+ * Affects Motor_Status[motor].Endstop_Front and Motor_Status[motor].Endstop_Back
+ * INPUT:  Motor (0-indexed)
+ *         Endstop engaged at the end of forward travel
+ */
+
+sensor_group getEndstopFront(output_group motor);
+/*
+ * Gets the endstop a motor is currently traveling toward
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: Front endstop
+ */
+
+void changeMotorState(output_group motor, motor_state state);
+/*
+ * Changes the state of a motor, handling all the tricky bits
+ *
+ * This includes enabling/disabling outputs, restarting the state timer,
+ * and changes to direction and speed.
+ *
+ * The loader electromagnet is disabled upon any fault conditions of the loader motor. However,
+ * The loader electromagnet must be enabled outside this function.
+ *
+ * Error codes are not flagged by this function. The change is recorded in the motion trace.
+ *
+ * Affects Motor_Status[motor] and Motor_Changed
+ * INPUT:  Motor to change state (0-indexed)
+ *         State to change to
+ */
+
+void assertCriticalError();
+/*
+ * Flags a critical error and halts all motors
+ *
+ * Affects Motor_Status[]
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void reverseMotor(output_group motor);
+/*
+ * Reverses the direction of a given motor, restarting the relay stagger
+ *
+ * Affects Motor_Status[motor] and Relay_Change_Time
+ * INPUT:  Motor to reverse (0-indexed)
+ */
+
+void updateMotorLimits(output_group motor);
+/*
+ * Copies the limits for a motor's current direction of travel into Motor_Status[motor].Limits
+ *
+ * Affects Motor_Status[motor].Limits
+ * INPUT:  Motor (0-indexed)
+ */
+
+uint16_t getMotorEvents(output_group motor, uint16_t needed, uint16_t elapsed_time);
+/*
+ * Gathers the events currently seen by a motor
+ * Events not referenced by the motor's current state are skipped
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Bitmask of events referenced by the current state
+ *         Time since the motor's state timer was last restarted, or MOTOR_ELAPSED_MAX
+ * OUTPUT: Bitmask of MOTOR_EVENT_* values
+ */
+
+uint16_t getMotorThreshold(output_group motor, uint16_t event);
+/*
+ * Gets the elapsed time at which a timed event occurs for a motor
+ *
+ * INPUT:  Motor (0-indexed)
+ *         A single timed MOTOR_EVENT_* value
+ * OUTPUT: Elapsed time in milliseconds
+ */
+
+void runMotorAction(output_group motor, motor_action action, sensor_group target, motor_dir dir, uint16_t elapsed_time);
+/*
+ * Carries out the action of a transition, after the state change itself
+ *
+ * INPUT:  Motor (0-indexed)
+ *         Action to take
+ *         Front endstop before the state change
+ *         Direction of travel before the state change
+ *         Time since the motor's state timer was last restarted, before the state change
+ */
+
+
+#endif
@@ -1,26 +1,32 @@
 #include "power.h"
 
-uint8_t Power_Output_PWM[4];
-bool Power_Output_Enabled[4];
-motor_dir Motor_Dir[3];
+uint8_t Power_Output_PWM[4];               // Preset of each output
+byte Power_Output_Enabled = 0;             // Bit n = output_group n
+byte Motor_Backward = 0;                   // Bit n = motor n traveling BACKWARD
+
+// Ramp state, advanced by rampMotors() from the system tick interrupt
+volatile uint8_t Power_Output_Level[3];      // PWM currently applied to each motor
+uint8_t Ramp_From[3];
+uint8_t Ramp_To[3];
+uint16_t Ramp_Step[3];                       // Progress per system tick
+volatile uint16_t Ramp_Progress[3];          // 0 to RAMP_COMPLETE
 
 void initPowerOutputs() {
 
 	// Prepare PWM outputs
+	Power_Output_Enabled = 0;
 	for(byte Output = 0; Output <= LOADER_MAGNET; Output++) {
-		Power_Output_Enabled[Output] = false;
 		setPowerOutputPWM((output_group)Output, 0);
 	}
 	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		Power_Output_Level[Motor] = 0;
+		Ramp_Progress[Motor] = RAMP_COMPLETE;
 		setMotorSpeed((output_group)Motor, SLOW);
 	}
 	Power_Output_PWM[LOADER_MAGNET] = PWM_MAGNET;
 
 	// Configure PWM registers
-	TCCR1A = B10100001;
-	TCCR1B = B00000100;
-	TCCR2A = B10100001;
-	TCCR2B = B00000110;
+	halInitPWM(POWER_PWM_CARRIER);
 
 	// Prepare direction outputs
 	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
@@ -28,74 +34,156 @@ void initPowerOutputs() {
 	}
 
 	// Drive output pins
-	for(byte Output = 0; Output <= LOADER_MAGNET; Output++) {
-		pinMode(POWER_PWM_PIN[Output], OUTPUT);
-	}
-	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
-		pinMode(MOTOR_DIR_PIN[Motor], OUTPUT);
-	}
+	halPinMode<POWER_PWM_PIN[ELEVATOR_MOTOR]>(OUTPUT);
+	halPinMode<POWER_PWM_PIN[CART_MOTOR]>(OUTPUT);
+	halPinMode<POWER_PWM_PIN[LOADER_MOTOR]>(OUTPUT);
+	halPinMode<POWER_PWM_PIN[LOADER_MAGNET]>(OUTPUT);
+	halPinMode<MOTOR_DIR_PIN[ELEVATOR_MOTOR]>(OUTPUT);
+	halPinMode<MOTOR_DIR_PIN[CART_MOTOR]>(OUTPUT);
+	halPinMode<MOTOR_DIR_PIN[LOADER_MOTOR]>(OUTPUT);
 
 	return;
 }
 
 void setPowerOutput(output_group output, bool enable) {
-	Power_Output_Enabled[output] = enable;
-	if(enable) {
-		setPowerOutputPWM(output, Power_Output_PWM[output]);
+	if(output == LOADER_MAGNET) {
+		setOutputBit(output, enable);
+		setPowerOutputPWM(output, (enable ? Power_Output_PWM[output] : 0));
+		return;
 	}
-	else {
-		setPowerOutputPWM(output, 0);
+
+	// A motor already running keeps its speed rather than starting over
+	if(enable && powerOutputEnabled(output)) {
+		return;
 	}
+	byte Old_SREG = SREG;
+	noInterrupts();
+	setOutputBit(output, enable);
+	Power_Output_Level[output] = 0;
+	Ramp_Progress[output] = RAMP_COMPLETE;
+	setPowerOutputPWM(output, 0);
+	if(enable) {
+		startRamp(output, Power_Output_PWM[output]);
+	}
+	SREG = Old_SREG;
 	return;
 }
 
 void setMotorSpeed(output_group motor, motor_speed speed) {
-	Power_Output_PWM[motor] = ((speed == SLOW) ? PWM_SPEED_SLOW[motor] : PWM_SPEED_FAST[motor]);
-	if(Power_Output_Enabled[motor]) {
-		setPowerOutputPWM(motor, Power_Output_PWM[motor]);
+	Power_Output_PWM[motor] = pgm_read_byte((speed == SLOW) ? &PWM_SPEED_SLOW[motor] : &PWM_SPEED_FAST[motor]);
+	if(powerOutputEnabled(motor)) {
+		byte Old_SREG = SREG;
+		noInterrupts();
+		startRamp(motor, Power_Output_PWM[motor]);
+		SREG = Old_SREG;
 	}
 	return;
 }
 
 void setMotorDir(output_group motor, motor_dir dir){
-	digitalWrite(MOTOR_DIR_PIN[motor], ((dir == BACKWARD) ? LOW : HIGH));
-	Motor_Dir[motor] = dir;
+	// A ramp step in between would rewrite the old direction
+	byte Old_SREG = SREG;
+	noInterrupts();
+	if(dir == BACKWARD) {
+		Motor_Backward |= (1 << motor);
+	}
+	else {
+		Motor_Backward &= ~(1 << motor);
+	}
+	setPowerOutputPWM(motor, (powerOutputEnabled(motor) ? Power_Output_Level[motor] : 0));
+	SREG = Old_SREG;
 	return;
 }
 
 motor_dir getMotorDir(output_group motor) {
-	return(Motor_Dir[motor]);
+	return((Motor_Backward & (1 << motor)) ? BACKWARD : FORWARD);
 }
 
 bool powerOutputEnabled(output_group output) {
-	return(Power_Output_Enabled[output]);
+	return((Power_Output_Enabled & (1 << output)) != 0);
 }
 
 bool anyMotorEnabled() {
-	for(byte Test_Motor = 0; Test_Motor <= LOADER_MOTOR; Test_Motor++) {
-		if(powerOutputEnabled((output_group)Test_Motor)) {
-			return true;
+	return((Power_Output_Enabled & POWER_MOTOR_MASK) != 0);
+}
+
+bool rampMotors() {
+	bool Ramping = false;
+
+	for(byte Motor = 0; Motor <= LOADER_MOTOR; Motor++) {
+		uint16_t Progress = Ramp_Progress[Motor];
+		if(Progress == RAMP_COMPLETE) {
+			continue;
+		}
+
+		Progress = (((RAMP_COMPLETE - Progress) > Ramp_Step[Motor]) ? (Progress + Ramp_Step[Motor]) : RAMP_COMPLETE);
+		Ramp_Progress[Motor] = Progress;
+		uint8_t Level = getRampLevel((output_group)Motor);
+		if(Level != Power_Output_Level[Motor]) {
+			Power_Output_Level[Motor] = Level;
+			setPowerOutputPWM((output_group)Motor, Level);
+		}
+		if(Progress != RAMP_COMPLETE) {
+			Ramping = true;
 		}
 	}
-	return false;
+	return Ramping;
+}
+
+void startRamp(output_group motor, uint8_t target) {
+	uint8_t From = Power_Output_Level[motor];
+	Ramp_From[motor] = From;
+	Ramp_To[motor] = target;
+	if(target == From) {
+		Ramp_Progress[motor] = RAMP_COMPLETE;
+		return;
+	}
+
+	// Smaller changes take proportionally less time than a change across the full range
+	uint8_t Change = ((target > From) ? (target - From) : (From - target));
+	unsigned int Full_Time = pgm_read_word((target > From) ? &RAMP_ACCEL_TIME[motor] : &RAMP_DECEL_TIME[motor]);
+	unsigned long Time_US = ((((unsigned long) Full_Time) * Change * 1000) / 255);
+	if(Time_US <= SYSTEM_TICK_US) {
+		Ramp_Step[motor] = RAMP_COMPLETE;
+	}
+	else {
+		Ramp_Step[motor] = ((((unsigned long) RAMP_COMPLETE) * SYSTEM_TICK_US) / Time_US);
+	}
+	Ramp_Progress[motor] = 0;
+	halStartSystemTick();
+	return;
+}
+
+uint8_t getRampLevel(output_group motor) {
+	// Kept to 16 bits with no divides, since this runs from the system tick interrupt
+	uint16_t Fraction = ((Ramp_Progress[motor] == RAMP_COMPLETE) ? 256 : (Ramp_Progress[motor] >> 8));  // 0-256
+
+	if((Fraction < 256) && (pgm_read_byte(&RAMP_SHAPE[motor]) == RAMP_S_CURVE)) {
+		Fraction = pgm_read_byte(&RAMP_SMOOTHSTEP[Fraction]);
+	}
+
+	if(Ramp_To[motor] >= Ramp_From[motor]) {
+		return(Ramp_From[motor] + ((((uint16_t)(Ramp_To[motor] - Ramp_From[motor])) * Fraction) >> 8));
+	}
+	return(Ramp_From[motor] - ((((uint16_t)(Ramp_From[motor] - Ramp_To[motor])) * Fraction) >> 8));
 }
 
 void setPowerOutputPWM(output_group power_output, uint8_t pwm) {
-	switch(power_output) {
-		case ELEVATOR_MOTOR:
-			OCR2A = pwm;
-			break;
-		case CART_MOTOR:
-			OCR1BL = pwm;
-			break;
-		case LOADER_MOTOR:
-			OCR1AL = pwm;
-			break;
-		case LOADER_MAGNET:
-			OCR2B = pwm;
-			break;
-		default:
-			break;
+	if(power_output == LOADER_MAGNET) {
+		halSetPWM((pwm_channel)pgm_read_byte(&POWER_PWM_CHANNEL[LOADER_MAGNET]), pwm);
+	}
+	else {
+		halSetDrive((pwm_channel)pgm_read_byte(&POWER_PWM_CHANNEL[power_output]), pwm, pgm_read_byte(&MOTOR_DIR_PIN[power_output]), ((Motor_Backward & (1 << power_output)) == 0));
+	}
+	return;
+}
+
+void setOutputBit(output_group output, bool enable) {
+	if(enable) {
+		Power_Output_Enabled |= (1 << output);
+	}
+	else {
+		Power_Output_Enabled &= ~(1 << output);
 	}
 	return;
 }
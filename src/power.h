@@ -8,29 +8,91 @@
  * It is expected that motors are disabled for a short while before and after switching directions.
  * These delays are to be handled elsewhere.
  *
+ * Motor speed changes are ramped rather than applied at once. Whenever a motor is enabled, its
+ * PWM rises from zero to its preset, and whenever its preset changes while enabled, its PWM moves
+ * to the new preset. Each motor has its own ramp profile: a linear or S-curve shape, along with
+ * the time taken to accelerate or decelerate across the full PWM range (a smaller change takes
+ * proportionally less time). Ramps are stepped by rampMotors() from the system tick interrupt, so
+ * they run independently of the main loop. Soft starts keep inrush current (and the resulting
+ * stress on the direction relays) down, and a motor blends into its approach speed instead of
+ * dropping to it in a single step.
+ *
+ * Disabling a motor always cuts its output immediately, cancelling any ramp in progress.
+ *
  * Written by Alex Tavares <tavaresa13@gmail.com>
  */
 
 #ifndef power_h
 #define power_h
 #include <arduino.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
 
 /////////////////////////
 // CONFIGURATION VARIABLES
 /////////////////////////
 
 // PWM presets
-const uint8_t PWM_SPEED_SLOW[3] = {32, 255, 255};
-const uint8_t PWM_SPEED_FAST[3] = {64, 255, 255};
+const uint8_t PWM_SPEED_SLOW[3] PROGMEM = {32, 255, 255};
+const uint8_t PWM_SPEED_FAST[3] PROGMEM = {64, 255, 255};
 const uint8_t PWM_MAGNET = 100;
 
+// PWM carrier frequency of every power output
+// A faster carrier would keep motor whine out of the speaker, but the output stages have only been
+// checked at 122 Hz and duty cycles are uncompensated at faster carriers (see halInitPWM())
+const pwm_carrier POWER_PWM_CARRIER = PWM_CARRIER_122HZ;
+
+// Ramp profiles, indexed by output_group
+// Times are for a change across the full PWM range (0-255), in milliseconds
+const byte RAMP_SHAPE[3] PROGMEM = {1, 0, 0};  // ramp_shape values (0 = linear, 1 = S-curve)
+const unsigned int RAMP_ACCEL_TIME[3] PROGMEM = {1000, 250, 250};
+const unsigned int RAMP_DECEL_TIME[3] PROGMEM = {2000, 250, 250};
+const uint16_t RAMP_COMPLETE = 0xFFFF;  // Ramp progress once the target PWM is reached
+
+// Smoothstep (3f^2 - 2f^3) of each ramp fraction f/256, scaled to 0-256 and rounded down
+// Held as a table, so an S-curve costs the system tick interrupt no multiplies or divides
+const uint8_t RAMP_SMOOTHSTEP[256] PROGMEM = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+	2, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 7, 8, 9, 9, 10,
+	11, 11, 12, 13, 13, 14, 15, 16, 16, 17, 18, 19, 20, 20, 21, 22,
+	23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38,
+	40, 41, 42, 43, 44, 45, 46, 48, 49, 50, 51, 53, 54, 55, 56, 58,
+	59, 60, 61, 63, 64, 65, 67, 68, 69, 71, 72, 74, 75, 76, 78, 79,
+	81, 82, 83, 85, 86, 88, 89, 90, 92, 93, 95, 96, 98, 99, 101, 102,
+	104, 105, 107, 108, 110, 111, 113, 114, 116, 117, 119, 120, 122, 123, 125, 126,
+	128, 129, 130, 132, 133, 135, 136, 138, 139, 141, 142, 144, 145, 147, 148, 150,
+	151, 153, 154, 156, 157, 159, 160, 162, 163, 165, 166, 167, 169, 170, 172, 173,
+	175, 176, 177, 179, 180, 181, 183, 184, 186, 187, 188, 190, 191, 192, 194, 195,
+	196, 197, 199, 200, 201, 202, 204, 205, 206, 207, 209, 210, 211, 212, 213, 214,
+	216, 217, 218, 219, 220, 221, 222, 223, 224, 225, 226, 227, 228, 229, 230, 231,
+	232, 233, 234, 235, 235, 236, 237, 238, 239, 239, 240, 241, 242, 242, 243, 244,
+	245, 245, 246, 246, 247, 248, 248, 249, 249, 250, 250, 251, 251, 251, 252, 252,
+	253, 253, 253, 254, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+// Bits of Power_Output_Enabled held by the motors (bit n = output_group n)
+const byte POWER_MOTOR_MASK = 0x07;
+
 
 /////////////////////////
 // PIN DEFINITIONS
 /////////////////////////
 
-const byte POWER_PWM_PIN[4] = {9, 10, 11, 3};
-const byte MOTOR_DIR_PIN[3] = {6, 5, 4};
+// Indexed by output_group
+constexpr byte POWER_PWM_PIN[4] = {11, 10, 9, 3};
+constexpr byte MOTOR_DIR_PIN[3] PROGMEM = {6, 5, 4};  // Each written alongside its PWM (see halSetDrive())
+
+// PWM timer channel driving each power output, as pwm_channel values (indexed by output_group)
+const byte POWER_PWM_CHANNEL[4] PROGMEM = {
+	halPinPWMChannel(POWER_PWM_PIN[0]),
+	halPinPWMChannel(POWER_PWM_PIN[1]),
+	halPinPWMChannel(POWER_PWM_PIN[2]),
+	halPinPWMChannel(POWER_PWM_PIN[3])
+};
+
+static_assert(halPinHasPWM(POWER_PWM_PIN[0]) && halPinHasPWM(POWER_PWM_PIN[1]) && halPinHasPWM(POWER_PWM_PIN[2]) && halPinHasPWM(POWER_PWM_PIN[3]), "Every power output must be on a Timer1 or Timer2 PWM pin");
+static_assert(halPinExists(MOTOR_DIR_PIN[0]) && halPinExists(MOTOR_DIR_PIN[1]) && halPinExists(MOTOR_DIR_PIN[2]), "Every motor direction pin must exist on the ATmega 328P");
+static_assert(!halPinHasPWM(MOTOR_DIR_PIN[0]) && !halPinHasPWM(MOTOR_DIR_PIN[1]) && !halPinHasPWM(MOTOR_DIR_PIN[2]), "No motor direction pin may be a power output's PWM pin");
 
 
 /////////////////////////
@@ -54,6 +116,11 @@ typedef enum {
 	BACKWARD
 } motor_dir;
 
+typedef enum {
+	RAMP_LINEAR = 0,
+	RAMP_S_CURVE = 1   // Smoothstep; eases in and out of each change
+} ramp_shape;
+
 
 /////////////////////////
 // AVAILABLE FUNCTIONS
@@ -67,14 +134,15 @@ void initPowerOutputs();
  * Initialization involves setting status variables, pin configuration, and PWM values.
  * Initial motor directions are also set.
  *
- * Affects Power_Output_PWM[], Power_Output_Enabled[], and Motor_Dir[]
+ * Affects Power_Output_PWM[], Power_Output_Enabled, and Motor_Backward
  */
 
 void setPowerOutput(output_group output, bool enable);
 /*
  * Enables or disables a power output
+ * Enabled motors ramp up from zero to their preset; disabled outputs stop at once
  *
- * Affects Power_Output_Enabled[]
+ * Affects Power_Output_Enabled, Power_Output_Level[], and the ramp of the output
  * INPUT:  Output in question (0-indexed)
  *         State of being enabled
  */
@@ -82,8 +150,9 @@ void setPowerOutput(output_group output, bool enable);
 void setMotorSpeed(output_group motor, motor_speed speed);
 /*
  * Sets the speed of a given motor
+ * If the motor is enabled, it ramps from its current PWM to the new preset
  *
- * Affects Power_Output_PWM[]
+ * Affects Power_Output_PWM[] and the ramp of the motor
  * INPUT:  Motor (0-indexed)
  *         Motor speed
  */
@@ -91,8 +160,9 @@ void setMotorSpeed(output_group motor, motor_speed speed);
 void setMotorDir(output_group motor, motor_dir dir);
 /*
  * Sets the direction of a given motor
+ * The direction pin and PWM are written together (see setPowerOutputPWM())
  *
- * Affects Motor_Dir[]
+ * Affects Motor_Backward
  * INPUT:  Motor (0-indexed)
  *         Motor direction
  */
@@ -121,16 +191,58 @@ bool anyMotorEnabled();
  * OUTPUT: Is any other motor enabled?
  */
 
+bool rampMotors();
+/*
+ * Advances the ramp of every motor by one system tick
+ * Must be called from systemTick()
+ *
+ * Affects Power_Output_Level[], Ramp_Progress[], and timer registers OCRnx (via the HAL)
+ * OUTPUT: Is any ramp still in progress?
+ */
+
 
 /////////////////////////
 // INTERNAL FUNCTIONS
 /////////////////////////
 
+void startRamp(output_group motor, uint8_t target);
+/*
+ * Starts ramping a motor from its current PWM to a new one
+ * Must be called with interrupts disabled, so rampMotors() never sees a ramp half-started
+ *
+ * The system tick is started, in case it was stopped while idle.
+ *
+ * Affects Ramp_From[], Ramp_To[], Ramp_Step[], and Ramp_Progress[]
+ * INPUT:  Motor (0-indexed)
+ *         PWM value to ramp to
+ */
+
+void setOutputBit(output_group output, bool enable);
+/*
+ * Sets or clears a power output's bit of Power_Output_Enabled
+ *
+ * Affects Power_Output_Enabled
+ * INPUT:  Output in question (0-indexed)
+ *         State of being enabled
+ */
+
+uint8_t getRampLevel(output_group motor);
+/*
+ * Calculates a motor's PWM from the progress of its ramp
+ *
+ * INPUT:  Motor (0-indexed)
+ * OUTPUT: PWM value
+ */
+
 void setPowerOutputPWM(output_group power_output, uint8_t pwm);
 /*
  * Sets the output PWM of a given power output
+ * Safe to call from interrupt context
+ *
+ * For motors, the direction pin is rewritten from Motor_Backward in the same atomic write, so the
+ * direction relay and the PWM driving it always agree.
  *
- * Affects timer registers ORCnx
+ * Affects timer registers OCRnx and motor direction pins (via the HAL)
  * INPUT:  Output in question (0-indexed)
  *         New output PWM value
  */
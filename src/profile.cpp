@@ -0,0 +1,91 @@
+#include "profile.h"
+
+#if PROFILE_ENABLED
+
+profile_stats Profile_Stats[PROFILE_SECTIONS];
+
+void recordProfile(profile_section section, uint16_t duration) {
+	profile_stats* Stats = &Profile_Stats[section];
+
+	if((Stats->Count == 0) || (duration < Stats->Min)) {
+		Stats->Min = duration;
+	}
+	if(duration > Stats->Max) {
+		Stats->Max = duration;
+	}
+	Stats->Count += 1;
+	Stats->Total += duration;
+
+	// Bin N holds durations with N significant bits
+	byte Bin = 0;
+	while((duration != 0) && (Bin < (PROFILE_BINS - 1))) {
+		duration >>= 1;
+		Bin++;
+	}
+	if(Stats->Histogram[Bin] < 0xFFFF) {
+		Stats->Histogram[Bin] += 1;
+	}
+	return;
+}
+
+void getProfileStats(profile_section section, profile_stats* stats) {
+	// systemTick() may record a pass partway through the copy
+	byte Old_SREG = SREG;
+	noInterrupts();
+	*stats = Profile_Stats[section];
+	SREG = Old_SREG;
+	return;
+}
+
+void clearProfile() {
+	byte Old_SREG = SREG;
+	noInterrupts();
+	for(byte Section = 0; Section < PROFILE_SECTIONS; Section++) {
+		Profile_Stats[Section].Count = 0;
+		Profile_Stats[Section].Total = 0;
+		Profile_Stats[Section].Min = 0;
+		Profile_Stats[Section].Max = 0;
+		for(byte Bin = 0; Bin < PROFILE_BINS; Bin++) {
+			Profile_Stats[Section].Histogram[Bin] = 0;
+		}
+	}
+	SREG = Old_SREG;
+	return;
+}
+
+void dumpProfile(void (*write)(char character)) {
+	for(byte Section = 0; Section < PROFILE_SECTIONS; Section++) {
+		profile_stats Stats;
+		getProfileStats((profile_section)Section, &Stats);
+
+		write('P');
+		writeProfileNumber(write, Section);
+		writeProfileNumber(write, Stats.Count);
+		writeProfileNumber(write, Stats.Min);
+		writeProfileNumber(write, ((Stats.Count > 0) ? (Stats.Total / Stats.Count) : 0));
+		writeProfileNumber(write, Stats.Max);
+		for(byte Bin = 0; Bin < PROFILE_BINS; Bin++) {
+			writeProfileNumber(write, Stats.Histogram[Bin]);
+		}
+		write('\n');
+	}
+	return;
+}
+
+void writeProfileNumber(void (*write)(char character), unsigned long number) {
+	char Digits[10];
+	byte Length = 0;
+
+	do {
+		Digits[Length++] = ('0' + (number % 10));
+		number /= 10;
+	} while(number != 0);
+
+	write(' ');
+	while(Length > 0) {
+		write(Digits[--Length]);
+	}
+	return;
+}
+
+#endif
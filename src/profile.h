@@ -0,0 +1,144 @@
+/* Profiling Module
+ *
+ * Used to measure how long each section of the main loop and the calibration routine takes
+ *
+ * Each profiled section is bracketed by PROFILE_BEGIN() and PROFILE_END(), which read the
+ * free-running Timer0 timestamp (see halReadTimestamp()) and record the difference. For every
+ * section, the number of passes along with the minimum, average, and maximum duration are kept,
+ * as well as a coarse histogram: bin 0 counts passes of 0 ticks, and bin N counts passes of
+ * 2^(N-1) to 2^N - 1 ticks. The last bin also counts every longer pass.
+ *
+ * Durations are in Timer0 ticks of PROFILE_TICK_US microseconds. A single pass longer than
+ * 65535 ticks (about 262 ms) wraps, and so is recorded as a short one.
+ *
+ * Profiling is disabled unless PROFILE_ENABLED is defined as 1, either below or by the build.
+ * When disabled, every PROFILE_* macro expands to nothing and no RAM is used, so profiled code
+ * is identical to unprofiled code.
+ *
+ * The statistics can be written out as text with dumpProfile(), through any link able to carry
+ * characters. Each section is written as a single line:
+ *
+ * P <section> <passes> <min> <avg> <max> <bin 0> <bin 1> ... <bin PROFILE_BINS - 1>
+ */
+
+#ifndef profile_h
+#define profile_h
+#include <arduino.h>
+#include "hal.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 0
+#endif
+
+const byte PROFILE_BINS = 12;
+const byte PROFILE_TICK_US = 4;
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Profiled sections
+typedef enum {
+	PROFILE_LOOP,               // A single pass of loop(), excluding time asleep
+	PROFILE_SAMPLE_INPUTS,      // sampleInputs() within loop()
+	PROFILE_MOTOR_ELEVATOR,     // Each motor's pass of handleMotors(), in output_group order
+	PROFILE_MOTOR_CART,
+	PROFILE_MOTOR_LOADER,
+	PROFILE_AUDIO,              // Audio state machine and playlist
+	PROFILE_CALIBRATION,        // handleCalibration() within loop()
+	PROFILE_LINK,               // handleLinkCommands() within loop()
+	PROFILE_SYSTEM_TICK,        // systemTick(), in interrupt context
+	PROFILE_ERROR_TICK,         // errorTick(), in interrupt context
+	PROFILE_SECTIONS
+} profile_section;
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// Statistics of a single section, in Timer0 ticks
+typedef struct {
+	unsigned long Count;                 // Number of passes
+	unsigned long Total;                 // Sum of all pass durations
+	uint16_t Min;
+	uint16_t Max;
+	uint16_t Histogram[PROFILE_BINS];    // Saturates at 65535
+} profile_stats;
+
+
+/////////////////////////
+// MACROS
+/////////////////////////
+
+#if PROFILE_ENABLED
+#define PROFILE_BEGIN(timestamp) uint16_t timestamp = halReadTimestamp()
+#define PROFILE_END(section, timestamp) recordProfile((section), (uint16_t)(halReadTimestamp() - (timestamp)))
+#else
+#define PROFILE_BEGIN(timestamp)
+#define PROFILE_END(section, timestamp)
+#endif
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+#if PROFILE_ENABLED
+
+void recordProfile(profile_section section, uint16_t duration);
+/*
+ * Records a single pass of a section
+ * Used by PROFILE_END(); safe to call from interrupt context
+ *
+ * Affects Profile_Stats[section]
+ * INPUT:  Section
+ *         Duration of the pass, in Timer0 ticks
+ */
+
+void getProfileStats(profile_section section, profile_stats* stats);
+/*
+ * Gets a consistent copy of a section's statistics
+ *
+ * INPUT:  Section
+ *         Pointer to the copy
+ */
+
+void clearProfile();
+/*
+ * Clears the statistics of every section
+ *
+ * Affects Profile_Stats[]
+ */
+
+void dumpProfile(void (*write)(char character));
+/*
+ * Writes the statistics of every section as text, one line per section
+ * See the top of this file for the line format
+ *
+ * INPUT:  Function which sends a single character over the link
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void writeProfileNumber(void (*write)(char character), unsigned long number);
+/*
+ * Writes a space followed by a number in decimal
+ * Used by dumpProfile()
+ *
+ * INPUT:  Function which sends a single character
+ *         Number to write
+ */
+
+#endif
+
+
+#endif
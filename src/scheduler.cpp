@@ -0,0 +1,119 @@
+#include "scheduler.h"
+
+// Deadlines
+byte Task_Scheduled = 0;                 // One bit per task_id
+unsigned long Task_Deadline[TASKS];
+unsigned long Scheduler_Now = 0;         // millis() at the start of the current pass
+
+// Statistics
+unsigned long Task_Start = 0;
+unsigned long Task_Runs[TASKS];
+unsigned long Task_Time[TASKS];
+unsigned int Task_Max_Time[TASKS];
+unsigned long Task_Overruns[TASKS];
+unsigned long Scheduler_Sleep_Time = 0;
+
+void initScheduler() {
+	unsigned long Now = millis();
+	for(byte Task = 0; Task < TASKS; Task++) {
+		Task_Deadline[Task] = Now;
+		Task_Runs[Task] = 0;
+		Task_Time[Task] = 0;
+		Task_Max_Time[Task] = 0;
+		Task_Overruns[Task] = 0;
+	}
+	Task_Scheduled = ((1 << TASKS) - 1);
+	Scheduler_Now = Now;
+	Scheduler_Sleep_Time = 0;
+	return;
+}
+
+void waitForTasks() {
+	while(true) {
+		// Interrupts stay disabled from the final check until the MCU is asleep,
+		// so an input change or deadline in between cannot be slept through. The time is only
+		// read when there is a deadline to check, or a pass to start
+		noInterrupts();
+		bool Wake = (inputsPending() || linkPending());
+		if(Wake || (Task_Scheduled != 0)) {
+			Scheduler_Now = millis();
+			Wake = (Wake || anyTaskDue());
+		}
+		if(Wake) {
+			interrupts();
+			return;
+		}
+
+		unsigned long Sleep_Start = micros();
+		halSleep();
+		Scheduler_Sleep_Time += (micros() - Sleep_Start);
+	}
+}
+
+unsigned long getLoopTime() {
+	return Scheduler_Now;
+}
+
+bool taskDue(task_id task) {
+	if(!(Task_Scheduled & (1 << task))) {
+		return false;
+	}
+	return((long)(Scheduler_Now - Task_Deadline[task]) >= 0);
+}
+
+void beginTask(task_id task) {
+	Task_Scheduled &= ~(1 << task);
+	Task_Start = micros();
+	return;
+}
+
+void endTask(task_id task) {
+	unsigned long Elapsed_Time = (micros() - Task_Start);
+
+	Task_Runs[task] += 1;
+	Task_Time[task] += Elapsed_Time;
+	if(Elapsed_Time > Task_Max_Time[task]) {
+		Task_Max_Time[task] = ((Elapsed_Time > 0xFFFF) ? 0xFFFF : Elapsed_Time);
+	}
+	if(Elapsed_Time > pgm_read_word(&TASK_BUDGET_US[task])) {
+		Task_Overruns[task] += 1;
+	}
+	return;
+}
+
+void scheduleTask(task_id task, unsigned long deadline) {
+	if(!(Task_Scheduled & (1 << task)) || ((long)(deadline - Task_Deadline[task]) < 0)) {
+		Task_Deadline[task] = deadline;
+		Task_Scheduled |= (1 << task);
+	}
+	return;
+}
+
+unsigned long getTaskRuns(task_id task) {
+	return Task_Runs[task];
+}
+
+unsigned long getTaskTime(task_id task) {
+	return Task_Time[task];
+}
+
+unsigned int getTaskMaxTime(task_id task) {
+	return Task_Max_Time[task];
+}
+
+unsigned long getTaskOverruns(task_id task) {
+	return Task_Overruns[task];
+}
+
+unsigned long getSleepTime() {
+	return Scheduler_Sleep_Time;
+}
+
+bool anyTaskDue() {
+	for(byte Task = 0; Task < TASKS; Task++) {
+		if((Task_Scheduled & (1 << Task)) && ((long)(Scheduler_Now - Task_Deadline[Task]) >= 0)) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,174 @@
+/* Task Scheduler Module
+ *
+ * Used to run the main loop's tasks only when they have work to do, sleeping the MCU in between
+ *
+ * Each task (the motor state machines, the audio sequencer, the calibration routine, and the
+ * diagnostic link) reports the next time at which it has something to do, such as a motor's next
+ * elapsed time threshold or the end of the current audio clip. loop() runs a task once its deadline
+ * has passed, or whenever the debounced inputs have changed, and then reschedules it. A task with
+ * no deadline waits for the inputs alone. The diagnostic link has no deadlines, and runs whenever
+ * bytes have been received.
+ *
+ * When no task is due, waitForTasks() puts the MCU into idle sleep. Any interrupt wakes it: the
+ * Timer0 overflow behind millis() (about once a millisecond), the system tick while inputs are
+ * being debounced or audio commands transmitted, the endstop and arcade button pin change
+ * interrupts, which restart the system tick, the watchdog interrupt while an error code is
+ * displayed, and the USART receive interrupt. Deadlines are in milliseconds, so a task is never
+ * run later than it would have been by a free-running loop.
+ *
+ * millis() is read once per pass, as waitForTasks() returns, and every task due in that pass is
+ * judged against that one timestamp (see getLoopTime()). A deadline which passes partway through
+ * a pass is caught by the next one, which follows without sleeping.
+ *
+ * The time spent in each task is measured with micros(), so each task's share of the CPU and the
+ * passes which exceed its budget can be read back while tuning.
+ */
+
+#ifndef scheduler_h
+#define scheduler_h
+#include <arduino.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
+#include "input.h"
+#include "link.h"
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Scheduled tasks
+typedef enum {
+	TASK_MOTORS,
+	TASK_AUDIO,
+	TASK_CALIBRATION,
+	TASK_LINK,
+	TASKS
+} task_id;
+
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+// Time each task is expected to run for in a single pass, in microseconds (indexed by task_id)
+// Passes which take longer are counted as overruns
+const unsigned int TASK_BUDGET_US[TASKS] PROGMEM = {250, 250, 250, 250};
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void initScheduler();
+/*
+ * Initializes the scheduler, with every task due immediately
+ * Must be called in setup() before any motor is started, since motors time their states from
+ * getLoopTime()
+ *
+ * Affects Task_Scheduled, Task_Deadline[], Scheduler_Now, and all task statistics
+ */
+
+void waitForTasks();
+/*
+ * Sleeps until the debounced inputs change, the link receives a byte, or any task is due
+ * Should be called at the start of loop(), before sampleInputs()
+ *
+ * Affects Scheduler_Now and Scheduler_Sleep_Time
+ */
+
+unsigned long getLoopTime();
+/*
+ * Gets the time at which the current pass of loop() began
+ * Tasks should use this rather than reading millis() again for anything judged once per pass
+ *
+ * OUTPUT: Time in milliseconds, as read by the last call to waitForTasks()
+ */
+
+bool taskDue(task_id task);
+/*
+ * Determines if a task's deadline had passed when the current pass of loop() began
+ *
+ * INPUT:  Task in question
+ * OUTPUT: Is the task due?
+ */
+
+void beginTask(task_id task);
+/*
+ * Marks the start of a task's pass, clearing its deadline
+ * The task must be rescheduled with scheduleTask() if it still has work to do
+ *
+ * Affects Task_Scheduled and Task_Start
+ * INPUT:  Task starting
+ */
+
+void endTask(task_id task);
+/*
+ * Marks the end of a task's pass, accounting for the time it took
+ *
+ * Affects Task_Runs[], Task_Time[], Task_Max_Time[], and Task_Overruns[]
+ * INPUT:  Task ending
+ */
+
+void scheduleTask(task_id task, unsigned long deadline);
+/*
+ * Schedules a task to run once millis() reaches a deadline
+ * If the task is already scheduled, the earlier of the two deadlines is kept
+ *
+ * Affects Task_Scheduled and Task_Deadline[task]
+ * INPUT:  Task to schedule
+ *         Deadline, in milliseconds
+ */
+
+unsigned long getTaskRuns(task_id task);
+/*
+ * Gets the number of passes a task has run
+ *
+ * INPUT:  Task in question
+ * OUTPUT: Pass count
+ */
+
+unsigned long getTaskTime(task_id task);
+/*
+ * Gets the total time a task has run for
+ *
+ * INPUT:  Task in question
+ * OUTPUT: Time in microseconds
+ */
+
+unsigned int getTaskMaxTime(task_id task);
+/*
+ * Gets the longest single pass of a task
+ *
+ * INPUT:  Task in question
+ * OUTPUT: Time in microseconds
+ */
+
+unsigned long getTaskOverruns(task_id task);
+/*
+ * Gets the number of passes of a task which exceeded TASK_BUDGET_US[task]
+ *
+ * INPUT:  Task in question
+ * OUTPUT: Overrun count
+ */
+
+unsigned long getSleepTime();
+/*
+ * Gets the total time spent asleep in waitForTasks()
+ *
+ * OUTPUT: Time in microseconds
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+bool anyTaskDue();
+/*
+ * Determines if any task's deadline had passed at Scheduler_Now
+ *
+ * OUTPUT: Is any task due?
+ */
+
+
+#endif
@@ -0,0 +1,209 @@
+#include "storage.h"
+#include "input.h"
+#include "power.h"
+#include <util/crc16.h>
+
+// Calibration ring
+storage_ring Storage_Ring = {0, STORAGE_SLOT_SIZE, STORAGE_SLOTS, (STORAGE_SLOTS - 1), 0};
+
+// Background save state
+// Only saveBlock() starts a save, and only eepromReady() advances it
+byte Storage_Buffer[STORAGE_RECORD_LENGTH];
+const byte* Storage_Source = NULL;               // Bytes being saved, held by the caller until the save ends
+uint16_t Storage_Length = 0;
+uint16_t Storage_Address = 0;
+volatile uint16_t Storage_Index = 0;             // Next byte of Storage_Source[] to program
+volatile bool Storage_Saving = false;
+
+bool readCalibrationRecord(calibration_record* record) {
+	byte Newest[STORAGE_RECORD_LENGTH];
+	if(!readRing(&Storage_Ring, Newest, readSlot)) {
+		return readLegacyRecord(record);
+	}
+
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		record->Ref_Time_Forward[Motor] = getWord(&Newest[3 + (Motor * 2)]);
+		record->Ref_Time_Backward[Motor] = getWord(&Newest[9 + (Motor * 2)]);
+		record->Endstop_Forward[Motor] = Newest[15 + Motor];
+	}
+	record->Near_Factor = Newest[18];
+	record->Slowdown_Factor = Newest[19];
+	record->Timeout_Factor = Newest[20];
+	record->Timeout_Buffer = getWord(&Newest[21]);
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		bool Trimmed = (Newest[0] >= 2);
+		record->Slowdown_Trim[Motor][FORWARD] = (Trimmed ? (int8_t)Newest[23 + Motor] : 0);
+		record->Slowdown_Trim[Motor][BACKWARD] = (Trimmed ? (int8_t)Newest[26 + Motor] : 0);
+	}
+	return true;
+}
+
+void saveCalibrationRecord(const calibration_record* record) {
+	// Calibration is saved at most once per boot, and periodic saves check storageBusy() first
+	while(storageBusy()) {
+		delayMicroseconds(SYSTEM_TICK_US);
+	}
+
+	Storage_Buffer[0] = STORAGE_VERSION;
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		putWord(&Storage_Buffer[3 + (Motor * 2)], record->Ref_Time_Forward[Motor]);
+		putWord(&Storage_Buffer[9 + (Motor * 2)], record->Ref_Time_Backward[Motor]);
+		Storage_Buffer[15 + Motor] = record->Endstop_Forward[Motor];
+	}
+	Storage_Buffer[18] = record->Near_Factor;
+	Storage_Buffer[19] = record->Slowdown_Factor;
+	Storage_Buffer[20] = record->Timeout_Factor;
+	putWord(&Storage_Buffer[21], record->Timeout_Buffer);
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		Storage_Buffer[23 + Motor] = (byte)record->Slowdown_Trim[Motor][FORWARD];
+		Storage_Buffer[26 + Motor] = (byte)record->Slowdown_Trim[Motor][BACKWARD];
+	}
+	saveRing(&Storage_Ring, Storage_Buffer, STORAGE_RECORD_LENGTH);
+	return;
+}
+
+bool readRing(storage_ring* ring, byte* buffer, bool (*read_slot)(uint16_t address, byte* buffer)) {
+	bool Found = false;
+
+	for(byte Slot = 0; Slot < ring->Slots; Slot++) {
+		if(!read_slot(getSlotAddress(ring, Slot), buffer)) {
+			continue;
+		}
+
+		uint16_t Sequence = getWord(&buffer[1]);
+		if(!Found || ((int16_t)(Sequence - ring->Sequence) > 0)) {
+			ring->Sequence = Sequence;
+			ring->Newest_Slot = Slot;
+			Found = true;
+		}
+	}
+
+	// Any slot read after the newest one has since overwritten the buffer
+	return(Found && read_slot(getSlotAddress(ring, ring->Newest_Slot), buffer));
+}
+
+void saveRing(storage_ring* ring, byte* buffer, byte length) {
+	ring->Sequence += 1;
+	ring->Newest_Slot = ((ring->Newest_Slot + 1) % ring->Slots);
+
+	putWord(&buffer[1], ring->Sequence);
+	putWord(&buffer[length - 2], getRecordCRC(buffer, length));
+	saveBlock(getSlotAddress(ring, ring->Newest_Slot), buffer, length);
+	return;
+}
+
+void saveBlock(uint16_t address, const byte* buffer, uint16_t length) {
+	while(storageBusy()) {
+		delayMicroseconds(SYSTEM_TICK_US);
+	}
+
+	// The ready interrupt fires as soon as it is enabled, unless a write is still in progress
+	Storage_Source = buffer;
+	Storage_Length = length;
+	Storage_Address = address;
+	Storage_Index = 0;
+	Storage_Saving = true;
+	halEepromReadyInterrupt(true);
+	return;
+}
+
+bool storageBusy() {
+	return Storage_Saving;
+}
+
+void eepromReady() {
+	// Bytes which already hold the right value are skipped, saving an erase and write cycle each
+	while(Storage_Index < Storage_Length) {
+		uint16_t Index = Storage_Index;
+		Storage_Index = (Index + 1);
+		if(halEepromRead(Storage_Address + Index) != Storage_Source[Index]) {
+			halEepromWriteAsync((Storage_Address + Index), Storage_Source[Index]);
+			return;
+		}
+	}
+
+	// The last byte has finished programming
+	halEepromReadyInterrupt(false);
+	Storage_Saving = false;
+	return;
+}
+
+bool readSlot(uint16_t address, byte* buffer) {
+	buffer[0] = halEepromRead(address);
+	byte Length = getRecordLength(buffer[0]);
+	if(Length == 0) {
+		return false;
+	}
+	for(byte Index = 1; Index < Length; Index++) {
+		buffer[Index] = halEepromRead(address + Index);
+	}
+	return(getRecordCRC(buffer, Length) == getWord(&buffer[Length - 2]));
+}
+
+bool readLegacyRecord(calibration_record* record) {
+	calibration_record Legacy;
+
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		Legacy.Ref_Time_Forward[Motor] = halEepromRead(EEPROM_LEGACY_REF_FORWARD_PTR + (Motor * 2));
+		Legacy.Ref_Time_Forward[Motor] += (((uint16_t) halEepromRead(EEPROM_LEGACY_REF_FORWARD_PTR + (Motor * 2) + 1)) << 8);
+		Legacy.Ref_Time_Backward[Motor] = halEepromRead(EEPROM_LEGACY_REF_BACKWARD_PTR + (Motor * 2));
+		Legacy.Ref_Time_Backward[Motor] += (((uint16_t) halEepromRead(EEPROM_LEGACY_REF_BACKWARD_PTR + (Motor * 2) + 1)) << 8);
+		Legacy.Endstop_Forward[Motor] = halEepromRead(EEPROM_LEGACY_ENDSTOP_FORWARD_PTR + Motor);
+
+		// Each motor's forward endstop must be one of its own pair
+		byte Endstop_X = ((Motor * 2) + ENDSTOP_1);
+		if((Legacy.Endstop_Forward[Motor] != Endstop_X) && (Legacy.Endstop_Forward[Motor] != (Endstop_X + 1))) {
+			return false;
+		}
+	}
+	Legacy.Near_Factor = halEepromRead(EEPROM_LEGACY_NEAR_FACTOR_PTR);
+	Legacy.Slowdown_Factor = halEepromRead(EEPROM_LEGACY_SLOWDOWN_FACTOR_PTR);
+	Legacy.Timeout_Factor = halEepromRead(EEPROM_LEGACY_TIMEOUT_FACTOR_PTR);
+	Legacy.Timeout_Buffer = halEepromRead(EEPROM_LEGACY_TIMEOUT_BUFFER_PTR);
+	Legacy.Timeout_Buffer += (((uint16_t) halEepromRead(EEPROM_LEGACY_TIMEOUT_BUFFER_PTR + 1)) << 8);
+
+	for(byte Motor = 0; Motor < 3; Motor++) {
+		Legacy.Slowdown_Trim[Motor][FORWARD] = 0;
+		Legacy.Slowdown_Trim[Motor][BACKWARD] = 0;
+	}
+
+	if((Legacy.Near_Factor >= Legacy.Slowdown_Factor) || (Legacy.Slowdown_Factor > 100) || (Legacy.Timeout_Factor < 100) || (Legacy.Timeout_Buffer == 0xFFFF)) {
+		return false;
+	}
+
+	*record = Legacy;
+	return true;
+}
+
+byte getRecordLength(byte version) {
+	switch(version) {
+		case 1:
+			return STORAGE_RECORD_LENGTH_V1;
+		case STORAGE_VERSION:
+			return STORAGE_RECORD_LENGTH;
+		default:
+			return 0;
+	}
+}
+
+uint16_t getSlotAddress(const storage_ring* ring, byte slot) {
+	return(ring->Address + (((uint16_t) slot) * ring->Slot_Size));
+}
+
+uint16_t getRecordCRC(const byte buffer[STORAGE_RECORD_LENGTH], byte length) {
+	uint16_t CRC = 0xFFFF;
+	for(byte Index = 0; Index < (length - 2); Index++) {
+		CRC = _crc_ccitt_update(CRC, buffer[Index]);
+	}
+	return CRC;
+}
+
+uint16_t getWord(const byte* buffer) {
+	return(buffer[0] | (((uint16_t) buffer[1]) << 8));
+}
+
+void putWord(byte* buffer, uint16_t value) {
+	buffer[0] = (value & 0xFF);
+	buffer[1] = ((value >> 8) & 0xFF);
+	return;
+}
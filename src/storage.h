@@ -0,0 +1,256 @@
+/* Calibration Storage Module
+ *
+ * Used to keep calibration data in EEPROM across power cycles
+ *
+ * Calibration data is stored as a versioned record with a CRC, in one of a ring of fixed-size
+ * slots spanning the first STORAGE_RING_SIZE bytes of EEPROM. The rest of the EEPROM holds the
+ * motor health checkpoints (see src/health.h) and the motion trace saved on a critical error
+ * (see src/trace.h). Every record carries a sequence number, one higher than the
+ * record before it. Each save goes into the slot after the newest record, so wear is spread
+ * evenly across every slot rather than concentrated on a few cells.
+ *
+ * At startup, every slot is scanned once, and the valid record (correct version and CRC) with the
+ * highest sequence number is used. If the newest record was corrupted, such as by power being lost
+ * partway through a save, it simply fails its CRC and the previous good record is used instead.
+ * If no slot holds a valid record, calibration data written by older Firmware (a fixed, unchecked
+ * layout at 0x000) is accepted if it is plausible.
+ *
+ * Saving does not block. The record is copied into a buffer, and each byte is programmed from the
+ * EEPROM ready interrupt once the previous byte has finished (about 3.4 ms per byte). Bytes which
+ * already hold the right value are skipped. Other modules save blocks of their own the same way,
+ * through saveBlock(), or keep rings of their own records through readRing() and saveRing().
+ *
+ * Slot layout (multi-byte values are little-endian):
+ *
+ *  0      Record version (STORAGE_VERSION)
+ *  1-2    Sequence number
+ *  3-8    Forward reference travel time of each motor
+ *  9-14   Backward reference travel time of each motor
+ * 15-17   Endstop engaged at the end of forward travel, for each motor
+ * 18-20   Near, slowdown, and timeout factors
+ * 21-22   Timeout buffer
+ * 23-25   Forward slowdown trim of each motor
+ * 26-28   Backward slowdown trim of each motor
+ * 29-30   CRC-CCITT of bytes 0-28
+ *
+ * Version 1 records, which end with their CRC at bytes 23-24, are still read, with every slowdown
+ * trim taken as zero.
+ */
+
+#ifndef storage_h
+#define storage_h
+#include <arduino.h>
+#include "hal.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+const uint16_t STORAGE_EEPROM_SIZE = 1024;
+const uint16_t STORAGE_RING_SIZE = 576;
+const byte STORAGE_SLOT_SIZE = 32;
+const byte STORAGE_SLOTS = (STORAGE_RING_SIZE / STORAGE_SLOT_SIZE);
+const byte STORAGE_RECORD_LENGTH = 31;
+const byte STORAGE_RECORD_LENGTH_V1 = 25;
+
+// Must be changed whenever the slot layout changes
+const byte STORAGE_VERSION = 2;
+
+
+/////////////////////////
+// EEPROM POINTERS
+/////////////////////////
+
+// Layout used by older Firmware, read only if no valid record exists
+const uint16_t EEPROM_LEGACY_REF_FORWARD_PTR = 0x000;
+const uint16_t EEPROM_LEGACY_REF_BACKWARD_PTR = 0x006;
+const uint16_t EEPROM_LEGACY_ENDSTOP_FORWARD_PTR = 0x00C;
+const uint16_t EEPROM_LEGACY_NEAR_FACTOR_PTR = 0x00F;
+const uint16_t EEPROM_LEGACY_SLOWDOWN_FACTOR_PTR = 0x010;
+const uint16_t EEPROM_LEGACY_TIMEOUT_FACTOR_PTR = 0x011;
+const uint16_t EEPROM_LEGACY_TIMEOUT_BUFFER_PTR = 0x012;
+
+// Motor health checkpoints, after the ring
+const uint16_t EEPROM_HEALTH_PTR = STORAGE_RING_SIZE;
+const uint16_t EEPROM_HEALTH_SIZE = 192;
+
+// Saved motion trace, after the health checkpoints
+const uint16_t EEPROM_TRACE_PTR = (EEPROM_HEALTH_PTR + EEPROM_HEALTH_SIZE);
+const uint16_t EEPROM_TRACE_SIZE = (STORAGE_EEPROM_SIZE - EEPROM_TRACE_PTR);
+
+
+/////////////////////////
+// STRUCTURES
+/////////////////////////
+
+// Calibration data, independent of how it is laid out in EEPROM
+typedef struct {
+	uint16_t Ref_Time_Forward[3];   // Milliseconds
+	uint16_t Ref_Time_Backward[3];  // Milliseconds
+	byte Endstop_Forward[3];        // sensor_group values
+	byte Near_Factor;               // Percentages of reference travel time
+	byte Slowdown_Factor;
+	byte Timeout_Factor;
+	uint16_t Timeout_Buffer;        // Milliseconds
+	int8_t Slowdown_Trim[3][2];     // Tenths of a percent added to Slowdown_Factor, indexed by motor_dir
+} calibration_record;
+
+
+// A ring of fixed-size slots, each able to hold a record which starts with its version (1 byte) and
+// sequence number (2 bytes), and ends with the CRC-CCITT of every byte before it (2 bytes)
+typedef struct {
+	uint16_t Address;   // EEPROM address of the first slot
+	byte Slot_Size;     // Bytes from the start of one slot to the next
+	byte Slots;
+	byte Newest_Slot;   // Starts as the last slot, so the first save into an empty ring goes into slot 0
+	uint16_t Sequence;  // Sequence number of the record in Newest_Slot
+} storage_ring;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+bool readCalibrationRecord(calibration_record* record);
+/*
+ * Finds the newest valid calibration record in EEPROM
+ * Must be called once at startup, before saveCalibrationRecord()
+ *
+ * Affects Storage_Ring
+ * INPUT:  Pointer to the record to fill
+ * OUTPUT: Was a valid record found? (if not, the record is left unchanged)
+ */
+
+void saveCalibrationRecord(const calibration_record* record);
+/*
+ * Starts saving a calibration record into the next slot of the ring
+ * Returns immediately; the record is written in the background by the EEPROM ready interrupt
+ *
+ * If a previous save is still in progress, this waits for it to finish first. Callers which
+ * save periodically should check storageBusy() beforehand rather than wait.
+ *
+ * Affects Storage_Buffer[], Storage_Ring, and the background save state
+ * INPUT:  Record to save
+ */
+
+void saveBlock(uint16_t address, const byte* buffer, uint16_t length);
+/*
+ * Starts saving a block of bytes to EEPROM
+ * Returns immediately; the block is written in the background by the EEPROM ready interrupt
+ *
+ * The buffer is read as each byte is programmed, so it must not change until storageBusy() is
+ * false. If a previous save is still in progress, this waits for it to finish first.
+ *
+ * Affects Storage_Source, Storage_Length, Storage_Address, Storage_Index, and Storage_Saving
+ * INPUT:  EEPROM address of the first byte
+ *         Bytes to save
+ *         Number of bytes
+ */
+
+bool readRing(storage_ring* ring, byte* buffer, bool (*read_slot)(uint16_t address, byte* buffer));
+/*
+ * Finds the newest valid record in a ring
+ * Must be called once at startup, before saveRing()
+ *
+ * Every slot is read into the buffer in turn, so it must fit the longest record any slot can hold.
+ * Sequence numbers wrap, so the newest record is the one furthest ahead of the rest.
+ *
+ * Affects ring->Newest_Slot and ring->Sequence
+ * INPUT:  Ring to scan
+ *         Buffer to read the newest record into
+ *         Function reading the slot at an EEPROM address into a buffer, and checking its version and CRC
+ * OUTPUT: Was a valid record found? (if not, the buffer holds whatever the last slot read left)
+ */
+
+void saveRing(storage_ring* ring, byte* buffer, byte length);
+/*
+ * Starts saving a record into the slot after the newest one in a ring
+ * Returns immediately; the record is written in the background (see saveBlock())
+ *
+ * The record's sequence number and CRC are filled in here, so only its version and data need to be
+ * in the buffer beforehand.
+ *
+ * Affects ring->Newest_Slot, ring->Sequence, and the background save state
+ * INPUT:  Ring to save into
+ *         Record, held until storageBusy() is false
+ *         Length of the record, including its CRC
+ */
+
+bool storageBusy();
+/*
+ * Determines if a save is still in progress
+ * Callers which save periodically check this first, so a save still in progress is waited out on
+ * a later pass rather than blocking this one
+ *
+ * OUTPUT: Is a save in progress?
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+bool readSlot(uint16_t address, byte* buffer);
+/*
+ * Reads a calibration slot, checking its version and CRC
+ * Only as many bytes as the record's version uses are read
+ *
+ * INPUT:  EEPROM address of the slot
+ *         Buffer to read the slot's record into
+ * OUTPUT: Does the slot hold a valid record?
+ */
+
+bool readLegacyRecord(calibration_record* record);
+/*
+ * Reads calibration data saved in the layout used by older Firmware
+ *
+ * The layout has no checksum, so the data is only accepted if every endstop and factor is in range.
+ *
+ * INPUT:  Pointer to the record to fill
+ * OUTPUT: Was plausible data found?
+ */
+
+byte getRecordLength(byte version);
+/*
+ * Gets the length of a record, including its CRC
+ *
+ * INPUT:  Record version
+ * OUTPUT: Length in bytes (0 if the version is unknown)
+ */
+
+uint16_t getSlotAddress(const storage_ring* ring, byte slot);
+/*
+ * Gets the EEPROM address of a slot in a ring
+ *
+ * INPUT:  Ring
+ *         Slot (0-indexed)
+ * OUTPUT: Address of the slot's first byte
+ */
+
+uint16_t getRecordCRC(const byte buffer[STORAGE_RECORD_LENGTH], byte length);
+/*
+ * Computes the CRC of a record, excluding its own CRC field
+ *
+ * INPUT:  Record bytes
+ *         Length of the record, including its CRC
+ * OUTPUT: CRC-CCITT (initial value 0xFFFF)
+ */
+
+uint16_t getWord(const byte* buffer);
+/*
+ * Gets a little-endian word from a record buffer
+ *
+ * INPUT:  Pointer to the low byte
+ * OUTPUT: Word
+ */
+
+void putWord(byte* buffer, uint16_t value);
+/*
+ * Puts a little-endian word into a record buffer
+ *
+ * INPUT:  Pointer to the low byte
+ *         Word
+ */
+
+
+#endif
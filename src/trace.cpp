@@ -0,0 +1,97 @@
+#include "trace.h"
+#include <util/crc16.h>
+
+// The ring is kept in its dump layout, so it can be saved or dumped without copying
+byte Trace_Buffer[TRACE_LENGTH];
+byte* const TRACE_FIRST = &Trace_Buffer[TRACE_HEADER_LENGTH];
+byte* const TRACE_END = &Trace_Buffer[TRACE_HEADER_LENGTH + (TRACE_RECORDS * TRACE_RECORD_LENGTH)];
+
+// Ring state
+byte* Trace_Next = TRACE_FIRST;   // Next record to write
+byte Trace_Count = 0;
+uint16_t Trace_Epoch = 0;         // Upper 16 bits of millis() at the last record
+uint16_t Trace_Base_Epoch = 0;    // Upper 16 bits of millis() at the oldest record held
+bool Trace_Frozen = false;
+
+void traceEvent(trace_event event, byte subject, byte value) {
+	if(Trace_Frozen) {
+		return;
+	}
+
+	unsigned long Now = millis();
+	uint16_t Epoch = (Now >> 16);
+	if(Epoch != Trace_Epoch) {
+		Trace_Epoch = Epoch;
+		writeTraceRecord((TRACE_EPOCH << 4), 0, Epoch);
+	}
+	writeTraceRecord(((event << 4) | (subject & 0x0F)), value, (uint16_t) Now);
+	return;
+}
+
+void freezeTrace() {
+	if(Trace_Frozen) {
+		return;
+	}
+	Trace_Frozen = true;
+	updateTraceHeader();
+	if(TRACE_PERSIST) {
+		saveBlock(EEPROM_TRACE_PTR, Trace_Buffer, TRACE_LENGTH);
+	}
+	return;
+}
+
+bool traceFrozen() {
+	return Trace_Frozen;
+}
+
+void dumpTrace(void (*write)(byte data)) {
+	// A frozen trace may still be being saved, and its header is already up to date
+	if(!Trace_Frozen) {
+		updateTraceHeader();
+	}
+	for(uint16_t Index = 0; Index < TRACE_LENGTH; Index++) {
+		write(Trace_Buffer[Index]);
+	}
+	return;
+}
+
+void writeTraceRecord(byte type, byte value, uint16_t time) {
+	byte* Record = Trace_Next;
+
+	// Records before the next epoch record belong to the epoch it overwrites
+	if(Trace_Count == TRACE_RECORDS) {
+		if((Record[0] >> 4) == TRACE_EPOCH) {
+			Trace_Base_Epoch = (Record[2] | (((uint16_t) Record[3]) << 8));
+		}
+	}
+	else {
+		Trace_Count += 1;
+	}
+
+	Record[0] = type;
+	Record[1] = value;
+	Record[2] = (time & 0xFF);
+	Record[3] = (time >> 8);
+	Record += TRACE_RECORD_LENGTH;
+	if(Record == TRACE_END) {
+		Record = TRACE_FIRST;
+	}
+	Trace_Next = Record;
+	return;
+}
+
+void updateTraceHeader() {
+	Trace_Buffer[0] = TRACE_VERSION;
+	Trace_Buffer[1] = Trace_Count;
+	Trace_Buffer[2] = ((Trace_Next - TRACE_FIRST) / TRACE_RECORD_LENGTH);
+	Trace_Buffer[3] = (Trace_Base_Epoch & 0xFF);
+	Trace_Buffer[4] = (Trace_Base_Epoch >> 8);
+
+	uint16_t CRC = 0xFFFF;
+	for(uint16_t Index = 0; Index < (TRACE_LENGTH - 2); Index++) {
+		CRC = _crc_ccitt_update(CRC, Trace_Buffer[Index]);
+	}
+	Trace_Buffer[TRACE_LENGTH - 2] = (CRC & 0xFF);
+	Trace_Buffer[TRACE_LENGTH - 1] = (CRC >> 8);
+	return;
+}
@@ -0,0 +1,144 @@
+/* Motion Trace Module
+ *
+ * Used to keep a short history of what the Firmware did, for post-mortem analysis of faults
+ *
+ * Every motor state change, debounced input change, audio clip, and flagged error is recorded as
+ * a packed 4 byte record in a fixed-size ring, overwriting the oldest record once the ring is full.
+ * Recording only takes a millis() read and a few stores, so the trace is always enabled.
+ *
+ * When a critical error is flagged, the ring is frozen, so the events leading up to it are kept
+ * however long the Firmware keeps running afterwards. If TRACE_PERSIST is true, the frozen trace
+ * is also saved to EEPROM at EEPROM_TRACE_PTR in the background, where it survives until the
+ * next critical error. It can be read back with any EEPROM programmer.
+ *
+ * The trace can also be written out at any time with dumpTrace(), through any link able to carry
+ * bytes. Both the dump and the saved copy use the following layout (multi-byte values are
+ * little-endian):
+ *
+ *  0      Trace version (TRACE_VERSION)
+ *  1      Records held (0 to TRACE_RECORDS)
+ *  2      Index of the next record to be written, which is the oldest once the ring is full
+ *  3-4    Upper 16 bits of millis() at the oldest record held
+ *  5-244  Records
+ * 245-246 CRC-CCITT of bytes 0-244
+ *
+ * Record layout:
+ *
+ *  0      Event type (upper 4 bits) and subject (lower 4 bits)
+ *  1      Value
+ *  2-3    Lower 16 bits of millis()
+ *
+ * Events, with the subject and value of each:
+ *
+ * TRACE_EPOCH   Upper 16 bits of millis() for the records after it, held in bytes 2-3 instead
+ * TRACE_MOTOR   Motor (0-indexed), and the motor_state it changed to
+ * TRACE_INPUTS  Debounced input snapshot (see src/input.h) after any input changed
+ * TRACE_AUDIO   Volume, and the audio_clip started
+ * TRACE_ERROR   Error code flagged (1-indexed)
+ *
+ * The simulation build decodes both formats (see the Simulation documentation).
+ */
+
+#ifndef trace_h
+#define trace_h
+#include <arduino.h>
+#include "hal.h"
+#include "storage.h"
+
+/////////////////////////
+// CONFIGURATION VARIABLES
+/////////////////////////
+
+const byte TRACE_RECORDS = 60;
+const bool TRACE_PERSIST = true;  // Save the frozen trace to EEPROM?
+
+// Must be changed whenever the layout changes
+const byte TRACE_VERSION = 1;
+
+const byte TRACE_RECORD_LENGTH = 4;
+const byte TRACE_HEADER_LENGTH = 5;
+const uint16_t TRACE_LENGTH = (TRACE_HEADER_LENGTH + (TRACE_RECORDS * TRACE_RECORD_LENGTH) + 2);
+
+static_assert(TRACE_LENGTH <= EEPROM_TRACE_SIZE, "The trace does not fit in its EEPROM area");
+
+
+/////////////////////////
+// ENUMERATIONS
+/////////////////////////
+
+// Event types, stored in the upper 4 bits of a record's first byte
+typedef enum {
+	TRACE_EMPTY = 0,
+	TRACE_EPOCH = 1,
+	TRACE_MOTOR = 2,
+	TRACE_INPUTS = 3,
+	TRACE_AUDIO = 4,
+	TRACE_ERROR = 5
+} trace_event;
+
+
+/////////////////////////
+// AVAILABLE FUNCTIONS
+/////////////////////////
+
+void traceEvent(trace_event event, byte subject, byte value);
+/*
+ * Records a single event, timestamped with millis()
+ * Does nothing once the trace is frozen
+ *
+ * A TRACE_EPOCH record is written first whenever the upper 16 bits of millis() have changed
+ * since the last record.
+ *
+ * Affects Trace_Buffer[], Trace_Next, Trace_Count, Trace_Epoch, and Trace_Base_Epoch
+ * INPUT:  Event type
+ *         Subject (0-15)
+ *         Value
+ */
+
+void freezeTrace();
+/*
+ * Stops recording, keeping the trace as it is, and saves it to EEPROM if TRACE_PERSIST is true
+ * Called when a critical error is flagged
+ *
+ * Affects Trace_Frozen and Trace_Buffer[]
+ */
+
+bool traceFrozen();
+/*
+ * Determines if the trace has been frozen
+ *
+ * OUTPUT: Is the trace frozen?
+ */
+
+void dumpTrace(void (*write)(byte data));
+/*
+ * Writes the trace in the layout described at the top of this file
+ *
+ * INPUT:  Function which sends a single byte over the link
+ */
+
+
+/////////////////////////
+// INTERNAL FUNCTIONS
+/////////////////////////
+
+void writeTraceRecord(byte type, byte value, uint16_t time);
+/*
+ * Writes a single record into the ring, overwriting the oldest once full
+ * Used by traceEvent()
+ *
+ * Affects Trace_Buffer[], Trace_Next, Trace_Count, and Trace_Base_Epoch
+ * INPUT:  Event type and subject, as stored in the record
+ *         Value
+ *         Timestamp
+ */
+
+void updateTraceHeader();
+/*
+ * Fills in the header and CRC of Trace_Buffer[] from the ring state
+ *
+ * Affects Trace_Buffer[]
+ */
+
+
+#endif